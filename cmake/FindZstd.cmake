@@ -0,0 +1,27 @@
+# - Try to find Zstandard (libzstd)
+# Once done, this will define
+#
+#  Zstd_FOUND - system has Zstandard
+#  Zstd_INCLUDE_DIRS - the Zstandard include directories
+#  Zstd_LIBRARIES - link these to use Zstandard
+
+include(LibFindMacros)
+
+libfind_pkg_check_modules(Zstd_PKGCONF libzstd)
+# Main include dir
+find_path(Zstd_INCLUDE_DIR
+  NAMES zstd.h
+  PATHS ${Zstd_PKGCONF_INCLUDE_DIRS}
+)
+
+# Finally the library itself
+find_library(Zstd_LIBRARY
+  NAMES zstd
+  PATHS ${Zstd_PKGCONF_LIBRARY_DIRS}
+)
+
+# Set the include dir variables and the libraries and let libfind_process do the rest.
+# NOTE: Singular variables for this library, plural for libraries this this lib depends on.
+set(Zstd_PROCESS_INCLUDES Zstd_INCLUDE_DIR)
+set(Zstd_PROCESS_LIBS Zstd_LIBRARY)
+libfind_process(Zstd)
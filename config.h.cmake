@@ -25,6 +25,8 @@
 
 #cmakedefine HAVE_ZLIB 1
 
+#cmakedefine HAVE_ZSTD 1
+
 #cmakedefine USE_ROUTING 1
 
 #cmakedefine HAVE_GTK2 1
@@ -44,6 +46,9 @@
 #cmakedefine DBUS_USE_SYSTEM_BUS 1
 
 #cmakedefine HAVE_SOCKET 1
+
+#cmakedefine HAVE_PTHREAD 1
+
 #cmakedefine HAVE_SNPRINTF 1
 #cmakedefine HAVE_DECL__SNPRINTF 1
 
@@ -194,6 +194,26 @@ ATTR(turn_around_penalty)
 ATTR(turn_around_penalty2)
 ATTR(autozoom_max)
 ATTR(nav_status)
+ATTR(route_search_mode)
+ATTR(graph_cache)
+ATTR(alternatives)
+ATTR(graph_build_threads)
+ATTR(route_heap)
+ATTR(optimize_waypoints)
+ATTR(turn_penalty_left)
+ATTR(turn_penalty_right)
+ATTR(turn_penalty_yield)
+ATTR(departure_time)
+ATTR(route_worker)
+ATTR(route_progress)
+ATTR(graph_memory_budget)
+ATTR(graph_memory)
+ATTR(tile_cache_size)
+ATTR(tile_cache_hits)
+ATTR(tile_cache_misses)
+ATTR(tile_cache_evictions)
+ATTR(tile_prefetch_threads)
+ATTR(isochrones)
 ATTR2(0x00027500,type_rel_abs_begin)
 /* These attributes are int that can either hold relative or absolute values. See the
  * documentation of ATTR_REL_RELSHIFT for details.
@@ -394,6 +414,8 @@ ATTR(street_destination)
 ATTR(exit_to)
 ATTR(street_destination_forward)
 ATTR(street_destination_backward)
+ATTR(traffic_file)
+ATTR(speed_profile_file)
 ATTR2(0x0003ffff,type_string_end)
 ATTR2(0x00040000,type_special_begin)
 ATTR(order)
@@ -408,6 +430,7 @@ ATTR(ch_edge)
 ATTR(zipfile_ref_block)
 ATTR(item_id)
 ATTR(pdl_gps_update)
+ATTR(tile_summary)
 ATTR2(0x0004ffff,type_special_end)
 ATTR2(0x00050000,type_double_begin)
 ATTR(position_height)
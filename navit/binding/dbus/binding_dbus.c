@@ -1114,6 +1114,84 @@ request_route_remove_attr(DBusConnection *connection, DBusMessage *message)
 	return request_set_add_remove_attr(connection, message, "route", NULL, (int (*)(void *, struct attr *))route_remove_attr);
 }
 
+/**
+ * Reads an array of coordinate strings from a DBus message
+ *
+ * @param iter Points to the array in the message
+ * @param count Receives the number of coordinates
+ * @returns The coordinates, or NULL if one of them could not be parsed
+ */
+static struct pcoord *
+pcoord_array_get_from_message(DBusMessageIter *iter, int *count)
+{
+	DBusMessageIter iter2;
+	struct pcoord *pc=NULL;
+	char *coordstring;
+
+	*count=0;
+	if (dbus_message_iter_get_arg_type(iter) != DBUS_TYPE_ARRAY)
+		return NULL;
+	dbus_message_iter_recurse(iter, &iter2);
+	while (dbus_message_iter_get_arg_type(&iter2) == DBUS_TYPE_STRING) {
+		dbus_message_iter_get_basic(&iter2, &coordstring);
+		pc=g_renew(struct pcoord, pc, *count+1);
+		if (!pcoord_parse(coordstring, projection_mg, &pc[*count])) {
+			g_free(pc);
+			return NULL;
+		}
+		(*count)++;
+		dbus_message_iter_next(&iter2);
+	}
+	return pc;
+}
+
+static void
+int_array_encode(DBusMessageIter *iter, int *values, int count)
+{
+	DBusMessageIter iter2;
+	dbus_message_iter_open_container(iter, DBUS_TYPE_ARRAY, "i", &iter2);
+	if (count)
+		dbus_message_iter_append_fixed_array(&iter2, DBUS_TYPE_INT32, &values, count);
+	dbus_message_iter_close_container(iter, &iter2);
+}
+
+static DBusHandlerResult
+request_route_get_matrix(DBusConnection *connection, DBusMessage *message)
+{
+	struct route *route;
+	struct pcoord *src,*dst;
+	int src_count,dst_count,*times,*distances;
+	DBusMessage *reply;
+	DBusMessageIter iter;
+
+	route=object_get_from_message(message, "route");
+	if (! route)
+		return dbus_error_invalid_object_path(connection, message);
+	dbus_message_iter_init(message, &iter);
+	src=pcoord_array_get_from_message(&iter, &src_count);
+	dbus_message_iter_next(&iter);
+	dst=pcoord_array_get_from_message(&iter, &dst_count);
+	if (!src || !dst) {
+		g_free(src);
+		g_free(dst);
+		return dbus_error_invalid_parameter(connection, message);
+	}
+	times=g_new(int, src_count*dst_count);
+	distances=g_new(int, src_count*dst_count);
+	route_get_matrix(route, src, src_count, dst, dst_count, times, distances);
+	reply = dbus_message_new_method_return(message);
+	dbus_message_iter_init_append(reply, &iter);
+	int_array_encode(&iter, times, src_count*dst_count);
+	int_array_encode(&iter, distances, src_count*dst_count);
+	dbus_connection_send (connection, reply, NULL);
+	dbus_message_unref (reply);
+	g_free(times);
+	g_free(distances);
+	g_free(src);
+	g_free(dst);
+	return DBUS_HANDLER_RESULT_HANDLED;
+}
+
 static DBusHandlerResult
 request_route_destroy(DBusConnection *connection, DBusMessage *message)
 {
@@ -2007,6 +2085,7 @@ struct dbus_method {
 	{".route",    "add_attr",          "sv",      "attribute,value",                         "",    "",  request_route_add_attr},
 	{".route",    "remove_attr",       "sv",      "attribute,value",                         "",    "",  request_route_remove_attr},
 	{".route",    "destroy",           "",        "",                                        "",    "",  request_route_destroy},
+	{".route",    "get_matrix",        "asas",    "sources,destinations",                    "aiai", "times,distances", request_route_get_matrix},
 	{".route",    "dup",               "",        "",                                        "",    "",  request_route_dup},
 	{".search_list","destroy",         "",        "",                                        "",   "",      request_search_list_destroy},
 	{".search_list","destroy",         "",        "",                                        "",   "",      request_search_list_destroy},
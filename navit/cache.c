@@ -215,6 +215,13 @@ cache_entry_destroy(struct cache *cache, void *data)
 	entry->usage--;
 }
 
+void
+cache_entry_free(struct cache *cache, void *data)
+{
+	struct cache_entry *entry=(struct cache_entry *)((char *)data-cache->entry_size);
+	g_slice_free1(entry->size, entry);
+}
+
 static struct cache_entry *
 cache_trim(struct cache *cache, struct cache_entry *entry)
 {
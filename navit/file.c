@@ -31,6 +31,9 @@
 #include <wordexp.h>
 #include <glib.h>
 #include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
 #include "debug.h"
 #include "cache.h"
 #include "file.h"
@@ -39,6 +42,9 @@
 #include "util.h"
 #include "types.h"
 #include "zipfile.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #ifdef HAVE_SOCKET
 #include <sys/socket.h>
 #include <netdb.h>
@@ -60,6 +66,16 @@ static GHashTable *file_name_hash;
 
 static struct cache *file_cache;
 
+#ifdef HAVE_PTHREAD
+/* Protects file_cache and the file positions of cached files, map drivers may be used from several threads */
+static pthread_mutex_t file_cache_mutex;
+#define file_cache_lock() pthread_mutex_lock(&file_cache_mutex)
+#define file_cache_unlock() pthread_mutex_unlock(&file_cache_mutex)
+#else
+#define file_cache_lock()
+#define file_cache_unlock()
+#endif
+
 #ifdef HAVE_PRAGMA_PACK
 #pragma pack(push)
 #pragma pack(1)
@@ -341,11 +357,14 @@ file_data_read(struct file *file, long long offset, int size)
 		return NULL;
 	if (file->begin)
 		return file->begin+offset;
+	file_cache_lock();
 	if (file->cache) {
 		struct file_cache_id id={offset,size,file->name_id,0};
 		ret=cache_lookup(file_cache,&id); 
-		if (ret)
+		if (ret) {
+			file_cache_unlock();
 			return ret;
+		}
 		ret=cache_insert_new(file_cache,&id,size);
 	} else
 		ret=g_malloc(size);
@@ -354,6 +373,7 @@ file_data_read(struct file *file, long long offset, int size)
 		file_data_free(file, ret);
 		ret=NULL;
 	}
+	file_cache_unlock();
 	return ret;
 
 }
@@ -460,7 +480,9 @@ file_data_flush(struct file *file, long long offset, int size)
 {
 	if (file->cache) {
 		struct file_cache_id id={offset,size,file->name_id,0};
+		file_cache_lock();
 		cache_flush(file_cache,&id);
+		file_cache_unlock();
 		dbg(lvl_debug,"Flushing "LONGLONG_FMT" %d bytes\n",offset,size);
 	}
 }
@@ -522,52 +544,168 @@ uncompress_int(Bytef *dest, uLongf *destLen, const Bytef *source, uLong sourceLe
 	return err;
 }
 
-unsigned char *
-file_data_read_compressed(struct file *file, long long offset, int size, int size_uncomp)
+#ifdef HAVE_ZSTD
+static int
+file_zstd_decompress(void *dest, int destLen, const void *source, int sourceLen, void *dict)
 {
-	void *ret;
+	ZSTD_DCtx *dctx=ZSTD_createDCtx();
+	size_t ret;
+
+	if (!dctx)
+		return 0;
+	if (dict)
+		ret=ZSTD_decompress_usingDDict(dctx, dest, destLen, source, sourceLen, dict);
+	else
+		ret=ZSTD_decompressDCtx(dctx, dest, destLen, source, sourceLen);
+	ZSTD_freeDCtx(dctx);
+	if (ZSTD_isError(ret)) {
+		dbg(lvl_error,"%s\n", ZSTD_getErrorName(ret));
+		return 0;
+	}
+	return ret == destLen;
+}
+#endif
+
+static unsigned char *
+file_data_read_decoded(struct file *file, long long offset, int size, int size_uncomp, int method, void *dict, int cache)
+{
+	void *ret,*cached;
 	char *buffer = 0;
 	uLongf destLen=size_uncomp;
+	struct file_cache_id id={offset,size,file->name_id,method == zip_zstd_method ? 2:1};
+	int ok;
 
-	if (file->cache) {
-		struct file_cache_id id={offset,size,file->name_id,1};
+	cache=cache && file->cache;
+	file_cache_lock();
+	if (cache) {
 		ret=cache_lookup(file_cache,&id); 
-		if (ret)
+		if (ret) {
+			file_cache_unlock();
 			return ret;
-		ret=cache_insert_new(file_cache,&id,size_uncomp);
+		}
+		ret=cache_entry_new(file_cache,&id,size_uncomp);
 	} else 
 		ret=g_malloc(size_uncomp);
 	lseek(file->fd, offset, SEEK_SET);
 
 	buffer = (char *)g_malloc(size);
-	if (read(file->fd, buffer, size) != size) {
-		g_free(ret);
-		ret=NULL;
-	} else {
-		if (uncompress_int(ret, &destLen, (Bytef *)buffer, size) != Z_OK) {
-			dbg(lvl_error,"uncompress failed\n");
-			g_free(ret);
-			ret=NULL;
+	ok=(read(file->fd, buffer, size) == size);
+	file_cache_unlock();
+
+	/* Decode without holding the lock, so several threads can decode at once. The entry is
+	 * inserted into the cache only afterwards, another thread may have inserted it meanwhile. */
+	if (ok) {
+		switch (method) {
+		case 8:
+			if (uncompress_int(ret, &destLen, (Bytef *)buffer, size) != Z_OK) {
+				dbg(lvl_error,"uncompress failed\n");
+				ok=0;
+			}
+			break;
+#ifdef HAVE_ZSTD
+		case zip_zstd_method:
+			if (!file_zstd_decompress(ret, size_uncomp, buffer, size, dict)) {
+				dbg(lvl_error,"zstd decompression failed\n");
+				ok=0;
+			}
+			break;
+#endif
+		default:
+			dbg(lvl_error,"compression method %d not supported\n", method);
+			ok=0;
 		}
 	}
 	g_free(buffer);
-
+	if (cache) {
+		file_cache_lock();
+		if (!ok) {
+			cache_entry_free(file_cache, ret);
+			ret=NULL;
+		} else if ((cached=cache_lookup(file_cache,&id))) {
+			cache_entry_free(file_cache, ret);
+			ret=cached;
+		} else
+			cache_insert(file_cache, ret);
+		file_cache_unlock();
+	} else if (!ok) {
+		g_free(ret);
+		ret=NULL;
+	}
 	return ret;
 }
 
 unsigned char *
-file_data_read_encrypted(struct file *file, long long offset, int size, int size_uncomp, int compressed, char *passwd)
+file_data_read_compressed(struct file *file, long long offset, int size, int size_uncomp)
+{
+	return file_data_read_decoded(file, offset, size, size_uncomp, 8, NULL, 1);
+}
+
+/* dict is the dictionary the member was compressed with as returned by file_zstd_dict_new(), or NULL */
+unsigned char *
+file_data_read_zstd(struct file *file, long long offset, int size, int size_uncomp, void *dict)
+{
+	return file_data_read_decoded(file, offset, size, size_uncomp, zip_zstd_method, dict, 1);
+}
+
+/* Reads a zip member stored (method 0), deflated (8) or compressed with Zstandard past the file
+ * cache, for callers which cache the data themselves. Free the data with file_data_free_uncached() */
+unsigned char *
+file_data_read_uncached(struct file *file, long long offset, int size, int size_uncomp, int method, void *dict)
+{
+	unsigned char *ret;
+
+	if (method)
+		return file_data_read_decoded(file, offset, size, size_uncomp, method, dict, 0);
+	if (file->special)
+		return NULL;
+	if (file->begin)
+		return file->begin+offset;
+	ret=g_malloc(size_uncomp);
+	file_cache_lock();
+	lseek(file->fd, offset, SEEK_SET);
+	if (read(file->fd, ret, size_uncomp) != size_uncomp) {
+		g_free(ret);
+		ret=NULL;
+	}
+	file_cache_unlock();
+	return ret;
+}
+
+/* The prepared dictionary may be shared by several threads */
+void *
+file_zstd_dict_new(unsigned char *data, int size)
+{
+#ifdef HAVE_ZSTD
+	return ZSTD_createDDict(data, size);
+#else
+	return NULL;
+#endif
+}
+
+void
+file_zstd_dict_destroy(void *dict)
+{
+#ifdef HAVE_ZSTD
+	ZSTD_freeDDict(dict);
+#endif
+}
+
+static unsigned char *
+file_data_read_encrypted_do(struct file *file, long long offset, int size, int size_uncomp, int compressed, char *passwd, int cache)
 {
 #ifdef HAVE_LIBCRYPTO
 	void *ret;
 	unsigned char *buffer = 0;
 	uLongf destLen=size_uncomp;
 
-	if (file->cache) {
+	file_cache_lock();
+	if (cache && file->cache) {
 		struct file_cache_id id={offset,size,file->name_id,1};
 		ret=cache_lookup(file_cache,&id); 
-		if (ret)
+		if (ret) {
+			file_cache_unlock();
 			return ret;
+		}
 		ret=cache_insert_new(file_cache,&id,size_uncomp);
 	} else 
 		ret=g_malloc(size_uncomp);
@@ -623,6 +761,7 @@ file_data_read_encrypted(struct file *file, long long offset, int size, int size
 		}
 	}
 	g_free(buffer);
+	file_cache_unlock();
 
 	return ret;
 #else
@@ -630,6 +769,19 @@ file_data_read_encrypted(struct file *file, long long offset, int size, int size
 #endif
 }
 
+unsigned char *
+file_data_read_encrypted(struct file *file, long long offset, int size, int size_uncomp, int compressed, char *passwd)
+{
+	return file_data_read_encrypted_do(file, offset, size, size_uncomp, compressed, passwd, 1);
+}
+
+/* Like file_data_read_uncached(), for encrypted members */
+unsigned char *
+file_data_read_encrypted_uncached(struct file *file, long long offset, int size, int size_uncomp, int compressed, char *passwd)
+{
+	return file_data_read_encrypted_do(file, offset, size, size_uncomp, compressed, passwd, 0);
+}
+
 void
 file_data_free(struct file *file, unsigned char *data)
 {
@@ -640,11 +792,21 @@ file_data_free(struct file *file, unsigned char *data)
 			return;
 	}
 	if (file->cache && data) {
+		file_cache_lock();
 		cache_entry_destroy(file_cache, data);
+		file_cache_unlock();
 	} else
 		g_free(data);
 }
 
+void
+file_data_free_uncached(struct file *file, unsigned char *data)
+{
+	if (file->begin && data >= file->begin && data < file->end)
+		return;
+	g_free(data);
+}
+
 void
 file_data_remove(struct file *file, unsigned char *data)
 {
@@ -655,7 +817,9 @@ file_data_remove(struct file *file, unsigned char *data)
 			return;
 	}
 	if (file->cache && data) {
+		file_cache_lock();
 		cache_flush_data(file_cache, data);
+		file_cache_unlock();
 	} else
 		g_free(data);
 }
@@ -905,7 +1069,9 @@ int
 file_set_cache_size(int cache_size)
 {
 #ifdef CACHE_SIZE
+	file_cache_lock();
 	cache_resize(file_cache, cache_size);
+	file_cache_unlock();
 	return 1;
 #else
 	return 0;
@@ -915,6 +1081,13 @@ file_set_cache_size(int cache_size)
 void
 file_init(void)
 {
+#ifdef HAVE_PTHREAD
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&file_cache_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+#endif
 #ifdef CACHE_SIZE
 	file_name_hash=g_hash_table_new(g_str_hash, g_str_equal);
 	file_cache=cache_new(sizeof(struct file_cache_id), CACHE_SIZE);
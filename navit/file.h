@@ -76,8 +76,14 @@ void file_data_flush(struct file *file, long long offset, int size);
 int file_data_write(struct file *file, long long offset, int size, const void *data);
 int file_get_contents(char *name, unsigned char **buffer, int *size);
 unsigned char *file_data_read_compressed(struct file *file, long long offset, int size, int size_uncomp);
+unsigned char *file_data_read_zstd(struct file *file, long long offset, int size, int size_uncomp, void *dict);
+void *file_zstd_dict_new(unsigned char *data, int size);
+void file_zstd_dict_destroy(void *dict);
+unsigned char *file_data_read_uncached(struct file *file, long long offset, int size, int size_uncomp, int method, void *dict);
 unsigned char *file_data_read_encrypted(struct file *file, long long offset, int size, int size_uncomp, int compressed, char *passwd);
+unsigned char *file_data_read_encrypted_uncached(struct file *file, long long offset, int size, int size_uncomp, int compressed, char *passwd);
 void file_data_free(struct file *file, unsigned char *data);
+void file_data_free_uncached(struct file *file, unsigned char *data);
 int file_exists(char const *name);
 void file_remap_readonly(struct file *f);
 void file_unmap(struct file *f);
@@ -517,6 +517,7 @@ ITEM(forest_way_3)
 ITEM(forest_way_4)
 ITEM(former_itinerary)
 ITEM(former_itinerary_part)
+ITEM(street_route_alternative)
 /* Area */
 ITEM2(0xc0000000,area)
 ITEM2(0xc0000001,area_unspecified)
@@ -621,4 +622,5 @@ ITEM(poly_place5)
 ITEM(poly_place6)
 ITEM(poly_water_tiled)
 ITEM(poly_meadow)
+ITEM(poly_isochrone)
 ITEM2(0xffffffff,last)
@@ -118,6 +118,35 @@ map_new(struct attr *parent, struct attr **attrs)
 	return m;
 }
 
+/**
+ * @brief Opens a map a second time
+ *
+ * The new map reads the same data as {@code m}, but has private data of its own, so it can be read
+ * from another thread while {@code m} is in use. This only works for maps which read their data from
+ * a file, other maps (e.g. the route map) cannot be opened again.
+ *
+ * @param m The map to open again
+ * @param attrs Attributes replacing those of {@code m} for the new map, e.g. to give it no cache, may be NULL
+ * @return The new map, or NULL if {@code m} cannot be opened again
+ */
+struct map *
+map_dup(struct map *m, struct attr **attrs)
+{
+	struct attr **dup_attrs,*data;
+	struct map *ret;
+
+	/* The maps navit creates in memory, like the route map, have an empty data attribute */
+	data=attr_search(m->attrs, NULL, attr_data);
+	if (!data || !data->u.str || !data->u.str[0])
+		return NULL;
+	dup_attrs=attr_list_dup(m->attrs);
+	while (attrs && *attrs)
+		dup_attrs=attr_generic_set_attr(dup_attrs, *attrs++);
+	ret=map_new(NULL, dup_attrs);
+	attr_list_free(dup_attrs);
+	return ret;
+}
+
 /**
  * @brief Gets an attribute from a map
  *
@@ -651,6 +680,49 @@ map_selection_contains_item_range(struct map_selection *sel, int follow, struct
 	}
 	return 0;
 }
+/**
+ * @brief Checks if a selection needs a map tile holding the given item ranges
+ *
+ * Like map_selection_contains_item_range(), but a selection of routable streets also matches
+ * turn restrictions and traffic distortions. The route graph reads them together with the streets,
+ * while their types lie outside the street range of route_rect(), so a tile holding only such items
+ * must not be skipped.
+ *
+ * @param sel The selection to be checked
+ * @param follow Whether the next pointer of the selection should be followed
+ * @param ranges The item ranges held by the tile
+ * @count the number of elements in ranges
+ * @return True if there is a match, false otherwise
+ */
+
+int
+map_selection_contains_tile_item_range(struct map_selection *sel, int follow, struct item_range *range, int count)
+{
+	static struct item_range route_range={route_item_first, route_item_last};
+	static struct item_range route_extra_ranges[]={
+		{type_street_turn_restriction_no,type_street_turn_restriction_only},
+		{type_traffic_distortion,type_traffic_distortion},
+	};
+	int i,j;
+	if (! sel)
+		return 1;
+	while (sel) {
+		if (map_selection_contains_item_range(sel, 0, range, count))
+			return 1;
+		if (item_range_intersects_range(&sel->range, &route_range)) {
+			for (i = 0 ; i < count ; i++) {
+				for (j = 0 ; j < sizeof(route_extra_ranges)/sizeof(route_extra_ranges[0]) ; j++) {
+					if (item_range_intersects_range(&route_extra_ranges[j], &range[i]))
+						return 1;
+				}
+			}
+		}
+		if (! follow)
+			break;
+		sel=sel->next;
+	}
+	return 0;
+}
 /**
  * @brief Checks if a selection contains a item 
  *
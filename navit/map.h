@@ -240,6 +240,7 @@ struct map_search;
 struct map_selection;
 struct pcoord;
 struct map *map_new(struct attr *parent, struct attr **attrs);
+struct map *map_dup(struct map *m, struct attr **attrs);
 struct map *map_ref(struct map* m);
 void map_unref(struct map* m);
 int map_get_attr(struct map *this_, enum attr_type type, struct attr *attr, struct attr_iter *iter);
@@ -268,6 +269,7 @@ struct map_selection *map_selection_dup(struct map_selection *sel);
 void map_selection_destroy(struct map_selection *sel);
 int map_selection_contains_item_rect(struct map_selection *sel, struct item *item);
 int map_selection_contains_item_range(struct map_selection *sel, int follow, struct item_range *range, int count);
+int map_selection_contains_tile_item_range(struct map_selection *sel, int follow, struct item_range *range, int count);
 int map_selection_contains_item(struct map_selection *sel, int follow, enum item_type type);
 int map_priv_is(struct map *map, struct map_priv *priv);
 void map_dump_filedesc(struct map *map, FILE *out);
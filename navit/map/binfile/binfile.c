@@ -39,9 +39,22 @@
 #include "callback.h"
 #include "types.h"
 #include "geom.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#include <unistd.h>
+#endif
 
 static int map_id;
 
+/** Default size of the decoded tiles kept by a map, in bytes */
+#define BINFILE_TILE_CACHE_SIZE (8*1024*1024)
+
+/** Most threads a map uses by default to inflate tiles ahead of its map rects */
+#define BINFILE_PREFETCH_THREADS 4
+
+/** Most tiles queued for prefetching or being prefetched at once */
+#define BINFILE_PREFETCH_QUEUE 64
+
 
 /**
  * @brief A map tile, a rectangular region of the world.
@@ -81,7 +94,50 @@ struct tile {
 	int *pos_next;          //!< Pointer to the next item (the item which follows the "current item" as indicated by *pos).
 	struct file *fi;        //!< The file from which this tile was loaded.
 	int zipfile_num;
-	int mode;
+	int mode;               //!< 0: whole file, 1: freed when popped, 2: changed item, 3: held by the tile cache
+	struct tile_cache_entry *cached; //!< The tile cache entry holding the data if mode is 3
+	int uncached;           //!< The data was read past the file cache, see file_data_read_uncached()
+};
+
+/**
+ * @brief A decoded tile in the tile cache of a map
+ *
+ * Map rects using the tile hold a reference. Tiles without references are kept in
+ * least recently used order until the cache exceeds its size.
+ */
+struct tile_cache_entry {
+	int zipfile_num;        //!< Number of the zip member the tile was read from
+	int *start;             //!< Uncompressed tile data
+	int *end;               //!< First address not belonging to the tile data
+	struct file *fi;        //!< The file the tile data was read from
+	int size;               //!< Size of the tile data in bytes
+	int refcount;           //!< Number of tile stack entries using the tile
+	int detached;           //!< Set if the cache was flushed while the tile was in use
+	int uncached;           //!< The data was read past the file cache, see file_data_read_uncached()
+	struct tile_cache_entry *prev,*next; //!< Neighbours in the list of unused tiles, only valid if refcount is 0
+};
+
+/**
+ * @brief Decoded tiles of a map, shared by all its map rects
+ */
+struct tile_cache {
+	GHashTable *tiles;      //!< Cached tiles by zip member number
+	struct tile_cache_entry *first,*last; //!< Tiles without references, most recently used first
+	long size;              //!< Bytes of tile data in the cache
+	long max_size;          //!< Bytes of unused tiles to keep, 0 disables the cache
+	long hits;              //!< Tiles found in the cache
+	long misses;            //!< Tiles which had to be read from the file
+	long evictions;         //!< Tiles dropped to keep the size limit
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mutex;  //!< Protects the cache, map rects may be used from several threads
+	pthread_cond_t cond;    //!< Signalled when tiles are queued for prefetching or a prefetched tile is done
+	int prefetch_threads;   //!< Number of threads inflating tiles ahead of the map rects, 0 disables prefetching
+	pthread_t *prefetch_thread; //!< The prefetch threads, NULL if not running
+	GList *prefetch_queue;  //!< Numbers of the zip members waiting to be prefetched
+	GHashTable *prefetch_pending; //!< 1 for zip members in the queue, 2 for those being read
+	int prefetch_quit;      //!< Set to stop the prefetch threads
+	struct map_priv *m;     //!< The map, read by the prefetch threads
+#endif
 };
 
 
@@ -122,6 +178,7 @@ struct map_priv {
 	int map_version;
 	GHashTable *changes;
 	char *passwd;
+	void *zstd_dict;             //!< Dictionary the Zstandard members are compressed with, NULL if there is none
 	char *map_release;
 	int flags;
 	char *url;
@@ -133,6 +190,7 @@ struct map_priv {
 	long download_enabled;
 	int last_searched_town_id_hi;	
 	int last_searched_town_id_lo;
+	struct tile_cache tile_cache;
 };
 
 struct map_rect_priv {
@@ -183,6 +241,8 @@ static void setup_pos(struct map_rect_priv *mr);
 static void map_binfile_close(struct map_priv *m);
 static int map_binfile_open(struct map_priv *m);
 static void map_binfile_destroy(struct map_priv *m);
+static int selection_contains(struct map_selection *sel, struct coord_rect *r, struct range *mima);
+static int selection_contains_summary(struct map_selection *sel, struct coord_rect *r, struct range *mima, int *summary);
 
 static void lfh_to_cpu(struct zip_lfh *lfh) {
 	dbg_assert(lfh != NULL);
@@ -360,8 +420,12 @@ binfile_read_lfh(struct file *fi, long long offset)
 	return lfh;
 }
 
+/*
+ * With cache set to 0, the data is read past the file cache and has to be freed with
+ * file_data_free_uncached(). This is used for tiles which the tile cache keeps anyway.
+ */
 static unsigned char *
-binfile_read_content(struct map_priv *m, struct file *fi, long long offset, struct zip_lfh *lfh)
+binfile_read_content(struct map_priv *m, struct file *fi, long long offset, struct zip_lfh *lfh, int cache)
 {
 	struct zip_enc *enc;
 	unsigned char *ret=NULL;
@@ -370,11 +434,17 @@ binfile_read_content(struct map_priv *m, struct file *fi, long long offset, stru
 	switch (lfh->zipmthd) {
 	case 0:
 		offset+=lfh->zipxtraln;
-		ret=file_data_read(fi,offset, lfh->zipuncmp);
+		if (cache)
+			ret=file_data_read(fi,offset, lfh->zipuncmp);
+		else
+			ret=file_data_read_uncached(fi, offset, lfh->zipuncmp, lfh->zipuncmp, 0, NULL);
 		break;
 	case 8:
 		offset+=lfh->zipxtraln;
-		ret=file_data_read_compressed(fi,offset, lfh->zipsize, lfh->zipuncmp);
+		if (cache)
+			ret=file_data_read_compressed(fi,offset, lfh->zipsize, lfh->zipuncmp);
+		else
+			ret=file_data_read_uncached(fi, offset, lfh->zipsize, lfh->zipuncmp, 8, NULL);
 		break;
 	case 99:
 		if (!m->passwd)
@@ -383,16 +453,24 @@ binfile_read_content(struct map_priv *m, struct file *fi, long long offset, stru
 		offset+=lfh->zipxtraln;
 		switch (enc->compress_method) {
 		case 0:
-			ret=file_data_read_encrypted(fi, offset, lfh->zipsize, lfh->zipuncmp, 0, m->passwd);
-			break;
 		case 8:
-			ret=file_data_read_encrypted(fi, offset, lfh->zipsize, lfh->zipuncmp, 1, m->passwd);
+			if (cache)
+				ret=file_data_read_encrypted(fi, offset, lfh->zipsize, lfh->zipuncmp, enc->compress_method == 8, m->passwd);
+			else
+				ret=file_data_read_encrypted_uncached(fi, offset, lfh->zipsize, lfh->zipuncmp, enc->compress_method == 8, m->passwd);
 			break;
 		default:
 			dbg(lvl_error,"map file %s: unknown encrypted compression method %d\n", fi->name, enc->compress_method);
 		}
 		file_data_free(fi, (unsigned char *)enc);
 		break;
+	case zip_zstd_method:
+		offset+=lfh->zipxtraln;
+		if (cache)
+			ret=file_data_read_zstd(fi, offset, lfh->zipsize, lfh->zipuncmp, m->zstd_dict);
+		else
+			ret=file_data_read_uncached(fi, offset, lfh->zipsize, lfh->zipuncmp, zip_zstd_method, m->zstd_dict);
+		break;
 	default:
 		dbg(lvl_error,"map file %s: unknown compression method %d\n", fi->name, lfh->zipmthd);
 	}
@@ -541,7 +619,7 @@ binfile_extract(struct map_priv *m, char *dir, char *filename, int partial)
 		}
 		if (full[len-2] != '/') {
 			lfh=binfile_read_lfh(m->fi, binfile_cd_offset(cd));
-			start=binfile_read_content(m, m->fi, binfile_cd_offset(cd), lfh);
+			start=binfile_read_content(m, m->fi, binfile_cd_offset(cd), lfh, 1);
 			dbg(lvl_debug,"fopen '%s'\n", full);
 			f=fopen(full,"w");
 			fwrite(start, lfh->zipuncmp, 1, f);
@@ -888,6 +966,275 @@ static struct item_methods methods_binfile = {
         binfile_coord_set,
 };
 
+#ifdef HAVE_PTHREAD
+#define tile_cache_lock(tc) pthread_mutex_lock(&(tc)->mutex)
+#define tile_cache_unlock(tc) pthread_mutex_unlock(&(tc)->mutex)
+#else
+#define tile_cache_lock(tc)
+#define tile_cache_unlock(tc)
+#endif
+
+static void
+tile_cache_init(struct tile_cache *tc, struct map_priv *m, long max_size, int prefetch_threads)
+{
+	tc->tiles=g_hash_table_new(g_direct_hash, g_direct_equal);
+	tc->max_size=max_size;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&tc->mutex, NULL);
+	pthread_cond_init(&tc->cond, NULL);
+	tc->prefetch_threads=prefetch_threads;
+	tc->m=m;
+#endif
+}
+
+static void
+tile_cache_unused_remove(struct tile_cache *tc, struct tile_cache_entry *e)
+{
+	if (e->prev)
+		e->prev->next=e->next;
+	else
+		tc->first=e->next;
+	if (e->next)
+		e->next->prev=e->prev;
+	else
+		tc->last=e->prev;
+}
+
+static void
+tile_cache_unused_add(struct tile_cache *tc, struct tile_cache_entry *e)
+{
+	e->prev=NULL;
+	e->next=tc->first;
+	if (tc->first)
+		tc->first->prev=e;
+	else
+		tc->last=e;
+	tc->first=e;
+}
+
+static void
+tile_data_free(struct file *fi, int *start, int uncached)
+{
+	if (uncached)
+		file_data_free_uncached(fi, (unsigned char *)start);
+	else
+		file_data_free(fi, (unsigned char *)start);
+}
+
+static void
+tile_cache_entry_free(struct tile_cache_entry *e)
+{
+	tile_data_free(e->fi, e->start, e->uncached);
+	g_free(e);
+}
+
+/**
+ * @brief Drops unused tiles, least recently used first, until the cache fits its size
+ *
+ * Must be called with the cache locked.
+ */
+static void
+tile_cache_trim(struct tile_cache *tc)
+{
+	struct tile_cache_entry *e;
+
+	while (tc->size > tc->max_size && (e=tc->last)) {
+		tile_cache_unused_remove(tc, e);
+		g_hash_table_remove(tc->tiles, GINT_TO_POINTER(e->zipfile_num));
+		tc->size-=e->size;
+		tc->evictions++;
+		tile_cache_entry_free(e);
+	}
+}
+
+/**
+ * @brief Drops all tiles from the cache
+ *
+ * Tiles still in use are detached and freed when their last user releases them.
+ */
+static void
+tile_cache_flush(struct tile_cache *tc)
+{
+	GHashTableIter iter;
+	struct tile_cache_entry *e;
+
+	tile_cache_lock(tc);
+	g_hash_table_iter_init(&iter, tc->tiles);
+	while (g_hash_table_iter_next(&iter, NULL, (gpointer *)&e)) {
+		if (e->refcount)
+			e->detached=1;
+		else
+			tile_cache_entry_free(e);
+	}
+	g_hash_table_remove_all(tc->tiles);
+	tc->first=tc->last=NULL;
+	tc->size=0;
+	tile_cache_unlock(tc);
+}
+
+static void
+tile_cache_destroy(struct tile_cache *tc)
+{
+	tile_cache_flush(tc);
+	g_hash_table_destroy(tc->tiles);
+#ifdef HAVE_PTHREAD
+	pthread_cond_destroy(&tc->cond);
+	pthread_mutex_destroy(&tc->mutex);
+#endif
+}
+
+/**
+ * @brief Takes a reference on a cached tile for a tile stack entry
+ *
+ * Must be called with the cache locked.
+ */
+static void
+tile_cache_ref(struct tile_cache *tc, struct tile_cache_entry *e, struct tile *t)
+{
+	if (!e->refcount++)
+		tile_cache_unused_remove(tc, e);
+	t->start=e->start;
+	t->end=e->end;
+	t->fi=e->fi;
+	t->zipfile_num=e->zipfile_num;
+	t->mode=3;
+	t->cached=e;
+}
+
+/**
+ * @brief Stores a freshly read tile in the cache, without references
+ *
+ * If the tile was cached in the meantime, the data of {@code t} is freed. Must be called
+ * with the cache locked.
+ *
+ * @param tc The tile cache
+ * @param t The tile, read by zipfile_to_tile()
+ * @return The cache entry of the tile
+ */
+static struct tile_cache_entry *
+tile_cache_insert(struct tile_cache *tc, struct tile *t)
+{
+	struct tile_cache_entry *e;
+
+	e=g_hash_table_lookup(tc->tiles, GINT_TO_POINTER(t->zipfile_num));
+	if (e) {
+		tile_data_free(t->fi, t->start, t->uncached);
+		return e;
+	}
+	e=g_new0(struct tile_cache_entry, 1);
+	e->zipfile_num=t->zipfile_num;
+	e->start=t->start;
+	e->end=t->end;
+	e->fi=t->fi;
+	e->uncached=t->uncached;
+	e->size=(t->end-t->start)*sizeof(int);
+	g_hash_table_insert(tc->tiles, GINT_TO_POINTER(e->zipfile_num), e);
+	tile_cache_unused_add(tc, e);
+	tc->size+=e->size;
+	return e;
+}
+
+/**
+ * @brief Looks up a tile in the cache and takes a reference on it
+ *
+ * If the tile is being read by a prefetch thread, waits for it. If it is still queued for
+ * prefetching, it is taken off the queue, since the caller reads it right away.
+ *
+ * @param tc The tile cache
+ * @param zipfile_num The number of the zip member containing the tile
+ * @param t Receives the tile data on success
+ * @return True if the tile was found
+ */
+static int
+tile_cache_get(struct tile_cache *tc, int zipfile_num, struct tile *t)
+{
+	struct tile_cache_entry *e;
+
+	if (!tc->max_size)
+		return 0;
+	tile_cache_lock(tc);
+	for (;;) {
+		e=g_hash_table_lookup(tc->tiles, GINT_TO_POINTER(zipfile_num));
+		if (e)
+			break;
+#ifdef HAVE_PTHREAD
+		if (tc->prefetch_pending) {
+			int state=GPOINTER_TO_INT(g_hash_table_lookup(tc->prefetch_pending, GINT_TO_POINTER(zipfile_num)));
+			if (state == 2) {
+				pthread_cond_wait(&tc->cond, &tc->mutex);
+				continue;
+			}
+			if (state == 1) {
+				tc->prefetch_queue=g_list_remove(tc->prefetch_queue, GINT_TO_POINTER(zipfile_num));
+				g_hash_table_remove(tc->prefetch_pending, GINT_TO_POINTER(zipfile_num));
+			}
+		}
+#endif
+		tc->misses++;
+		tile_cache_unlock(tc);
+		return 0;
+	}
+	tile_cache_ref(tc, e, t);
+	tc->hits++;
+	tile_cache_unlock(tc);
+	return 1;
+}
+
+/**
+ * @brief Checks whether a tile is used in place from a memory mapped map file
+ *
+ * This is the case for tiles stored without compression, see the --zero-copy option of maptool.
+ * They take neither memory nor time to decode, so they are not kept in the tile cache.
+ */
+static int
+tile_is_mapped(struct tile *t)
+{
+	unsigned char *start=(unsigned char *)t->start;
+	return t->fi->begin && start >= t->fi->begin && start < t->fi->end;
+}
+
+/**
+ * @brief Hands a freshly read tile over to the cache
+ *
+ * If another map rect cached the same tile in the meantime, its copy is used and the data
+ * of {@code t} is freed. Either way {@code t} holds a reference on the cached tile afterwards.
+ *
+ * @param tc The tile cache
+ * @param t The tile, read by zipfile_to_tile()
+ */
+static void
+tile_cache_add(struct tile_cache *tc, struct tile *t)
+{
+	if (!tc->max_size || tile_is_mapped(t))
+		return;
+	tile_cache_lock(tc);
+	tile_cache_ref(tc, tile_cache_insert(tc, t), t);
+	tile_cache_unlock(tc);
+}
+
+/**
+ * @brief Releases the reference of a tile stack entry on a cached tile
+ *
+ * @param tc The tile cache
+ * @param t The tile, with mode 3
+ */
+static void
+tile_cache_release(struct tile_cache *tc, struct tile *t)
+{
+	struct tile_cache_entry *e=t->cached;
+
+	tile_cache_lock(tc);
+	if (!--e->refcount) {
+		if (e->detached)
+			tile_cache_entry_free(e);
+		else {
+			tile_cache_unused_add(tc, e);
+			tile_cache_trim(tc);
+		}
+	}
+	tile_cache_unlock(tc);
+}
+
 static void
 push_tile(struct map_rect_priv *mr, struct tile *t, int offset, int length)
 {
@@ -907,7 +1254,9 @@ pop_tile(struct map_rect_priv *mr)
 	if (mr->tile_depth <= 1)
 		return 0;
 	if (mr->t->mode < 2)
-		file_data_free(mr->m->fi, (unsigned char *)(mr->t->start));
+		tile_data_free(mr->m->fi, mr->t->start, mr->t->uncached);
+	else if (mr->t->mode == 3)
+		tile_cache_release(&mr->m->tile_cache, mr->t);
 #ifdef DEBUG_SIZE
 #if DEBUG_SIZE > 0
 	dbg(lvl_debug,"leave %d\n",mr->t->zipfile_num);
@@ -921,30 +1270,201 @@ pop_tile(struct map_rect_priv *mr)
 static int
 zipfile_to_tile(struct map_priv *m, struct zip_cd *cd, struct tile *t)
 {
-	char buffer[1024];
 	struct zip_lfh *lfh;
-	char *zipfn;
 	struct file *fi;
 	dbg(lvl_debug,"enter %p %p %p\n", m, cd, t);
 	dbg(lvl_debug,"cd->zipofst=0x"LONGLONG_HEX_FMT "\n", binfile_cd_offset(cd));
 	t->start=NULL;
 	t->mode=1;
+	/* Tiles go to the tile cache, keeping them in the file cache as well would only waste memory */
+	t->uncached=m->tile_cache.max_size != 0;
 	if (m->fis)
 		fi=m->fis[cd->zipdsk];
 	else
 		fi=m->fi;
 	lfh=binfile_read_lfh(fi, binfile_cd_offset(cd));
-	zipfn=(char *)(file_data_read(fi,binfile_cd_offset(cd)+sizeof(struct zip_lfh), lfh->zipfnln));
-	strncpy(buffer, zipfn, lfh->zipfnln);
-	buffer[lfh->zipfnln]='\0';
-	t->start=(int *)binfile_read_content(m, fi, binfile_cd_offset(cd), lfh);
+	t->start=(int *)binfile_read_content(m, fi, binfile_cd_offset(cd), lfh, !t->uncached);
 	t->end=t->start+lfh->zipuncmp/4;
 	t->fi=fi;
-	file_data_free(fi, (unsigned char *)zipfn);
 	file_data_free(fi, (unsigned char *)lfh);
 	return t->start != NULL;
 }
 
+#ifdef HAVE_PTHREAD
+/**
+ * @brief Main function of a prefetch thread
+ *
+ * Reads and inflates the queued tiles and stores them in the tile cache, where the map rects
+ * find them once they descend into them.
+ */
+static void *
+tile_prefetch_main(void *data)
+{
+	struct tile_cache *tc=data;
+	struct map_priv *m=tc->m;
+	long long cdoffset=m->eoc64?m->eoc64->zip64eofst:m->eoc->zipeofst;
+	struct zip_cd *cd;
+	struct tile t;
+	int zipfile,ok;
+
+	tile_cache_lock(tc);
+	while (!tc->prefetch_quit) {
+		if (!tc->prefetch_queue) {
+			pthread_cond_wait(&tc->cond, &tc->mutex);
+			continue;
+		}
+		zipfile=GPOINTER_TO_INT(tc->prefetch_queue->data);
+		tc->prefetch_queue=g_list_delete_link(tc->prefetch_queue, tc->prefetch_queue);
+		g_hash_table_insert(tc->prefetch_pending, GINT_TO_POINTER(zipfile), GINT_TO_POINTER(2));
+		tile_cache_unlock(tc);
+		ok=0;
+		cd=(struct zip_cd *)file_data_read(m->fi, cdoffset+zipfile*m->cde_size, m->cde_size);
+		if (cd) {
+			cd_to_cpu(cd);
+			t.zipfile_num=zipfile;
+			/* Tiles of maps being downloaded may not be there yet */
+			if (cd->zipcunc)
+				ok=zipfile_to_tile(m, cd, &t);
+			file_data_free(m->fi, (unsigned char *)cd);
+		}
+		tile_cache_lock(tc);
+		if (ok && !tile_is_mapped(&t)) {
+			tile_cache_insert(tc, &t);
+			tile_cache_trim(tc);
+		}
+		g_hash_table_remove(tc->prefetch_pending, GINT_TO_POINTER(zipfile));
+		pthread_cond_broadcast(&tc->cond);
+	}
+	tile_cache_unlock(tc);
+	return NULL;
+}
+
+/**
+ * @brief Stops the prefetch threads of a map and drops their queue
+ */
+static void
+tile_prefetch_stop(struct tile_cache *tc)
+{
+	int i;
+
+	tile_cache_lock(tc);
+	if (!tc->prefetch_thread) {
+		tile_cache_unlock(tc);
+		return;
+	}
+	tc->prefetch_quit=1;
+	pthread_cond_broadcast(&tc->cond);
+	tile_cache_unlock(tc);
+	for (i = 0 ; i < tc->prefetch_threads ; i++)
+		pthread_join(tc->prefetch_thread[i], NULL);
+	tile_cache_lock(tc);
+	g_list_free(tc->prefetch_queue);
+	tc->prefetch_queue=NULL;
+	g_hash_table_destroy(tc->prefetch_pending);
+	tc->prefetch_pending=NULL;
+	g_free(tc->prefetch_thread);
+	tc->prefetch_thread=NULL;
+	tile_cache_unlock(tc);
+}
+
+/**
+ * @brief Queues a tile for prefetching, starting the prefetch threads if needed
+ *
+ * Must be called with the cache locked.
+ *
+ * @return False if the queue is full
+ */
+static int
+tile_prefetch_queue(struct tile_cache *tc, int zipfile)
+{
+	int i;
+
+	if (!tc->prefetch_thread) {
+		tc->prefetch_quit=0;
+		tc->prefetch_pending=g_hash_table_new(g_direct_hash, g_direct_equal);
+		tc->prefetch_thread=g_new0(pthread_t, tc->prefetch_threads);
+		for (i = 0 ; i < tc->prefetch_threads ; i++) {
+			if (pthread_create(&tc->prefetch_thread[i], NULL, tile_prefetch_main, tc)) {
+				dbg(lvl_error,"failed to start prefetch thread, %d running\n", i);
+				tc->prefetch_threads=i;
+				break;
+			}
+		}
+		dbg(lvl_debug,"started %d prefetch threads\n", tc->prefetch_threads);
+	}
+	if (g_hash_table_size(tc->prefetch_pending) >= BINFILE_PREFETCH_QUEUE)
+		return 0;
+	if (g_hash_table_lookup(tc->tiles, GINT_TO_POINTER(zipfile)) ||
+	    g_hash_table_lookup(tc->prefetch_pending, GINT_TO_POINTER(zipfile)))
+		return 1;
+	tc->prefetch_queue=g_list_append(tc->prefetch_queue, GINT_TO_POINTER(zipfile));
+	g_hash_table_insert(tc->prefetch_pending, GINT_TO_POINTER(zipfile), GINT_TO_POINTER(1));
+	pthread_cond_broadcast(&tc->cond);
+	return 1;
+}
+#endif
+
+/**
+ * @brief Queues the tiles a map rect will descend into from its current tile for prefetching
+ *
+ * The submap items of the tile are checked against the selection of the map rect the same way
+ * map_parse_submap() does it later, so only tiles which are going to be read are inflated ahead.
+ *
+ * @param mr The map rect, its current tile was just pushed
+ */
+static void
+tile_prefetch_submaps(struct map_rect_priv *mr)
+{
+#ifdef HAVE_PTHREAD
+	struct tile_cache *tc=&mr->m->tile_cache;
+	struct tile *t=mr->t;
+	int *pos,*attr,*end,*summary,size,zipfile;
+	struct coord_rect r;
+	struct range mima;
+	struct attr at;
+
+	if (tc->prefetch_threads <= 0 || !tc->max_size || mr->country_id || !mr->m->eoc)
+		return;
+	for (pos=t->pos ; pos < t->end ; pos+=size+1) {
+		size=le32_to_cpu(pos[0]);
+		if (le32_to_cpu(pos[1]) != type_submap || le32_to_cpu(pos[2]) != 4)
+			continue;
+		r.lu.x=le32_to_cpu(pos[3]);
+		r.lu.y=le32_to_cpu(pos[6]);
+		r.rl.x=le32_to_cpu(pos[5]);
+		r.rl.y=le32_to_cpu(pos[4]);
+		mima.min=mima.max=0;
+		zipfile=-1;
+		summary=NULL;
+		end=pos+size+1;
+		for (attr=pos+7 ; attr < end ; attr+=le32_to_cpu(attr[0])+1) {
+			at.type=le32_to_cpu(attr[1]);
+			if (at.type == attr_order) {
+				attr_data_set_le(&at, attr+2);
+#if __BYTE_ORDER == __BIG_ENDIAN
+				mima.min=le16_to_cpu(at.u.range.max);
+				mima.max=le16_to_cpu(at.u.range.min);
+#else
+				mima=at.u.range;
+#endif
+			} else if (at.type == attr_zipfile_ref) {
+				attr_data_set_le(&at, attr+2);
+				zipfile=at.u.num;
+			} else if (at.type == attr_tile_summary)
+				summary=attr+2;
+		}
+		if (zipfile < 0 || !selection_contains_summary(mr->sel, &r, &mima, summary))
+			continue;
+		tile_cache_lock(tc);
+		if (!tile_prefetch_queue(tc, zipfile)) {
+			tile_cache_unlock(tc);
+			break;
+		}
+		tile_cache_unlock(tc);
+	}
+#endif
+}
+
 
 static int
 map_binfile_handle_redirect(struct map_priv *m)
@@ -1310,8 +1830,11 @@ push_zipfile_tile_do(struct map_rect_priv *mr, struct zip_cd *cd, int zipfile, i
 	mr->size+=cd->zipcunc;
 #endif
 	t.zipfile_num=zipfile;
-	if (zipfile_to_tile(m, cd, &t))
+	if (zipfile_to_tile(m, cd, &t)) {
+		tile_cache_add(&m->tile_cache, &t);
 		push_tile(mr, &t, offset, length);
+		tile_prefetch_submaps(mr);
+	}
 	file_data_free(f, (unsigned char *)cd);
 }
 
@@ -1461,7 +1984,15 @@ push_zipfile_tile(struct map_rect_priv *mr, int zipfile, int offset, int length,
         struct map_priv *m=mr->m;
 	struct file *f=m->fi;
 	long long cdoffset=m->eoc64?m->eoc64->zip64eofst:m->eoc->zipeofst;
-	struct zip_cd *cd=(struct zip_cd *)(file_data_read(f, cdoffset + zipfile*m->cde_size, m->cde_size));
+	struct zip_cd *cd;
+	struct tile t;
+
+	if (tile_cache_get(&m->tile_cache, zipfile, &t)) {
+		push_tile(mr, &t, offset, length);
+		tile_prefetch_submaps(mr);
+		return 0;
+	}
+	cd=(struct zip_cd *)(file_data_read(f, cdoffset + zipfile*m->cde_size, m->cde_size));
 	dbg(lvl_debug,"read from "LONGLONG_FMT" %d bytes\n",cdoffset + zipfile*m->cde_size, m->cde_size);
 	cd_to_cpu(cd);
 	if (!cd->zipcunc && m->url) {
@@ -1582,6 +2113,7 @@ map_rect_new_binfile(struct map_priv *map, struct map_selection *sel)
 			t.fi=map->fi;
 			t.zipfile_num=0;
 			t.mode=0;
+			t.uncached=0;
 			push_tile(mr, &t, 0, 0);
 		} else if (map->url && !map->download) {
 			download(map, NULL, NULL, 0, 0, 0, 1);
@@ -1654,8 +2186,10 @@ map_rect_destroy_binfile(struct map_rect_priv *mr)
 #ifdef DEBUG_SIZE
 	dbg(lvl_debug,"size=%d kb\n",mr->size/1024);
 #endif
-	if (mr->tiles[0].fi && mr->tiles[0].start)
-		file_data_free(mr->tiles[0].fi, (unsigned char *)(mr->tiles[0].start));
+	if (mr->tiles[0].mode == 3)
+		tile_cache_release(&mr->m->tile_cache, &mr->tiles[0]);
+	else if (mr->tiles[0].fi && mr->tiles[0].start)
+		tile_data_free(mr->tiles[0].fi, mr->tiles[0].start, mr->tiles[0].uncached);
 	g_free(mr->url);
 	map_binfile_http_close(mr->m);
         g_free(mr);
@@ -1682,22 +2216,76 @@ setup_pos(struct map_rect_priv *mr)
 }
 
 static int
-selection_contains(struct map_selection *sel, struct coord_rect *r, struct range *mima)
+selection_contains_one(struct map_selection *sel, struct coord_rect *r, struct range *mima)
 {
 	int order;
+	if (coord_rect_overlap(r, &sel->u.c_rect)) {
+		order=sel->order;
+		dbg(lvl_debug,"min %d max %d order %d\n", mima->min, mima->max, order);
+		if (!mima->min && !mima->max)
+			return 1;
+		if (order >= mima->min && order <= mima->max)
+			return 1;
+	}
+	return 0;
+}
+
+static int
+selection_contains(struct map_selection *sel, struct coord_rect *r, struct range *mima)
+{
 	if (! sel)
 		return 1;
 	while (sel) {
-		if (coord_rect_overlap(r, &sel->u.c_rect)) {
-			order=sel->order;
-			dbg(lvl_debug,"min %d max %d order %d\n", mima->min, mima->max, order);
-			if (!mima->min && !mima->max)
-				return 1;
-			if (order >= mima->min && order <= mima->max)
+		if (selection_contains_one(sel, r, mima))
+			return 1;
+		sel=sel->next;
+	}
+	return 0;
+}
+
+/**
+ * @brief Checks whether a selection may want items from a submap, using the tile summary of the submap
+ *
+ * The summary is written by maptool as {@code attr_tile_summary} of the submap item: the number of
+ * items, the number of ranges and per range the first and the last item type and the orders at which
+ * they are delivered. It covers the tiles the submap refers to as well. Without a summary, only the
+ * bbox and the order range of the submap are checked.
+ *
+ * @param sel The selection
+ * @param r The bbox of the submap
+ * @param mima The order range of the submap
+ * @param summary The tile summary of the submap, or NULL
+ * @return True if the submap has to be read
+ */
+static int
+selection_contains_summary(struct map_selection *sel, struct coord_rect *r, struct range *mima, int *summary)
+{
+	struct item_range *ranges;
+	struct range *order;
+	int i,count,entries;
+	int *entry;
+
+	if (!sel || !summary)
+		return selection_contains(sel, r, mima);
+	entries=le32_to_cpu(summary[1]);
+	ranges=g_alloca(sizeof(*ranges)*(entries+1));
+	while (sel) {
+		if (selection_contains_one(sel, r, mima)) {
+			count=0;
+			for (i = 0, entry=summary+2 ; i < entries ; i++, entry+=3) {
+				order=(struct range *)(entry+2);
+				if (sel->order < le16_to_cpu(order->min) || sel->order > le16_to_cpu(order->max))
+					continue;
+				ranges[count].min=le32_to_cpu(entry[0]);
+				ranges[count].max=le32_to_cpu(entry[1]);
+				count++;
+			}
+			if (map_selection_contains_tile_item_range(sel, 0, ranges, count))
 				return 1;
 		}
 		sel=sel->next;
 	}
+	dbg(lvl_debug,"skipping submap with %d items\n", le32_to_cpu(summary[0]));
 	return 0;
 }
 
@@ -1759,7 +2347,10 @@ map_parse_submap(struct map_rect_priv *mr, int async)
 #else
 	mima=at.u.range;
 #endif
-	if (!mr->m->eoc || !selection_contains(mr->sel, &r, &mima))
+	if (!mr->m->eoc)
+		return 0;
+	if (!selection_contains_summary(mr->sel, &r, &mima,
+			binfile_attr_get(mr->item.priv_data, attr_tile_summary, &at) ? at.u.data : NULL))
 		return 0;
 	if (!binfile_attr_get(mr->item.priv_data, attr_zipfile_ref, &at))
 		return 0;
@@ -2503,6 +3094,19 @@ binmap_get_attr(struct map_priv *m, enum attr_type type, struct attr *attr)
 			attr->u.str=m->progress;
 			return 1;
 		}
+		break;
+	case attr_tile_cache_size:
+		attr->u.num=m->tile_cache.max_size/1024;
+		return 1;
+	case attr_tile_cache_hits:
+		attr->u.num=m->tile_cache.hits;
+		return 1;
+	case attr_tile_cache_misses:
+		attr->u.num=m->tile_cache.misses;
+		return 1;
+	case attr_tile_cache_evictions:
+		attr->u.num=m->tile_cache.evictions;
+		return 1;
 	default:
 		break;
 	}
@@ -2516,6 +3120,12 @@ binmap_set_attr(struct map_priv *map, struct attr *attr)
 	case attr_update:
 		map->download_enabled = attr->u.num;
 		return 1;
+	case attr_tile_cache_size:
+		tile_cache_lock(&map->tile_cache);
+		map->tile_cache.max_size=(long)attr->u.num*1024;
+		tile_cache_trim(&map->tile_cache);
+		tile_cache_unlock(&map->tile_cache);
+		return 1;
 	default:
 		return 0;
 	}
@@ -2580,6 +3190,40 @@ binfile_get_index(struct map_priv *m)
 	return 1;
 }
 
+/**
+ * @brief Loads the dictionary the Zstandard members of the map are compressed with
+ *
+ * maptool stores the dictionary as the member right before the index, so it is found without
+ * searching the central directory. Maps without Zstandard members have no dictionary.
+ *
+ * @param m The map
+ */
+static void
+binfile_read_zstd_dict(struct map_priv *m)
+{
+	struct zip_cd *cd;
+	struct zip_lfh *lfh;
+	struct file *fi;
+	unsigned char *dict;
+	int len=strlen(zip_zstd_dictionary);
+
+	if (m->zip_members < 2 || !(cd=binfile_read_cd(m, (m->zip_members-2)*m->cde_size, -1)))
+		return;
+	if (cd->zipcfnl >= len && !strncmp(cd->zipcfn, zip_zstd_dictionary, len)) {
+		fi=m->fis ? m->fis[cd->zipdsk] : m->fi;
+		if ((lfh=binfile_read_lfh(fi, binfile_cd_offset(cd)))) {
+			if ((dict=binfile_read_content(m, fi, binfile_cd_offset(cd), lfh, 1))) {
+				m->zstd_dict=file_zstd_dict_new(dict, lfh->zipuncmp);
+				if (!m->zstd_dict)
+					dbg(lvl_error,"map file %s: unable to load the zstd dictionary\n", m->filename);
+				file_data_free(fi, dict);
+			}
+			file_data_free(fi, (unsigned char *)lfh);
+		}
+	}
+	file_data_free(m->fi, (unsigned char *)cd);
+}
+
 static int
 map_binfile_zip_setup(struct map_priv *m, char *filename, int mmap)
 {
@@ -2617,6 +3261,7 @@ map_binfile_zip_setup(struct map_priv *m, char *filename, int mmap)
 	dbg(lvl_debug,"cde_size %d\n", m->cde_size);
 	dbg(lvl_debug,"members %d\n",m->zip_members);
 	file_data_free(m->fi, (unsigned char *)first_cd);
+	binfile_read_zstd_dict(m);
 	if (mmap)
 		file_mmap(m->fi);
 	return 1;
@@ -2778,6 +3423,14 @@ static void
 map_binfile_close(struct map_priv *m)
 {
 	int i;
+#ifdef HAVE_PTHREAD
+	tile_prefetch_stop(&m->tile_cache);
+#endif
+	tile_cache_flush(&m->tile_cache);
+	if (m->zstd_dict) {
+		file_zstd_dict_destroy(m->zstd_dict);
+		m->zstd_dict=NULL;
+	}
 	file_data_free(m->fi, (unsigned char *)m->index_cd);
 	file_data_free(m->fi, (unsigned char *)m->eoc);
 	file_data_free(m->fi, (unsigned char *)m->eoc64);
@@ -2794,6 +3447,7 @@ map_binfile_close(struct map_priv *m)
 static void
 map_binfile_destroy(struct map_priv *m)
 {
+	tile_cache_destroy(&m->tile_cache);
 	g_free(m->filename);
 	g_free(m->url);
 	g_free(m->progress);
@@ -2822,7 +3476,8 @@ map_new_binfile(struct map_methods *meth, struct attr **attrs, struct callback_l
 {
 	struct map_priv *m;
 	struct attr *data=attr_search(attrs, NULL, attr_data);
-	struct attr *check_version,*map_pass,*flags,*url,*download_enabled;
+	struct attr *check_version,*map_pass,*flags,*url,*download_enabled,*tile_cache_size,*prefetch_threads;
+	int threads=0;
 	struct file_wordexp *wexp;
 	char **wexp_data;
 	if (! data)
@@ -2853,6 +3508,17 @@ map_new_binfile(struct map_methods *meth, struct attr **attrs, struct callback_l
 	download_enabled = attr_search(attrs, NULL, attr_update);
 	if (download_enabled)
 		m->download_enabled=download_enabled->u.num;
+	tile_cache_size=attr_search(attrs, NULL, attr_tile_cache_size);
+	prefetch_threads=attr_search(attrs, NULL, attr_tile_prefetch_threads);
+	if (prefetch_threads)
+		threads=prefetch_threads->u.num;
+#ifdef HAVE_PTHREAD
+	else {
+		threads=sysconf(_SC_NPROCESSORS_ONLN);
+		threads=threads > 1 ? MIN(threads, BINFILE_PREFETCH_THREADS) : 0;
+	}
+#endif
+	tile_cache_init(&m->tile_cache, m, tile_cache_size ? (long)tile_cache_size->u.num*1024 : BINFILE_TILE_CACHE_SIZE, threads);
 
 	if (!map_binfile_open(m) && !m->check_version && !m->url) {
 		map_binfile_destroy(m);
@@ -35,6 +35,7 @@
 #include "projection.h"
 #include "map.h"
 #include "xmlconfig.h"
+#include "streetindex.h"
 
 /**
  * @brief A mapset
@@ -44,6 +45,7 @@
 struct mapset {
 	NAVIT_OBJECT
 	GList *maps; /**< Linked list of all the maps in the mapset */
+	struct street_index *street_index; /**< Index of the streets of the maps, created on first use */
 };
 
 struct attr_iter {
@@ -100,6 +102,8 @@ mapset_add_attr(struct mapset *ms, struct attr *attr)
 	case attr_map:
 		ms->attrs=attr_generic_add_attr(ms->attrs,attr);
 		ms->maps=g_list_append(ms->maps, attr->u.map);
+		if (ms->street_index)
+			street_index_flush(ms->street_index);
 		return 1;
 	default:
 		return 0;
@@ -113,6 +117,8 @@ mapset_remove_attr(struct mapset *ms, struct attr *attr)
 	case attr_map:
 		ms->attrs=attr_generic_remove_attr(ms->attrs,attr);
 		ms->maps=g_list_remove(ms->maps, attr->u.map);
+		if (ms->street_index)
+			street_index_flush(ms->street_index);
 		return 1;
 	default:
 		return 0;
@@ -153,11 +159,29 @@ mapset_get_attr(struct mapset *ms, enum attr_type type, struct attr *attr, struc
  */
 void mapset_destroy(struct mapset *ms)
 {
+	if (ms->street_index)
+		street_index_destroy(ms->street_index);
 	g_list_free(ms->maps);
 	attr_list_free(ms->attrs);
 	g_free(ms);
 }
 
+/**
+ * @brief Returns the spatial index of the streets of a mapset
+ *
+ * The index is created on first use and flushed whenever maps are added or removed.
+ *
+ * @param ms The mapset
+ * @return The street index
+ */
+struct street_index *
+mapset_get_street_index(struct mapset *ms)
+{
+	if (!ms->street_index)
+		ms->street_index=street_index_new();
+	return ms->street_index;
+}
+
 /**
  * @brief Handle for a mapset in use
  *
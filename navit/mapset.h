@@ -33,6 +33,7 @@ struct map;
 struct mapset;
 struct mapset_handle;
 struct mapset_search;
+struct street_index;
 struct mapset *mapset_new(struct attr *parent, struct attr **attrs);
 struct mapset *mapset_dup(struct mapset *ms);
 struct attr_iter *mapset_attr_iter_new(void);
@@ -41,6 +42,7 @@ int mapset_add_attr(struct mapset *ms, struct attr *attr);
 int mapset_remove_attr(struct mapset *ms, struct attr *attr);
 int mapset_get_attr(struct mapset *ms, enum attr_type type, struct attr *attr, struct attr_iter *iter);
 void mapset_destroy(struct mapset *ms);
+struct street_index *mapset_get_street_index(struct mapset *ms);
 struct map *mapset_get_map_by_name(struct mapset *ms, const char*map_name);
 struct mapset_handle *mapset_open(struct mapset *ms);
 struct map *mapset_next(struct mapset_handle *msh, int active);
@@ -23,6 +23,9 @@
 #include "coord.h"
 #include "file.h"
 #include "debug.h"
+#include "attr.h"
+#include "transform.h"
+#include "routech.h"
 
 #if GLIB_MAJOR_VERSION == 2 && GLIB_MINOR_VERSION < 10
 #define g_slice_alloc0 g_malloc0
@@ -80,47 +83,34 @@ GHashTable *sgr_nodes_hash;
 
 static int ch_levels=14;
 
+/**
+ * @brief Returns the direction of the DDSG edge of a street
+ *
+ * @param ib The street
+ * @return 0 if the street can be driven both ways, 1 in the order of its coordinates only, 2 against it only,
+ * or -1 if it is not part of the hierarchy
+ */
 static int
-road_speed(enum item_type type)
+ch_edge_direction(struct item_bin *ib)
 {
-	switch (type) {
-	case type_street_0:
-	case type_street_1_city:
-	case type_living_street:
-	case type_street_service:
-	case type_track_gravelled:
-	case type_track_unpaved:
-		return 10;
-	case type_street_2_city:
-	case type_track_paved:
-		return 30;
-	case type_street_3_city:
-		return 40;
-	case type_street_4_city:
-		return 50;
-	case type_highway_city:
-		return 80;
-	case type_street_1_land:
-		return 60;
-	case type_street_2_land:
-		return 65;
-	case type_street_3_land:
-		return 70;
-	case type_street_4_land:
-		return 80;
-	case type_street_n_lanes:
-		return 120;
-	case type_highway_land:
-		return 120;
-	case type_ramp:
-		return 40;
-	case type_roundabout:
-		return 10;
-	case type_ferry:
-		return 40;
-	default:
+	int *flags,forward,reverse;
+
+	if (!routech_road_speed(ib->type))
+		return -1;
+	flags=item_bin_get_attr(ib, attr_flags, NULL);
+	if (!flags)
+		flags=item_get_default_flags(ib->type);
+	if (!flags)
+		return -1;
+	forward=(*flags & ROUTECH_FLAGS_FORWARD_MASK) == ROUTECH_FLAGS;
+	reverse=(*flags & ROUTECH_FLAGS_REVERSE_MASK) == ROUTECH_FLAGS;
+	if (forward && reverse)
 		return 0;
-	}
+	if (forward)
+		return 1;
+	if (reverse)
+		return 2;
+	return -1;
 }
 
 static void
@@ -188,7 +178,7 @@ ch_generate_ddsg(FILE *in, FILE *ref, FILE *idx, FILE *ddsg)
 	while ((ib=read_item(in))) {
 		int ccount=ib->clen/2;
                 struct coord *c=(struct coord *)(ib+1);
-		if (road_speed(ib->type)) {
+		if (ch_edge_direction(ib) != -1) {
 			add_node_to_hash(idx, hash, &c[0], &nodes);
 			add_node_to_hash(idx, hash, &c[ccount-1], &nodes);
 			edges++;
@@ -201,11 +191,11 @@ ch_generate_ddsg(FILE *in, FILE *ref, FILE *idx, FILE *ddsg)
 	while ((ib=read_item(in))) {
 		int i,ccount=ib->clen/2;
                 struct coord *c=(struct coord *)(ib+1);
-		int n1,n2,speed=road_speed(ib->type);
+		int n1,n2,direction=ch_edge_direction(ib);
 		struct item_id road_id;
 		double l;
 		fread(&road_id, sizeof(road_id), 1, ref);
-		if (speed) {
+		if (direction != -1) {
 			struct edge_hash_item *hi=g_slice_new(struct edge_hash_item);
 			struct item_id *id=g_slice_new(struct item_id);
 			*id=road_id;
@@ -213,9 +203,9 @@ ch_generate_ddsg(FILE *in, FILE *ref, FILE *idx, FILE *ddsg)
 			dbg_assert((n2=GPOINTER_TO_INT(g_hash_table_lookup(hash, &c[ccount-1]))) != 0);
 			l=0;
 			for (i = 0 ; i < ccount-1 ; i++) {
-				l+=sqrt(sq(c[i+1].x-c[i].x)+sq(c[i+1].y-c[i].y));
+				l+=transform_distance(projection_mg, &c[i], &c[i+1]);
 			}
-			fprintf(ddsg,"%d %d %d 0\n", n1-1, n2-1, (int)(l*36/speed));
+			fprintf(ddsg,"%d %d %d %d\n", n1-1, n2-1, routech_street_time(ib->type, (int)l), direction);
 			hi->first=n1-1;
 			hi->last=n2-1;
 			g_hash_table_insert(edge_hash, hi, id);
@@ -520,6 +510,7 @@ ch_assemble_map(char *map_suffix, char *suffix, struct zip_info *zip_info)
         while (th) {
 		th->zip_data=malloc(th->total_size);
 		th->total_size_used=0;
+		tile_summary_reset(th);
                 th=th->next;
         }
 	ch_create_tempfiles(suffix, graphfiles, ch_levels, 1);
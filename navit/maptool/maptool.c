@@ -302,7 +302,9 @@ usage(FILE *f)
 	fprintf(f,"-W (--ways-only)                  : process only ways\n");
 	fprintf(f,"-U (--unknown-country)            : add objects with unknown country to index\n");
 	fprintf(f,"-x (--index-size)                 : set maximum country index size in bytes\n");
+	fprintf(f,"-Y (--zstd)                       : compress tiles with Zstandard and a dictionary trained from them instead of deflate\n");
 	fprintf(f,"-z (--compression-level) <level>  : set the compression level\n");
+	fprintf(f,"-Z (--zero-copy)                  : store tiles uncompressed and aligned, so navit can use them in place from a memory mapped map, not with -z or -Y\n");
 	fprintf(f,"Internal options (undocumented):\n");                                                                      
 	fprintf(f,"-b (--binfile)\n");                                                                                        
 	fprintf(f,"-B \n");                                                                                                   
@@ -327,6 +329,9 @@ struct maptool_params {
 	int output;
 	int o5m;
 	int compression_level;
+	int compression_level_set;
+	int zero_copy;
+	int zstd;
 	int protobuf;
 	int dump_coordinates;
 	int input;
@@ -384,13 +389,15 @@ parse_option(struct maptool_params *p, char **argv, int argc, int *option_index)
 		{"slice-size", 1, 0, 'S'},
 		{"unknown-country", 0, 0, 'U'},
 		{"index-size", 0, 0, 'x'},
+		{"zero-copy", 0, 0, 'Z'},
+		{"zstd", 0, 0, 'Y'},
 		{0, 0, 0, 0}
 	};
 	c = getopt_long (argc, argv, "5:6B:DEMNO:PS:Wa:bc"
 #ifdef HAVE_POSTGRESQL
 				      "d:"
 #endif
-				      "e:hi:knm:p:r:s:t:wu:z:Ux:", long_options, option_index);
+				      "e:hi:knm:p:r:s:t:wu:z:Ux:YZ", long_options, option_index);
 	if (c == -1)
 		return 1;
 	switch (c) {
@@ -523,8 +530,16 @@ parse_option(struct maptool_params *p, char **argv, int argc, int *option_index)
 #ifdef HAVE_ZLIB
 	case 'z':
 		p->compression_level=atoi(optarg);
+		p->compression_level_set=1;
 		break;
 #endif
+	case 'Y':
+		p->zstd=1;
+		break;
+	case 'Z':
+		p->zero_copy=1;
+		p->compression_level=0;
+		break;
         case '?':
 	default:
 		return 0;
@@ -804,6 +819,12 @@ maptool_assemble_map(struct maptool_params *p, char *suffix, char **filenames, c
 		zip_set_timestamp(zip_info, p->timestamp);
 		zip_set_maxnamelen(zip_info, 14+strlen(suffix0));
 		zip_set_compression_level(zip_info, p->compression_level);
+		if (p->zero_copy)
+			zip_set_alignment(zip_info, sizeof(int));
+		if (p->zstd && !zip_set_zstd(zip_info, 1)) {
+			fprintf(stderr,"maptool was built without Zstandard support\n");
+			exit(1);
+		}
 		if (p->md5file) 
 			zip_set_md5(zip_info, 1);
 		if(!zip_open(zip_info, p->result, zipdir, zipindex)) {
@@ -961,6 +982,10 @@ int main(int argc, char **argv)
 			exit(0);
 		}
 	}
+	if (p.zero_copy && (p.compression_level_set || p.zstd)) {
+		fprintf(stderr,"-Z stores tiles uncompressed and can not be combined with -z or -Y\n");
+		exit(1);
+	}
 	if (experimental && (!experimental_feature_description )) {
 		fprintf(stderr,"No experimental features available in this version, aborting. \n");
 		exit(1);
@@ -59,6 +59,26 @@ struct tile_info {
 	FILE *tilesdir_out;
 };
 
+/**
+ * An item type found in a tile, with the orders at which it is delivered.
+ */
+struct tile_summary_type {
+	enum item_type type;
+	struct range order;
+};
+
+/**
+ * The item types of a tile, including those of the tiles its submaps refer to.
+ * maptool stores it with the submap item of the tile, so navit can skip tiles without
+ * anything the selection asks for.
+ */
+struct tile_summary {
+	int items;                      /**< number of items */
+	int count;                      /**< number of item types */
+	int size;                       /**< number of item types allocated */
+	struct tile_summary_type *types;        /**< item types, sorted */
+};
+
 extern struct tile_head {
 	int num_subtiles;
 	int total_size;
@@ -67,6 +87,7 @@ extern struct tile_head {
 	int total_size_used;
 	int zipnum;
 	int process;
+	struct tile_summary summary;
 	struct tile_head *next;
 	// char subtiles[0];
 } *tile_head_root;
@@ -388,6 +409,7 @@ int tile(struct rect *r, char *suffix, char *ret, int max, int overlap, struct r
 void tile_bbox(char *tile, struct rect *r, int overlap);
 int tile_len(char *tile);
 void load_tilesdir(FILE *in);
+void tile_summary_reset(struct tile_head *th);
 void tile_write_item_to_tile(struct tile_info *info, struct item_bin *ib, FILE *reference, char *name);
 void tile_write_item_minmax(struct tile_info *info, struct item_bin *ib, FILE *reference, int min, int max);
 int add_aux_tile(struct zip_info *zip_info, char *name, char *filename, int size);
@@ -408,6 +430,8 @@ void zip_set_md5(struct zip_info *info, int on);
 int zip_get_md5(struct zip_info *info, unsigned char *out);
 void zip_set_zip64(struct zip_info *info, int on);
 void zip_set_compression_level(struct zip_info *info, int level);
+int zip_set_zstd(struct zip_info *info, int on);
+void zip_set_alignment(struct zip_info *info, int alignment);
 void zip_set_maxnamelen(struct zip_info *info, int max);
 int zip_get_maxnamelen(struct zip_info *info);
 int zip_add_member(struct zip_info *info);
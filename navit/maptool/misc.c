@@ -335,6 +335,7 @@ process_slice(FILE **in, FILE **reference, int in_count, int with_range, long lo
 			th->zip_data=zip_data;
 			zip_data+=th->total_size;
 		}
+		tile_summary_reset(th);
 		th=th->next;
 	}
 	for (i = 0 ; i < in_count ; i++) {
@@ -73,6 +73,111 @@ static char** th_get_subtile( const struct tile_head* th, int idx )
 	return (char**)subtile_ptr;
 }
 
+static struct tile_head *
+tile_head_lookup(char *tile)
+{
+	struct tile_head *th=NULL;
+	if (tile_hash2)
+		th=g_hash_table_lookup(tile_hash2, tile);
+	if (!th)
+		th=g_hash_table_lookup(tile_hash, tile);
+	return th;
+}
+
+static void
+tile_summary_add(struct tile_summary *s, enum item_type type, struct range *order)
+{
+	int min=0,max=s->count,mid;
+	struct tile_summary_type *t;
+
+	while (min < max) {
+		mid=(min+max)/2;
+		if (s->types[mid].type < type)
+			min=mid+1;
+		else
+			max=mid;
+	}
+	if (min < s->count && s->types[min].type == type) {
+		t=&s->types[min];
+		if (order->min < t->order.min)
+			t->order.min=order->min;
+		if (order->max > t->order.max)
+			t->order.max=order->max;
+		return;
+	}
+	if (s->count == s->size) {
+		s->size=s->size ? s->size*2 : 8;
+		s->types=g_renew(struct tile_summary_type, s->types, s->size);
+	}
+	memmove(s->types+min+1, s->types+min, (s->count-min)*sizeof(*s->types));
+	s->types[min].type=type;
+	s->types[min].order=*order;
+	s->count++;
+}
+
+static void
+tile_summary_add_item(struct tile_head *th, struct item_bin *ib)
+{
+	struct range all={0,255};
+	/* Submap items are not delivered by navit, the summary of their tile is merged instead */
+	if (ib->type == type_submap)
+		return;
+	tile_summary_add(&th->summary, ib->type, &all);
+	th->summary.items++;
+}
+
+static void
+tile_summary_merge(struct tile_summary *s, struct tile_summary *from, struct range *order)
+{
+	struct range r;
+	int i;
+
+	for (i = 0 ; i < from->count ; i++) {
+		r.min=MAX(from->types[i].order.min, order->min);
+		r.max=MIN(from->types[i].order.max, order->max);
+		if (r.min <= r.max)
+			tile_summary_add(s, from->types[i].type, &r);
+	}
+	s->items+=from->items;
+}
+
+/*
+ * Adds the summary as attr_tile_summary: the number of items, the number of ranges and per range
+ * the first and the last item type and the order range. Adjacent item types with the same order
+ * range share a range.
+ */
+static void
+tile_summary_write(struct tile_summary *s, struct item_bin *ib)
+{
+	int *data=g_new(int, 2+s->count*3),*entry=NULL;
+	int i,count=0;
+	struct tile_summary_type *t;
+
+	for (i = 0 ; i < s->count ; i++) {
+		t=&s->types[i];
+		if (entry && entry[1]+1 == t->type && !memcmp(entry+2, &t->order, sizeof(t->order))) {
+			entry[1]=t->type;
+			continue;
+		}
+		entry=data+2+count*3;
+		entry[0]=t->type;
+		entry[1]=t->type;
+		memcpy(entry+2, &t->order, sizeof(t->order));
+		count++;
+	}
+	data[0]=s->items;
+	data[1]=count;
+	item_bin_add_attr_data(ib, attr_tile_summary, data, (2+count*3)*sizeof(int));
+	g_free(data);
+}
+
+void
+tile_summary_reset(struct tile_head *th)
+{
+	g_free(th->summary.types);
+	memset(&th->summary, 0, sizeof(th->summary));
+}
+
 int
 tile(struct rect *r, char *suffix, char *ret, int max, int overlap, struct rect *tr)
 {
@@ -189,10 +294,7 @@ tile_extend(char *tile, struct item_bin *ib, GList **tiles_list)
 	struct tile_head *th=NULL;
 	if (debug_tile(tile))
 		fprintf(stderr,"Tile:Writing %d bytes to '%s' (%p,%p) 0x%x "LONGLONG_FMT"\n", (ib->len+1)*4, tile, g_hash_table_lookup(tile_hash, tile), tile_hash2 ? g_hash_table_lookup(tile_hash2, tile) : NULL, ib->type, item_bin_get_id(ib));
-	if (tile_hash2)
-		th=g_hash_table_lookup(tile_hash2, tile);
-	if (!th)
-		th=g_hash_table_lookup(tile_hash, tile);
+	th=tile_head_lookup(tile);
 	if (! th) {
 		th=malloc(sizeof(struct tile_head)+ sizeof( char* ) );
 		assert(th != NULL);
@@ -202,6 +304,7 @@ tile_extend(char *tile, struct item_bin *ib, GList **tiles_list)
 		th->total_size_used=0;
 		th->zipnum=0;
 		th->zip_data=NULL;
+		memset(&th->summary, 0, sizeof(th->summary));
 		th->name=string_hash_lookup(tile);
 		*th_get_subtile( th, 0 ) = th->name;
 
@@ -214,6 +317,7 @@ tile_extend(char *tile, struct item_bin *ib, GList **tiles_list)
 			fprintf(stderr,"new '%s'\n", tile);
 	}
 	th->total_size+=ib->len*4+4;
+	tile_summary_add_item(th, ib);
 	if (debug_tile(tile))
 		fprintf(stderr,"New total size of %s(%p):%d\n", th->name, th, th->total_size);
 	g_hash_table_insert(tile_hash, string_hash_lookup( th->name ), th);
@@ -233,6 +337,7 @@ static int
 merge_tile(char *base, char *sub)
 {
 	struct tile_head *thb, *ths;
+	struct range all={0,255};
 	thb=g_hash_table_lookup(tile_hash, base);
 	ths=g_hash_table_lookup(tile_hash, sub);
 	if (! ths)
@@ -251,6 +356,8 @@ merge_tile(char *base, char *sub)
 		memcpy( th_get_subtile( thb, thb->num_subtiles ), th_get_subtile( ths, 0 ), ths->num_subtiles * sizeof( char*) );
 		thb->num_subtiles+=ths->num_subtiles;
 		thb->total_size+=ths->total_size;
+		tile_summary_merge(&thb->summary, &ths->summary, &all);
+		tile_summary_reset(ths);
 		g_hash_table_insert(tile_hash, string_hash_lookup( thb->name ), thb);
 		g_hash_table_remove(tile_hash, sub);
 		g_free(ths);
@@ -313,6 +420,8 @@ write_item(char *tile, struct item_bin *ib, FILE *reference)
 	if (! th)
 		th=g_hash_table_lookup(tile_hash, tile);
 	if (th) {
+		/* The summary of every tile is needed for the submap items, not only of the tiles in this slice */
+		tile_summary_add_item(th, ib);
 		if (debug_itembin(ib)) {
 			fprintf(stderr,"Match %s %d %s\n",tile,th->process,th->name);
 			dump_itembin(ib);
@@ -499,6 +608,7 @@ load_tilesdir(FILE *in)
 		th->total_size_used=0;
 		th->zipnum=zipnum++;
 		th->zip_data=NULL;
+		memset(&th->summary, 0, sizeof(th->summary));
 		th->name=string_hash_lookup(tile);
 #if 0
 		printf("tile '%s' %d\n",tile,size);
@@ -682,7 +792,9 @@ index_submap_add(struct tile_info *info, struct tile_head *th)
 	int len=tlen;
 	char *index_tile;
 	struct rect r;
+	struct range order;
 	struct item_bin *item_bin;
+	struct tile_head *index_th;
 
 	index_tile=g_alloca(len+1+strlen(info->suffix));
 	strcpy(index_tile, th->name);
@@ -694,9 +806,16 @@ index_submap_add(struct tile_info *info, struct tile_head *th)
 	strcat(index_tile, info->suffix);
 	tile_bbox(th->name, &r, overlap);
 
+	order.min=(tlen > 4)?tlen-4 : 0;
+	order.max=255;
 	item_bin=init_item(type_submap);
 	item_bin_add_coord_rect(item_bin, &r);
-	item_bin_add_attr_range(item_bin, attr_order, (tlen > 4)?tlen-4 : 0, 255);
+	item_bin_add_attr_range(item_bin, attr_order, order.min, order.max);
 	item_bin_add_attr_int(item_bin, attr_zipfile_ref, th->zipnum);
+	tile_summary_write(&th->summary, item_bin);
 	tile_write_item_to_tile(info, item_bin, NULL, index_tile);
+	/* Tiles are added longest name first, so the summary of th is complete and the index tile
+	 * is added to its own index only later */
+	if ((index_th=tile_head_lookup(index_tile)))
+		tile_summary_merge(&index_th->summary, &th->summary, &order);
 }
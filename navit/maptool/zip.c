@@ -24,6 +24,15 @@
 #include "maptool.h"
 #include "config.h"
 #include "zipfile.h"
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+/* Members buffered to train the zstd dictionary with before any of them is written */
+#define ZIP_ZSTD_SAMPLES_SIZE (8*1024*1024)
+/* Largest zstd dictionary to train */
+#define ZIP_ZSTD_DICT_SIZE (64*1024)
 
 #ifdef HAVE_LIBCRYPTO
 #include <openssl/sha.h>
@@ -39,6 +48,7 @@ struct zip_info {
 	int dir_size;
 	long long offset;
 	int compression_level;
+	int alignment;
 	int maxnamelen;
 	int zip64;
 	short date;
@@ -51,8 +61,27 @@ struct zip_info {
 	MD5_CTX md5_ctx;
 #endif
 	int md5;
+	int zstd;
+#ifdef HAVE_ZSTD
+	ZSTD_CCtx *zstd_cctx;
+	ZSTD_CDict *zstd_cdict;
+	char *zstd_dict;
+	int zstd_dict_size;
+	int zstd_trained;
+	GList *zstd_samples;
+	int zstd_samples_size;
+#endif
 };
 
+#ifdef HAVE_ZSTD
+struct zip_sample {
+	char *name;
+	int filelen;
+	char *data;
+	int data_size;
+};
+#endif
+
 static int
 zip_write(struct zip_info *info, void *data, int len)
 {
@@ -97,8 +126,8 @@ compress2_int(Byte *dest, uLongf *destLen, const Bytef *source, uLong sourceLen,
 }
 #endif
 
-void
-write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data, int data_size)
+static void
+write_zipmember_do(struct zip_info *zip_info, char *name, int filelen, char *data, int data_size, int compress)
 {
 	struct zip_lfh lfh = {
 		0x04034b50,
@@ -150,11 +179,16 @@ write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data,
 	};
 	unsigned char salt[8], key[34], verify[2], mac[10];
 #endif
+	struct zip_alignment align;
 	char *filename;
-	int crc=0,len,comp_size=data_size;
+	int crc=0,len,comp_size=data_size,align_len=0;
 	uLongf destlen=data_size+data_size/500+12;
 	char *compbuffer;
 
+#ifdef HAVE_ZSTD
+	if (zip_info->zstd)
+		destlen=ZSTD_compressBound(data_size);
+#endif
 	compbuffer = malloc(destlen);
 	if (!compbuffer) {
 	  fprintf(stderr, "No more memory.\n");
@@ -173,9 +207,27 @@ write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data,
 #ifdef HAVE_LIBCRYPTO
 	}
 #endif
-	lfh.zipmthd=zip_info->compression_level ? 8:0;
+	lfh.zipmthd=compress && zip_info->compression_level ? 8:0;
+#ifdef HAVE_ZSTD
+	if (lfh.zipmthd && zip_info->zstd) {
+		size_t size;
+		if (zip_info->zstd_cdict)
+			size=ZSTD_compress_usingCDict(zip_info->zstd_cctx, compbuffer, destlen, data, data_size, zip_info->zstd_cdict);
+		else
+			size=ZSTD_compressCCtx(zip_info->zstd_cctx, compbuffer, destlen, data, data_size, zip_info->compression_level);
+		if (ZSTD_isError(size)) {
+			fprintf(stderr,"ZSTD_compress returned %s\n", ZSTD_getErrorName(size));
+			lfh.zipmthd=0;
+		} else if (size < data_size) {
+			lfh.zipmthd=zip_zstd_method;
+			data=compbuffer;
+			comp_size=size;
+		} else
+			lfh.zipmthd=0;
+	}
+#endif
 #ifdef HAVE_ZLIB
-	if (zip_info->compression_level) {
+	if (lfh.zipmthd == 8) {
 		int error=compress2_int((Byte *)compbuffer, &destlen, (Bytef *)data, data_size, zip_info->compression_level);
 		if (error == Z_OK) {
 			if (destlen < data_size) {
@@ -222,9 +274,24 @@ write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data,
 		filename[len++]='_';
 	}
 	filename[filelen]='\0';
+	if (zip_info->alignment > 1 && lfh.zipmthd == 0) {
+		long long offset=zip_info->offset+sizeof(lfh)+filelen+sizeof(align);
+		align.tag=zip_alignment_tag;
+		align.size=(zip_info->alignment-offset%zip_info->alignment)%zip_info->alignment;
+		align_len=sizeof(align)+align.size;
+		lfh.zipxtraln+=align_len;
+	}
 	zip_write(zip_info, &lfh, sizeof(lfh));
 	zip_write(zip_info, filename, filelen);
 	zip_info->offset+=sizeof(lfh)+filelen;
+	if (align_len) {
+		static char padding[64];
+		int size;
+		zip_write(zip_info, &align, sizeof(align));
+		for (size=align.size ; size > 0 ; size-=(int)sizeof(padding))
+			zip_write(zip_info, padding, MIN(size, (int)sizeof(padding)));
+		zip_info->offset+=align_len;
+	}
 #ifdef HAVE_LIBCRYPTO
 	if (zip_info->passwd) {
 		unsigned char counter[16], xor[16], *datap=(unsigned char *)data;
@@ -279,12 +346,86 @@ write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data,
 	free(compbuffer);
 }
 
+#ifdef HAVE_ZSTD
+static void
+zip_zstd_train(struct zip_info *info)
+{
+	GList *l;
+	struct zip_sample *sample;
+	size_t *sizes,size;
+	char *samples;
+	int count=0,pos=0;
+
+	info->zstd_samples=g_list_reverse(info->zstd_samples);
+	samples=g_malloc(info->zstd_samples_size);
+	sizes=g_new(size_t, g_list_length(info->zstd_samples));
+	for (l = info->zstd_samples ; l ; l = g_list_next(l)) {
+		sample=l->data;
+		memcpy(samples+pos, sample->data, sample->data_size);
+		pos+=sample->data_size;
+		sizes[count++]=sample->data_size;
+	}
+	info->zstd_dict=g_malloc(ZIP_ZSTD_DICT_SIZE);
+	size=ZDICT_trainFromBuffer(info->zstd_dict, ZIP_ZSTD_DICT_SIZE, samples, sizes, count);
+	if (ZDICT_isError(size)) {
+		fprintf(stderr,"Unable to train zstd dictionary from %d members (%s), compressing without\n", count, ZDICT_getErrorName(size));
+		g_free(info->zstd_dict);
+		info->zstd_dict=NULL;
+	} else {
+		info->zstd_dict_size=size;
+		info->zstd_cdict=ZSTD_createCDict(info->zstd_dict, size, info->compression_level);
+	}
+	g_free(sizes);
+	g_free(samples);
+	info->zstd_trained=1;
+	for (l = info->zstd_samples ; l ; l = g_list_next(l)) {
+		sample=l->data;
+		write_zipmember_do(info, sample->name, sample->filelen, sample->data, sample->data_size, 1);
+		g_free(sample->name);
+		g_free(sample->data);
+		g_free(sample);
+	}
+	g_list_free(info->zstd_samples);
+	info->zstd_samples=NULL;
+	info->zstd_samples_size=0;
+}
+#endif
+
+void
+write_zipmember(struct zip_info *zip_info, char *name, int filelen, char *data, int data_size)
+{
+#ifdef HAVE_ZSTD
+	/* The dictionary is trained from the first members, so they are held back until it is ready */
+	if (zip_info->zstd && !zip_info->zstd_trained) {
+		struct zip_sample *sample=g_new(struct zip_sample, 1);
+		sample->name=g_strdup(name);
+		sample->filelen=filelen;
+		sample->data=g_memdup(data, data_size);
+		sample->data_size=data_size;
+		zip_info->zstd_samples=g_list_prepend(zip_info->zstd_samples, sample);
+		zip_info->zstd_samples_size+=data_size;
+		if (zip_info->zstd_samples_size >= ZIP_ZSTD_SAMPLES_SIZE)
+			zip_zstd_train(zip_info);
+		return;
+	}
+#endif
+	write_zipmember_do(zip_info, name, filelen, data, data_size, 1);
+}
+
 void
 zip_write_index(struct zip_info *info)
 {
 	int size=ftell(info->index);
 	char *buffer;
 
+#ifdef HAVE_ZSTD
+	if (info->zstd && !info->zstd_trained)
+		zip_zstd_train(info);
+	if (info->zstd_dict) {
+		write_zipmember_do(info, zip_zstd_dictionary, info->maxnamelen, info->zstd_dict, info->zstd_dict_size, 0);
+		info->zipnum++;
+	}
+#endif
 	buffer=g_alloca(size);
 	fseek(info->index, 0, SEEK_SET);
 	fread(buffer, size, 1, info->index);
@@ -397,6 +538,25 @@ zip_set_compression_level(struct zip_info *info, int level)
 	info->compression_level=level;
 }
 
+int
+zip_set_zstd(struct zip_info *info, int on)
+{
+#ifdef HAVE_ZSTD
+	info->zstd=on;
+	if (on && !info->zstd_cctx)
+		info->zstd_cctx=ZSTD_createCCtx();
+	return 1;
+#else
+	return !on;
+#endif
+}
+
+void
+zip_set_alignment(struct zip_info *info, int alignment)
+{
+	info->alignment=alignment;
+}
+
 void
 zip_set_maxnamelen(struct zip_info *info, int max)
 {
@@ -479,5 +639,10 @@ zip_close(struct zip_info *info)
 void
 zip_destroy(struct zip_info *info)
 {
+#ifdef HAVE_ZSTD
+	ZSTD_freeCDict(info->zstd_cdict);
+	ZSTD_freeCCtx(info->zstd_cctx);
+	g_free(info->zstd_dict);
+#endif
 	g_free(info);
 }
@@ -320,6 +320,11 @@ static void
 navit_redraw_route(struct navit *this_, struct route *route, struct attr *attr)
 {
 	int updated;
+	if (attr->type == attr_alternatives || attr->type == attr_isochrones) {
+		if (this_->ready == 3)
+			navit_draw(this_);
+		return;
+	}
 	if (attr->type != attr_route_status)
 		return;
 	updated=attr->u.num;
@@ -1243,6 +1248,93 @@ navit_cmd_route_remove_last_waypoint(struct navit *this, char *function, struct
 }
 
 
+/**
+ * Calculate travel times and distances between several sources and destinations
+ *
+ * @param navit The navit instance
+ * @param function unused (needed to match command function signature)
+ * @param in input attributes in[0] - number of sources, followed by the coordinates of the sources and then
+ * the coordinates of the destinations
+ * @param out output attributes, a {@code destination_time} (in tenths of seconds) and a {@code destination_length}
+ * (in meters) for each pair, ordered by source and then by destination. Both are -1 if there is no route.
+ * @param valid unused
+ * @returns nothing
+ */
+static void
+navit_cmd_route_matrix(struct navit *this, char *function, struct attr **in, struct attr ***out, int *valid)
+{
+	struct pcoord *pc=NULL;
+	struct attr attr;
+	int *times,*distances;
+	int i,src_count,count=0;
+
+	if (!this->route || !in || !in[0] || !ATTR_IS_INT(in[0]->type) || !out)
+		return;
+	src_count=in[0]->u.num;
+	in++;
+	while (in && in[0]) {
+		pc=g_renew(struct pcoord, pc, count+1);
+		in=navit_get_coord(this, in, &pc[count]);
+		if (in)
+			count++;
+	}
+	if (src_count <= 0 || src_count >= count) {
+		dbg(lvl_error,"%d coordinates are not enough for %d sources\n", count, src_count);
+		g_free(pc);
+		return;
+	}
+	times=g_new(int, src_count*(count-src_count));
+	distances=g_new(int, src_count*(count-src_count));
+	route_get_matrix(this->route, pc, src_count, pc+src_count, count-src_count, times, distances);
+	for (i = 0 ; i < src_count*(count-src_count) ; i++) {
+		attr.type=attr_destination_time;
+		attr.u.num=times[i];
+		*out=attr_generic_add_attr(*out, &attr);
+		attr.type=attr_destination_length;
+		attr.u.num=distances[i];
+		*out=attr_generic_add_attr(*out, &attr);
+	}
+	g_free(times);
+	g_free(distances);
+	g_free(pc);
+}
+
+
+/**
+ * Show the areas reachable from a location within several time budgets
+ *
+ * @param navit The navit instance
+ * @param function unused (needed to match command function signature)
+ * @param in input attributes in[0] - the location, followed by the time budgets in minutes. Without
+ * time budgets, the areas shown before are removed. The areas are computed in the background and
+ * drawn once they are found.
+ * @param out unused
+ * @param valid unused
+ * @returns nothing
+ */
+static void
+navit_cmd_route_isochrone(struct navit *this, char *function, struct attr **in, struct attr ***out, int *valid)
+{
+	struct pcoord pc;
+	int *budgets=NULL;
+	int count=0;
+
+	if (!this->route)
+		return;
+	in=navit_get_coord(this, in, &pc);
+	if (!in)
+		return;
+	while (in[0] && ATTR_IS_INT(in[0]->type)) {
+		budgets=g_renew(int, budgets, count+1);
+		budgets[count++]=in[0]->u.num*600;
+		in++;
+	}
+	route_set_isochrone(this->route, &pc, budgets, count);
+	g_free(budgets);
+	navit_draw(this);
+}
+
+
 static void
 navit_cmd_set_center(struct navit *this, char *function, struct attr **in, struct attr ***out, int *valid)
 {
@@ -1388,6 +1480,8 @@ static struct command_table commands[] = {
 	{"set_position",command_cast(navit_cmd_set_position)},
 	{"route_remove_next_waypoint",command_cast(navit_cmd_route_remove_next_waypoint)},
 	{"route_remove_last_waypoint",command_cast(navit_cmd_route_remove_last_waypoint)},
+	{"route_matrix",command_cast(navit_cmd_route_matrix)},
+	{"route_isochrone",command_cast(navit_cmd_route_isochrone)},
 	{"set_position",command_cast(navit_cmd_set_position)},
 	{"announcer_toggle",command_cast(navit_cmd_announcer_toggle)},
 	{"fmt_coordinates",command_cast(navit_cmd_fmt_coordinates)},
@@ -2115,6 +2209,18 @@ navit_init(struct navit *this_)
 				mapset_add_attr(ms, &map_a);
 				map_set_attr(map, &active);
 			}
+			if ((map=route_get_alternatives_map(this_->route))) {
+				struct attr map_a;
+				map_a.type=attr_map;
+				map_a.u.map=map;
+				mapset_add_attr(ms, &map_a);
+			}
+			if ((map=route_get_isochrone_map(this_->route))) {
+				struct attr map_a;
+				map_a.type=attr_map;
+				map_a.u.map=map;
+				mapset_add_attr(ms, &map_a);
+			}
 			route_set_mapset(this_->route, ms);
 			route_set_projection(this_->route, transform_get_projection(this_->trans));
 		}
@@ -2152,7 +2258,7 @@ navit_init(struct navit *this_)
 	}
 	if (this_->route) {
 		struct attr callback;
-		this_->route_cb=callback_new_attr_1(callback_cast(navit_redraw_route), attr_route_status, this_);
+		this_->route_cb=callback_new_attr_1(callback_cast(navit_redraw_route), attr_any, this_);
 		callback.type=attr_callback;
 		callback.u.callback=this_->route_cb;
 		route_add_attr(this_->route, &callback);
@@ -43,14 +43,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 #if 0
 #include <assert.h>
 #include <unistd.h>
-#include <sys/time.h>
 #endif
 #include "navit_nls.h"
 #include "glib_slice.h"
 #include "config.h"
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #include "point.h"
 #include "graphics.h"
 #include "profile.h"
@@ -64,13 +68,20 @@
 #include "track.h"
 #include "transform.h"
 #include "plugin.h"
-#include "fib.h"
+#include "routeheap.h"
+#include "routeorder.h"
+#include "streetindex.h"
+#include "speedprofile.h"
 #include "event.h"
 #include "callback.h"
 #include "vehicle.h"
 #include "vehicleprofile.h"
 #include "roadprofile.h"
 #include "debug.h"
+#include "file.h"
+#include "types.h"
+#include "navit.h"
+#include "routech.h"
 
 struct map_priv {
 	struct route *route;
@@ -85,15 +96,14 @@ int debug_route=0;
  * but there are also points which don't do that (e.g. at the end of a dead-end).
  */
 struct route_graph_point {
-	struct route_graph_point *hash_next; /**< Pointer to a chained hashlist of all route_graph_points with this hash */
 	struct route_graph_segment *start;	 /**< Pointer to a list of segments of which this point is the start. The links 
 										  *  of this linked-list are in route_graph_segment->start_next.*/
 	struct route_graph_segment *end;	 /**< Pointer to a list of segments of which this pointer is the end. The links
 										  *  of this linked-list are in route_graph_segment->end_next. */
 	struct route_graph_segment *seg;	 /**< Pointer to the segment one should use to reach the destination at
 										  *  least costs */
-	struct fibheap_el *el;				 /**< When this point is put on a Fibonacci heap, this is a pointer
-										  *  to this point's heap-element */
+	void *el;							 /**< Handle of this point while it is queued on a route heap,
+										  *  {@code NULL} otherwise */
 	int value;							 /**< The cost at which one can reach the destination from this point on */
 	struct coord c;						 /**< Coordinates of this point */
 	int flags;						/**< Flags for this point (eg traffic distortion) */
@@ -102,6 +112,103 @@ struct route_graph_point {
 #define RP_TRAFFIC_DISTORTION 1
 #define RP_TURN_RESTRICTION 2
 #define RP_TURN_RESTRICTION_RESOLVED 4
+#define RP_FLOOD_TARGET 8
+
+#define RS_ALTERNATIVE_PENALTY 1
+
+/**
+ * Percentage of the straight-line travel time used as the A* estimate. Segment lengths are summed
+ * over their polylines with a per-segment Mercator scale, so the estimate is kept slightly below
+ * the exact bound in order to remain admissible over long distances.
+ */
+#define ROUTE_ASTAR_ESTIMATE_PERCENT 90
+
+/**
+ * Minimum straight-line distance in meters between position and destination for the contraction
+ * hierarchy to be used. Shorter routes are computed on the route graph, which is cheap for them and
+ * knows about traffic distortions and turn restrictions.
+ */
+#define ROUTE_CH_MIN_DISTANCE 10000
+
+/**
+ * Grid the rectangles of the route graph selection are aligned to if the graph cache is enabled.
+ * Small changes of the position then lead to the same selection, so the cached graph can be used.
+ */
+#define ROUTE_GRAPH_CACHE_GRID 4096
+
+/**
+ * Penalty in percent on segments of already found paths while searching for alternative routes.
+ */
+#define ROUTE_ALTERNATIVE_PENALTY_PERCENT 40
+
+/**
+ * Time in milliseconds after which the search for alternative routes returns to the main loop. At
+ * least one flood is done per step.
+ */
+#define ROUTE_ALTERNATIVE_STEP_TIME 50
+
+/**
+ * An alternative route may share at most this percentage of its length with any other route.
+ */
+#define ROUTE_ALTERNATIVE_MAX_SHARED_PERCENT 70
+
+/**
+ * An alternative route may take at most this percentage of the time of the best route.
+ */
+#define ROUTE_ALTERNATIVE_MAX_STRETCH_PERCENT 140
+
+/**
+ * {@code id_hi} of the items of route graph segments which represent a {@code struct route_traffic}.
+ * {@code id_lo} holds the id of the distortion.
+ */
+#define ROUTE_TRAFFIC_ID_HI 0x7fffffff
+
+/**
+ * Interval in milliseconds at which traffic distortions are expired and the traffic file is checked
+ */
+#define ROUTE_TRAFFIC_INTERVAL 5000
+
+#define ROUTE_GRAPH_CACHE_MAGIC "NRGC"
+#define ROUTE_GRAPH_CACHE_VERSION 4
+
+/**
+ * Number of sectors around the center of an isochrone. The outline of an isochrone runs through the
+ * farthest reachable location within each sector.
+ */
+#define ROUTE_ISOCHRONE_SECTORS 72
+
+/**
+ * Turns which change the heading by at most this much (in 1/256 of a full circle, i.e. about 22
+ * degrees) count as going straight on and carry no turn costs.
+ */
+#define ROUTE_TURN_STRAIGHT 16
+
+/**
+ * Number of points a flood on a route worker settles between checks for cancellation
+ */
+#define ROUTE_WORKER_CHECK 4096
+
+/**
+ * Interval in milliseconds at which the main loop checks the progress of a route worker
+ */
+#define ROUTE_WORKER_POLL 50
+
+/**
+ * Number of orders for which a simplified route path geometry is kept, the route map returns the
+ * full geometry at higher orders
+ */
+#define ROUTE_GEOMETRY_LEVELS 13
+
+/**
+ * Maximum number of coordinates of an item of simplified route path geometry
+ */
+#define ROUTE_GEOMETRY_CHUNK 256
+
+/**
+ * Number of orders by which route_selection_degrade() lowers the selection of a route graph
+ * which exceeds its memory budget
+ */
+#define ROUTE_DEGRADE_STEP 2
 
 /**
  * @brief A segment in the route graph or path
@@ -143,6 +250,27 @@ struct route_graph_segment_data {
 	int maxspeed;
 	struct size_weight_limit size_weight;
 	int dangerous_goods;
+	unsigned char start_dir;
+	unsigned char end_dir;
+};
+
+/**
+ * @brief Cost of driving a route graph segment in one direction, for floods with turn costs
+ *
+ * If the vehicle profile has turn costs, the cost of going on from a point depends on the segment
+ * the point was reached over, so the floods label the segments instead of the points, see
+ * route_graph_turn_labels(). Each segment has two labels, the first one for driving it in the order
+ * of its points, the second one for driving it the other way.
+ */
+struct route_graph_turn_label {
+	void *el;				/**< Handle of this label while it is queued on a route heap, {@code NULL} otherwise */
+	int value;				/**< Cost of driving the segment and on to the destination, or for a forward
+						 *  flood, of getting from the start to the end of the segment */
+	int dst;				/**< Set if {@code value} is that of the destination on the segment itself */
+	int cost;				/**< Cost of driving the segment in this direction, -1 if not known yet,
+						 *  see route_graph_turn_label_cost() */
+	int weight;				/**< Route weight of the road profile of the segment, -1 if not known yet */
+	struct route_graph_segment *seg;	/**< The segment */
 };
 
 /**
@@ -158,6 +286,13 @@ struct route_graph_segment {
 												 *  same point. Start of this list is in route_graph_point->end. */
 	struct route_graph_point *start;			/**< Pointer to the point this segment starts at. */
 	struct route_graph_point *end;				/**< Pointer to the point this segment ends at. */
+	unsigned char start_dir;				/**< Heading in which the segment leaves its start point, see route_heading() */
+	unsigned char end_dir;					/**< Heading in which the segment arrives at its end point */
+	unsigned short speed_profile;				/**< Historic speed profile of the segment plus one, 0 if it has none,
+								 *  see route_graph_set_speed_profiles() */
+	unsigned short flags;					/**< Flags for this segment, see {@code RS_ALTERNATIVE_PENALTY} */
+	struct route_graph_turn_label *labels;			/**< The two labels of this segment if the graph was flooded with turn costs,
+								 *  {@code NULL} otherwise */
 	struct route_segment_data data;				/**< The segment data */
 };
 
@@ -178,6 +313,55 @@ struct route_traffic_distortion {
 	int delay;					/**< Delay in tenths of seconds (0 for no delay) */
 };
 
+/**
+ * @brief A traffic distortion set on a route which is in use
+ *
+ * Unlike traffic distortion items from a map, these can be added, changed and removed at any time.
+ * They are kept in the route and applied to every route graph built for it.
+ */
+struct route_traffic {
+	int id;						/**< Identifier chosen by the supplier of the distortion */
+	struct coord start;				/**< Start of the segment the distortion applies to */
+	struct coord end;				/**< End of the segment the distortion applies to */
+	int delay;					/**< Delay in tenths of seconds */
+	int maxspeed;					/**< Maximum speed in km/h, {@code INT_MAX} for none */
+	time_t expires;					/**< Time at which the distortion is removed, 0 for never */
+	int file;					/**< Set if the distortion was read from the traffic file */
+	int seen;					/**< Set while reading the traffic file if the distortion is still in it */
+};
+
+#ifdef HAVE_PTHREAD
+/**
+ * @brief A thread computing the route path of a route
+ *
+ * The worker gets copies of everything it reads from the route, including instances of its own of the
+ * maps, so the main loop is free to change the route and to read the maps meanwhile. Only the fields
+ * protected by {@code mutex} are shared while it runs.
+ */
+struct route_worker {
+	pthread_t thread;				/**< The thread */
+	pthread_mutex_t mutex;				/**< Protects {@code cancel}, {@code progress} and {@code finished} */
+	int cancel;					/**< Set to make the worker stop */
+	int progress;					/**< Progress in percent */
+	int finished;					/**< Set when the worker is done */
+	int traffic_changed;				/**< Set on the main loop if traffic distortions changed meanwhile */
+	int phase_base;					/**< Progress at the start of the current phase, used by the worker only */
+	int phase_span;					/**< Share of the current phase in the progress, used by the worker only */
+	GHashTable *maps;				/**< Instances of their own of the maps the graph refers to, by the map of the route */
+	struct vehicleprofile *profile;			/**< Copy of the vehicle profile */
+	struct route_info *pos;				/**< Copy of the position */
+	GList *destinations;				/**< Copies of the destinations */
+	GList *traffic;					/**< Copies of the traffic distortions */
+	struct speed_profiles *speed_profiles;		/**< Historic speeds of the streets, or NULL */
+	int departure_time;				/**< Time of departure */
+	struct route_graph *graph;			/**< The route graph, built on the main loop beforehand */
+	struct route_path *path;			/**< The route path computed */
+	int current_dst;				/**< Index of the destination the graph was flooded for last */
+	struct callback *poll_cb;			/**< Callback to check the worker from the main loop */
+	struct event_timeout *poll;			/**< Timeout to call {@code poll_cb} */
+};
+#endif
+
 /**
  * @brief A segment in the route path
  *
@@ -229,6 +413,64 @@ struct route_path {
 	/* XXX: path_hash is not necessery now */
 	struct item_hash *path_hash;				/**< A hashtable of all the items represented by this route's segements */
 	struct route_path *next;				/**< Next route path in case of intermediate destinations */	
+	struct route_path_geometry *geometry;			/**< Simplified geometry, created when first needed */
+};
+
+/**
+ * @brief The geometry of a route path, simplified for each order up to {@code ROUTE_GEOMETRY_LEVELS}
+ *
+ * At each order, coordinates are dropped as long as the path does not move by more than half
+ * a pixel.
+ */
+struct route_path_geometry {
+	struct coord *c[ROUTE_GEOMETRY_LEVELS];			/**< The coordinates of the whole path for each order */
+	int count[ROUTE_GEOMETRY_LEVELS];			/**< Number of coordinates for each order */
+};
+
+/**
+ * @brief The area reachable from a location within a time budget
+ *
+ * The area is approximated by a polygon which is star-shaped around the location.
+ */
+struct route_isochrone {
+	int in_use;						/**< Number of references from the route and from map rects */
+	int budget;						/**< Time budget in tenths of seconds */
+	int count;						/**< Number of vertices */
+	struct coord c[0];					/**< Vertices of the outline in {@code projection_mg} */
+};
+
+/**
+ * @brief The reordering of the waypoints started by route_destinations_optimize()
+ */
+struct route_destinations_optimization {
+	struct route *route;					/**< The route whose waypoints are reordered */
+	struct route_graph *graph;				/**< The graph the travel times are computed on, NULL until
+								 *  route_graph_build() returned */
+	struct route_info **info;				/**< Copies of the position and the intermediate waypoints,
+								 *  followed by copies of all waypoints */
+	int count;						/**< Number of waypoints */
+	int *times;						/**< Travel times from each source to each waypoint */
+	int *distances;						/**< Lengths of these routes */
+	int next;						/**< The waypoint to flood the graph from next */
+	int built;						/**< Set if the graph was built before {@code graph} was set */
+	struct callback *done_cb;				/**< Callback when the graph is built */
+	struct callback *idle_cb;				/**< Callback to flood the graph from one waypoint after the other */
+	struct event_idle *idle;				/**< The idle event for {@code idle_cb} */
+};
+
+/**
+ * @brief The computation of isochrones started by route_set_isochrone()
+ */
+struct route_isochrone_build {
+	struct route *route;					/**< The route the isochrones are added to */
+	struct route_graph *graph;				/**< The graph being built, NULL until route_graph_build_selection() returned */
+	struct route_info *pos;					/**< The street the isochrones start at */
+	enum projection pro;					/**< The projection of {@code pos} */
+	int *budgets;						/**< The time budgets in tenths of seconds */
+	int count;						/**< Number of time budgets */
+	int limit;						/**< The largest time budget */
+	int done;						/**< Set if the graph was built before {@code graph} was set */
+	struct callback *done_cb;				/**< Callback when the graph is built */
 };
 
 /**
@@ -258,6 +500,32 @@ struct route {
 	int link_path;			/**< Link paths over multiple waypoints together */
 	struct pcoord pc;
 	struct vehicle *v;
+	int graph_cache;		/**< Store route graphs in a cache file and reuse them if possible */
+	int graph_build_threads;	/**< Number of threads to read the maps with when building the graph, 1 or less to
+					 *  build the graph on the main loop */
+	GList *traffic;			/**< Traffic distortions set while the route is in use, see route_set_traffic_distortion() */
+	char *traffic_file;		/**< File to read traffic distortions from, or NULL */
+	time_t traffic_file_mtime;	/**< Modification time of {@code traffic_file} when it was last read */
+	struct callback *traffic_cb;	/**< Callback to expire traffic distortions and poll {@code traffic_file} */
+	struct event_timeout *traffic_timeout; /**< Timeout event for {@code traffic_cb} */
+	int alternatives_max;		/**< Number of alternative routes to search for */
+	GList *alternatives;		/**< Alternative route paths to the destination */
+	struct callback *alternatives_cb; /**< Callback to compute the alternative routes */
+	struct event_idle *alternatives_idle; /**< Idle event to compute the alternative routes */
+	struct route_alternatives_search *alternatives_search; /**< The running search for alternative routes, or NULL */
+	struct map *alternatives_map;	/**< Map of the alternative routes, see route_get_alternatives_map() */
+	int optimize_waypoints;		/**< Time in milliseconds to spend on reordering the intermediate waypoints
+					 *  when destinations are set, 0 to keep their order */
+	struct route_destinations_optimization *optimization; /**< The running reordering of the waypoints, or NULL */
+	GList *isochrones;		/**< Areas computed by route_set_isochrone(), largest budget first */
+	struct route_isochrone_build *isochrone_build; /**< The running computation of isochrones, or NULL */
+	struct map *isochrone_map;
+	struct speed_profiles *speed_profiles;	/**< Historic speeds of the streets, or NULL */
+	int departure_time;		/**< Time of departure in seconds since the epoch, 0 to depart now */
+	int route_worker;		/**< Compute routes on a background thread, see route_worker_start() */
+	struct route_worker *worker;	/**< The thread computing the route, or NULL */
+	int progress;			/**< Progress of the route computation in percent */
+	int graph_memory_budget;	/**< Memory in kB the route graph may use, 0 for no limit, see route_selection_degrade() */
 };
 
 /**
@@ -268,6 +536,7 @@ struct route {
 struct route_graph {
 	int busy;					/**< The graph is being built */
 	struct map_selection *sel;			/**< The rectangle selection for the graph */
+	struct coord_rect rect;				/**< Bounding rectangle of the selection the graph was built from */
 	struct mapset_handle *h;			/**< Handle to the mapset */	
 	struct map *m;					/**< Pointer to the currently active map */	
 	struct map_rect *mr;				/**< Pointer to the currently active map rectangle */
@@ -277,11 +546,42 @@ struct route_graph {
 	struct event_idle *idle_ev;			/**< The pointer to the idle event */
    	struct route_graph_segment *route_segments; /**< Pointer to the first route_graph_segment in the linked list of all segments */
 	struct route_graph_segment *avoid_seg;
-#define HASH_SIZE 8192
-	struct route_graph_point *hash[HASH_SIZE];	/**< A hashtable containing all route_graph_points in this graph */
+	int max_maxspeed;				/**< Highest maxspeed of any segment or traffic distortion in this graph, -1 if none */
+	int flood_partial;				/**< Set if the last flood stopped before covering the whole graph */
+	int floods;					/**< Number of times the costs were reset or repaired, to notice changes */
+	struct item flood_item;				/**< The street the last partial flood was directed at */
+	struct item position_item;			/**< The street route_graph_add_position() last read the map for */
+	int ch;						/**< Set if the path was computed with the contraction hierarchy,
+							 *  the graph is an empty placeholder in this case */
+	struct mapset *ms;				/**< The mapset the graph is built from */
+	char *cache_key;				/**< Key to store the graph in the graph cache with, or NULL */
+	struct route_graph_build_workers *workers;	/**< Threads reading the maps, NULL if the graph is built on the main loop */
+	struct route_graph_point **point_blocks;	/**< Blocks of {@code ROUTE_GRAPH_POINT_BLOCK_SIZE} points each,
+							 *  points are stored in the order they were created */
+	int point_count;				/**< Number of points in this graph */
+	struct route_graph_point **point_index;		/**< Open addressing index from coordinates to points */
+	int point_index_size;				/**< Number of slots in {@code point_index}, a power of two */
+	int point_lookups;				/**< Number of lookups in {@code point_index} */
+	int point_probes;				/**< Number of slots examined by these lookups */
+	int point_probe_max;				/**< Longest probe sequence of a lookup */
+	struct speed_profiles *speed_profiles;		/**< Speed profiles assigned to the segments, or NULL */
+	int departure;					/**< Time of departure in seconds since the start of the week,
+							 *  see speed_profiles_week_time() */
+	struct route_worker *worker;			/**< The thread the graph is flooded on, NULL for the main loop.
+							 *  Items are read through the maps of the worker then. */
+	struct route_graph_turn_label *turn_labels;	/**< Labels of all segments if the last flood had turn costs, NULL otherwise */
+	int turn_label_count;				/**< Number of labels in {@code turn_labels} */
+	long memory;					/**< Bytes allocated for points, segments, the point index and the labels */
+	long heap_memory;				/**< Bytes allocated by the priority queue of the last flood */
+	long memory_budget;				/**< Bytes {@code memory} may grow to while building, 0 for no limit */
+	int async;					/**< Set if the graph is built from idle events */
+	int threads;					/**< Number of threads to read the maps with */
 };
 
-#define HASHCOORD(c) ((((c)->x +(c)->y) * 2654435761UL) & (HASH_SIZE-1))
+#define ROUTE_GRAPH_POINT_BLOCK_SIZE 1024
+#define ROUTE_GRAPH_POINT(g,i) (&(g)->point_blocks[(i)/ROUTE_GRAPH_POINT_BLOCK_SIZE][(i)%ROUTE_GRAPH_POINT_BLOCK_SIZE])
+#define ROUTE_GRAPH_POINT_INDEX_MIN 4096
+#define HASHCOORD(c,size) (route_graph_hash_coord(c) & ((size)-1))
 
 /**
  * @brief Iterator to iterate through all route graph segments in a route graph point
@@ -310,8 +610,26 @@ static void route_process_street_graph(struct route_graph *this, struct item *it
 static void route_graph_destroy(struct route_graph *this);
 static void route_path_update(struct route *this, int cancel, int async);
 static int route_time_seg(struct vehicleprofile *profile, struct route_segment_data *over, struct route_traffic_distortion *dist);
-static void route_graph_flood(struct route_graph *this, struct route_info *dst, struct vehicleprofile *profile, struct callback *cb);
+static void route_graph_flood(struct route_graph *this, struct route_info *dst, struct route_info *pos, struct vehicleprofile *profile, struct callback *cb);
 static void route_graph_reset(struct route_graph *this);
+static int route_ch_usable(struct vehicleprofile *profile);
+static int route_path_update_ch(struct route *this);
+static void route_graph_cache_save(struct route_graph *this);
+static void route_alternatives_schedule(struct route *this);
+static void route_alternatives_clear(struct route *this);
+static double route_benchmark_elapsed(struct timeval *start);
+static int route_graph_add_position(struct route_graph *this, struct route_info *pos, struct vehicleprofile *profile, GList *traffic);
+static void route_graph_process_item(struct route_graph *rg, struct item *item, struct vehicleprofile *profile);
+static void route_graph_process_restriction_point(struct route_graph *this, struct route_graph_point *p);
+static void route_traffic_start(struct route *this);
+static void route_isochrone_unref(struct route_isochrone *iso);
+static void route_isochrone_build_cancel(struct route *this);
+static void route_destinations_optimize(struct route *this, int async);
+static void route_destinations_optimize_cancel(struct route *this);
+#ifdef HAVE_PTHREAD
+static int route_worker_check(struct route_worker *w, int progress);
+static void route_worker_cancel(struct route *this);
+#endif
 
 
 /**
@@ -449,6 +767,13 @@ route_path_destroy(struct route_path *this, int recurse)
 			item_hash_destroy(this->path_hash);
 			this->path_hash=NULL;
 		}
+		if (this->geometry) {
+			int i;
+			for (i = 0 ; i < ROUTE_GEOMETRY_LEVELS ; i++)
+				g_free(this->geometry->c[i]);
+			g_free(this->geometry);
+			this->geometry=NULL;
+		}
 		c=this->path;
 		while (c) {
 			n=c->next;
@@ -464,6 +789,57 @@ route_path_destroy(struct route_path *this, int recurse)
 	}
 }
 
+/**
+ * @brief Returns the simplified geometry of a route path, creating it if needed
+ *
+ * Each order is simplified from the next higher one, so the total work is little more than
+ * simplifying the full geometry once.
+ *
+ * @param this The route path
+ * @return The geometry
+ */
+static struct route_path_geometry *
+route_path_get_geometry(struct route_path *this)
+{
+	struct route_path_geometry *ret;
+	struct route_path_segment *seg;
+	struct coord *c,*in;
+	int i,count=0,in_count,tolerance;
+
+	if (this->geometry)
+		return this->geometry;
+	for (seg=this->path ; seg ; seg=seg->next)
+		count+=seg->ncoords;
+	c=g_new(struct coord, count);
+	count=0;
+	for (seg=this->path ; seg ; seg=seg->next) {
+		i=0;
+		/* consecutive segments share their end points */
+		if (count && seg->ncoords && seg->c[0].x == c[count-1].x && seg->c[0].y == c[count-1].y)
+			i=1;
+		for ( ; i < seg->ncoords ; i++)
+			c[count++]=seg->c[i];
+	}
+	ret=g_new0(struct route_path_geometry, 1);
+	in=c;
+	in_count=count;
+	for (i = ROUTE_GEOMETRY_LEVELS-1 ; i >= 0 ; i--) {
+		/* At order 14 one pixel is about one unit of the map projection, each order below doubles it */
+		tolerance=1 << (13-i);
+		ret->c[i]=g_new(struct coord, in_count);
+		/* Routes span far more than the 32767 units the integer distances work with */
+		ret->count[i]=transform_douglas_peucker_float(in, in_count, (navit_float)tolerance*tolerance, ret->c[i]);
+		ret->c[i]=g_renew(struct coord, ret->c[i], ret->count[i]);
+		in=ret->c[i];
+		in_count=ret->count[i];
+	}
+	dbg(lvl_debug,"%d coordinates, %d at order %d, %d at order 0\n", count, ret->count[ROUTE_GEOMETRY_LEVELS-1],
+		ROUTE_GEOMETRY_LEVELS-1, ret->count[0]);
+	g_free(c);
+	this->geometry=ret;
+	return ret;
+}
+
 /**
  * @brief Creates a completely new route structure
  *
@@ -484,6 +860,24 @@ route_new(struct attr *parent, struct attr **attrs)
 	} else {
 		this->destination_distance = 50; // Default value
 	}
+	if (attr_generic_get_attr(attrs, NULL, attr_graph_cache, &dest_attr, NULL))
+		this->graph_cache = dest_attr.u.num;
+	if (attr_generic_get_attr(attrs, NULL, attr_graph_build_threads, &dest_attr, NULL))
+		this->graph_build_threads = dest_attr.u.num;
+	if (attr_generic_get_attr(attrs, NULL, attr_alternatives, &dest_attr, NULL))
+		this->alternatives_max = dest_attr.u.num;
+	if (attr_generic_get_attr(attrs, NULL, attr_optimize_waypoints, &dest_attr, NULL))
+		this->optimize_waypoints = dest_attr.u.num;
+	if (attr_generic_get_attr(attrs, NULL, attr_traffic_file, &dest_attr, NULL))
+		this->traffic_file = g_strdup(dest_attr.u.str);
+	if (attr_generic_get_attr(attrs, NULL, attr_speed_profile_file, &dest_attr, NULL))
+		this->speed_profiles = speed_profiles_new(dest_attr.u.str);
+	if (attr_generic_get_attr(attrs, NULL, attr_departure_time, &dest_attr, NULL))
+		this->departure_time = dest_attr.u.num;
+	if (attr_generic_get_attr(attrs, NULL, attr_route_worker, &dest_attr, NULL))
+		this->route_worker = dest_attr.u.num;
+	if (attr_generic_get_attr(attrs, NULL, attr_graph_memory_budget, &dest_attr, NULL))
+		this->graph_memory_budget = dest_attr.u.num;
 	this->cbl2=callback_list_new();
 
 	return this;
@@ -771,6 +1165,48 @@ route_previous_destination(struct route *this)
 	return l->data;
 }
 
+/**
+ * @brief Sums up the time and length of all segments of a route path
+ *
+ * With historic speed profiles, each segment is timed with the speeds of the slot in which it is
+ * reached, the same way route_value_seg() does while flooding.
+ *
+ * @param this The route path
+ * @param profile The vehicle profile used to compute the times
+ * @param sp The historic speed profiles, or {@code NULL}
+ * @param departure Time of departure in seconds since the start of the week, see speed_profiles_week_time()
+ */
+static void
+route_path_set_totals(struct route_path *this, struct vehicleprofile *profile, struct speed_profiles *sp, int departure)
+{
+	struct route_path_segment *seg=this->path;
+	struct map *map=NULL;
+	unsigned char *speeds;
+	int path_time=0,path_len=0,speed_profile,map_index=-1;
+	while (seg) {
+		/* FIXME */
+		int seg_time=route_time_seg(profile, seg->data, NULL);
+		if (sp && seg->data->item.map != map) {
+			map=seg->data->item.map;
+			map_index=speed_profiles_map(sp, map);
+		}
+		if (seg_time != INT_MAX && sp && seg->data->item.type != type_none &&
+			(speed_profile=speed_profiles_lookup(sp, map_index, &seg->data->item))) {
+			speeds=speed_profiles_get_speeds(sp, departure+path_time/10);
+			if (speeds[speed_profile-1])
+				seg_time=seg_time*100/speeds[speed_profile-1];
+		}
+		if (seg_time == INT_MAX) {
+			dbg(lvl_debug,"error\n");
+		} else
+			path_time+=seg_time;
+		path_len+=seg->data->len;
+		seg=seg->next;
+	}
+	this->path_time=path_time;
+	this->path_len=path_len;
+}
+
 /**
  * @brief Updates or recreates the route graph.
  *
@@ -795,6 +1231,13 @@ route_path_update_done(struct route *this, int new_graph)
 		this->path2->update_required=1+new_graph;
 		return;
 	}
+	if (this->graph->ch) {
+		if (!route_path_update_ch(this)) {
+			route_path_destroy(this->path2,1);
+			this->path2=NULL;
+		}
+		return;
+	}
 	route_status.u.num=route_status_building_path;
 	route_set_attr(this, &route_status);
 	prev_dst=route_previous_destination(this);
@@ -812,31 +1255,20 @@ route_path_update_done(struct route *this, int new_graph)
 		}
 	}
 	if (this->path2) {
-		struct route_path_segment *seg=this->path2->path;
-		int path_time=0,path_len=0;
-		while (seg) {
-			/* FIXME */
-			int seg_time=route_time_seg(this->vehicleprofile, seg->data, NULL);
-			if (seg_time == INT_MAX) {
-				dbg(lvl_debug,"error\n");
-			} else
-				path_time+=seg_time;
-			path_len+=seg->data->len;
-			seg=seg->next;
-		}
-		this->path2->path_time=path_time;
-		this->path2->path_len=path_len;
+		route_path_set_totals(this->path2, this->vehicleprofile, this->graph->speed_profiles, this->graph->departure);
 		if (prev_dst != this->pos) {
 			this->link_path=1;
 			this->current_dst=prev_dst;
 			route_graph_reset(this->graph);
-			route_graph_flood(this->graph, this->current_dst, this->vehicleprofile, this->route_graph_flood_done_cb);
+			route_graph_flood(this->graph, this->current_dst, route_previous_destination(this), this->vehicleprofile, this->route_graph_flood_done_cb);
 			return;
 		}
 		if (!new_graph && this->path2->updated)
 			route_status.u.num=route_status_path_done_incremental;
-		else
+		else {
 			route_status.u.num=route_status_path_done_new;
+			route_alternatives_schedule(this);
+		}
 	} else 
 		route_status.u.num=route_status_not_found;
 	this->link_path=0;
@@ -867,15 +1299,33 @@ route_path_update_done(struct route *this, int new_graph)
 static void
 route_path_update_flags(struct route *this, enum route_path_flags flags)
 {
+	int ch_failed=0;
 	dbg(lvl_debug,"enter %d\n", flags);
 	this->flags = flags;
-	if (! this->pos || ! this->destinations) {
+	route_traffic_start(this);
+#ifdef HAVE_PTHREAD
+	if (this->worker) {
+		if (this->pos && this->destinations && !(flags & route_path_flag_cancel)) {
+			dbg(lvl_debug,"busy computing route on worker\n");
+			return;
+		}
+		route_worker_cancel(this);
+	}
+#endif
+	if (! this->pos || ! this->destinations || this->optimization) {
 		dbg(lvl_debug,"destroy\n");
+		route_alternatives_clear(this);
+		if (this->optimization) {
+			/* Routed once the waypoints are reordered */
+			route_graph_destroy(this->graph);
+			this->graph=NULL;
+		}
 		route_path_destroy(this->path2,1);
 		this->path2 = NULL;
 		return;
 	}
 	if (flags & route_path_flag_cancel) {
+		route_alternatives_clear(this);
 		route_graph_destroy(this->graph);
 		this->graph=NULL;
 	}
@@ -887,11 +1337,27 @@ route_path_update_flags(struct route *this, enum route_path_flags flags)
 		}
 		// we can try to update
 		dbg(lvl_debug,"try update\n");
+		if (!this->graph->ch)
+			route_graph_add_position(this->graph, this->pos, this->vehicleprofile, this->traffic);
 		route_path_update_done(this, 0);
+		if (this->graph->ch && !this->path2) {
+			dbg(lvl_debug,"contraction hierarchy failed, building route graph\n");
+			route_graph_destroy(this->graph);
+			this->graph=NULL;
+			ch_failed=1;
+		}
 	} else {
 		route_path_destroy(this->path2,1);
 		this->path2 = NULL;
 	}
+	if (!this->graph && !ch_failed && route_ch_usable(this->vehicleprofile)) {
+		this->graph=g_new0(struct route_graph, 1);
+		this->graph->ch=1;
+		if (route_path_update_ch(this))
+			return;
+		route_graph_destroy(this->graph);
+		this->graph=NULL;
+	}
 	if (!this->graph || (!this->path2 && !(flags & route_path_flag_no_rebuild))) {
 		dbg(lvl_debug,"rebuild graph %p %p\n",this->graph,this->path2);
 		if (! this->route_graph_flood_done_cb)
@@ -1133,6 +1599,73 @@ route_calc_selection(struct coord *c, int count, struct vehicleprofile *profile)
 	return ret;
 }
 
+/**
+ * @brief Returns a list of map selections to build a route graph for isochrones from
+ *
+ * Like route_calc_selection(), the {@code route_depth} of the vehicle profile decides up to which
+ * distance from the center the streets of each order are read, but none of the rectangles reaches
+ * farther than {@code radius}. Rectangles given in percent cover the whole radius. With the default
+ * depth, all streets are read only close to the center and only the major roads farther out.
+ *
+ * @param c The center of the isochrones
+ * @param radius The farthest distance reachable at the highest speed of the vehicle profile
+ * @param profile The vehicle profile
+ */
+static struct map_selection *
+route_isochrone_selection(struct coord *c, int radius, struct vehicleprofile *profile)
+{
+	struct map_selection *ret=NULL;
+	char *depth, *str, *tok;
+
+	depth=profile->route_depth;
+	if (!depth)
+		depth="4:25%,8:40000,18:10000";
+	depth=str=g_strdup(depth);
+
+	while((tok=strtok(str,","))!=NULL) {
+		int order=0, dist=0;
+		sscanf(tok,"%d:%d",&order,&dist);
+		if(strchr(tok,'%') || dist > radius)
+			dist=radius;
+		ret=route_rect_add(ret, order, c, c, 0, dist);
+		str=NULL;
+	}
+
+	g_free(depth);
+
+	return ret;
+}
+
+/**
+ * @brief Lowers the orders of a list of map selections, so fewer streets are read
+ *
+ * The rectangles with the highest order, which route_calc_selection() puts around the start, the
+ * waypoints and the destination, are kept so the streets there are still found. All others, i.e.
+ * the corridor between them and their wider surroundings, get an order {@code ROUTE_DEGRADE_STEP}
+ * lower, so only more important roads are read there.
+ *
+ * @param sel Start of the list, modified in place
+ * @return True if an order was lowered, false if the selection cannot be degraded any further
+ */
+static int
+route_selection_degrade(struct map_selection *sel)
+{
+	struct map_selection *curr;
+	int max=0,ret=0;
+
+	for (curr=sel ; curr ; curr=curr->next) {
+		if (curr->order > max)
+			max=curr->order;
+	}
+	for (curr=sel ; curr ; curr=curr->next) {
+		if (curr->order > 0 && curr->order < max) {
+			curr->order=MAX(0, curr->order-ROUTE_DEGRADE_STEP);
+			ret=1;
+		}
+	}
+	return ret;
+}
+
 /**
  * @brief Destroys a list of map selections
  *
@@ -1149,10 +1682,29 @@ route_free_selection(struct map_selection *sel)
 	}
 }
 
+/**
+ * @brief Calculates the bounding rectangle of a list of map selections
+ *
+ * @param sel Start of the list
+ * @param r Receives the bounding rectangle
+ */
+static void
+route_selection_rect(struct map_selection *sel, struct coord_rect *r)
+{
+	if (!sel)
+		return;
+	*r=sel->u.c_rect;
+	for (sel=sel->next ; sel ; sel=sel->next) {
+		coord_rect_extend(r, &sel->u.c_rect.lu);
+		coord_rect_extend(r, &sel->u.c_rect.rl);
+	}
+}
+
 
 static void
 route_clear_destinations(struct route *this_)
 {
+	route_destinations_optimize_cancel(this_);
 	g_list_foreach(this_->destinations, (GFunc)route_info_free, NULL);
 	g_list_free(this_->destinations);
 	this_->destinations=NULL;
@@ -1188,6 +1740,8 @@ route_set_destinations(struct route *this, struct pcoord *dst, int count, int as
 				this->destinations=g_list_append(this->destinations, dsti);
 			}
 		}
+		profile(1,"find_nearest_street");
+		route_destinations_optimize(this, async);
 		route_status.u.num=route_status_destination_set;
 	} else  {
 		this->reached_destinations_count=0;
@@ -1195,7 +1749,7 @@ route_set_destinations(struct route *this, struct pcoord *dst, int count, int as
 	}
 	callback_list_call_attr_1(this->cbl2, attr_destination, this);
 	route_set_attr(this, &route_status);
-	profile(1,"find_nearest_street");
+	profile(1,"optimize waypoints");
 
 	/* The graph has to be destroyed and set to NULL, otherwise route_path_update() doesn't work */
 	route_graph_destroy(this->graph);
@@ -1326,6 +1880,7 @@ route_append_destination(struct route *this, struct pcoord *dst, int async)
 			route_info_distances(dsti, dst->pro);
 			this->destinations=g_list_append(this->destinations, dsti);
 		}
+		route_destinations_optimize(this, async);
 		/* The graph has to be destroyed and set to NULL, otherwise route_path_update() doesn't work */
 		route_graph_destroy(this->graph);
 		this->graph=NULL;
@@ -1347,6 +1902,7 @@ void
 route_remove_nth_waypoint(struct route *this, int n)
 {
 	struct route_info *ri=g_list_nth_data(this->destinations, n);
+	route_destinations_optimize_cancel(this);
 	this->destinations=g_list_remove(this->destinations,ri);
 	route_info_free(ri);
 	/* The graph has to be destroyed and set to NULL, otherwise route_path_update() doesn't work */
@@ -1362,6 +1918,7 @@ route_remove_waypoint(struct route *this)
 	if (this->path2) {
 		struct route_path *path = this->path2;
 		struct route_info *ri = this->destinations->data;
+		route_destinations_optimize_cancel(this);
 		this->destinations = g_list_remove(this->destinations, ri);
 		route_info_free(ri);
 		this->path2 = this->path2->next;
@@ -1372,15 +1929,68 @@ route_remove_waypoint(struct route *this)
 			return;
 		}
 		this->reached_destinations_count++;
-		route_graph_reset(this->graph);
 		this->current_dst = this->destinations->data;
-		route_graph_flood(this->graph, this->current_dst, this->vehicleprofile,	this->route_graph_flood_done_cb);
+		if (this->graph->ch)
+			return;
+		route_graph_reset(this->graph);
+		route_graph_flood(this->graph, this->current_dst, route_previous_destination(this), this->vehicleprofile,
+				this->route_graph_flood_done_cb);
+	}
+}
+
+static inline unsigned int
+route_graph_hash_coord(struct coord *c)
+{
+	unsigned int h=(unsigned int)c->x*2654435761U ^ (unsigned int)c->y*2246822519U;
+	return h ^ (h >> 15);
+}
+
+/**
+ * @brief Walks the probe sequence of a coordinate in the point index
+ *
+ * Points with equal coordinates are found in the order they were created, as the index is never
+ * shrunk and points are never removed from it.
+ *
+ * @param this The route graph
+ * @param c Coordinates to search for
+ * @param last The point to stop at, or {@code NULL} to walk the whole sequence
+ * @param first Returns the first point with coordinates {@code c}, may be NULL
+ * @return The last point with coordinates {@code c} before {@code last}
+ */
+static struct route_graph_point *
+route_graph_point_index_walk(struct route_graph *this, struct coord *c, struct route_graph_point *last, struct route_graph_point **first)
+{
+	struct route_graph_point *p,*ret=NULL;
+	int i,probes=0;
+
+	if (first)
+		*first=NULL;
+	if (!this->point_index)
+		return NULL;
+	i=HASHCOORD(c, this->point_index_size);
+	while ((p=this->point_index[i])) {
+		probes++;
+		if (p == last)
+			break;
+		if (p->c.x == c->x && p->c.y == c->y) {
+			if (first && !*first)
+				*first=p;
+			ret=p;
+		}
+		i=(i+1)&(this->point_index_size-1);
 	}
+	this->point_lookups++;
+	this->point_probes+=probes;
+	if (probes > this->point_probe_max)
+		this->point_probe_max=probes;
+	return ret;
 }
 
 /**
  * @brief Gets the next route_graph_point with the specified coordinates
  *
+ * Points with equal coordinates are returned newest first.
+ *
  * @param this The route in which to search
  * @param c Coordinates to search for
  * @param last The last route graph point returned to iterate over multiple points with the same coordinates,
@@ -1390,19 +2000,7 @@ route_remove_waypoint(struct route *this)
 static struct route_graph_point *
 route_graph_get_point_next(struct route_graph *this, struct coord *c, struct route_graph_point *last)
 {
-	struct route_graph_point *p;
-	int seen=0,hashval=HASHCOORD(c);
-	p=this->hash[hashval];
-	while (p) {
-		if (p->c.x == c->x && p->c.y == c->y) {
-			if (!last || seen)
-				return p;
-			if (p == last)
-				seen=1;
-		}
-		p=p->hash_next;
-	}
-	return NULL;
+	return route_graph_point_index_walk(this, c, last, NULL);
 }
 
 /**
@@ -1428,22 +2026,33 @@ route_graph_get_point(struct route_graph *this, struct coord *c)
 static struct route_graph_point *
 route_graph_get_point_last(struct route_graph *this, struct coord *c)
 {
-	struct route_graph_point *p,*ret=NULL;
-	int hashval=HASHCOORD(c);
-	p=this->hash[hashval];
-	while (p) {
-		if (p->c.x == c->x && p->c.y == c->y)
-			ret=p;
-		p=p->hash_next;
-	}
+	struct route_graph_point *ret;
+	route_graph_point_index_walk(this, c, NULL, &ret);
 	return ret;
 }
 
-
+/**
+ * @brief Inserts a point into the point index
+ *
+ * @param index The index
+ * @param size The number of slots of the index
+ * @param p The point to insert
+ */
+static void
+route_graph_point_index_insert(struct route_graph_point **index, int size, struct route_graph_point *p)
+{
+	int i=HASHCOORD(&p->c, size);
+	while (index[i])
+		i=(i+1)&(size-1);
+	index[i]=p;
+}
 
 /**
  * @brief Create a new point for the route graph with the specified coordinates
  *
+ * Points are allocated from blocks of {@code ROUTE_GRAPH_POINT_BLOCK_SIZE} points. The point index is
+ * doubled in size whenever it becomes half full, which keeps the probe sequences short.
+ *
  * @param this The route to insert the point into
  * @param f The coordinates at which the point should be created
  * @return The point created
@@ -1452,17 +2061,33 @@ route_graph_get_point_last(struct route_graph *this, struct coord *c)
 static struct route_graph_point *
 route_graph_point_new(struct route_graph *this, struct coord *f)
 {
-	int hashval;
 	struct route_graph_point *p;
+	int i;
 
-	hashval=HASHCOORD(f);
 	if (debug_route)
 		printf("p (0x%x,0x%x)\n", f->x, f->y);
-	p=g_slice_new0(struct route_graph_point);
-	p->hash_next=this->hash[hashval];
-	this->hash[hashval]=p;
+	if (this->point_count*2 >= this->point_index_size) {
+		int size=this->point_index_size ? this->point_index_size*2 : ROUTE_GRAPH_POINT_INDEX_MIN;
+		struct route_graph_point **index=g_new0(struct route_graph_point *, size);
+		for (i = 0 ; i < this->point_count ; i++)
+			route_graph_point_index_insert(index, size, ROUTE_GRAPH_POINT(this, i));
+		this->memory+=(long)(size-this->point_index_size)*sizeof(*index);
+		g_free(this->point_index);
+		this->point_index=index;
+		this->point_index_size=size;
+	}
+	if (!(this->point_count % ROUTE_GRAPH_POINT_BLOCK_SIZE)) {
+		i=this->point_count/ROUTE_GRAPH_POINT_BLOCK_SIZE;
+		this->point_blocks=g_renew(struct route_graph_point *, this->point_blocks, i+1);
+		this->point_blocks[i]=g_new(struct route_graph_point, ROUTE_GRAPH_POINT_BLOCK_SIZE);
+		this->memory+=ROUTE_GRAPH_POINT_BLOCK_SIZE*sizeof(struct route_graph_point)+sizeof(struct route_graph_point *);
+	}
+	p=ROUTE_GRAPH_POINT(this, this->point_count);
+	this->point_count++;
+	memset(p, 0, sizeof(*p));
 	p->value=INT_MAX;
 	p->c=*f;
+	route_graph_point_index_insert(this->point_index, this->point_index_size, p);
 	return p;
 }
 
@@ -1498,17 +2123,17 @@ route_graph_add_point(struct route_graph *this, struct coord *f)
 static void
 route_graph_free_points(struct route_graph *this)
 {
-	struct route_graph_point *curr,*next;
-	int i;
-	for (i = 0 ; i < HASH_SIZE ; i++) {
-		curr=this->hash[i];
-		while (curr) {
-			next=curr->hash_next;
-			g_slice_free(struct route_graph_point, curr);
-			curr=next;
-		}
-		this->hash[i]=NULL;
-	}
+	int i,blocks=(this->point_count+ROUTE_GRAPH_POINT_BLOCK_SIZE-1)/ROUTE_GRAPH_POINT_BLOCK_SIZE;
+	for (i = 0 ; i < blocks ; i++)
+		g_free(this->point_blocks[i]);
+	g_free(this->point_blocks);
+	g_free(this->point_index);
+	this->memory-=blocks*(ROUTE_GRAPH_POINT_BLOCK_SIZE*sizeof(struct route_graph_point)+sizeof(struct route_graph_point *))+
+		(long)this->point_index_size*sizeof(struct route_graph_point *);
+	this->point_blocks=NULL;
+	this->point_index=NULL;
+	this->point_count=0;
+	this->point_index_size=0;
 }
 
 /**
@@ -1517,7 +2142,7 @@ route_graph_free_points(struct route_graph *this)
  * This iterates through all the points in the route graph, resetting them to their initial state.
  * The {@code value} member of each point (cost to reach the destination) is reset to
  * {@code INT_MAX}, the {@code seg} member (cheapest way to destination) is reset to {@code NULL}
- * and the {@code el} member (pointer to element in Fibonacci heap) is also reset to {@code NULL}.
+ * and the {@code el} member (handle of the point on the route heap) is also reset to {@code NULL}.
  *
  * References to elements of the route graph which were obtained prior to calling this function
  * remain valid after it returns.
@@ -1529,14 +2154,12 @@ route_graph_reset(struct route_graph *this)
 {
 	struct route_graph_point *curr;
 	int i;
-	for (i = 0 ; i < HASH_SIZE ; i++) {
-		curr=this->hash[i];
-		while (curr) {
-			curr->value=INT_MAX;
-			curr->seg=NULL;
-			curr->el=NULL;
-			curr=curr->hash_next;
-		}
+	this->floods++;
+	for (i = 0 ; i < this->point_count ; i++) {
+		curr=ROUTE_GRAPH_POINT(this, i);
+		curr->value=INT_MAX;
+		curr->seg=NULL;
+		curr->el=NULL;
 	}
 }
 
@@ -1621,6 +2244,19 @@ route_graph_segment_is_duplicate(struct route_graph_point *start, struct route_g
 	return 0;
 }
 
+/**
+ * @brief Returns the heading of a straight line
+ *
+ * @param from The start of the line
+ * @param to The end of the line
+ * @return The heading in 1/256 of a full circle, clockwise from north
+ */
+static unsigned char
+route_heading(struct coord *from, struct coord *to)
+{
+	return transform_get_angle_delta(from, to, 0)*256/360;
+}
+
 /**
  * @brief Inserts a new segment into the route graph
  *
@@ -1649,19 +2285,27 @@ route_graph_add_segment(struct route_graph *this, struct route_graph_point *star
 		printf("%s:Out of memory\n", __FUNCTION__);
 		return;
 	}
+	this->memory+=size;
 	s->start=start;
 	s->start_next=start->start;
 	start->start=s;
 	s->end=end;
 	s->end_next=end->end;
 	end->end=s;
+	s->start_dir=data->start_dir;
+	s->end_dir=data->end_dir;
 	dbg_assert(data->len >= 0);
 	s->data.len=data->len;
 	s->data.item=*data->item;
 	s->data.flags=data->flags;
 
-	if (data->flags & AF_SPEED_LIMIT) 
+	if (data->flags & AF_SPEED_LIMIT) {
 		RSD_MAXSPEED(&s->data)=data->maxspeed;
+		/* The maxspeed of a traffic distortion is enforced on streets without a limit of their own as well,
+		 * so it counts too */
+		if (data->maxspeed > this->max_maxspeed)
+			this->max_maxspeed=data->maxspeed;
+	}
 	if (data->flags & AF_SEGMENTED) 
 		RSD_OFFSET(&s->data)=data->offset;
 	if (data->flags & AF_SIZE_OR_WEIGHT_LIMIT) 
@@ -1675,6 +2319,26 @@ route_graph_add_segment(struct route_graph *this, struct route_graph_point *star
 		printf("l (0x%x,0x%x)-(0x%x,0x%x)\n", start->c.x, start->c.y, end->c.x, end->c.y);
 }
 
+/**
+ * @brief Returns the map to read an item of a route graph from
+ *
+ * While the graph is flooded on a worker thread, the item is read through the instance of its map
+ * opened for the worker.
+ *
+ * @param graph The route graph
+ * @param item The item
+ * @return The map
+ */
+static struct map *
+route_graph_item_map(struct route_graph *graph, struct item *item)
+{
+#ifdef HAVE_PTHREAD
+	if (graph->worker)
+		return g_hash_table_lookup(graph->worker->maps, item->map);
+#endif
+	return item->map;
+}
+
 /**
  * @brief Gets all the coordinates of an item
  *
@@ -1686,6 +2350,7 @@ route_graph_add_segment(struct route_graph *this, struct route_graph_point *star
  * @important Make sure that whatever c points to has enough memory allocated
  * @important to hold max coordinates!
  *
+ * @param map The map to read the item from
  * @param i The item to get the coordinates of
  * @param c Pointer to memory allocated for holding the coordinates
  * @param max Maximum number of coordinates to return
@@ -1693,14 +2358,14 @@ route_graph_add_segment(struct route_graph *this, struct route_graph_point *star
  * @param end Last coordinate to get
  * @return The number of coordinates returned
  */
-static int get_item_seg_coords(struct item *i, struct coord *c, int max,
+static int get_item_seg_coords(struct map *map, struct item *i, struct coord *c, int max,
 		struct coord *start, struct coord *end)
 {
 	struct map_rect *mr;
 	struct item *item;
 	int rc = 0, p = 0;
 	struct coord c1;
-	mr=map_rect_new(i->map, NULL);
+	mr=map_rect_new(map, NULL);
 	if (!mr)
 		return 0;
 	item = map_rect_get_item_byid(mr, i->id_hi, i->id_lo);
@@ -1818,6 +2483,7 @@ route_path_add_line(struct route_path *this, struct coord *start, struct coord *
  * parameter has no effect.
  *
  * @param this The path to add the item to
+ * @param graph The route graph the segment belongs to
  * @param oldpath Old path containing the segment to be added. Speeds up the function, but can be NULL.
  * @param rgs Segment of the route graph that should be "copied" to the route path
  * @param dir Order in which to add the coordinates. See route_path_add_item()
@@ -1826,7 +2492,8 @@ route_path_add_line(struct route_path *this, struct coord *start, struct coord *
  */
 
 static int
-route_path_add_item_from_graph(struct route_path *this, struct route_path *oldpath, struct route_graph_segment *rgs, int dir, struct route_info *pos, struct route_info *dst)
+route_path_add_item_from_graph(struct route_path *this, struct route_graph *graph, struct route_path *oldpath, struct route_graph_segment *rgs, int dir,
+		struct route_info *pos, struct route_info *dst)
 {
 	struct route_path_segment *segment=NULL;
 	int i, ccnt, extra=0, ret=0;
@@ -1895,7 +2562,7 @@ route_path_add_item_from_graph(struct route_path *this, struct route_path *oldpa
 			len=dst->lenpos;
 		}
 	} else {
-		ccnt=get_item_seg_coords(&rgs->data.item, ca, 2047, &rgs->start->c, &rgs->end->c);
+		ccnt=get_item_seg_coords(route_graph_item_map(graph, &rgs->data.item), &rgs->data.item, ca, 2047, &rgs->start->c, &rgs->end->c);
 		c=ca;
 	}
 	seg_size=sizeof(*segment) + sizeof(struct coord) * (ccnt + extra);
@@ -1953,26 +2620,84 @@ route_graph_free_segments(struct route_graph *this)
 		next=curr->next;
 		size = sizeof(struct route_graph_segment)-sizeof(struct route_segment_data)+route_segment_data_size(curr->data.flags);
 		g_slice_free1(size, curr);
+		this->memory-=size;
 		curr=next;
 	}
 	this->route_segments=NULL;
 }
 
 /**
- * @brief Destroys a route graph
- * 
- * @param this The route graph to be destroyed
+ * @brief Frees the segment labels of a route graph, see route_graph_turn_labels()
+ *
+ * @param this The route graph
  */
 static void
-route_graph_destroy(struct route_graph *this)
+route_graph_turn_labels_free(struct route_graph *this)
 {
-	if (this) {
-		route_graph_build_done(this, 1);
-		route_graph_free_points(this);
-		route_graph_free_segments(this);
-		g_free(this);
-	}
-}
+	struct route_graph_segment *s;
+
+	if (!this->turn_labels)
+		return;
+	for (s=this->route_segments ; s ; s=s->next)
+		s->labels=NULL;
+	g_free(this->turn_labels);
+	this->memory-=this->turn_label_count*sizeof(struct route_graph_turn_label);
+	this->turn_labels=NULL;
+	this->turn_label_count=0;
+}
+
+/**
+ * @brief Prepares the segment labels of a route graph for a flood with turn costs
+ *
+ * Every segment gets two labels without costs. The labels are kept until the next flood, since
+ * route_path_new() needs them to follow the path.
+ *
+ * @param this The route graph
+ */
+static void
+route_graph_turn_labels(struct route_graph *this)
+{
+	struct route_graph_segment *s;
+	int count=0;
+
+	for (s=this->route_segments ; s ; s=s->next)
+		count+=2;
+	if (count != this->turn_label_count) {
+		route_graph_turn_labels_free(this);
+		this->turn_labels=g_new(struct route_graph_turn_label, count);
+		this->turn_label_count=count;
+		this->memory+=count*sizeof(struct route_graph_turn_label);
+	}
+	count=0;
+	for (s=this->route_segments ; s ; s=s->next) {
+		s->labels=this->turn_labels+count;
+		s->labels[0].seg=s->labels[1].seg=s;
+		s->labels[0].el=s->labels[1].el=NULL;
+		s->labels[0].value=s->labels[1].value=INT_MAX;
+		s->labels[0].dst=s->labels[1].dst=0;
+		s->labels[0].cost=s->labels[1].cost=-1;
+		s->labels[0].weight=s->labels[1].weight=-1;
+		count+=2;
+	}
+}
+
+/**
+ * @brief Destroys a route graph
+ * 
+ * @param this The route graph to be destroyed
+ */
+static void
+route_graph_destroy(struct route_graph *this)
+{
+	if (this) {
+		route_graph_build_done(this, 1);
+		route_graph_free_points(this);
+		route_graph_turn_labels_free(this);
+		route_graph_free_segments(this);
+		g_free(this->cache_key);
+		g_free(this);
+	}
+}
 
 /**
  * @brief Returns the estimated speed on a segment, or 0 for an impassable segment
@@ -2103,6 +2828,57 @@ route_through_traffic_allowed(struct vehicleprofile *profile, struct route_graph
 	return (seg->data.flags & AF_THROUGH_TRAFFIC_LIMIT) == 0;
 }
 
+/**
+ * @brief Assigns historic speed profiles to the segments of a route graph
+ *
+ * The profile of each segment is looked up once per graph, so route_value_seg() only needs to
+ * index the speeds of the current time slot.
+ *
+ * @param this The route graph
+ * @param sp The speed profiles, or {@code NULL} to route without them
+ * @param departure Time of departure in seconds since the epoch, 0 to depart now
+ */
+static void
+route_graph_set_speed_profiles(struct route_graph *this, struct speed_profiles *sp, time_t departure)
+{
+	struct route_graph_segment *s;
+	struct map *map=NULL;
+	int count=0,map_index=-1;
+
+	if (this->speed_profiles != sp) {
+		for (s=this->route_segments ; s ; s=s->next) {
+			s->speed_profile=0;
+			if (sp && s->data.item.map != map) {
+				map=s->data.item.map;
+				map_index=speed_profiles_map(sp, map);
+			}
+			if (sp && s->data.item.type != type_none && s->data.item.type != type_traffic_distortion &&
+				s->data.item.type != type_street_turn_restriction_no && s->data.item.type != type_street_turn_restriction_only)
+				s->speed_profile=speed_profiles_lookup(sp, map_index, &s->data.item);
+			if (s->speed_profile)
+				count++;
+		}
+		this->speed_profiles=sp;
+		dbg(lvl_debug,"%d segments with speed profile\n", count);
+	}
+	this->departure=speed_profiles_week_time(departure ? departure : time(NULL));
+}
+
+/**
+ * @brief Returns the speeds of the historic speed profiles of a route graph at a given time
+ *
+ * @param this The route graph
+ * @param offset The time after departure in tenths of seconds
+ * @return The speeds to pass to route_value_seg(), or {@code NULL} if the graph has no speed profiles
+ */
+static unsigned char *
+route_graph_speeds(struct route_graph *this, int offset)
+{
+	if (!this->speed_profiles)
+		return NULL;
+	return speed_profiles_get_speeds(this->speed_profiles, this->departure+offset/10);
+}
+
 /**
  * @brief Returns the "cost" of driving from point {@code from} along segment {@code over} in direction {@code dir}
  *
@@ -2118,12 +2894,15 @@ route_through_traffic_allowed(struct vehicleprofile *profile, struct route_graph
  * @param dir The direction of segment which we are driving. Positive values indicate we are
  * traveling in the direction of the segment, negative values indicate we are traveling against
  * that direction. Values of +2 or -2 cause the function to ignore traffic distortions.
+ * @param speeds The speeds of the historic speed profiles at the time the segment is passed, see
+ * route_graph_speeds(), or {@code NULL} to use the speeds of the vehicle profile
  *
  * @return The "cost" needed to travel along the segment
  */  
 
 static int
-route_value_seg(struct vehicleprofile *profile, struct route_graph_point *from, struct route_graph_segment *over, int dir)
+route_value_seg(struct vehicleprofile *profile, struct route_graph_point *from, struct route_graph_segment *over, int dir,
+		unsigned char *speeds)
 {
 	int ret;
 	struct route_traffic_distortion dist,*distp=NULL;
@@ -2145,6 +2924,13 @@ route_value_seg(struct vehicleprofile *profile, struct route_graph_point *from,
 	ret=route_time_seg(profile, &over->data, distp);
 	if (ret == INT_MAX)
 		return ret;
+	if (speeds && over->speed_profile) {
+		if (!speeds[over->speed_profile-1])
+			return INT_MAX;
+		ret=ret*100/speeds[over->speed_profile-1];
+	}
+	if (over->flags & RS_ALTERNATIVE_PENALTY)
+		ret+=ret*ROUTE_ALTERNATIVE_PENALTY_PERCENT/100;
 	if (!route_through_traffic_allowed(profile, over) && from && route_through_traffic_allowed(profile, from->seg)) 
 		ret+=profile->through_traffic_penalty;
 	return ret;
@@ -2217,6 +3003,7 @@ route_process_traffic_distortion(struct route_graph *this, struct item *item)
 	data.flags=0;
 	data.offset=1;
 	data.maxspeed = INT_MAX;
+	data.start_dir=data.end_dir=0;
 
 	if (item_coord_get(item, &l, 1)) {
 		s_pnt=route_graph_add_point(this,&l);
@@ -2236,6 +3023,118 @@ route_process_traffic_distortion(struct route_graph *this, struct item *item)
 	}
 }
 
+/**
+ * @brief Removes a segment from a route graph and frees it
+ *
+ * The points at its ends lose {@code RP_TRAFFIC_DISTORTION} once no other distortion is attached to them.
+ *
+ * @param this The route graph
+ * @param seg The segment to remove
+ */
+static void
+route_graph_remove_segment(struct route_graph *this, struct route_graph_segment *seg)
+{
+	struct route_graph_segment **s;
+	struct route_graph_point *p[2];
+	int i,size;
+
+	for (s=&seg->start->start ; *s ; s=&(*s)->start_next) {
+		if (*s == seg) {
+			*s=seg->start_next;
+			break;
+		}
+	}
+	for (s=&seg->end->end ; *s ; s=&(*s)->end_next) {
+		if (*s == seg) {
+			*s=seg->end_next;
+			break;
+		}
+	}
+	for (s=&this->route_segments ; *s ; s=&(*s)->next) {
+		if (*s == seg) {
+			*s=seg->next;
+			break;
+		}
+	}
+	p[0]=seg->start;
+	p[1]=seg->end;
+	if (seg->labels)
+		seg->labels[0].seg=seg->labels[1].seg=NULL;
+	size = sizeof(struct route_graph_segment)-sizeof(struct route_segment_data)+route_segment_data_size(seg->data.flags);
+	g_slice_free1(size, seg);
+	this->memory-=size;
+	for (i = 0 ; i < 2 ; i++) {
+		struct route_graph_segment *t;
+		int distortion=0;
+		for (t=p[i]->start ; t && !distortion ; t=t->start_next)
+			distortion=(t->data.item.type == type_traffic_distortion);
+		for (t=p[i]->end ; t && !distortion ; t=t->end_next)
+			distortion=(t->data.item.type == type_traffic_distortion);
+		if (!distortion)
+			p[i]->flags &= ~RP_TRAFFIC_DISTORTION;
+	}
+}
+
+/**
+ * @brief Sets, updates or removes a traffic distortion of the route in a route graph
+ *
+ * @param this The route graph
+ * @param t The traffic distortion
+ * @param remove True to remove the distortion from the graph
+ * @param ends Receives the points at both ends of the distortion if the graph changed
+ * @return True if the graph changed
+ */
+static int
+route_graph_apply_traffic(struct route_graph *this, struct route_traffic *t, int remove, struct route_graph_point **ends)
+{
+	struct route_graph_point *start,*end;
+	struct route_graph_segment *s,*found=NULL;
+
+	start=route_graph_get_point(this, &t->start);
+	end=route_graph_get_point(this, &t->end);
+	if (!start || !end)
+		return 0;
+	for (s=start->start ; s && !found ; s=s->start_next) {
+		if (s->end == end && s->data.item.type == type_traffic_distortion &&
+			s->data.item.id_hi == ROUTE_TRAFFIC_ID_HI && s->data.item.id_lo == t->id)
+			found=s;
+	}
+	if (remove) {
+		if (!found)
+			return 0;
+		route_graph_remove_segment(this, found);
+	} else if (found && (t->maxspeed == INT_MAX) == !(found->data.flags & AF_SPEED_LIMIT)) {
+		found->data.len=t->delay;
+		if (t->maxspeed != INT_MAX) {
+			RSD_MAXSPEED(&found->data)=t->maxspeed;
+			if (t->maxspeed > this->max_maxspeed)
+				this->max_maxspeed=t->maxspeed;
+		}
+	} else {
+		struct route_graph_segment_data data;
+		struct item item;
+		if (found)
+			route_graph_remove_segment(this, found);
+		memset(&data, 0, sizeof(data));
+		memset(&item, 0, sizeof(item));
+		item.type=type_traffic_distortion;
+		item.id_hi=ROUTE_TRAFFIC_ID_HI;
+		item.id_lo=t->id;
+		data.item=&item;
+		data.offset=1;
+		data.len=t->delay;
+		data.maxspeed=t->maxspeed;
+		if (t->maxspeed != INT_MAX)
+			data.flags |= AF_SPEED_LIMIT;
+		start->flags |= RP_TRAFFIC_DISTORTION;
+		end->flags |= RP_TRAFFIC_DISTORTION;
+		route_graph_add_segment(this, start, end, &data);
+	}
+	ends[0]=start;
+	ends[1]=end;
+	return 1;
+}
+
 /**
  * @brief Adds a turn restriction item to the route graph
  *
@@ -2263,6 +3162,7 @@ route_process_turn_restriction(struct route_graph *this, struct item *item)
 	data.item=item;
 	data.flags=0;
 	data.len=0;
+	data.start_dir=data.end_dir=0;
 	route_graph_add_segment(this, pnt[0], pnt[1], &data);
 	route_graph_add_segment(this, pnt[1], pnt[2], &data);
 #if 1
@@ -2294,6 +3194,7 @@ route_process_street_graph(struct route_graph *this, struct item *item, struct v
 	double len=0;
 #endif
 	int segmented = 0;
+	int first = 1;
 	struct roadprofile *roadp;
 	struct route_graph_point *s_pnt,*e_pnt; /* Start and end point */
 	struct coord c,l; /* Current and previous point */
@@ -2357,9 +3258,16 @@ route_process_street_graph(struct route_graph *this, struct item *item, struct v
 		}
 
 		s_pnt=route_graph_add_point(this,&l);
+		data.start_dir=data.end_dir=0;
 		if (!segmented) {
 			while (item_coord_get(item, &c, 1)) {
 				len+=transform_distance(map_projection(item->map), &l, &c);
+				if (l.x != c.x || l.y != c.y) {
+					data.end_dir=route_heading(&l, &c);
+					if (first)
+						data.start_dir=data.end_dir;
+					first=0;
+				}
 				l=c;
 			}
 			e_pnt=route_graph_add_point(this,&l);
@@ -2375,6 +3283,12 @@ route_process_street_graph(struct route_graph *this, struct item *item, struct v
 				rc = item_coord_get(item, &c, 1);
 				if (rc) {
 					len+=transform_distance(map_projection(item->map), &l, &c);
+					if (l.x != c.x || l.y != c.y) {
+						data.end_dir=route_heading(&l, &c);
+						if (first)
+							data.start_dir=data.end_dir;
+						first=0;
+					}
 					l=c;
 					if (isseg) {
 						e_pnt=route_graph_add_point(this,&l);
@@ -2384,6 +3298,7 @@ route_process_street_graph(struct route_graph *this, struct item *item, struct v
 						data.offset++;
 						s_pnt=route_graph_add_point(this,&l);
 						len = 0;
+						first=1;
 					}
 				}
 			} while(rc);
@@ -2429,1774 +3344,6298 @@ route_graph_get_segment(struct route_graph *graph, struct street_data *sd, struc
 	return NULL;
 }
 
+static void
+route_graph_max_route_weight(gpointer key, gpointer value, gpointer user_data)
+{
+	struct roadprofile *rp=value;
+	int *max=user_data;
+	if (rp->route_weight > *max)
+		*max=rp->route_weight;
+}
+
 /**
- * @brief Calculates the routing costs for each point
+ * @brief Returns an upper bound for the speed on any segment of the route graph
  *
- * This function is the heart of routing. It assigns each point in the route graph a
- * cost at which one can reach the destination from this point on. Additionally it assigns
- * each point a segment one should follow from this point on to reach the destination at the
- * stated costs.
- * 
- * This function uses Dijkstra's algorithm to do the routing. To understand it you should have a look
- * at this algorithm.
+ * This is the highest {@code route_weight} of all road profiles, or the highest maxspeed found in the
+ * graph if the vehicle profile enforces maxspeed and that one is higher. The maxspeeds of traffic
+ * distortions count as well, since route_seg_speed() enforces them on streets without a speed limit,
+ * where they may exceed the {@code route_weight}.
  *
- * References to elements of the route graph which were obtained prior to calling this function
- * remain valid after it returns.
+ * @param this The route graph
+ * @param profile The vehicle profile used for routing
+ * @return The speed in km/h, or 0 if no road is passable at all
+ */
+static int
+route_graph_max_speed(struct route_graph *this, struct vehicleprofile *profile)
+{
+	int ret=0;
+	g_hash_table_foreach(profile->roadprofile_hash, route_graph_max_route_weight, &ret);
+	if (profile->maxspeed_handling == maxspeed_enforce && this->max_maxspeed > ret)
+		ret=this->max_maxspeed;
+	return ret;
+}
+
+/**
+ * @brief Estimates the cost of traveling from a point to the target of a goal-directed flood
  *
- * @param this_ The route graph to flood
- * @param dst The destination of the route
- * @param profile The vehicle profile to use for routing. This determines which ways are passable
- * and how their costs are calculated.
- * @param cb The callback function to call when flooding is complete
+ * The estimate is the straight-line distance driven at the highest speed possible in the graph,
+ * so it never exceeds the real cost. This is the heuristic of the A* search in route_graph_flood().
+ *
+ * @param c The coordinates of the point
+ * @param target The coordinates the flood is directed at
+ * @param pro The projection of the coordinates
+ * @param speed The highest speed possible in the graph, see route_graph_max_speed()
+ * @return The estimated cost in tenths of seconds
  */
-static void
-route_graph_flood(struct route_graph *this, struct route_info *dst, struct vehicleprofile *profile, struct callback *cb)
+static int
+route_graph_flood_estimate(struct coord *c, struct coord *target, enum projection pro, int speed)
 {
-	struct route_graph_point *p_min;
-	struct route_graph_segment *s=NULL;
-	int min,new,val;
-	struct fibheap *heap; /* This heap will hold all points with "temporarily" calculated costs */
+	long long dist=transform_distance(pro, c, target);
+	return dist*36*ROUTE_ASTAR_ESTIMATE_PERCENT/(100LL*speed);
+}
 
-	heap = fh_makekeyheap();   
+/**
+ * @brief Checks if a route graph has a segment of an item starting at a given point
+ */
+static int
+route_graph_has_item(struct route_graph *this, struct item *item, struct coord *c)
+{
+	struct route_graph_point *p=NULL;
+	struct route_graph_segment *s;
 
-	while ((s=route_graph_get_segment(this, dst->street, s))) {
-		val=route_value_seg(profile, NULL, s, -1);
-		if (val != INT_MAX) {
-			val=val*(100-dst->percent)/100;
-			s->end->seg=s;
-			s->end->value=val;
-			s->end->el=fh_insertkey(heap, s->end->value, s->end);
-		}
-		val=route_value_seg(profile, NULL, s, 1);
-		if (val != INT_MAX) {
-			val=val*dst->percent/100;
-			s->start->seg=s;
-			s->start->value=val;
-			s->start->el=fh_insertkey(heap, s->start->value, s->start);
+	while ((p=route_graph_get_point_next(this, c, p))) {
+		for (s=p->start ; s ; s=s->start_next) {
+			if (item_is_equal(s->data.item, *item))
+				return 1;
 		}
 	}
-	for (;;) {
-		p_min=fh_extractmin(heap); /* Starting Dijkstra by selecting the point with the minimum costs on the heap */
-		if (! p_min) /* There are no more points with temporarily calculated costs, Dijkstra has finished */
-			break;
-		min=p_min->value;
-		if (debug_route)
-			printf("extract p=%p free el=%p min=%d, 0x%x, 0x%x\n", p_min, p_min->el, min, p_min->c.x, p_min->c.y);
-		p_min->el=NULL; /* This point is permanently calculated now, we've taken it out of the heap */
-		s=p_min->start;
-		while (s) { /* Iterating all the segments leading away from our point to update the points at their ends */
-			val=route_value_seg(profile, p_min, s, -1);
-			if (val != INT_MAX && item_is_equal(s->data.item,p_min->seg->data.item)) {
-				if (profile->turn_around_penalty2)
-					val+=profile->turn_around_penalty2;
-				else
-					val=INT_MAX;
-			}
-			if (val != INT_MAX) {
-				new=min+val;
-				if (debug_route)
-					printf("begin %d len %d vs %d (0x%x,0x%x)\n",new,val,s->end->value, s->end->c.x, s->end->c.y);
-				if (new < s->end->value) { /* We've found a less costly way to reach the end of s, update it */
-					s->end->value=new;
-					s->end->seg=s;
-					if (! s->end->el) {
-						if (debug_route)
-							printf("insert_end p=%p el=%p val=%d ", s->end, s->end->el, s->end->value);
-						s->end->el=fh_insertkey(heap, new, s->end);
-						if (debug_route)
-							printf("el new=%p\n", s->end->el);
-					}
-					else {
-						if (debug_route)
-							printf("replace_end p=%p el=%p val=%d\n", s->end, s->end->el, s->end->value);
-						fh_replacekey(heap, s->end->el, new);
-					}
-				}
-				if (debug_route)
-					printf("\n");
-			}
-			s=s->start_next;
+	return 0;
+}
+
+/**
+ * @brief Makes sure the street of a position is part of a route graph
+ *
+ * When the vehicle leaves the route, it may end up on a street which was not included in the graph,
+ * e.g. a minor road far from the start and the destination. If the position still lies within the
+ * area the graph was built for, only this street is added to the graph. As soon as one end of it
+ * connects to a point which already carries costs, route_path_new() can use the existing flood
+ * instead of rebuilding and flooding the whole graph.
+ *
+ * The street is read from the map together with the traffic distortions and turn restrictions
+ * around it which the graph does not have yet. The traffic distortions of the route are applied
+ * again, and the turn restrictions of points not resolved yet are resolved, see
+ * route_graph_process_restriction_point(). A street which could not be added, e.g. because the
+ * vehicle profile does not allow it, is remembered so the map is not read again on the next
+ * position update on it.
+ *
+ * @param this The route graph
+ * @param pos The position
+ * @param profile The vehicle profile in use
+ * @param traffic The traffic distortions of the route
+ * @return True if the street of the position is part of the graph
+ */
+static int
+route_graph_add_position(struct route_graph *this, struct route_info *pos, struct vehicleprofile *profile, GList *traffic)
+{
+	struct street_data *sd=pos->street;
+	struct route_graph_segment *old=this->route_segments,*s;
+	struct route_graph_point *ends[2],*p[2];
+	struct map_selection *sel;
+	struct map_rect *mr;
+	struct item *item;
+	struct coord_rect r;
+	struct coord c;
+	GList *l;
+	int i;
+
+	if (!sd)
+		return 0;
+	if (route_graph_get_segment(this, sd, NULL))
+		return 1;
+	if (!sd->item.map || !coord_rect_contains(&this->rect, &pos->c) || item_is_equal(this->position_item, sd->item))
+		return 0;
+	this->position_item=sd->item;
+	r.lu=sd->c[0];
+	r.rl=sd->c[0];
+	for (i = 1 ; i < sd->count ; i++)
+		coord_rect_extend(&r, &sd->c[i]);
+	sel=route_rect(18, &r.lu, &r.rl, 0, 0);
+	mr=map_rect_new(sd->item.map, sel);
+	while (mr && (item=map_rect_get_item(mr))) {
+		if (item_is_equal(*item, sd->item)) {
+			dbg(lvl_debug,"adding street 0x%x,0x%x of position to route graph\n", item->id_hi, item->id_lo);
+			route_process_street_graph(this, item, profile);
+		} else if (item->type == type_traffic_distortion || item->type == type_street_turn_restriction_no ||
+				item->type == type_street_turn_restriction_only) {
+			if (!item_coord_get(item, &c, 1) || route_graph_has_item(this, item, &c))
+				continue;
+			item_coord_rewind(item);
+			route_graph_process_item(this, item, profile);
 		}
-		s=p_min->end;
-		while (s) { /* Doing the same as above with the segments leading towards our point */
-			val=route_value_seg(profile, p_min, s, 1);
-			if (val != INT_MAX && item_is_equal(s->data.item,p_min->seg->data.item)) {
-				if (profile->turn_around_penalty2)
-					val+=profile->turn_around_penalty2;
-				else
-					val=INT_MAX;
-			}
-			if (val != INT_MAX) {
-				new=min+val;
-				if (debug_route)
-					printf("end %d len %d vs %d (0x%x,0x%x)\n",new,val,s->start->value,s->start->c.x, s->start->c.y);
-				if (new < s->start->value) {
-					s->start->value=new;
-					s->start->seg=s;
-					if (! s->start->el) {
-						if (debug_route)
-							printf("insert_start p=%p el=%p val=%d ", s->start, s->start->el, s->start->value);
-						s->start->el=fh_insertkey(heap, new, s->start);
-						if (debug_route)
-							printf("el new=%p\n", s->start->el);
-					}
-					else {
-						if (debug_route)
-							printf("replace_start p=%p el=%p val=%d\n", s->start, s->start->el, s->start->value);
-						fh_replacekey(heap, s->start->el, new);
-					}
-				}
-				if (debug_route)
-					printf("\n");
-			}
-			s=s->end_next;
+	}
+	map_rect_destroy(mr);
+	route_free_selection(sel);
+	if (this->route_segments == old)
+		return 0;
+	for (l=traffic ; l ; l=g_list_next(l))
+		route_graph_apply_traffic(this, l->data, 0, ends);
+	for (s=this->route_segments ; s != old ; s=s->next) {
+		p[0]=s->start;
+		p[1]=s->end;
+		for (i = 0 ; i < 2 ; i++) {
+			if ((p[i]->flags & (RP_TURN_RESTRICTION|RP_TURN_RESTRICTION_RESOLVED)) == RP_TURN_RESTRICTION)
+				route_graph_process_restriction_point(this, p[i]);
 		}
 	}
-	fh_deleteheap(heap);
-	callback_call_0(cb);
-	dbg(lvl_debug,"return\n");
+	return route_graph_get_segment(this, sd, NULL) != NULL;
 }
 
 /**
- * @brief Starts an "offroad" path
+ * @brief Checks if the last flood of a route graph is usable for a given position
  *
- * This starts a path that is not located on a street. It creates a new route path
- * adding only one segment, that leads from pos to dest, and which is not associated with an item.
+ * A full flood covers every position. After a partial (goal-directed) flood only the points which
+ * were settled carry costs, which is enough if the position lies on the street the flood was
+ * directed at or if both ends of the position's street have been settled.
  *
- * @param this Not used
- * @param pos The starting position for the new path
- * @param dst The destination of the new path
- * @param dir Not used
- * @return The new path
+ * @param this The route graph
+ * @param pos The position to check
+ * @return True if route_path_new() can use the costs of the graph for this position
  */
-static struct route_path *
-route_path_new_offroad(struct route_graph *this, struct route_info *pos, struct route_info *dst)
+static int
+route_graph_flood_covers(struct route_graph *this, struct route_info *pos)
 {
-	struct route_path *ret;
+	struct route_graph_segment *s=NULL;
+	if (!this->flood_partial || item_is_equal(this->flood_item, pos->street->item))
+		return 1;
+	while ((s=route_graph_get_segment(this, pos->street, s))) {
+		if (s->start->value == INT_MAX || s->end->value == INT_MAX)
+			return 0;
+	}
+	return 1;
+}
 
-	ret=g_new0(struct route_path, 1);
-	ret->in_use=1;
-	ret->path_hash=item_hash_new();
-	route_path_add_line(ret, &pos->c, &dst->c, pos->lenextra+dst->lenextra);
-	ret->updated=1;
+/**
+ * @brief Returns the queue to flood a route graph with, as selected by the vehicle profile
+ *
+ * The radix heap requires that no key below the last extracted one is queued. A* can not promise
+ * that, since its estimate is not consistent if a speed profile or a traffic distortion makes a
+ * segment faster than the road profile, and neither can route_graph_flood_repair(), which queues the
+ * lowered costs of points behind those already extracted. Such searches use the 4-ary heap instead.
+ *
+ * @param profile The vehicle profile
+ * @param monotone True if the search never queues a key below the last extracted one
+ * @return The type of the queue
+ */
+static enum route_heap_type
+route_graph_heap_type(struct vehicleprofile *profile, int monotone)
+{
+	if (profile->route_heap == route_heap_radix && !monotone)
+		return route_heap_dary;
+	return profile->route_heap;
+}
 
-	return ret;
+/**
+ * @brief Creates the queue for flooding a route graph, see route_graph_heap_type()
+ *
+ * @param profile The vehicle profile
+ * @param monotone True if the search never queues a key below the last extracted one
+ * @param labels True to queue segment labels (see {@code struct route_graph_turn_label}) instead of points
+ */
+static struct route_heap *
+route_graph_heap_new(struct vehicleprofile *profile, int monotone, int labels)
+{
+	return route_heap_new(route_graph_heap_type(profile, monotone),
+		labels ? offsetof(struct route_graph_turn_label, el) : offsetof(struct route_graph_point, el));
 }
 
 /**
- * @brief Returns a coordinate at a given distance
+ * @brief Returns the label of driving a segment towards a point
+ */
+static struct route_graph_turn_label *
+route_graph_turn_label_in(struct route_graph_segment *s, struct route_graph_point *p)
+{
+	return &s->labels[s->end != p];
+}
+
+/**
+ * @brief Returns the cost of driving the segment of a label in the direction of the label
  *
- * This function returns the coordinate, where the user will be if he
- * follows the current route for a certain distance.
+ * Without speed profiles the cost does not change during a flood, so it is calculated once per
+ * flood instead of once for every turn onto the segment.
  *
- * @param this_ The route we're driving upon
- * @param dist The distance in meters
- * @return The coordinate where the user will be in that distance
+ * @param label The label
+ * @param profile The vehicle profile
+ * @param speeds The speeds to pass to route_value_seg()
+ * @return The cost, {@code INT_MAX} if the segment can not be driven in this direction
  */
-struct coord 
-route_get_coord_dist(struct route *this_, int dist)
+static int
+route_graph_turn_label_cost(struct route_graph_turn_label *label, struct vehicleprofile *profile, unsigned char *speeds)
 {
-	int d,l,i,len;
-	int dx,dy;
-	double frac;
-	struct route_path_segment *cur;
-	struct coord ret;
-	enum projection pro=route_projection(this_);
-	struct route_info *dst=route_get_dst(this_);
+	int dir=label-label->seg->labels;
 
-	d = dist;
+	if (speeds)
+		return route_value_seg(profile, NULL, label->seg, dir ? -1 : 1, speeds);
+	if (label->cost == -1)
+		label->cost=route_value_seg(profile, NULL, label->seg, dir ? -1 : 1, NULL);
+	return label->cost;
+}
 
-	if (!this_->path2 || pro == projection_none) {
-		return this_->pos->c;
+/**
+ * @brief Returns the route weight of the road profile of the segment of a label, 0 if there is none
+ */
+static int
+route_graph_turn_label_weight(struct route_graph_turn_label *label, struct vehicleprofile *profile)
+{
+	struct roadprofile *rp;
+
+	if (label->weight == -1) {
+		rp=vehicleprofile_get_roadprofile(profile, label->seg->data.item.type);
+		label->weight=rp ? rp->route_weight : 0;
 	}
-	
-	ret = this_->pos->c;
-	cur = this_->path2->path;
-	while (cur) {
-		if (cur->data->len < d) {
-			d -= cur->data->len;
-		} else {
-			for (i=0; i < (cur->ncoords-1); i++) {
-				l = d;
-				len = (int)transform_polyline_length(pro, (cur->c + i), 2);
-				d -= len;
-				if (d <= 0) { 
-					// We interpolate a bit here...
-					frac = (double)l / len;
-					
-					dx = (cur->c + i + 1)->x - (cur->c + i)->x;
-					dy = (cur->c + i + 1)->y - (cur->c + i)->y;
-					
-					ret.x = (cur->c + i)->x + (frac * dx);
-					ret.y = (cur->c + i)->y + (frac * dy);
-					return ret;
-				}
-			}
-			return cur->c[(cur->ncoords-1)];
-		}
-		cur = cur->next;
-	}
-
-	return dst->c;
+	return label->weight;
 }
 
 /**
- * @brief Creates a new route path
- * 
- * This creates a new non-trivial route. It therefore needs the routing information created by route_graph_flood, so
- * make sure to run route_graph_flood() after changing the destination before using this function.
+ * @brief Returns the cost of turning from one segment into another
  *
- * @param this The route graph to create the route from
- * @param oldpath (Optional) old path which may contain parts of the new part - this speeds things up a bit. May be NULL.
- * @param pos The starting position of the route
- * @param dst The destination of the route
- * @param preferences The routing preferences
- * @return The new route path
+ * Turning costs grow with the angle of the turn, with separate penalties for turns to the left and
+ * to the right, so that turns across oncoming traffic can be made more expensive. Turning onto a
+ * road which is faster than the one the vehicle comes from means giving way, which costs
+ * {@code turn_penalty_yield} on top.
+ *
+ * Forbidden turns are not handled here, they are resolved when the graph is built (see
+ * route_graph_process_restrictions()).
+ *
+ * @param profile The vehicle profile
+ * @param from The label of the segment over which the turn point is reached
+ * @param to The label of the segment over which the turn point is left
+ * @return The cost in tenths of seconds
  */
-static struct route_path *
-route_path_new(struct route_graph *this, struct route_path *oldpath, struct route_info *pos, struct route_info *dst, struct vehicleprofile *profile)
+static int
+route_turn_cost(struct vehicleprofile *profile, struct route_graph_turn_label *from, struct route_graph_turn_label *to)
 {
-	struct route_graph_segment *s=NULL,*s1=NULL,*s2=NULL; /* candidate segments for cheapest path */
-	struct route_graph_point *start; /* point at which the next segment starts, i.e. up to which the path is complete */
-	struct route_info *posinfo, *dstinfo; /* same as pos and dst, but NULL if not part of current segment */
-	int segs=0,dir; /* number of segments added to graph, direction of first segment */
-	int val1=INT_MAX,val2=INT_MAX; /* total cost for s1 and s2, respectively */
-	int val,val1_new,val2_new;
-	struct route_path *ret;
-
-	if (! pos->street || ! dst->street) {
-		dbg(lvl_error,"pos or dest not set\n");
-		return NULL;
-	}
-
-	if (profile->mode == 2 || (profile->mode == 0 && pos->lenextra + dst->lenextra > transform_distance(map_projection(pos->street->item.map), &pos->c, &dst->c)))
-		return route_path_new_offroad(this, pos, dst);
-	while ((s=route_graph_get_segment(this, pos->street, s))) {
-		val=route_value_seg(profile, NULL, s, 2);
-		if (val != INT_MAX && s->end->value != INT_MAX) {
-			val=val*(100-pos->percent)/100;
-			dbg(lvl_debug,"val1 %d\n",val);
-			if (route_graph_segment_match(s,this->avoid_seg) && pos->street_direction < 0)
-				val+=profile->turn_around_penalty;
-			dbg(lvl_debug,"val1 %d\n",val);
-			val1_new=s->end->value+val;
-			dbg(lvl_debug,"val1 +%d=%d\n",s->end->value,val1_new);
-			if (val1_new < val1) {
-				val1=val1_new;
-				s1=s;
-			}
-		}
-		val=route_value_seg(profile, NULL, s, -2);
-		if (val != INT_MAX && s->start->value != INT_MAX) {
-			val=val*pos->percent/100;
-			dbg(lvl_debug,"val2 %d\n",val);
-			if (route_graph_segment_match(s,this->avoid_seg) && pos->street_direction > 0)
-				val+=profile->turn_around_penalty;
-			dbg(lvl_debug,"val2 %d\n",val);
-			val2_new=s->start->value+val;
-			dbg(lvl_debug,"val2 +%d=%d\n",s->start->value,val2_new);
-			if (val2_new < val2) {
-				val2=val2_new;
-				s2=s;
-			}
-		}
-	}
-	if (val1 == INT_MAX && val2 == INT_MAX) {
-		dbg(lvl_error,"no route found, pos blocked\n");
-		return NULL;
-	}
-	if (val1 == val2) {
-		val1=s1->end->value;
-		val2=s2->start->value;
-	}
-	if (val1 < val2) {
-		start=s1->start;
-		s=s1;
-		dir=1;
-	} else {
-		start=s2->end;
-		s=s2;
-		dir=-1;
-	}
-	if (pos->street_direction && dir != pos->street_direction && profile->turn_around_penalty) {
-		if (!route_graph_segment_match(this->avoid_seg,s)) {
-			dbg(lvl_debug,"avoid current segment\n");
-			if (this->avoid_seg)
-				route_graph_set_traffic_distortion(this, this->avoid_seg, 0);
-			this->avoid_seg=s;
-			route_graph_set_traffic_distortion(this, this->avoid_seg, profile->turn_around_penalty);
-			route_graph_reset(this);
-			route_graph_flood(this, dst, profile, NULL);
-			return route_path_new(this, oldpath, pos, dst, profile);
-		}
+	int in,out,delta,ret=0,weight;
+
+	in=(from == from->seg->labels) ? from->seg->end_dir : (from->seg->start_dir+128)&255;
+	out=(to == to->seg->labels) ? to->seg->start_dir : (to->seg->end_dir+128)&255;
+	delta=(signed char)(out-in);
+	if (delta > ROUTE_TURN_STRAIGHT)
+		ret=profile->turn_penalty_right*delta/64;
+	else if (delta < -ROUTE_TURN_STRAIGHT)
+		ret=-profile->turn_penalty_left*delta/64;
+	if (profile->turn_penalty_yield) {
+		weight=route_graph_turn_label_weight(from, profile);
+		if (weight && route_graph_turn_label_weight(to, profile) > weight)
+			ret+=profile->turn_penalty_yield;
 	}
-	ret=g_new0(struct route_path, 1);
-	ret->in_use=1;
-	ret->updated=1;
-	if (pos->lenextra) 
-		route_path_add_line(ret, &pos->c, &pos->lp, pos->lenextra);
-	ret->path_hash=item_hash_new();
-	dstinfo=NULL;
-	posinfo=pos;
-	while (s && !dstinfo) { /* following start->seg, which indicates the least costly way to reach our destination */
-		segs++;
-#if 0
-		printf("start->value=%d 0x%x,0x%x\n", start->value, start->c.x, start->c.y);
-#endif
-		if (s->start == start) {		
-			if (item_is_equal(s->data.item, dst->street->item) && (s->end->seg == s || !posinfo))
-				dstinfo=dst;
-			if (!route_path_add_item_from_graph(ret, oldpath, s, 1, posinfo, dstinfo))
-				ret->updated=0;
-			start=s->end;
-		} else {
-			if (item_is_equal(s->data.item, dst->street->item) && (s->start->seg == s || !posinfo))
-				dstinfo=dst;
-			if (!route_path_add_item_from_graph(ret, oldpath, s, -1, posinfo, dstinfo))
-				ret->updated=0;
-			start=s->start;
-		}
-		posinfo=NULL;
-		s=start->seg;
-	}
-	if (dst->lenextra) 
-		route_path_add_line(ret, &dst->lp, &dst->c, dst->lenextra);
-	dbg(lvl_debug, "%d segments\n", segs);
 	return ret;
 }
 
+/**
+ * @brief Checks if a vehicle profile has turn costs
+ *
+ * Floods with turn costs label the segments of the graph instead of its points, see
+ * {@code struct route_graph_turn_label}.
+ */
 static int
-route_graph_build_next_map(struct route_graph *rg)
+route_graph_turn_costs(struct vehicleprofile *profile)
 {
-	do {
-		rg->m=mapset_next(rg->h, 2);
-		if (! rg->m)
-			return 0;
-		map_rect_destroy(rg->mr);
-		rg->mr=map_rect_new(rg->m, rg->sel);
-	} while (!rg->mr);
-		
-	return 1;
+	return profile->turn_penalty_left || profile->turn_penalty_right || profile->turn_penalty_yield;
 }
 
-
+/**
+ * @brief Returns the cost of a turn at a point in a flood with turn costs
+ *
+ * On top of route_turn_cost(), this covers what route_graph_flood_relax() and route_value_seg()
+ * charge at a point in a flood without turn costs: A segment can not be left over itself, turning
+ * onto another segment of the same street costs {@code turn_around_penalty2} and is not possible
+ * if that is not set, and the through traffic penalty applies to the segment whose label is
+ * updated if it is closed to through traffic and the other segment is not.
+ *
+ * @param profile The vehicle profile
+ * @param from The label of the segment over which the turn point is reached
+ * @param to The label of the segment over which the turn point is left
+ * @param forward True if {@code to} is updated, as in a forward flood, false if {@code from} is
+ * @return The cost in tenths of seconds, or {@code INT_MAX} if the turn is not possible
+ */
 static int
-is_turn_allowed(struct route_graph_point *p, struct route_graph_segment *from, struct route_graph_segment *to)
+route_graph_turn_penalty(struct vehicleprofile *profile, struct route_graph_turn_label *from, struct route_graph_turn_label *to, int forward)
 {
-	struct route_graph_point *prev,*next;
-	struct route_graph_segment *tmp1,*tmp2;
-	if (item_is_equal(from->data.item, to->data.item))
-		return 0;
-	if (from->start == p)
-		prev=from->end;
-	else
-		prev=from->start;
-	if (to->start == p)
-		next=to->end;
-	else
-		next=to->start;
-	tmp1=p->end;
-	while (tmp1) {
-		if (tmp1->start->c.x == prev->c.x && tmp1->start->c.y == prev->c.y &&
-			(tmp1->data.item.type == type_street_turn_restriction_no ||
-			tmp1->data.item.type == type_street_turn_restriction_only)) {
-			tmp2=p->start;
-			dbg(lvl_debug,"found %s (0x%x,0x%x) (0x%x,0x%x)-(0x%x,0x%x) %p-%p\n",item_to_name(tmp1->data.item.type),tmp1->data.item.id_hi,tmp1->data.item.id_lo,tmp1->start->c.x,tmp1->start->c.y,tmp1->end->c.x,tmp1->end->c.y,tmp1->start,tmp1->end);
-			while (tmp2) {
-				dbg(lvl_debug,"compare %s (0x%x,0x%x) (0x%x,0x%x)-(0x%x,0x%x) %p-%p\n",item_to_name(tmp2->data.item.type),tmp2->data.item.id_hi,tmp2->data.item.id_lo,tmp2->start->c.x,tmp2->start->c.y,tmp2->end->c.x,tmp2->end->c.y,tmp2->start,tmp2->end);
-				if (item_is_equal(tmp1->data.item, tmp2->data.item)) 
-					break;
-				tmp2=tmp2->start_next;
-			}
-			dbg(lvl_debug,"tmp2=%p\n",tmp2);
-			if (tmp2) {
-				dbg(lvl_debug,"%s tmp2->end=%p next=%p\n",item_to_name(tmp1->data.item.type),tmp2->end,next);
-			}
-			if (tmp1->data.item.type == type_street_turn_restriction_no && tmp2 && tmp2->end->c.x == next->c.x && tmp2->end->c.y == next->c.y) {
-				dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x not allowed (no)\n",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,next->c.y);
-				return 0;
-			}
-			if (tmp1->data.item.type == type_street_turn_restriction_only && tmp2 && (tmp2->end->c.x != next->c.x || tmp2->end->c.y != next->c.y)) {
-				dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x not allowed (only)\n",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,next->c.y);
-				return 0;
-			}
-		}
-		tmp1=tmp1->end_next;
+	struct route_graph_segment *over=forward ? to->seg : from->seg,*other=forward ? from->seg : to->seg;
+	int ret;
+
+	if (from->seg == to->seg)
+		return INT_MAX;
+	ret=route_turn_cost(profile, from, to);
+	if (item_is_equal(from->seg->data.item, to->seg->data.item)) {
+		if (!profile->turn_around_penalty2)
+			return INT_MAX;
+		ret+=profile->turn_around_penalty2;
 	}
-	dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x allowed\n",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,next->c.y);
-	return 1;
+	if (!route_through_traffic_allowed(profile, over) && route_through_traffic_allowed(profile, other))
+		ret+=profile->through_traffic_penalty;
+	return ret;
 }
 
-static void
-route_graph_clone_segment(struct route_graph *this, struct route_graph_segment *s, struct route_graph_point *start, struct route_graph_point *end, int flags)
+/**
+ * @brief Returns the point at which a flood with turn costs continues from a label
+ *
+ * @param label The label
+ * @param forward True for a forward flood, which continues where the segment is left, false for a
+ * flood towards the destination, which continues where the segment is entered
+ */
+static struct route_graph_point *
+route_graph_turn_label_point(struct route_graph_turn_label *label, int forward)
 {
-	struct route_graph_segment_data data;
-	data.item=&s->data.item;
-	data.offset=1;
-	data.flags=s->data.flags|flags;
-	data.len=s->data.len+1;
-	data.maxspeed=-1;
-	data.dangerous_goods=0;
-	if (s->data.flags & AF_SPEED_LIMIT)
-		data.maxspeed=RSD_MAXSPEED(&s->data);
-	if (s->data.flags & AF_SEGMENTED) 
-		data.offset=RSD_OFFSET(&s->data);
-	dbg(lvl_debug,"cloning segment from %p (0x%x,0x%x) to %p (0x%x,0x%x)\n",start,start->c.x,start->c.y, end, end->c.x, end->c.y);
-	route_graph_add_segment(this, start, end, &data);
+	int dir=label-label->seg->labels;
+	return dir == !!forward ? label->seg->start : label->seg->end;
 }
 
+/**
+ * @brief Lowers the cost of a label and queues it
+ *
+ * @param heap The heap of labels with temporarily calculated costs
+ * @param label The label
+ * @param value The new cost
+ * @param key The key to queue the label with, i.e. {@code value} plus the estimate of a goal-directed flood
+ */
 static void
-route_graph_process_restriction_segment(struct route_graph *this, struct route_graph_point *p, struct route_graph_segment *s, int dir)
+route_graph_turn_label_set(struct route_heap *heap, struct route_graph_turn_label *label, int value, int key)
 {
-	struct route_graph_segment *tmp;
-	struct route_graph_point *pn;
-	struct coord c=p->c;
-	int dx=0;
-	int dy=0;
-	c.x+=dx;
-	c.y+=dy;
-	dbg(lvl_debug,"From %s %d,%d\n",item_to_name(s->data.item.type),dx,dy);
-	pn=route_graph_point_new(this, &c);
-	if (dir > 0) { /* going away */
-		dbg(lvl_debug,"other 0x%x,0x%x\n",s->end->c.x,s->end->c.y);
-		if (s->data.flags & AF_ONEWAY) {
-			dbg(lvl_debug,"Not possible\n");
-			return;
-		}
-		route_graph_clone_segment(this, s, pn, s->end, AF_ONEWAYREV);
-	} else { /* coming in */
-		dbg(lvl_debug,"other 0x%x,0x%x\n",s->start->c.x,s->start->c.y);
-		if (s->data.flags & AF_ONEWAYREV) {
-			dbg(lvl_debug,"Not possible\n");
-			return;
-		}
-		route_graph_clone_segment(this, s, s->start, pn, AF_ONEWAY);
-	}
-	tmp=p->start;
-	while (tmp) {
-		if (tmp != s && tmp->data.item.type != type_street_turn_restriction_no &&
-			tmp->data.item.type != type_street_turn_restriction_only &&
-			!(tmp->data.flags & AF_ONEWAYREV) && is_turn_allowed(p, s, tmp)) {
-			route_graph_clone_segment(this, tmp, pn, tmp->end, AF_ONEWAY);
-			dbg(lvl_debug,"To start %s\n",item_to_name(tmp->data.item.type));
-		}
-		tmp=tmp->start_next;
-	}
-	tmp=p->end;
-	while (tmp) {
-		if (tmp != s && tmp->data.item.type != type_street_turn_restriction_no &&
-			tmp->data.item.type != type_street_turn_restriction_only &&
-			!(tmp->data.flags & AF_ONEWAY) && is_turn_allowed(p, s, tmp)) {
-			route_graph_clone_segment(this, tmp, tmp->start, pn, AF_ONEWAYREV);
-			dbg(lvl_debug,"To end %s\n",item_to_name(tmp->data.item.type));
-		}
-		tmp=tmp->end_next;
-	}
+	label->value=value;
+	label->dst=0;
+	if (label->el)
+		route_heap_decrease(heap, label, key);
+	else
+		route_heap_insert(heap, label, key);
 }
 
+/**
+ * @brief Updates the labels of all segments connected to a segment whose label has become final
+ *
+ * This is route_graph_flood_relax() for floods with turn costs. A flood towards the destination
+ * updates the labels of the segments which lead to the point at which the segment of {@code label}
+ * is entered, a forward flood those of the segments which leave the point at which it is left. The
+ * costs include the turn at that point, see route_graph_turn_penalty().
+ *
+ * @param graph The route graph
+ * @param heap The heap of labels with temporarily calculated costs
+ * @param label The label whose cost is final
+ * @param profile The vehicle profile to use for routing
+ * @param target The coordinates a goal-directed flood is directed at, or {@code NULL}
+ * @param pro The projection of {@code target}
+ * @param speed The highest speed possible in the graph, used for the estimate towards {@code target}
+ * @param forward If true, costs are those of driving away from the start (see route_graph_flood_forward()),
+ * otherwise those of driving towards the destination
+ */
 static void
-route_graph_process_restriction_point(struct route_graph *this, struct route_graph_point *p)
+route_graph_turn_relax(struct route_graph *graph, struct route_heap *heap, struct route_graph_turn_label *label, struct vehicleprofile *profile,
+		struct coord *target, enum projection pro, int speed, int forward)
 {
-	struct route_graph_segment *tmp;
-	tmp=p->start;
-	dbg(lvl_debug,"node 0x%x,0x%x\n",p->c.x,p->c.y);
-	while (tmp) {
-		if (tmp->data.item.type != type_street_turn_restriction_no &&
-			tmp->data.item.type != type_street_turn_restriction_only)
-			route_graph_process_restriction_segment(this, p, tmp, 1);
-		tmp=tmp->start_next;
+	struct route_graph_point *p=route_graph_turn_label_point(label, forward);
+	struct route_graph_turn_label *next;
+	struct route_graph_segment *s;
+	int i,dir,val,new;
+	unsigned char *speeds=NULL;
+
+	if (graph->speed_profiles) {
+		if (forward)
+			speeds=route_graph_speeds(graph, label->value);
+		else
+			speeds=route_graph_speeds(graph, target ? route_graph_flood_estimate(&p->c, target, pro, speed) : 0);
 	}
-	tmp=p->end;
-	while (tmp) {
-		if (tmp->data.item.type != type_street_turn_restriction_no &&
-			tmp->data.item.type != type_street_turn_restriction_only)
-			route_graph_process_restriction_segment(this, p, tmp, -1);
-		tmp=tmp->end_next;
+	/* The segments starting at p, then those ending at p */
+	for (i = 0 ; i < 2 ; i++) {
+		for (s=i ? p->end : p->start ; s ; s=i ? s->end_next : s->start_next) {
+			if (!s->labels)
+				continue;
+			/* A forward flood leaves p over s, a flood towards the destination reaches p over it */
+			dir=forward ? i : !i;
+			next=&s->labels[dir];
+			val=route_graph_turn_label_cost(next, profile, speeds);
+			/* Turns do not lower costs, so the turn only needs to be looked at if the label can still improve */
+			if (val == INT_MAX || label->value+val >= next->value)
+				continue;
+			new=forward ? route_graph_turn_penalty(profile, label, next, 1) : route_graph_turn_penalty(profile, next, label, 0);
+			if (new == INT_MAX)
+				continue;
+			new+=label->value+val;
+			if (new >= next->value)
+				continue;
+			route_graph_turn_label_set(heap, next, new,
+				target ? new+route_graph_flood_estimate(&route_graph_turn_label_point(next, forward)->c, target, pro, speed) : new);
+		}
 	}
-	p->flags |= RP_TURN_RESTRICTION_RESOLVED;
 }
 
-static void
-route_graph_process_restrictions(struct route_graph *this)
+/**
+ * @brief Returns the cost of getting from a point to the destination after reaching it over a segment
+ *
+ * Without turn costs, this is the cost of the point, and the way goes on over the segment of the
+ * point. After a flood with turn costs, the turn at the point counts: The way goes on over the
+ * segment whose label plus the cost of turning into it is lowest. If the destination lies on
+ * {@code from} itself, reaching it by driving back over {@code from} counts as well, as it does without
+ * turn costs.
+ *
+ * @param this The route graph, flooded towards the destination
+ * @param profile The vehicle profile the graph was flooded with
+ * @param p The point
+ * @param from The segment over which {@code p} is reached
+ * @param next Receives the segment to go on with, {@code NULL} if there is none. May be {@code NULL}.
+ * @return The cost, {@code INT_MAX} if the destination can not be reached
+ */
+static int
+route_graph_point_value(struct route_graph *this, struct vehicleprofile *profile, struct route_graph_point *p,
+		struct route_graph_segment *from, struct route_graph_segment **next)
 {
-	struct route_graph_point *curr;
-	int i;
-	dbg(lvl_debug,"enter\n");
-	for (i = 0 ; i < HASH_SIZE ; i++) {
-		curr=this->hash[i];
-		while (curr) {
-			if (curr->flags & RP_TURN_RESTRICTION) 
-				route_graph_process_restriction_point(this, curr);
-			curr=curr->hash_next;
+	struct route_graph_segment *s,*best=p->seg;
+	int i,val,ret=p->value;
+
+	if (this->turn_labels && from->labels) {
+		best=NULL;
+		ret=INT_MAX;
+		if (from->labels[from->start != p].dst) {
+			best=from;
+			ret=from->labels[from->start != p].value;
+		}
+		/* The segments starting at p, then those ending at p */
+		for (i = 0 ; i < 2 ; i++) {
+			for (s=i ? p->end : p->start ; s ; s=i ? s->end_next : s->start_next) {
+				if (!s->labels || s->labels[i].value == INT_MAX)
+					continue;
+				val=route_graph_turn_penalty(profile, route_graph_turn_label_in(from, p), &s->labels[i], 0);
+				if (val == INT_MAX || s->labels[i].value+val >= ret)
+					continue;
+				ret=s->labels[i].value+val;
+				best=s;
+			}
 		}
 	}
+	if (next)
+		*next=best;
+	return ret;
 }
 
+/**
+ * @brief Updates the costs of all neighbors of a point whose cost has become final
+ *
+ * This is one step of Dijkstra's algorithm as used by route_graph_flood() and
+ * route_graph_flood_repair(). Every neighbor which can be reached more cheaply through {@code p_min}
+ * is updated and inserted into the heap, or its key on the heap is lowered. This is only used if
+ * the vehicle profile has no turn costs, see route_graph_turn_relax() otherwise.
+ *
+ * @param graph The route graph
+ * @param heap The heap of points with temporarily calculated costs
+ * @param p_min The point whose cost is final
+ * @param profile The vehicle profile to use for routing
+ * @param target The coordinates a goal-directed flood is directed at, or {@code NULL}
+ * @param pro The projection of {@code target}
+ * @param speed The highest speed possible in the graph, used for the estimate towards {@code target}
+ * @param forward If true, costs are those of driving away from {@code p_min} (see route_graph_flood_forward()),
+ * otherwise those of driving towards it
+ */
 static void
-route_graph_build_done(struct route_graph *rg, int cancel)
+route_graph_flood_relax(struct route_graph *graph, struct route_heap *heap, struct route_graph_point *p_min, struct vehicleprofile *profile,
+		struct coord *target, enum projection pro, int speed, int forward)
 {
-	dbg(lvl_debug,"cancel=%d\n",cancel);
-	if (rg->idle_ev)
-		event_remove_idle(rg->idle_ev);
-	if (rg->idle_cb)
-		callback_destroy(rg->idle_cb);
-	map_rect_destroy(rg->mr);
-        mapset_close(rg->h);
-	route_free_selection(rg->sel);
-	rg->idle_ev=NULL;
-	rg->idle_cb=NULL;
-	rg->mr=NULL;
-	rg->h=NULL;
-	rg->sel=NULL;
-	if (! cancel) {
-		route_graph_process_restrictions(rg);
-		callback_call_0(rg->done_cb);
+	struct route_graph_segment *s;
+	int min=p_min->value,new,val;
+	unsigned char *speeds=NULL;
+
+	if (graph->speed_profiles) {
+		/* The time at which p_min is passed: known for a forward flood, estimated from the
+		 * distance to the start otherwise */
+		if (forward)
+			speeds=route_graph_speeds(graph, min);
+		else
+			speeds=route_graph_speeds(graph, target ? route_graph_flood_estimate(&p_min->c, target, pro, speed) : 0);
 	}
-	rg->busy=0;
-}
-
-static void
-route_graph_build_idle(struct route_graph *rg, struct vehicleprofile *profile)
-{
-	int count=1000;
-	struct item *item;
 
-	while (count > 0) {
-		for (;;) {	
-			item=map_rect_get_item(rg->mr);
-			if (item)
-				break;
-			if (!route_graph_build_next_map(rg)) {
-				route_graph_build_done(rg, 0);
-				return;
+	s=p_min->start;
+	while (s) { /* Iterating all the segments leading away from our point to update the points at their ends */
+		val=route_value_seg(profile, p_min, s, forward ? 1 : -1, speeds);
+		if (val != INT_MAX && item_is_equal(s->data.item,p_min->seg->data.item)) {
+			if (profile->turn_around_penalty2)
+				val+=profile->turn_around_penalty2;
+			else
+				val=INT_MAX;
+		}
+		if (val != INT_MAX) {
+			new=min+val;
+			if (debug_route)
+				printf("begin %d len %d vs %d (0x%x,0x%x)\n",new,val,s->end->value, s->end->c.x, s->end->c.y);
+			if (new < s->end->value) { /* We've found a less costly way to reach the end of s, update it */
+				s->end->value=new;
+				s->end->seg=s;
+				if (target)
+					new+=route_graph_flood_estimate(&s->end->c, target, pro, speed);
+				if (! s->end->el) {
+					if (debug_route)
+						printf("insert_end p=%p el=%p val=%d ", s->end, s->end->el, s->end->value);
+					route_heap_insert(heap, s->end, new);
+					if (debug_route)
+						printf("el new=%p\n", s->end->el);
+				}
+				else {
+					if (debug_route)
+						printf("replace_end p=%p el=%p val=%d\n", s->end, s->end->el, s->end->value);
+					route_heap_decrease(heap, s->end, new);
+				}
 			}
+			if (debug_route)
+				printf("\n");
 		}
-		if (item->type == type_traffic_distortion)
-			route_process_traffic_distortion(rg, item);
-		else if (item->type == type_street_turn_restriction_no || item->type == type_street_turn_restriction_only)
-			route_process_turn_restriction(rg, item);
-		else
-			route_process_street_graph(rg, item, profile);
-		count--;
+		s=s->start_next;
+	}
+	s=p_min->end;
+	while (s) { /* Doing the same as above with the segments leading towards our point */
+		val=route_value_seg(profile, p_min, s, forward ? -1 : 1, speeds);
+		if (val != INT_MAX && item_is_equal(s->data.item,p_min->seg->data.item)) {
+			if (profile->turn_around_penalty2)
+				val+=profile->turn_around_penalty2;
+			else
+				val=INT_MAX;
+		}
+		if (val != INT_MAX) {
+			new=min+val;
+			if (debug_route)
+				printf("end %d len %d vs %d (0x%x,0x%x)\n",new,val,s->start->value,s->start->c.x, s->start->c.y);
+			if (new < s->start->value) {
+				s->start->value=new;
+				s->start->seg=s;
+				if (target)
+					new+=route_graph_flood_estimate(&s->start->c, target, pro, speed);
+				if (! s->start->el) {
+					if (debug_route)
+						printf("insert_start p=%p el=%p val=%d ", s->start, s->start->el, s->start->value);
+					route_heap_insert(heap, s->start, new);
+					if (debug_route)
+						printf("el new=%p\n", s->start->el);
+				}
+				else {
+					if (debug_route)
+						printf("replace_start p=%p el=%p val=%d\n", s->start, s->start->el, s->start->value);
+					route_heap_decrease(heap, s->start, new);
+				}
+			}
+			if (debug_route)
+				printf("\n");
+		}
+		s=s->end_next;
 	}
 }
 
 /**
- * @brief Builds a new route graph from a mapset
+ * @brief Calculates the routing costs for each point
  *
- * This function builds a new route graph from a map. Please note that this function does not
- * add any routing information to the route graph - this has to be done via the route_graph_flood()
- * function.
+ * This function is the heart of routing. It assigns each point in the route graph a
+ * cost at which one can reach the destination from this point on. Additionally it assigns
+ * each point a segment one should follow from this point on to reach the destination at the
+ * stated costs.
+ * 
+ * This function uses Dijkstra's algorithm to do the routing. To understand it you should have a look
+ * at this algorithm.
  *
- * The function does not create a graph covering the whole map, but only covering the rectangle
- * between c1 and c2.
+ * If the vehicle profile selects {@code route_search_astar} or {@code route_search_ch} and {@code pos}
+ * is given, the search is directed towards {@code pos} using the straight-line travel time as
+ * estimate (A*), and it stops as soon as no cheaper way to the street of {@code pos} can be found. Only the points settled up to
+ * then keep their costs, all others are reset to {@code INT_MAX}. Callers which need costs for
+ * every point (e.g. for re-routing off the path) must pass {@code NULL} as {@code pos}.
  *
- * @param ms The mapset to build the route graph from
- * @param c The coordinates of the destination or next waypoint
- * @param c1 Corner 1 of the rectangle to use from the map
- * @param c2 Corner 2 of the rectangle to use from the map
- * @param done_cb The callback which will be called when graph is complete
- * @return The new route graph.
+ * If the vehicle profile has turn costs, the cost of going on from a point depends on the segment
+ * it was reached over. The flood then labels both directions of each segment instead of the points,
+ * see {@code struct route_graph_turn_label}, and each point gets the cost of its cheapest label.
+ * route_path_new() follows the labels, see route_graph_point_value().
+ *
+ * References to elements of the route graph which were obtained prior to calling this function
+ * remain valid after it returns.
+ *
+ * @param this_ The route graph to flood
+ * @param dst The destination of the route
+ * @param pos The position the route will start at, or {@code NULL} to flood the whole graph
+ * @param profile The vehicle profile to use for routing. This determines which ways are passable
+ * and how their costs are calculated.
+ * @param cb The callback function to call when flooding is complete
  */
-// FIXME documentation does not match argument list
-static struct route_graph *
-route_graph_build(struct mapset *ms, struct coord *c, int count, struct callback *done_cb, int async, struct vehicleprofile *profile)
+static void
+route_graph_flood(struct route_graph *this, struct route_info *dst, struct route_info *pos, struct vehicleprofile *profile, struct callback *cb)
 {
-	struct route_graph *ret=g_new0(struct route_graph, 1);
+	struct route_graph_point *p_min;
+	struct route_graph_segment *s=NULL,*t=NULL;
+	struct route_graph_turn_label *label=NULL;
+	int min,val;
+	struct route_heap *heap; /* This heap will hold all points (or labels) with "temporarily" calculated costs */
+	enum projection pro=projection_none;
+	struct coord *target=NULL;
+	int speed=0,targets=0,target_len=0,best=INT_MAX,turns=route_graph_turn_costs(profile);
+	unsigned char *speeds=route_graph_speeds(this, 0);
+#ifdef HAVE_PTHREAD
+	int settled=0;
+#endif
 
-	dbg(lvl_debug,"enter\n");
+	/* profile() keeps its state in static variables, so the flood is only profiled on the main loop */
+	if (!this->worker)
+		profile(2,NULL);
 
-	ret->sel=route_calc_selection(c, count, profile);
-	ret->h=mapset_open(ms);
-	ret->done_cb=done_cb;
-	ret->busy=1;
-	if (route_graph_build_next_map(ret)) {
-		if (async) {
-			ret->idle_cb=callback_new_2(callback_cast(route_graph_build_idle), ret, profile);
-			ret->idle_ev=event_add_idle(50, ret->idle_cb);
+	this->floods++;
+	this->flood_partial=0;
+	if (turns)
+		route_graph_turn_labels(this);
+	else
+		route_graph_turn_labels_free(this);
+	if (pos && pos->street && profile->route_search_mode != route_search_full) {
+		speed=route_graph_max_speed(this, profile);
+		while (speed && (s=route_graph_get_segment(this, pos->street, s))) {
+			val=route_time_seg(profile, &s->data, NULL);
+			if (val != INT_MAX && speeds && s->speed_profile && speeds[s->speed_profile-1])
+				val=val*100/speeds[s->speed_profile-1];
+			if (val != INT_MAX && val > target_len)
+				target_len=val;
+			if (!(s->start->flags & RP_FLOOD_TARGET)) {
+				s->start->flags |= RP_FLOOD_TARGET;
+				targets++;
+			}
+			if (!(s->end->flags & RP_FLOOD_TARGET)) {
+				s->end->flags |= RP_FLOOD_TARGET;
+				targets++;
+			}
 		}
-	} else
-		route_graph_build_done(ret, 0);
-
-	return ret;
+		if (targets) {
+			pro=map_projection(pos->street->item.map);
+			target=&pos->lp;
+			target_len+=profile->turn_around_penalty;
+			this->flood_item=pos->street->item;
+			speeds=route_graph_speeds(this, route_graph_flood_estimate(&dst->lp, target, pro, speed));
+		}
+	}
+	heap=route_graph_heap_new(profile, !target, turns);
+	while ((s=route_graph_get_segment(this, dst->street, s))) {
+		val=route_value_seg(profile, NULL, s, -1, speeds);
+		if (val != INT_MAX) {
+			val=val*(100-dst->percent)/100;
+			if (turns) {
+				s->labels[1].value=val;
+				s->labels[1].dst=1;
+			} else {
+				s->end->seg=s;
+				s->end->value=val;
+			}
+			if (target)
+				val+=route_graph_flood_estimate(&s->end->c, target, pro, speed);
+			if (turns)
+				route_heap_insert(heap, &s->labels[1], val);
+			else
+				route_heap_insert(heap, s->end, val);
+		}
+		val=route_value_seg(profile, NULL, s, 1, speeds);
+		if (val != INT_MAX) {
+			val=val*dst->percent/100;
+			if (turns) {
+				s->labels[0].value=val;
+				s->labels[0].dst=1;
+			} else {
+				s->start->seg=s;
+				s->start->value=val;
+			}
+			if (target)
+				val+=route_graph_flood_estimate(&s->start->c, target, pro, speed);
+			if (turns)
+				route_heap_insert(heap, &s->labels[0], val);
+			else
+				route_heap_insert(heap, s->start, val);
+		}
+	}
+	for (;;) {
+		if (target) {
+			/* All ends of the position's street are settled, or nothing cheaper can show up any more.
+			 * With turn costs, the labels of a settled point may still lower the cost from the
+			 * position, so only the second condition holds then. */
+			if ((!targets && !turns) || (best != INT_MAX && !route_heap_empty(heap) && route_heap_min_key(heap) >= best)) {
+				this->flood_partial=1;
+				break;
+			}
+		}
+		if (turns) {
+			label=route_heap_extract_min(heap);
+			if (!label)
+				break;
+			label->el=NULL;
+			min=label->value;
+			/* The cost of a point is that of its cheapest label, as if it was reached without a turn */
+			p_min=route_graph_turn_label_point(label, 0);
+			if (min < p_min->value) {
+				p_min->value=min;
+				p_min->seg=label->seg;
+			}
+		} else {
+			p_min=route_heap_extract_min(heap); /* Starting Dijkstra by selecting the point with the minimum costs on the heap */
+			if (! p_min) /* There are no more points with temporarily calculated costs, Dijkstra has finished */
+				break;
+			min=p_min->value;
+			if (debug_route)
+				printf("extract p=%p free el=%p min=%d, 0x%x, 0x%x\n", p_min, p_min->el, min, p_min->c.x, p_min->c.y);
+			p_min->el=NULL; /* This point is permanently calculated now, we've taken it out of the heap */
+		}
+#ifdef HAVE_PTHREAD
+		if (this->worker && !(++settled % ROUTE_WORKER_CHECK) && route_worker_check(this->worker, settled*100LL/this->point_count))
+			break;
+#endif
+		if (turns) {
+			if (p_min->flags & RP_FLOOD_TARGET) {
+				/* Leaving the position's street at p_min into this label */
+				while ((t=route_graph_get_segment(this, pos->street, t))) {
+					if (t->start != p_min && t->end != p_min)
+						continue;
+					val=route_graph_turn_penalty(profile, route_graph_turn_label_in(t, p_min), label, 0);
+					if (val != INT_MAX && min+val < best-target_len)
+						best=min+val+target_len;
+				}
+			}
+			route_graph_turn_relax(this, heap, label, profile, target, pro, speed, 0);
+			continue;
+		}
+		if (p_min->flags & RP_FLOOD_TARGET) {
+			p_min->flags &= ~RP_FLOOD_TARGET;
+			targets--;
+			if (target_len != INT_MAX && min < best-target_len)
+				best=min+target_len;
+		}
+		route_graph_flood_relax(this, heap, p_min, profile, target, pro, speed, 0);
+	}
+	if (this->flood_partial) {
+		/* Costs of points (or labels) still on the heap are not final, forget about them */
+		if (turns) {
+			while ((label=route_heap_extract_min(heap))) {
+				label->value=INT_MAX;
+				label->dst=0;
+				label->el=NULL;
+			}
+		} else {
+			while ((p_min=route_heap_extract_min(heap))) {
+				p_min->value=INT_MAX;
+				p_min->seg=NULL;
+				p_min->el=NULL;
+			}
+		}
+	}
+	if (target) {
+		while ((s=route_graph_get_segment(this, pos->street, s))) {
+			s->start->flags &= ~RP_FLOOD_TARGET;
+			s->end->flags &= ~RP_FLOOD_TARGET;
+		}
+	}
+	this->heap_memory=route_heap_memory(heap);
+	route_heap_destroy(heap);
+	if (!this->worker)
+		profile(2,"%s flood done using %s heap%s\n", this->flood_partial ? "partial" : "full",
+			route_heap_type_name(route_graph_heap_type(profile, !target)), turns ? " and turn costs" : "");
+	callback_call_0(cb);
+	dbg(lvl_debug,"return\n");
 }
 
+/**
+ * @brief Lowers the cost at which a point can be reached from the start of a forward flood
+ */
 static void
-route_graph_update_done(struct route *this, struct callback *cb)
+route_graph_flood_forward_seed(struct route_heap *heap, struct route_graph_point *p, struct route_graph_segment *s, int val)
 {
-	route_graph_flood(this->graph, this->current_dst, this->vehicleprofile, cb);
+	if (val >= p->value)
+		return;
+	p->value=val;
+	p->seg=s;
+	if (p->el)
+		route_heap_decrease(heap, p, val);
+	else
+		route_heap_insert(heap, p, val);
 }
 
 /**
- * @brief Updates the route graph
+ * @brief Calculates the costs of reaching each point from a position, up to a limit
  *
- * This updates the route graph after settings in the route have changed. It also
- * adds routing information afterwards by calling route_graph_flood().
- * 
- * @param this The route to update the graph for
- * @param cb The callback function to call when the route graph update is complete (used only in asynchronous mode)
- * @param async Set to nonzero in order to update the route graph asynchronously
+ * This is the opposite of route_graph_flood(): Each point is assigned the cost at which it can be
+ * reached from {@code pos}, and the segment over which it is reached. The search stops as soon as
+ * the cheapest point left exceeds {@code limit}, points which cannot be reached within the limit
+ * keep a cost of {@code INT_MAX}.
+ *
+ * With turn costs, the segments are labelled as in route_graph_flood(), and each point gets the cost
+ * of the cheapest label it is reached with.
+ *
+ * The graph must not carry costs from a previous flood, see route_graph_reset().
+ *
+ * @param this The route graph to flood
+ * @param pos The position to start at
+ * @param profile The vehicle profile to use for routing
+ * @param limit The highest cost of interest, in tenths of seconds
  */
 static void
-route_graph_update(struct route *this, struct callback *cb, int async)
+route_graph_flood_forward(struct route_graph *this, struct route_info *pos, struct vehicleprofile *profile, int limit)
 {
-	struct attr route_status;
-	struct coord *c=g_alloca(sizeof(struct coord)*(1+g_list_length(this->destinations)));
-	int i=0;
-	GList *tmp;
+	struct route_graph_point *p_min;
+	struct route_graph_segment *s=NULL;
+	struct route_graph_turn_label *label;
+	struct route_heap *heap;
+	int val,turns=route_graph_turn_costs(profile);
 
-	route_status.type=attr_route_status;
-	route_graph_destroy(this->graph);
-	this->graph=NULL;
-	callback_destroy(this->route_graph_done_cb);
-	this->route_graph_done_cb=callback_new_2(callback_cast(route_graph_update_done), this, cb);
-	route_status.u.num=route_status_building_graph;
-	route_set_attr(this, &route_status);
-	c[i++]=this->pos->c;
-	tmp=this->destinations;
-	while (tmp) {
-		struct route_info *dst=tmp->data;
-		c[i++]=dst->c;
-		tmp=g_list_next(tmp);
+	profile(2,NULL);
+	if (turns)
+		route_graph_turn_labels(this);
+	else
+		route_graph_turn_labels_free(this);
+	heap=route_graph_heap_new(profile, 1, turns);
+	while ((s=route_graph_get_segment(this, pos->street, s))) {
+		val=route_value_seg(profile, NULL, s, 1, route_graph_speeds(this, 0));
+		if (val != INT_MAX) {
+			val=val*(100-pos->percent)/100;
+			if (turns)
+				route_graph_turn_label_set(heap, &s->labels[0], val, val);
+			else
+				route_graph_flood_forward_seed(heap, s->end, s, val);
+		}
+		val=route_value_seg(profile, NULL, s, -1, route_graph_speeds(this, 0));
+		if (val != INT_MAX) {
+			val=val*pos->percent/100;
+			if (turns)
+				route_graph_turn_label_set(heap, &s->labels[1], val, val);
+			else
+				route_graph_flood_forward_seed(heap, s->start, s, val);
+		}
 	}
-	this->graph=route_graph_build(this->ms, c, i, this->route_graph_done_cb, async, this->vehicleprofile);
-	if (! async) {
-		while (this->graph->busy) 
-			route_graph_build_idle(this->graph, this->vehicleprofile);
+	if (turns) {
+		while ((label=route_heap_extract_min(heap))) {
+			label->el=NULL;
+			if (label->value > limit) {
+				label->value=INT_MAX;
+				break;
+			}
+			/* The cost of a point is that of the cheapest label it is reached with */
+			p_min=route_graph_turn_label_point(label, 1);
+			if (label->value < p_min->value) {
+				p_min->value=label->value;
+				p_min->seg=label->seg;
+			}
+			route_graph_turn_relax(this, heap, label, profile, NULL, projection_none, 0, 1);
+		}
+		/* Labels still on the heap can not be reached within the limit */
+		while ((label=route_heap_extract_min(heap))) {
+			label->value=INT_MAX;
+			label->el=NULL;
+		}
+	} else {
+		while ((p_min=route_heap_extract_min(heap))) {
+			if (p_min->value > limit) {
+				p_min->value=INT_MAX;
+				p_min->seg=NULL;
+				break;
+			}
+			route_graph_flood_relax(this, heap, p_min, profile, NULL, projection_none, 0, 1);
+		}
+		/* Points still on the heap can not be reached within the limit */
+		while ((p_min=route_heap_extract_min(heap))) {
+			p_min->value=INT_MAX;
+			p_min->seg=NULL;
+		}
 	}
+	this->heap_memory=route_heap_memory(heap);
+	route_heap_destroy(heap);
+	profile(2,"forward flood done using %s heap%s\n", route_heap_type_name(route_graph_heap_type(profile, 1)),
+		turns ? " and turn costs" : "");
 }
 
 /**
- * @brief Gets street data for an item
+ * @brief Lowers the cost of a point if one of its settled neighbors offers a cheaper way
  *
- * @param item The item to get the data for
- * @return Street data for the item
+ * This is the reverse of route_graph_flood_relax(): Instead of updating the neighbors of a point,
+ * the point itself is updated from all neighbors whose costs are final.
+ *
+ * @param heap The heap of points with temporarily calculated costs
+ * @param p The point to update
+ * @param profile The vehicle profile to use for routing
+ * @param speeds The speeds of the historic speed profiles, see route_graph_speeds()
  */
-struct street_data *
-street_get_data (struct item *item)
+static void
+route_graph_flood_repair_point(struct route_heap *heap, struct route_graph_point *p, struct vehicleprofile *profile, unsigned char *speeds)
 {
-	int count=0,*flags;
-	struct street_data *ret = NULL, *ret1;
-	struct attr flags_attr, maxspeed_attr;
-	const int step = 128;
-	int c;
-
-	do {
-		ret1=g_realloc(ret, sizeof(struct street_data)+(count+step)*sizeof(struct coord));
-		if (!ret1) {
-			if (ret)
-				g_free(ret);
-			return NULL;
-		}
-		ret = ret1;
-		c = item_coord_get(item, &ret->c[count], step);
-		count += c;
-	} while (c && c == step);
-
-	ret1=g_realloc(ret, sizeof(struct street_data)+count*sizeof(struct coord));
-	if (ret1)
-		ret = ret1;
-	ret->item=*item;
-	ret->count=count;
-	if (item_attr_get(item, attr_flags, &flags_attr)) 
-		ret->flags=flags_attr.u.num;
-	else {
-		flags=item_get_default_flags(item->type);
-		if (flags)
-			ret->flags=*flags;
-		else
-			ret->flags=0;
-	}
+	struct route_graph_segment *s;
+	struct route_graph_point *q;
+	int val,dir;
 
-	ret->maxspeed = -1;
-	if (ret->flags & AF_SPEED_LIMIT) {
-		if (item_attr_get(item, attr_maxspeed, &maxspeed_attr)) {
-			ret->maxspeed = maxspeed_attr.u.num;
+	for (dir = -1 ; dir <= 1 ; dir+=2) {
+		s=(dir < 0) ? p->end : p->start;
+		while (s) {
+			q=(dir < 0) ? s->start : s->end;
+			if (q->value != INT_MAX && !q->el && q->seg) {
+				val=route_value_seg(profile, q, s, dir, speeds);
+				if (val != INT_MAX && item_is_equal(s->data.item,q->seg->data.item)) {
+					if (profile->turn_around_penalty2)
+						val+=profile->turn_around_penalty2;
+					else
+						val=INT_MAX;
+				}
+				if (val != INT_MAX && q->value+val < p->value) {
+					p->value=q->value+val;
+					p->seg=s;
+				}
+			}
+			s=(dir < 0) ? s->end_next : s->start_next;
 		}
 	}
-
-	return ret;
+	if (p->value == INT_MAX)
+		return;
+	if (!p->el)
+		route_heap_insert(heap, p, p->value);
+	else
+		route_heap_decrease(heap, p, p->value);
 }
 
 /**
- * @brief Copies street data
- * 
- * @param orig The street data to copy
- * @return The copied street data
- */ 
-struct street_data *
-street_data_dup(struct street_data *orig)
-{
-	struct street_data *ret;
-	int size=sizeof(struct street_data)+orig->count*sizeof(struct coord);
-
-	ret=g_malloc(size);
-	memcpy(ret, orig, size);
-
-	return ret;
-}
-
-/**
- * @brief Frees street data
+ * @brief Repairs the costs of a flooded route graph after the costs of some segments changed
  *
- * @param sd Street data to be freed
- */
-void
-street_data_free(struct street_data *sd)
-{
-	g_free(sd);
-}
-
-/**
- * @brief Finds the nearest street to a given coordinate
+ * Instead of flooding the whole graph again, only the part of the shortest path tree which is
+ * affected is recalculated: All points whose way to the destination runs over one of the changed
+ * segments lose their costs. They and the ends of the changed segments are then updated from their
+ * unaffected neighbors, and Dijkstra's algorithm continues from there. Cheaper segments spread
+ * their savings the same way.
  *
- * @param ms The mapset to search in for the street
- * @param pc The coordinate to find a street nearby
- * @return The nearest street
+ * This requires a full flood, i.e. it must not be used after a goal-directed flood which stopped early.
+ *
+ * @param this The route graph
+ * @param dst The destination the graph was flooded for
+ * @param profile The vehicle profile to use for routing
+ * @param changed Pairs of points, each of them the ends of a segment whose costs changed
+ * @param count The number of points in {@code changed}
+ * @return The number of points whose costs were recalculated
  */
-static struct route_info *
-route_find_nearest_street(struct vehicleprofile *vehicleprofile, struct mapset *ms, struct pcoord *pc)
+static int
+route_graph_flood_repair(struct route_graph *this, struct route_info *dst, struct vehicleprofile *profile,
+			struct route_graph_point **changed, int count)
 {
-	struct route_info *ret=NULL;
-	int max_dist=1000;
-	struct map_selection *sel;
-	int dist,mindist=0,pos;
-	struct mapset_handle *h;
-	struct map *m;
-	struct map_rect *mr;
-	struct item *item;
-	struct coord lp;
-	struct street_data *sd;
-	struct coord c;
-	struct coord_geo g;
-	
-	if(!vehicleprofile)
-		return NULL;
-
-	ret=g_new0(struct route_info, 1);
-	mindist = INT_MAX;
+	struct route_graph_point *p,*q;
+	struct route_graph_segment *s=NULL;
+	struct route_heap *heap;
+	GList *invalid=NULL,*todo=NULL,*l;
+	int i,j,val,ret=0;
+	unsigned char *speeds=route_graph_speeds(this, 0);
 
-	h=mapset_open(ms);
-	while ((m=mapset_next(h,2))) {
-		c.x = pc->x;
-		c.y = pc->y;
-		if (map_projection(m) != pc->pro) {
-			transform_to_geo(pc->pro, &c, &g);
-			transform_from_geo(map_projection(m), &g, &c);
-		}
-		sel = route_rect(18, &c, &c, 0, max_dist);
-		if (!sel)
-			continue;
-		mr=map_rect_new(m, sel);
-		if (!mr) {
-			map_selection_destroy(sel);
-			continue;
+	this->floods++;
+	/* Points which reach the destination directly over a changed segment */
+	for (i = 0 ; i < count ; i++) {
+		p=changed[i];
+		q=changed[i^1];
+		if (p->value != INT_MAX && p->seg && ((p->seg->start == p && p->seg->end == q) || (p->seg->end == p && p->seg->start == q))) {
+			p->value=INT_MAX;
+			todo=g_list_prepend(todo, p);
 		}
-		while ((item=map_rect_get_item(mr))) {
-			if (item_get_default_flags(item->type)) {
-				sd=street_get_data(item);
-				if (!sd)
-					continue;
-				dist=transform_distance_polyline_sq(sd->c, sd->count, &c, &lp, &pos);
-				if (dist < mindist && (
-					(sd->flags & vehicleprofile->flags_forward_mask) == vehicleprofile->flags ||
-					(sd->flags & vehicleprofile->flags_reverse_mask) == vehicleprofile->flags)) {
-					mindist = dist;
-					if (ret->street) {
-						street_data_free(ret->street);
-					}
-					ret->c=c;
-					ret->lp=lp;
-					ret->pos=pos;
-					ret->street=sd;
-					dbg(lvl_debug,"dist=%d id 0x%x 0x%x pos=%d\n", dist, item->id_hi, item->id_lo, pos);
-				} else {
-					street_data_free(sd);
+	}
+	/* ... and all points whose way leads over one of them */
+	while (todo) {
+		p=todo->data;
+		todo=g_list_delete_link(todo, todo);
+		invalid=g_list_prepend(invalid, p);
+		for (j = 0 ; j < 2 ; j++) {
+			for (s=j ? p->end : p->start ; s ; s=j ? s->end_next : s->start_next) {
+				q=j ? s->start : s->end;
+				if (q != p && q->seg == s && q->value != INT_MAX) {
+					q->value=INT_MAX;
+					todo=g_list_prepend(todo, q);
 				}
 			}
 		}
-		map_selection_destroy(sel);
-		map_rect_destroy(mr);
+		p->seg=NULL;
 	}
-	mapset_close(h);
-
-	if (!ret->street || mindist > max_dist*max_dist) {
-		if (ret->street) {
-			street_data_free(ret->street);
-			dbg(lvl_debug,"Much too far %d > %d\n", mindist, max_dist);
+	heap=route_graph_heap_new(profile, 0, 0);
+	while ((s=route_graph_get_segment(this, dst->street, s))) {
+		val=route_value_seg(profile, NULL, s, -1, speeds);
+		if (val != INT_MAX) {
+			val=val*(100-dst->percent)/100;
+			if (val < s->end->value) {
+				s->end->seg=s;
+				s->end->value=val;
+			}
+		}
+		val=route_value_seg(profile, NULL, s, 1, speeds);
+		if (val != INT_MAX) {
+			val=val*dst->percent/100;
+			if (val < s->start->value) {
+				s->start->seg=s;
+				s->start->value=val;
+			}
 		}
-		g_free(ret);
-		ret = NULL;
 	}
-
+	for (l=invalid ; l ; l=g_list_next(l)) {
+		p=l->data;
+		if (p->value != INT_MAX)
+			route_heap_insert(heap, p, p->value);
+	}
+	for (l=invalid ; l ; l=g_list_next(l))
+		route_graph_flood_repair_point(heap, l->data, profile, speeds);
+	for (i = 0 ; i < count ; i++)
+		route_graph_flood_repair_point(heap, changed[i], profile, speeds);
+	while ((p=route_heap_extract_min(heap))) {
+		p->el=NULL;
+		route_graph_flood_relax(this, heap, p, profile, NULL, projection_none, 0, 0);
+		ret++;
+	}
+	route_heap_destroy(heap);
+	dbg(lvl_debug,"%d points invalidated, %d points updated\n", g_list_length(invalid), ret);
+	g_list_free(invalid);
 	return ret;
 }
 
 /**
- * @brief Destroys a route_info
+ * @brief Applies a traffic distortion of a route to its route graph
  *
- * @param info The route info to be destroyed
+ * @param this The route
+ * @param t The traffic distortion
+ * @param remove True to remove the distortion from the graph
+ * @param changed Array of points at the ends of changed segments, grown as needed
+ * @param count Number of points in {@code changed}
  */
-void
-route_info_free(struct route_info *inf)
+static void
+route_traffic_apply(struct route *this, struct route_traffic *t, int remove, struct route_graph_point ***changed, int *count)
 {
-	if (!inf)
+	struct route_graph_point *ends[2];
+#ifdef HAVE_PTHREAD
+	if (this->worker)
+		this->worker->traffic_changed=1;
+#endif
+	if (!this->graph || this->graph->busy || this->graph->ch)
 		return;
-	if (inf->street)
-		street_data_free(inf->street);
-	g_free(inf);
+	if (!route_graph_apply_traffic(this->graph, t, remove, ends))
+		return;
+	*changed=g_renew(struct route_graph_point *, *changed, *count+2);
+	(*changed)[(*count)++]=ends[0];
+	(*changed)[(*count)++]=ends[1];
 }
 
+/**
+ * @brief Updates the route after traffic distortions changed
+ *
+ * If the graph was fully flooded for a single destination without turn costs, only the affected part
+ * of the flood is repaired and the path is updated from there. Otherwise the graph is flooded again, which is still
+ * much cheaper than building a new graph.
+ *
+ * @param this The route
+ * @param changed Points at the ends of changed segments, in pairs
+ * @param count Number of points in {@code changed}
+ */
+static void
+route_traffic_changed(struct route *this, struct route_graph_point **changed, int count)
+{
+	struct route_graph *graph=this->graph;
 
-#include "point.h"
+	if (!count || !graph || !this->pos || !this->destinations)
+		return;
+	dbg(lvl_debug,"%d traffic distortions changed\n", count/2);
+	if (!graph->flood_partial && !graph->turn_labels && !this->link_path && !g_list_next(this->destinations) && this->current_dst) {
+		route_graph_flood_repair(graph, this->current_dst, this->vehicleprofile, changed, count);
+		/* Segments of the old path would be reused with their old costs */
+		route_path_destroy(this->path2,1);
+		this->path2=NULL;
+		route_path_update_done(this, 0);
+		return;
+	}
+	if (!this->route_graph_flood_done_cb)
+		this->route_graph_flood_done_cb=callback_new_2(callback_cast(route_path_update_done), this, (long)1);
+	route_path_destroy(this->path2,1);
+	this->path2=NULL;
+	this->link_path=0;
+	this->current_dst=route_get_dst(this);
+	route_graph_reset(graph);
+	route_graph_flood(graph, this->current_dst, route_previous_destination(this), this->vehicleprofile, this->route_graph_flood_done_cb);
+}
 
 /**
- * @brief Returns street data for a route info 
+ * @brief Applies all traffic distortions of a route to a newly built route graph
  *
- * @param rinf The route info to return the street data for
- * @return Street data for the route info
+ * @param this The route
  */
-struct street_data *
-route_info_street(struct route_info *rinf)
+static void
+route_traffic_apply_all(struct route *this)
 {
-	return rinf->street;
+	struct route_graph_point **changed=NULL;
+	int count=0;
+	GList *l;
+	for (l=this->traffic ; l ; l=g_list_next(l))
+		route_traffic_apply(this, l->data, 0, &changed, &count);
+	g_free(changed);
 }
 
-#if 0
-struct route_crossings *
-route_crossings_get(struct route *this, struct coord *c)
+static struct route_traffic *
+route_traffic_get(struct route *this, int id)
 {
-      struct route_point *pnt;
-      struct route_segment *seg;
-      int crossings=0;
-      struct route_crossings *ret;
-
-       pnt=route_graph_get_point(this, c);
-       seg=pnt->start;
-       while (seg) {
-		printf("start: 0x%x 0x%x\n", seg->item.id_hi, seg->item.id_lo);
-               crossings++;
-               seg=seg->start_next;
-       }
-       seg=pnt->end;
-       while (seg) {
-		printf("end: 0x%x 0x%x\n", seg->item.id_hi, seg->item.id_lo);
-               crossings++;
-               seg=seg->end_next;
-       }
-       ret=g_malloc(sizeof(struct route_crossings)+crossings*sizeof(struct route_crossing));
-       ret->count=crossings;
-       return ret;
+	GList *l;
+	for (l=this->traffic ; l ; l=g_list_next(l)) {
+		struct route_traffic *t=l->data;
+		if (t->id == id)
+			return t;
+	}
+	return NULL;
 }
-#endif
 
-
-struct map_rect_priv {
-	struct route_info_handle *ri;
-	enum attr_type attr_next;
-	int pos;
-	struct map_priv *mpriv;
-	struct item item;
-	unsigned int last_coord;
-	struct route_path *path;
-	struct route_path_segment *seg,*seg_next;
-	struct route_graph_point *point;
-	struct route_graph_segment *rseg;
-	char *str;
-	int hash_bucket;
-	struct coord *coord_sel;	/**< Set this to a coordinate if you want to filter for just a single route graph point */
-	struct route_graph_point_iterator it;
-	/* Pointer to current waypoint element of route->destinations */
-	GList *dest;
-};
+static struct route_traffic *
+route_traffic_set(struct route *this, int id, struct coord *start, struct coord *end, int delay, int maxspeed, int duration,
+		struct route_graph_point ***changed, int *count)
+{
+	struct route_traffic *t=route_traffic_get(this, id);
+	if (!t) {
+		t=g_new0(struct route_traffic, 1);
+		t->id=id;
+		this->traffic=g_list_prepend(this->traffic, t);
+	} else if (t->start.x != start->x || t->start.y != start->y || t->end.x != end->x || t->end.y != end->y)
+		route_traffic_apply(this, t, 1, changed, count);
+	t->start=*start;
+	t->end=*end;
+	t->delay=delay;
+	t->maxspeed=maxspeed;
+	t->expires=duration > 0 ? time(NULL)+duration : 0;
+	route_traffic_apply(this, t, 0, changed, count);
+	return t;
+}
 
 static void
-rm_coord_rewind(void *priv_data)
+route_traffic_remove(struct route *this, struct route_traffic *t, struct route_graph_point ***changed, int *count)
 {
-	struct map_rect_priv *mr = priv_data;
-	mr->last_coord = 0;
+	route_traffic_apply(this, t, 1, changed, count);
+	this->traffic=g_list_remove(this->traffic, t);
+	g_free(t);
 }
 
+/**
+ * @brief Reads the traffic file of a route if it was modified since it was last read
+ *
+ * Each line of the file describes one traffic distortion:
+ * {@code id delay maxspeed duration start_x start_y end_x end_y}
+ * with the delay in tenths of seconds, the maximum speed in km/h (-1 for none), the duration in
+ * seconds (0 for unlimited) and the coordinates in the projection of the map, e.g.
+ * {@code 1 600 -1 0 0x138a4a 0x5d773f 0x138b12 0x5d7702}.
+ * Lines starting with {@code #} are ignored. Distortions which were read from the file before but
+ * are no longer in it are removed.
+ *
+ * @param this The route
+ * @param changed Array of points at the ends of changed segments, grown as needed
+ * @param count Number of points in {@code changed}
+ */
 static void
-rm_attr_rewind(void *priv_data)
+route_traffic_read_file(struct route *this, struct route_graph_point ***changed, int *count)
 {
-	struct map_rect_priv *mr = priv_data;
-	mr->attr_next = attr_street_item;
+	struct stat st;
+	struct route_traffic *t;
+	struct coord c[2];
+	int id,delay,maxspeed,duration;
+	char line[256];
+	GList *l,*next;
+	FILE *f;
+
+	if (stat(this->traffic_file, &st) || st.st_mtime == this->traffic_file_mtime)
+		return;
+	f=fopen(this->traffic_file, "r");
+	if (!f)
+		return;
+	this->traffic_file_mtime=st.st_mtime;
+	for (l=this->traffic ; l ; l=g_list_next(l))
+		((struct route_traffic *)l->data)->seen=0;
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#')
+			continue;
+		if (sscanf(line, "%d %d %d %d %i %i %i %i", &id, &delay, &maxspeed, &duration, &c[0].x, &c[0].y, &c[1].x, &c[1].y) != 8) {
+			if (line[strspn(line, " \t\r\n")])
+				dbg(lvl_warning,"invalid line in %s: %s", this->traffic_file, line);
+			continue;
+		}
+		t=route_traffic_set(this, id, &c[0], &c[1], delay, maxspeed < 0 ? INT_MAX : maxspeed, duration, changed, count);
+		t->file=1;
+		t->seen=1;
+	}
+	fclose(f);
+	for (l=this->traffic ; l ; l=next) {
+		next=g_list_next(l);
+		t=l->data;
+		if (t->file && !t->seen)
+			route_traffic_remove(this, t, changed, count);
+	}
 }
 
+/**
+ * @brief Checks whether the traffic distortions of a route need to be checked periodically
+ *
+ * @param this The route
+ * @return True if there is a traffic file or a distortion which expires
+ */
 static int
-rm_attr_get(void *priv_data, enum attr_type attr_type, struct attr *attr)
+route_traffic_needs_timeout(struct route *this)
 {
-	struct map_rect_priv *mr = priv_data;
-	struct route_path_segment *seg=mr->seg;
-	struct route *route=mr->mpriv->route;
-	if (mr->item.type != type_street_route && mr->item.type != type_waypoint && mr->item.type != type_route_end)
-		return 0;
-	attr->type=attr_type;
-	switch (attr_type) {
-		case attr_any:
-			while (mr->attr_next != attr_none) {
-				if (rm_attr_get(priv_data, mr->attr_next, attr))
-					return 1;
-			}
-			return 0;
-		case attr_maxspeed:
-			mr->attr_next = attr_street_item;
-			if (seg && seg->data->flags & AF_SPEED_LIMIT) {
-				attr->u.num=RSD_MAXSPEED(seg->data);
-
-			} else {
-				return 0;
-			}
-			return 1;
-		case attr_street_item:
-			mr->attr_next=attr_direction;
-			if (seg && seg->data->item.map)
-				attr->u.item=&seg->data->item;
-			else
-				return 0;
-			return 1;
-		case attr_direction:
-			mr->attr_next=attr_route;
-			if (seg) 
-				attr->u.num=seg->direction;
-			else
-				return 0;
-			return 1;
-		case attr_route:
-			mr->attr_next=attr_length;
-			attr->u.route = mr->mpriv->route;
-			return 1;
-		case attr_length:
-			mr->attr_next=attr_time;
-			if (seg)
-				attr->u.num=seg->data->len;
-			else
-				return 0;
-			return 1;
-		case attr_time:
-			mr->attr_next=attr_speed;
-			if (seg)
-				attr->u.num=route_time_seg(route->vehicleprofile, seg->data, NULL);
-			else
-				return 0;
-			return 1;
-		case attr_speed:
-			mr->attr_next=attr_label;
-			if (seg)
-				attr->u.num=route_seg_speed(route->vehicleprofile, seg->data, NULL);
-			else
-				return 0;
+	GList *l;
+	if (this->traffic_file)
+		return 1;
+	for (l=this->traffic ; l ; l=g_list_next(l)) {
+		if (((struct route_traffic *)l->data)->expires)
 			return 1;
-		case attr_label:
-			mr->attr_next=attr_none;
-			if(mr->item.type==type_waypoint || mr->item.type == type_route_end) {
-				if(mr->str)
-					g_free(mr->str);
-				mr->str=g_strdup_printf("%d",route->reached_destinations_count+g_list_position(route->destinations,mr->dest)+1);
-				attr->u.str=mr->str;
-				return 1;
-			}
-			return 0;
-		default:
-			mr->attr_next=attr_none;
-			attr->type=attr_none;
-			return 0;
 	}
 	return 0;
 }
 
-static int
-rm_coord_get(void *priv_data, struct coord *c, int count)
+/**
+ * @brief Stops checking the traffic distortions of a route once nothing is left to check
+ *
+ * @param this The route
+ */
+static void
+route_traffic_stop(struct route *this)
 {
-	struct map_rect_priv *mr = priv_data;
-	struct route_path_segment *seg = mr->seg;
-	int i,rc=0;
-	struct route *r = mr->mpriv->route;
-	enum projection pro = route_projection(r);
+	if (!this->traffic_timeout || route_traffic_needs_timeout(this))
+		return;
+	event_remove_timeout(this->traffic_timeout);
+	this->traffic_timeout=NULL;
+}
 
-	if (pro == projection_none)
-		return 0;
-	if (mr->item.type == type_route_start || mr->item.type == type_route_start_reverse || mr->item.type == type_route_end || mr->item.type == type_waypoint ) {
-		if (! count || mr->last_coord)
-			return 0;
-		mr->last_coord=1;
-		if (mr->item.type == type_route_start || mr->item.type == type_route_start_reverse)
-			c[0]=r->pos->c;
-		else if (mr->item.type == type_waypoint) {
-			c[0]=((struct route_info *)mr->dest->data)->c;
-		} else { /*type_route_end*/
-			c[0]=route_get_dst(r)->c;
-		}
-		return 1;
-	}
-	if (! seg)
-		return 0;
-	for (i=0; i < count; i++) {
-		if (mr->last_coord >= seg->ncoords)
-			break;
-		if (i >= seg->ncoords)
-			break;
-		if (pro != projection_mg)
-			transform_from_to(&seg->c[mr->last_coord++], pro,
-				&c[i],projection_mg);
-		else
-			c[i] = seg->c[mr->last_coord++];
-		rc++;
+/**
+ * @brief Expires traffic distortions and reads the traffic file
+ *
+ * @param this The route
+ */
+static void
+route_traffic_timeout(struct route *this)
+{
+	struct route_graph_point **changed=NULL;
+	int count=0;
+	time_t now=time(NULL);
+	GList *l,*next;
+
+	for (l=this->traffic ; l ; l=next) {
+		struct route_traffic *t=l->data;
+		next=g_list_next(l);
+		if (t->expires && t->expires <= now)
+			route_traffic_remove(this, t, &changed, &count);
 	}
-	dbg(lvl_debug,"return %d\n",rc);
-	return rc;
+	if (this->traffic_file)
+		route_traffic_read_file(this, &changed, &count);
+	route_traffic_changed(this, changed, count);
+	g_free(changed);
+	route_traffic_stop(this);
 }
 
-static struct item_methods methods_route_item = {
-	rm_coord_rewind,
-	rm_coord_get,
-	rm_attr_rewind,
-	rm_attr_get,
-};
-
+/**
+ * @brief Starts checking the traffic distortions of a route periodically, if needed
+ *
+ * @param this The route
+ */
 static void
-rp_attr_rewind(void *priv_data)
+route_traffic_start(struct route *this)
 {
-	struct map_rect_priv *mr = priv_data;
-	mr->attr_next = attr_label;
+	if (this->traffic_timeout || !route_traffic_needs_timeout(this))
+		return;
+	if (!this->traffic_cb)
+		this->traffic_cb=callback_new_1(callback_cast(route_traffic_timeout), this);
+	this->traffic_timeout=event_add_timeout(ROUTE_TRAFFIC_INTERVAL, 1, this->traffic_cb);
 }
 
-static int
-rp_attr_get(void *priv_data, enum attr_type attr_type, struct attr *attr)
+/**
+ * @brief Sets or updates a traffic distortion on a route
+ *
+ * The distortion applies to the route graph segment between {@code start} and {@code end}, in both
+ * directions. If the route graph has been flooded already, only the affected part of the flood is
+ * recalculated and the route path is updated.
+ *
+ * @param this_ The route
+ * @param id Identifier of the distortion, an existing distortion with the same id is replaced
+ * @param start Start of the segment, in the projection of the map
+ * @param end End of the segment, in the projection of the map
+ * @param delay Delay in tenths of seconds
+ * @param maxspeed Maximum speed in km/h, 0 to close the segment or {@code INT_MAX} for no limit
+ * @param duration Time in seconds after which the distortion is removed again, 0 for never
+ */
+void
+route_set_traffic_distortion(struct route *this_, int id, struct coord *start, struct coord *end, int delay, int maxspeed, int duration)
 {
-	struct map_rect_priv *mr = priv_data;
-	struct route_graph_point *p = mr->point;
-	struct route_graph_segment *seg = mr->rseg;
-	struct route *route=mr->mpriv->route;
+	struct route_graph_point **changed=NULL;
+	int count=0;
+	route_traffic_set(this_, id, start, end, delay, maxspeed, duration, &changed, &count);
+	route_traffic_changed(this_, changed, count);
+	g_free(changed);
+	route_traffic_start(this_);
+	route_traffic_stop(this_);
+}
 
-	attr->type=attr_type;
-	switch (attr_type) {
-	case attr_any: // works only with rg_points for now
-		while (mr->attr_next != attr_none) {
-			dbg(lvl_debug,"querying %s\n", attr_to_name(mr->attr_next));
-			if (rp_attr_get(priv_data, mr->attr_next, attr))
-				return 1;
-		}
-		return 0;
-	case attr_maxspeed:
-		mr->attr_next = attr_label;
-		if (mr->item.type != type_rg_segment) 
-			return 0;
-		if (seg && (seg->data.flags & AF_SPEED_LIMIT)) {
-			attr->type = attr_maxspeed;
-			attr->u.num=RSD_MAXSPEED(&seg->data);
-			return 1;
-		} else {
-			return 0;
-		}
-	case attr_label:
-		mr->attr_next=attr_street_item;
-		attr->type = attr_label;
-		if (mr->str)
-			g_free(mr->str);
-		if (mr->item.type == type_rg_point) {
-			if (p->value != INT_MAX)
-				mr->str=g_strdup_printf("%d", p->value);
-			else
-				mr->str=g_strdup("-");
+/**
+ * @brief Removes a traffic distortion from a route
+ *
+ * @param this_ The route
+ * @param id Identifier of the distortion, as passed to route_set_traffic_distortion()
+ */
+void
+route_remove_traffic_distortion(struct route *this_, int id)
+{
+	struct route_graph_point **changed=NULL;
+	int count=0;
+	struct route_traffic *t=route_traffic_get(this_, id);
+	if (!t)
+		return;
+	route_traffic_remove(this_, t, &changed, &count);
+	route_traffic_changed(this_, changed, count);
+	g_free(changed);	route_traffic_stop(this_);
+}
+
+/**
+ * @brief Starts an "offroad" path
+ *
+ * This starts a path that is not located on a street. It creates a new route path
+ * adding only one segment, that leads from pos to dest, and which is not associated with an item.
+ *
+ * @param this Not used
+ * @param pos The starting position for the new path
+ * @param dst The destination of the new path
+ * @param dir Not used
+ * @return The new path
+ */
+static struct route_path *
+route_path_new_offroad(struct route_graph *this, struct route_info *pos, struct route_info *dst)
+{
+	struct route_path *ret;
+
+	ret=g_new0(struct route_path, 1);
+	ret->in_use=1;
+	ret->path_hash=item_hash_new();
+	route_path_add_line(ret, &pos->c, &dst->c, pos->lenextra+dst->lenextra);
+	ret->updated=1;
+
+	return ret;
+}
+
+/**
+ * @brief Returns a coordinate at a given distance
+ *
+ * This function returns the coordinate, where the user will be if he
+ * follows the current route for a certain distance.
+ *
+ * @param this_ The route we're driving upon
+ * @param dist The distance in meters
+ * @return The coordinate where the user will be in that distance
+ */
+struct coord 
+route_get_coord_dist(struct route *this_, int dist)
+{
+	int d,l,i,len;
+	int dx,dy;
+	double frac;
+	struct route_path_segment *cur;
+	struct coord ret;
+	enum projection pro=route_projection(this_);
+	struct route_info *dst=route_get_dst(this_);
+
+	d = dist;
+
+	if (!this_->path2 || pro == projection_none) {
+		return this_->pos->c;
+	}
+	
+	ret = this_->pos->c;
+	cur = this_->path2->path;
+	while (cur) {
+		if (cur->data->len < d) {
+			d -= cur->data->len;
 		} else {
-			int len=seg->data.len;
-			int speed=route_seg_speed(route->vehicleprofile, &seg->data, NULL);
-			int time=route_time_seg(route->vehicleprofile, &seg->data, NULL);
-			if (speed)
-				mr->str=g_strdup_printf("%dm %dkm/h %d.%ds",len,speed,time/10,time%10);
-			else if (len)
-				mr->str=g_strdup_printf("%dm",len);
-			else {
-				mr->str=NULL;
-				return 0;
+			for (i=0; i < (cur->ncoords-1); i++) {
+				l = d;
+				len = (int)transform_polyline_length(pro, (cur->c + i), 2);
+				d -= len;
+				if (d <= 0) { 
+					// We interpolate a bit here...
+					frac = (double)l / len;
+					
+					dx = (cur->c + i + 1)->x - (cur->c + i)->x;
+					dy = (cur->c + i + 1)->y - (cur->c + i)->y;
+					
+					ret.x = (cur->c + i)->x + (frac * dx);
+					ret.y = (cur->c + i)->y + (frac * dy);
+					return ret;
+				}
 			}
+			return cur->c[(cur->ncoords-1)];
 		}
-		attr->u.str = mr->str;
-		return 1;
-	case attr_street_item:
-		mr->attr_next=attr_flags;
-		if (mr->item.type != type_rg_segment) 
-			return 0;
-		if (seg && seg->data.item.map)
-			attr->u.item=&seg->data.item;
-		else
-			return 0;
-		return 1;
-	case attr_flags:
-		mr->attr_next = attr_direction;
-		if (mr->item.type != type_rg_segment)
-			return 0;
-		if (seg) {
-			attr->u.num = seg->data.flags;
-		} else {
-			return 0;
+		cur = cur->next;
+	}
+
+	return dst->c;
+}
+
+/**
+ * @brief Creates a new route path
+ * 
+ * This creates a new non-trivial route. It therefore needs the routing information created by route_graph_flood, so
+ * make sure to run route_graph_flood() after changing the destination before using this function.
+ *
+ * @param this The route graph to create the route from
+ * @param oldpath (Optional) old path which may contain parts of the new part - this speeds things up a bit. May be NULL.
+ * @param pos The starting position of the route
+ * @param dst The destination of the route
+ * @param preferences The routing preferences
+ * @return The new route path
+ */
+static struct route_path *
+route_path_new(struct route_graph *this, struct route_path *oldpath, struct route_info *pos, struct route_info *dst, struct vehicleprofile *profile)
+{
+	struct route_graph_segment *s=NULL,*s1=NULL,*s2=NULL; /* candidate segments for cheapest path */
+	struct route_graph_point *start; /* point at which the next segment starts, i.e. up to which the path is complete */
+	struct route_info *posinfo, *dstinfo; /* same as pos and dst, but NULL if not part of current segment */
+	int segs=0,dir; /* number of segments added to graph, direction of first segment */
+	int val1=INT_MAX,val2=INT_MAX; /* total cost for s1 and s2, respectively */
+	int val,value,val1_new,val2_new;
+	struct route_graph_segment *next;
+	struct route_graph_point *end;
+	struct route_path *ret;
+
+	if (! pos->street || ! dst->street) {
+		dbg(lvl_error,"pos or dest not set\n");
+		return NULL;
+	}
+
+	if (profile->mode == 2 || (profile->mode == 0 && pos->lenextra + dst->lenextra > transform_distance(map_projection(pos->street->item.map), &pos->c, &dst->c)))
+		return route_path_new_offroad(this, pos, dst);
+	if (!route_graph_flood_covers(this, pos)) {
+		dbg(lvl_debug,"position not covered by partial flood, reflooding\n");
+		route_graph_reset(this);
+		route_graph_flood(this, dst, pos, profile, NULL);
+	}
+	while ((s=route_graph_get_segment(this, pos->street, s))) {
+		val=route_value_seg(profile, NULL, s, 2, route_graph_speeds(this, 0));
+		if (val != INT_MAX && (value=route_graph_point_value(this, profile, s->end, s, NULL)) != INT_MAX) {
+			val=val*(100-pos->percent)/100;
+			dbg(lvl_debug,"val1 %d\n",val);
+			if (route_graph_segment_match(s,this->avoid_seg) && pos->street_direction < 0)
+				val+=profile->turn_around_penalty;
+			dbg(lvl_debug,"val1 %d\n",val);
+			val1_new=value+val;
+			dbg(lvl_debug,"val1 +%d=%d\n",value,val1_new);
+			if (val1_new < val1) {
+				val1=val1_new;
+				s1=s;
+			}
 		}
-		return 1;
-	case attr_direction:
-		mr->attr_next = attr_debug;
-		// This only works if the map has been opened at a single point, and in that case indicates if the
-		// segment returned last is connected to this point via its start (1) or its end (-1)
-		if (!mr->coord_sel || (mr->item.type != type_rg_segment))
-			return 0;
-		if (seg->start == mr->point) {
-			attr->u.num=1;
-		} else if (seg->end == mr->point) {
-			attr->u.num=-1;
-		} else {
-			return 0;
+		val=route_value_seg(profile, NULL, s, -2, route_graph_speeds(this, 0));
+		if (val != INT_MAX && (value=route_graph_point_value(this, profile, s->start, s, NULL)) != INT_MAX) {
+			val=val*pos->percent/100;
+			dbg(lvl_debug,"val2 %d\n",val);
+			if (route_graph_segment_match(s,this->avoid_seg) && pos->street_direction > 0)
+				val+=profile->turn_around_penalty;
+			dbg(lvl_debug,"val2 %d\n",val);
+			val2_new=value+val;
+			dbg(lvl_debug,"val2 +%d=%d\n",value,val2_new);
+			if (val2_new < val2) {
+				val2=val2_new;
+				s2=s;
+			}
 		}
-		return 1;
-	case attr_debug:
-		mr->attr_next=attr_none;
-		if (mr->str)
-			g_free(mr->str);
-		mr->str=NULL;
-		switch (mr->item.type) {
-		case type_rg_point:
-		{
-			struct route_graph_segment *tmp;
-			int start=0;
-			int end=0;
-			tmp=p->start;
-			while (tmp) {
-				start++;
-				tmp=tmp->start_next;
+	}
+	if (val1 == INT_MAX && val2 == INT_MAX) {
+		dbg(lvl_error,"no route found, pos blocked\n");
+		return NULL;
+	}
+	if (val1 == val2) {
+		val1=route_graph_point_value(this, profile, s1->end, s1, NULL);
+		val2=route_graph_point_value(this, profile, s2->start, s2, NULL);
+	}
+	if (val1 < val2) {
+		start=s1->start;
+		s=s1;
+		dir=1;
+	} else {
+		start=s2->end;
+		s=s2;
+		dir=-1;
+	}
+	if (pos->street_direction && dir != pos->street_direction && profile->turn_around_penalty) {
+		if (!route_graph_segment_match(this->avoid_seg,s)) {
+			dbg(lvl_debug,"avoid current segment\n");
+			if (this->avoid_seg)
+				route_graph_set_traffic_distortion(this, this->avoid_seg, 0);
+			this->avoid_seg=s;
+			route_graph_set_traffic_distortion(this, this->avoid_seg, profile->turn_around_penalty);
+			route_graph_reset(this);
+			route_graph_flood(this, dst, pos, profile, NULL);
+			return route_path_new(this, oldpath, pos, dst, profile);
+		}
+	}
+	ret=g_new0(struct route_path, 1);
+	ret->in_use=1;
+	ret->updated=1;
+	if (pos->lenextra) 
+		route_path_add_line(ret, &pos->c, &pos->lp, pos->lenextra);
+	ret->path_hash=item_hash_new();
+	dstinfo=NULL;
+	posinfo=pos;
+	while (s && !dstinfo) { /* following the least costly way to reach our destination, see route_graph_point_value() */
+		segs++;
+#if 0
+		printf("start->value=%d 0x%x,0x%x\n", start->value, start->c.x, start->c.y);
+#endif
+		end=(s->start == start) ? s->end : s->start;
+		route_graph_point_value(this, profile, end, s, &next);
+		if (item_is_equal(s->data.item, dst->street->item) && (next == s || !posinfo))
+			dstinfo=dst;
+		if (!route_path_add_item_from_graph(ret, this, oldpath, s, (s->start == start) ? 1 : -1, posinfo, dstinfo))
+			ret->updated=0;
+		start=end;
+		posinfo=NULL;
+		s=next;
+	}
+	if (dst->lenextra) 
+		route_path_add_line(ret, &dst->lp, &dst->c, dst->lenextra);
+	dbg(lvl_debug, "%d segments\n", segs);
+	return ret;
+}
+
+/**
+ * @brief State of the search for alternative routes
+ *
+ * The search runs in steps from an idle event. Between the steps, the route graph carries the costs
+ * of the route again, so the main loop can keep using it.
+ */
+struct route_alternatives_search {
+	struct route_graph *graph;		/**< The graph searched */
+	int floods;				/**< {@code floods} of the graph after the last step, the search is given up
+						 *  if the costs of the graph changed meanwhile */
+	int attempts;				/**< Number of floods done so far */
+	struct route_graph_segment **penalized;	/**< Segments of the paths found so far */
+	int penalized_count;			/**< Number of segments in {@code penalized} */
+	int penalized_size;			/**< Number of segments {@code penalized} has room for */
+	int point_count;			/**< Number of points of the graph when the search started */
+	int *value;				/**< Costs of the points when the search started */
+	struct route_graph_segment **seg;	/**< Segments the points were reached by when the search started */
+	struct route_graph_turn_label *labels;	/**< Copy of the segment labels when the search started, if the graph was
+						 *  flooded with turn costs */
+	int label_count;			/**< Number of labels in {@code labels} */
+	int flood_partial;			/**< {@code flood_partial} of the graph when the search started */
+	struct item flood_item;			/**< {@code flood_item} of the graph when the search started */
+};
+
+static void
+route_alternatives_penalized_add(struct route_alternatives_search *search, struct route_graph_segment *s)
+{
+	if (search->penalized_count == search->penalized_size) {
+		search->penalized_size=search->penalized_size ? search->penalized_size*2 : 256;
+		search->penalized=g_renew(struct route_graph_segment *, search->penalized, search->penalized_size);
+	}
+	search->penalized[search->penalized_count++]=s;
+}
+
+/**
+ * @brief Remembers the segments of a path for the alternative route penalty
+ *
+ * Only segments which are covered completely by the path are penalized, so the ends of the path and
+ * streets merely touched by it are not.
+ *
+ * @param search The search
+ * @param path The path whose segments should be penalized
+ */
+static void
+route_alternatives_mark(struct route_alternatives_search *search, struct route_path *path)
+{
+	struct route_path_segment *seg;
+	struct route_graph_point *p;
+	struct route_graph_segment *s;
+	struct coord *first,*last;
+	for (seg=path->path ; seg ; seg=seg->next) {
+		if (seg->ncoords < 2 || !seg->data->item.map)
+			continue;
+		first=&seg->c[0];
+		last=&seg->c[seg->ncoords-1];
+		p=NULL;
+		while ((p=route_graph_get_point_next(search->graph, first, p))) {
+			for (s=p->start ; s ; s=s->start_next) {
+				if (s->end->c.x == last->x && s->end->c.y == last->y && item_is_equal(s->data.item, seg->data->item))
+					route_alternatives_penalized_add(search, s);
 			}
-			tmp=p->end;
-			while (tmp) {
-				end++;
-				tmp=tmp->end_next;
+			for (s=p->end ; s ; s=s->end_next) {
+				if (s->start->c.x == last->x && s->start->c.y == last->y && item_is_equal(s->data.item, seg->data->item))
+					route_alternatives_penalized_add(search, s);
 			}
-			mr->str=g_strdup_printf("%d %d %p (0x%x,0x%x)", start, end, p, p->c.x, p->c.y);
-			attr->u.str = mr->str;
 		}
-			return 1;
-		case type_rg_segment:
-			if (! seg)
-				return 0;
-			mr->str=g_strdup_printf("len %d time %d start %p end %p",seg->data.len, route_time_seg(route->vehicleprofile, &seg->data, NULL), seg->start, seg->end);
-			attr->u.str = mr->str;
-			return 1;
-		default:
+	}
+}
+
+/**
+ * @brief Sets or clears the alternative route penalty on the segments of the paths found so far
+ */
+static void
+route_alternatives_penalize(struct route_alternatives_search *search, int set)
+{
+	int i;
+	for (i = 0 ; i < search->penalized_count ; i++) {
+		if (set)
+			search->penalized[i]->flags |= RS_ALTERNATIVE_PENALTY;
+		else
+			search->penalized[i]->flags &= ~RS_ALTERNATIVE_PENALTY;
+	}
+}
+
+/**
+ * @brief Restores the costs a route graph had when the search for alternative routes started
+ *
+ * Points added to the graph since, e.g. by route_graph_add_position(), had no costs then, neither
+ * had the labels of segments added since.
+ */
+static void
+route_alternatives_restore(struct route_alternatives_search *search)
+{
+	struct route_graph *graph=search->graph;
+	struct route_graph_point *p;
+	struct route_graph_turn_label *label;
+	int i;
+	for (i = 0 ; i < graph->point_count ; i++) {
+		p=ROUTE_GRAPH_POINT(graph, i);
+		p->value=i < search->point_count ? search->value[i] : INT_MAX;
+		p->seg=i < search->point_count ? search->seg[i] : NULL;
+		p->el=NULL;
+	}
+	if (graph->turn_labels && !search->labels)
+		route_graph_turn_labels_free(graph);
+	if (graph->turn_labels) {
+		for (i = 0 ; i < graph->turn_label_count ; i++) {
+			graph->turn_labels[i].value=INT_MAX;
+			graph->turn_labels[i].dst=0;
+			graph->turn_labels[i].el=NULL;
+		}
+		for (i = 0 ; i < search->label_count ; i++) {
+			label=&search->labels[i];
+			if (label->seg && label->seg->labels) {
+				label->seg->labels[i%2].value=label->value;
+				label->seg->labels[i%2].dst=label->dst;
+			}
+		}
+	}
+	graph->flood_partial=search->flood_partial;
+	graph->flood_item=search->flood_item;
+	search->floods=graph->floods;
+}
+
+/**
+ * @brief Starts searching for alternative routes on the flooded route graph of a route
+ *
+ * @param this The route object
+ * @return The search
+ */
+static struct route_alternatives_search *
+route_alternatives_search_new(struct route *this)
+{
+	struct route_alternatives_search *ret=g_new0(struct route_alternatives_search, 1);
+	struct route_graph *graph=this->graph;
+	struct route_graph_point *p;
+	int i;
+
+	ret->graph=graph;
+	ret->floods=graph->floods;
+	ret->point_count=graph->point_count;
+	ret->value=g_new(int, graph->point_count);
+	ret->seg=g_new(struct route_graph_segment *, graph->point_count);
+	for (i = 0 ; i < graph->point_count ; i++) {
+		p=ROUTE_GRAPH_POINT(graph, i);
+		ret->value[i]=p->value;
+		ret->seg[i]=p->seg;
+	}
+	if (graph->turn_labels) {
+		ret->label_count=graph->turn_label_count;
+		ret->labels=g_memdup(graph->turn_labels, graph->turn_label_count*sizeof(struct route_graph_turn_label));
+	}
+	ret->flood_partial=graph->flood_partial;
+	ret->flood_item=graph->flood_item;
+	route_alternatives_mark(ret, this->path2);
+	return ret;
+}
+
+/**
+ * @brief Stops the search for alternative routes, keeping the alternatives found so far
+ *
+ * The route graph is not touched, it carries the costs of the route between the steps of the search
+ * anyway.
+ *
+ * @param this The route object
+ */
+static void
+route_alternatives_stop(struct route *this)
+{
+	struct route_alternatives_search *search=this->alternatives_search;
+	if (this->alternatives_idle) {
+		event_remove_idle(this->alternatives_idle);
+		this->alternatives_idle=NULL;
+	}
+	if (!search)
+		return;
+	g_free(search->penalized);
+	g_free(search->value);
+	g_free(search->seg);
+	g_free(search->labels);
+	g_free(search);
+	this->alternatives_search=NULL;
+}
+
+/**
+ * @brief Returns the length of a path which runs on streets also used by another path
+ */
+static int
+route_alternative_shared_len(struct route_path *path, struct route_path *other)
+{
+	struct route_path_segment *seg;
+	int ret=0;
+	for (seg=path->path ; seg ; seg=seg->next) {
+		if (seg->data->item.map && item_hash_lookup(other->path_hash, &seg->data->item))
+			ret+=seg->data->len;
+	}
+	return ret;
+}
+
+/**
+ * @brief Checks if a path is a meaningful alternative to the route and the alternatives found so far
+ *
+ * @param this The route object
+ * @param path The candidate path
+ * @return True if the path is neither too slow nor too similar to any other path
+ */
+static int
+route_alternative_is_acceptable(struct route *this, struct route_path *path)
+{
+	GList *l;
+	if ((long long)path->path_time*100 > (long long)this->path2->path_time*ROUTE_ALTERNATIVE_MAX_STRETCH_PERCENT)
+		return 0;
+	if ((long long)route_alternative_shared_len(path, this->path2)*100 > (long long)path->path_len*ROUTE_ALTERNATIVE_MAX_SHARED_PERCENT)
+		return 0;
+	for (l=this->alternatives ; l ; l=g_list_next(l)) {
+		if ((long long)route_alternative_shared_len(path, l->data)*100 > (long long)path->path_len*ROUTE_ALTERNATIVE_MAX_SHARED_PERCENT)
 			return 0;
+	}
+	return 1;
+}
+
+/**
+ * @brief Frees the alternative routes found so far
+ */
+static void
+route_alternatives_free(struct route *this)
+{
+	GList *l;
+	for (l=this->alternatives ; l ; l=g_list_next(l))
+		route_path_destroy(l->data,0);
+	g_list_free(this->alternatives);
+	this->alternatives=NULL;
+}
+
+/**
+ * @brief Removes all alternative routes and stops searching for them
+ *
+ * @param this The route object
+ */
+static void
+route_alternatives_clear(struct route *this)
+{
+	route_alternatives_stop(this);
+	route_alternatives_free(this);
+}
+
+/**
+ * @brief Does one step of the search for alternative routes
+ *
+ * This uses the penalty method on the flooded route graph: The segments of the route are penalized
+ * and the graph is flooded again. Every path found is penalized as well, so the next flood is pushed
+ * away from it, too. A path is kept as alternative if it is not much slower than the route and does
+ * not share too much of its length with any other path. At most twice as many floods as
+ * alternatives wanted are done.
+ *
+ * Each step floods the graph until {@code ROUTE_ALTERNATIVE_STEP_TIME} is used up and restores the
+ * costs of the route afterwards, so the route itself keeps working between the steps. If the graph
+ * was replaced or its costs changed meanwhile, e.g. because of traffic distortions, the search stops
+ * with the alternatives found so far.
+ *
+ * Alternatives are only searched for routes to a single destination. They are shown on a map of
+ * their own, see route_get_alternatives_map(), so navigation never mistakes them for the route.
+ *
+ * @param this The route object
+ */
+static void
+route_alternatives_idle(struct route *this)
+{
+	struct route_graph *graph=this->graph;
+	struct vehicleprofile *profile=this->vehicleprofile;
+	struct route_alternatives_search *search=this->alternatives_search;
+	struct route_path *path;
+	struct timeval start;
+	struct attr attr;
+	GList *l;
+	int dir,street_direction,done=0;
+
+	if (!search) {
+		for (l=this->alternatives ; l ; l=g_list_next(l)) {
+			if (((struct route_path *)l->data)->in_use > 1)
+				return;
+		}
+		route_alternatives_free(this);
+		if (!graph || graph->busy || graph->ch || !this->pos || !this->path2 || this->path2->next ||
+			!this->destinations || g_list_next(this->destinations)) {
+			route_alternatives_stop(this);
+			return;
+		}
+		this->alternatives_search=route_alternatives_search_new(this);
+		return;
+	}
+	if (graph != search->graph || graph->busy || graph->floods != search->floods || !this->pos || !this->path2 ||
+		this->path2->next) {
+		dbg(lvl_debug,"route changed, stopping the search for alternatives\n");
+		route_alternatives_stop(this);
+		return;
+	}
+	gettimeofday(&start, NULL);
+	/* route_path_new() sets the direction on the street and avoids turning around, neither applies here */
+	dir=this->pos->dir;
+	street_direction=this->pos->street_direction;
+	this->pos->street_direction=0;
+	route_alternatives_penalize(search, 1);
+	do {
+		if (search->attempts >= this->alternatives_max*2 || g_list_length(this->alternatives) >= this->alternatives_max) {
+			done=1;
+			break;
+		}
+		search->attempts++;
+		route_graph_reset(graph);
+		route_graph_flood(graph, this->current_dst, this->pos, profile, NULL);
+		path=route_path_new(graph, NULL, this->pos, this->current_dst, profile);
+		if (!path) {
+			done=1;
+			break;
+		}
+		route_path_set_totals(path, profile, graph->speed_profiles, graph->departure);
+		route_alternatives_mark(search, path);
+		if (route_alternative_is_acceptable(this, path)) {
+			dbg(lvl_debug,"alternative %d: time %d len %d\n", g_list_length(this->alternatives), path->path_time, path->path_len);
+			this->alternatives=g_list_append(this->alternatives, path);
+		} else
+			route_path_destroy(path,0);
+	} while (route_benchmark_elapsed(&start) < ROUTE_ALTERNATIVE_STEP_TIME);
+	route_alternatives_penalize(search, 0);
+	route_alternatives_restore(search);
+	this->pos->dir=dir;
+	this->pos->street_direction=street_direction;
+	if (!done)
+		return;
+	route_alternatives_stop(this);
+	attr.type=attr_alternatives;
+	attr.u.num=g_list_length(this->alternatives);
+	callback_list_call_attr_2(this->cbl2, attr_alternatives, this, &attr);
+}
+
+/**
+ * @brief Schedules the search for alternative routes if the route is configured for them
+ *
+ * @param this The route object
+ */
+static void
+route_alternatives_schedule(struct route *this)
+{
+	if (!this->alternatives_max)
+		return;
+	/* A search still running is for the previous route */
+	route_alternatives_stop(this);
+	if (!this->alternatives_cb)
+		this->alternatives_cb=callback_new_1(callback_cast(route_alternatives_idle), this);
+	this->alternatives_idle=event_add_idle(50, this->alternatives_cb);
+}
+
+/**
+ * @brief Returns the flags of a street as kept in a route path segment
+ *
+ * Route path segments built from street data carry no offset and no size, weight or dangerous goods
+ * limits, so the corresponding flags are masked out in order to keep {@code RSD_*} working.
+ *
+ * @param sd The street data
+ * @return The flags for the segment data
+ */
+static int
+route_street_segment_flags(struct street_data *sd)
+{
+	int flags=sd->flags & ~(AF_SEGMENTED|AF_SIZE_OR_WEIGHT_LIMIT|AF_DANGEROUS_GOODS);
+	if (sd->maxspeed == -1)
+		flags&=~AF_SPEED_LIMIT;
+	return flags;
+}
+
+/**
+ * @brief Fills route segment data for a street
+ *
+ * @param sd The street data
+ * @param len The length to store in the segment data
+ * @param data The segment data, which must have room for {@code route_segment_data_size()} bytes
+ */
+static void
+route_street_segment_data(struct street_data *sd, int len, struct route_segment_data *data)
+{
+	data->item=sd->item;
+	data->flags=route_street_segment_flags(sd);
+	data->len=len;
+	if (data->flags & AF_SPEED_LIMIT)
+		RSD_MAXSPEED(data)=sd->maxspeed;
+}
+
+/**
+ * @brief Adds a street to a path without using the route graph
+ *
+ * This does the same as {@code route_path_add_item_from_graph()} for the whole street or, if
+ * {@code pos} or {@code dst} is given, for the part of the street behind the position or in front of
+ * the destination. Only one of {@code pos} and {@code dst} may be given.
+ *
+ * @param this The path to add the street to
+ * @param sd The street
+ * @param dir Order in which to add the coordinates, >0 in the order of the street's coordinates
+ * @param pos Information about the start point if this is the first street
+ * @param dst Information about the end point if this is the last street
+ */
+static void
+route_path_add_street(struct route_path *this, struct street_data *sd, int dir, struct route_info *pos, struct route_info *dst)
+{
+	struct route_path_segment *segment;
+	struct coord *c,*cd;
+	int i,ccnt,len,extra=0;
+	int seg_size,seg_dat_size;
+
+	if (pos) {
+		extra=1;
+		if (dir > 0) {
+			c=sd->c+pos->pos+1;
+			ccnt=sd->count-pos->pos-1;
+			len=pos->lenpos;
+		} else {
+			c=sd->c;
+			ccnt=pos->pos+1;
+			len=pos->lenneg;
+		}
+		pos->dir=dir;
+	} else if (dst) {
+		extra=1;
+		if (dir > 0) {
+			c=sd->c;
+			ccnt=dst->pos+1;
+			len=dst->lenneg;
+		} else {
+			c=sd->c+dst->pos+1;
+			ccnt=sd->count-dst->pos-1;
+			len=dst->lenpos;
+		}
+	} else {
+		c=sd->c;
+		ccnt=sd->count;
+		len=transform_polyline_length(map_projection(sd->item.map), sd->c, sd->count);
+	}
+	seg_size=sizeof(*segment) + sizeof(struct coord) * (ccnt + extra);
+	seg_dat_size=route_segment_data_size(route_street_segment_flags(sd));
+	segment=g_malloc0(seg_size + seg_dat_size);
+	segment->data=(struct route_segment_data *)((char *)segment+seg_size);
+	segment->direction=dir;
+	cd=segment->c;
+	if (pos && (!ccnt || c[dir < 0 ? ccnt-1 : 0].x != pos->lp.x || c[dir < 0 ? ccnt-1 : 0].y != pos->lp.y))
+		*cd++=pos->lp;
+	if (dir < 0)
+		c+=ccnt-1;
+	for (i = 0 ; i < ccnt ; i++) {
+		*cd++=*c;
+		c+=dir;
+	}
+	if (dst && (cd == segment->c || cd[-1].x != dst->lp.x || cd[-1].y != dst->lp.y))
+		*cd++=dst->lp;
+	segment->ncoords=cd-segment->c;
+	if (segment->ncoords <= 1) {
+		g_free(segment);
+		return;
+	}
+	route_street_segment_data(sd, len, segment->data);
+	item_hash_insert(this->path_hash, &sd->item, segment);
+	route_path_add_segment(this, segment);
+}
+
+/**
+ * @brief Checks if a contraction hierarchy may be used to route with a vehicle profile
+ *
+ * The edge weights of the hierarchy are fixed by maptool, see routech.c. It is only used if the profile
+ * selects {@code route_search_ch} and tests the street flags exactly as the hierarchy was built, i.e. for
+ * cars respecting one way streets. Even then its costs follow the street types only, the road profiles,
+ * maxspeeds, traffic distortions, turn restrictions and turn costs of the profile are ignored.
+ *
+ * @param profile The vehicle profile
+ * @return True if the hierarchy may be queried
+ */
+static int
+route_ch_usable(struct vehicleprofile *profile)
+{
+	return profile->route_search_mode == route_search_ch && profile->mode != 2 && profile->flags == ROUTECH_FLAGS
+		&& profile->flags_forward_mask == ROUTECH_FLAGS_FORWARD_MASK && profile->flags_reverse_mask == ROUTECH_FLAGS_REVERSE_MASK;
+}
+
+/**
+ * @brief Computes the seeds of a contraction hierarchy query for a position or destination
+ *
+ * The seeds are the ends of the street {@code ri} is on, together with the time needed to drive
+ * between the ends and {@code ri}. The time is computed as maptool computed the edge weights of the
+ * hierarchy, see routech_street_time(), so both add up. One way streets are respected.
+ *
+ * @param ri The position or destination
+ * @param is_dst True if {@code ri} is a destination, i.e. the street is driven towards it
+ * @param seeds Array of at least two seeds to fill
+ * @param dirs Array of at least two ints which receive the driving direction on the street for each seed
+ * @return The number of seeds
+ */
+static int
+route_path_ch_seeds(struct route_info *ri, int is_dst, struct routech_seed *seeds, int *dirs)
+{
+	struct street_data *sd=ri->street;
+	int time,dir,count=0;
+
+	time=routech_street_time(sd->item.type, ri->lenneg+ri->lenpos);
+	if (time == INT_MAX)
+		return 0;
+	for (dir = 1 ; dir >= -1 ; dir-=2) {
+		if ((sd->flags & (dir > 0 ? ROUTECH_FLAGS_FORWARD_MASK : ROUTECH_FLAGS_REVERSE_MASK)) != ROUTECH_FLAGS)
+			continue;
+		/* leaving the position forwards or reaching the destination backwards uses the last coordinate */
+		if ((dir > 0) != !!is_dst) {
+			seeds[count].c=sd->c[sd->count-1];
+			seeds[count].cost=time*(100-ri->percent)/100;
+		} else {
+			seeds[count].c=sd->c[0];
+			seeds[count].cost=time*ri->percent/100;
+		}
+		dirs[count++]=dir;
+	}
+	return count;
+}
+
+/**
+ * @brief Creates a new route path using the contraction hierarchy of a map in the mapset
+ *
+ * @param ms The mapset to search for a contraction hierarchy
+ * @param pos The starting position of the route
+ * @param dst The destination of the route
+ * @param profile The routing preferences
+ * @return The new route path, or NULL if no map has a hierarchy covering the route
+ */
+static struct route_path *
+route_path_new_ch(struct mapset *ms, struct route_info *pos, struct route_info *dst, struct vehicleprofile *profile)
+{
+	struct routech_seed src_seeds[2],dst_seeds[2];
+	int src_dirs[2],dst_dirs[2],src_count,dst_count;
+	struct mapset_handle *h;
+	struct map *m;
+	struct map_rect *mr;
+	struct routech_path *chpath=NULL;
+	struct route_path *ret;
+	GList *l;
+
+	if (!pos->street || !dst->street || item_is_equal(pos->street->item, dst->street->item))
+		return NULL;
+	src_count=route_path_ch_seeds(pos, 0, src_seeds, src_dirs);
+	dst_count=route_path_ch_seeds(dst, 1, dst_seeds, dst_dirs);
+	if (!src_count || !dst_count)
+		return NULL;
+	h=mapset_open(ms);
+	while (!chpath && (m=mapset_next(h, 2)))
+		chpath=routech_query(m, src_seeds, src_count, dst_seeds, dst_count);
+	mapset_close(h);
+	if (!chpath)
+		return NULL;
+	dbg(lvl_debug,"cost %d, %d streets\n", chpath->cost, g_list_length(chpath->streets));
+	ret=g_new0(struct route_path, 1);
+	ret->in_use=1;
+	ret->path_hash=item_hash_new();
+	if (pos->lenextra)
+		route_path_add_line(ret, &pos->c, &pos->lp, pos->lenextra);
+	route_path_add_street(ret, pos->street, src_dirs[chpath->src], pos, NULL);
+	mr=map_rect_new(m, NULL);
+	for (l=chpath->streets ; l ; l=g_list_next(l)) {
+		struct routech_street *street=l->data;
+		struct item *item=map_rect_get_item_byid(mr, street->id.id_hi, street->id.id_lo);
+		struct street_data *sd;
+		if (!item || !(sd=street_get_data(item))) {
+			dbg(lvl_error,"street "ITEM_ID_FMT" of the contraction hierarchy not found\n", ITEM_ID_ARGS(street->id));
+			map_rect_destroy(mr);
+			routech_path_destroy(chpath);
+			route_path_destroy(ret,0);
+			return NULL;
+		}
+		route_path_add_street(ret, sd, street->dir, NULL, NULL);
+		street_data_free(sd);
+	}
+	map_rect_destroy(mr);
+	route_path_add_street(ret, dst->street, dst_dirs[chpath->dst], NULL, dst);
+	if (dst->lenextra)
+		route_path_add_line(ret, &dst->lp, &dst->c, dst->lenextra);
+	routech_path_destroy(chpath);
+	return ret;
+}
+
+/**
+ * @brief Shortens the first leg of a route path to start at a position on it
+ *
+ * While the vehicle follows the path, the rest of the path from the street it is on stays valid,
+ * so the contraction hierarchy does not need to be queried again. The segments behind the street are
+ * moved to the new path and the street itself is added from the position on.
+ *
+ * @param oldpath The path, its segments behind the street of {@code pos} are moved to the new path
+ * @param pos The position
+ * @param dst The destination of the leg
+ * @return The new path, or NULL if the street of {@code pos} is not on the path, is the street of
+ * {@code dst}, or the vehicle drives against the direction of the path on it
+ */
+static struct route_path *
+route_path_trim(struct route_path *oldpath, struct route_info *pos, struct route_info *dst)
+{
+	struct route_path_segment *seg,*next;
+	struct route_path *ret;
+	int dir;
+
+	if (!pos->street || !dst->street || item_is_equal(pos->street->item, dst->street->item))
+		return NULL;
+	for (seg=oldpath->path ; seg ; seg=seg->next) {
+		if (item_is_equal(seg->data->item, pos->street->item))
+			break;
+	}
+	if (!seg || !seg->next)
+		return NULL;
+	dir=seg->direction > 0 ? 1 : -1;
+	if (pos->street_direction && pos->street_direction != dir)
+		return NULL;
+	ret=g_new0(struct route_path, 1);
+	ret->in_use=1;
+	ret->updated=1;
+	ret->path_hash=item_hash_new();
+	if (pos->lenextra)
+		route_path_add_line(ret, &pos->c, &pos->lp, pos->lenextra);
+	route_path_add_street(ret, pos->street, dir, pos, NULL);
+	next=seg->next;
+	seg->next=NULL;
+	oldpath->path_last=seg;
+	for (seg=next ; seg ; seg=next) {
+		next=seg->next;
+		seg->next=NULL;
+		item_hash_remove(oldpath->path_hash, &seg->data->item);
+		item_hash_insert(ret->path_hash, &seg->data->item, seg);
+		route_path_add_segment(ret, seg);
+	}
+	return ret;
+}
+
+/**
+ * @brief Computes the route path to all destinations using a contraction hierarchy
+ *
+ * This replaces flooding the route graph if the vehicle profile allows it, see route_ch_usable(),
+ * and the map contains a contraction hierarchy (see maptool/ch.c). The route graph of the route
+ * must be a placeholder with {@code ch} set, which keeps the route map and the graph map working
+ * while no graph is built.
+ *
+ * As long as the vehicle stays on the path, the path is only shortened, see route_path_trim().
+ *
+ * @param this The route object
+ * @return True if the route path was computed, false if the route graph has to be used instead
+ */
+static int
+route_path_update_ch(struct route *this)
+{
+	struct route_path *oldpath=this->path2,*first=NULL,*path,**next=&first;
+	struct route_info *prev=this->pos;
+	struct attr route_status;
+	GList *l;
+
+	if (!route_ch_usable(this->vehicleprofile))
+		return 0;
+	route_status.type=attr_route_status;
+	if (oldpath && (path=route_path_trim(oldpath, this->pos, this->destinations->data))) {
+		dbg(lvl_debug,"still on the contraction hierarchy path\n");
+		route_path_set_totals(path, this->vehicleprofile, this->speed_profiles,
+			speed_profiles_week_time(this->departure_time ? this->departure_time : time(NULL)));
+		path->next=oldpath->next;
+		oldpath->next=NULL;
+		route_path_destroy(oldpath,0);
+		this->path2=path;
+		route_status.u.num=route_status_path_done_incremental;
+		route_set_attr(this, &route_status);
+		return 1;
+	}
+	if (transform_distance(route_projection(this), &this->pos->c, &route_get_dst(this)->c) < ROUTE_CH_MIN_DISTANCE)
+		return 0;
+	route_status.u.num=route_status_building_path;
+	route_set_attr(this, &route_status);
+	for (l=this->destinations ; l ; l=g_list_next(l)) {
+		path=route_path_new_ch(this->ms, prev, l->data, this->vehicleprofile);
+		if (!path) {
+			dbg(lvl_debug,"no contraction hierarchy path\n");
+			route_path_destroy(first,1);
+			return 0;
+		}
+		route_path_set_totals(path, this->vehicleprofile, this->speed_profiles,
+			speed_profiles_week_time(this->departure_time ? this->departure_time : time(NULL)));
+		*next=path;
+		next=&path->next;
+		prev=l->data;
+	}
+	route_path_destroy(oldpath,1);
+	this->path2=first;
+	this->current_dst=this->destinations->data;
+	this->link_path=0;
+	route_status.u.num=oldpath ? route_status_path_done_incremental : route_status_path_done_new;
+	route_set_attr(this, &route_status);
+	return 1;
+}
+
+static int
+route_graph_build_next_map(struct route_graph *rg)
+{
+	do {
+		rg->m=mapset_next(rg->h, 2);
+		if (! rg->m)
+			return 0;
+		map_rect_destroy(rg->mr);
+		rg->mr=map_rect_new(rg->m, rg->sel);
+	} while (!rg->mr);
+		
+	return 1;
+}
+
+
+/**
+ * @brief A turn restriction at a point of the route graph
+ */
+struct route_turn_restriction {
+	enum item_type type;			/**< {@code type_street_turn_restriction_no} or {@code type_street_turn_restriction_only} */
+	struct coord from;			/**< The point the restricted turn comes from */
+	struct coord to;			/**< The point the restricted turn leads to */
+};
+
+/**
+ * @brief Collects the turn restrictions at a point
+ *
+ * The restrictions are looked up once per point, so checking a turn does not need to walk the
+ * segment lists of the point again.
+ *
+ * @param p The point
+ * @param count Receives the number of restrictions
+ * @return The restrictions, to be freed with {@code g_free()}
+ */
+static struct route_turn_restriction *
+route_graph_point_turn_restrictions(struct route_graph_point *p, int *count)
+{
+	struct route_turn_restriction *ret=NULL;
+	struct route_graph_segment *tmp1,*tmp2;
+
+	*count=0;
+	for (tmp1=p->end ; tmp1 ; tmp1=tmp1->end_next) {
+		if (tmp1->data.item.type != type_street_turn_restriction_no &&
+			tmp1->data.item.type != type_street_turn_restriction_only)
+			continue;
+		for (tmp2=p->start ; tmp2 ; tmp2=tmp2->start_next) {
+			if (item_is_equal(tmp1->data.item, tmp2->data.item))
+				break;
+		}
+		if (!tmp2)
+			continue;
+		dbg(lvl_debug,"found %s (0x%x,0x%x) (0x%x,0x%x)-(0x%x,0x%x)-(0x%x,0x%x)\n",item_to_name(tmp1->data.item.type),tmp1->data.item.id_hi,tmp1->data.item.id_lo,tmp1->start->c.x,tmp1->start->c.y,p->c.x,p->c.y,tmp2->end->c.x,tmp2->end->c.y);
+		ret=g_renew(struct route_turn_restriction, ret, *count+1);
+		ret[*count].type=tmp1->data.item.type;
+		ret[*count].from=tmp1->start->c;
+		ret[*count].to=tmp2->end->c;
+		(*count)++;
+	}
+	return ret;
+}
+
+static int
+is_turn_allowed(struct route_graph_point *p, struct route_graph_segment *from, struct route_graph_segment *to,
+		struct route_turn_restriction *restrictions, int count)
+{
+	struct route_graph_point *prev,*next;
+	int i;
+	if (item_is_equal(from->data.item, to->data.item))
+		return 0;
+	if (from->start == p)
+		prev=from->end;
+	else
+		prev=from->start;
+	if (to->start == p)
+		next=to->end;
+	else
+		next=to->start;
+	for (i = 0 ; i < count ; i++) {
+		if (restrictions[i].from.x != prev->c.x || restrictions[i].from.y != prev->c.y)
+			continue;
+		if (restrictions[i].type == type_street_turn_restriction_no && restrictions[i].to.x == next->c.x && restrictions[i].to.y == next->c.y) {
+			dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x not allowed (no)\n",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,next->c.y);
+			return 0;
+		}
+		if (restrictions[i].type == type_street_turn_restriction_only && (restrictions[i].to.x != next->c.x || restrictions[i].to.y != next->c.y)) {
+			dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x not allowed (only)\n",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,next->c.y);
+			return 0;
+		}
+	}
+	dbg(lvl_debug,"from 0x%x,0x%x over 0x%x,0x%x to 0x%x,0x%x allowed\n",prev->c.x,prev->c.y,p->c.x,p->c.y,next->c.x,next->c.y);
+	return 1;
+}
+
+static void
+route_graph_clone_segment(struct route_graph *this, struct route_graph_segment *s, struct route_graph_point *start, struct route_graph_point *end, int flags)
+{
+	struct route_graph_segment_data data;
+	data.item=&s->data.item;
+	data.offset=1;
+	data.flags=s->data.flags|flags;
+	data.len=s->data.len+1;
+	data.maxspeed=-1;
+	data.dangerous_goods=0;
+	data.start_dir=s->start_dir;
+	data.end_dir=s->end_dir;
+	if (s->data.flags & AF_SPEED_LIMIT)
+		data.maxspeed=RSD_MAXSPEED(&s->data);
+	if (s->data.flags & AF_SEGMENTED) 
+		data.offset=RSD_OFFSET(&s->data);
+	dbg(lvl_debug,"cloning segment from %p (0x%x,0x%x) to %p (0x%x,0x%x)\n",start,start->c.x,start->c.y, end, end->c.x, end->c.y);
+	route_graph_add_segment(this, start, end, &data);
+}
+
+static void
+route_graph_process_restriction_segment(struct route_graph *this, struct route_graph_point *p, struct route_graph_segment *s, int dir,
+		struct route_turn_restriction *restrictions, int count)
+{
+	struct route_graph_segment *tmp;
+	struct route_graph_point *pn;
+	struct coord c=p->c;
+	int dx=0;
+	int dy=0;
+	c.x+=dx;
+	c.y+=dy;
+	dbg(lvl_debug,"From %s %d,%d\n",item_to_name(s->data.item.type),dx,dy);
+	pn=route_graph_point_new(this, &c);
+	if (dir > 0) { /* going away */
+		dbg(lvl_debug,"other 0x%x,0x%x\n",s->end->c.x,s->end->c.y);
+		if (s->data.flags & AF_ONEWAY) {
+			dbg(lvl_debug,"Not possible\n");
+			return;
+		}
+		route_graph_clone_segment(this, s, pn, s->end, AF_ONEWAYREV);
+	} else { /* coming in */
+		dbg(lvl_debug,"other 0x%x,0x%x\n",s->start->c.x,s->start->c.y);
+		if (s->data.flags & AF_ONEWAYREV) {
+			dbg(lvl_debug,"Not possible\n");
+			return;
+		}
+		route_graph_clone_segment(this, s, s->start, pn, AF_ONEWAY);
+	}
+	tmp=p->start;
+	while (tmp) {
+		if (tmp != s && tmp->data.item.type != type_street_turn_restriction_no &&
+			tmp->data.item.type != type_street_turn_restriction_only &&
+			!(tmp->data.flags & AF_ONEWAYREV) && is_turn_allowed(p, s, tmp, restrictions, count)) {
+			route_graph_clone_segment(this, tmp, pn, tmp->end, AF_ONEWAY);
+			dbg(lvl_debug,"To start %s\n",item_to_name(tmp->data.item.type));
+		}
+		tmp=tmp->start_next;
+	}
+	tmp=p->end;
+	while (tmp) {
+		if (tmp != s && tmp->data.item.type != type_street_turn_restriction_no &&
+			tmp->data.item.type != type_street_turn_restriction_only &&
+			!(tmp->data.flags & AF_ONEWAY) && is_turn_allowed(p, s, tmp, restrictions, count)) {
+			route_graph_clone_segment(this, tmp, tmp->start, pn, AF_ONEWAYREV);
+			dbg(lvl_debug,"To end %s\n",item_to_name(tmp->data.item.type));
+		}
+		tmp=tmp->end_next;
+	}
+}
+
+static void
+route_graph_process_restriction_point(struct route_graph *this, struct route_graph_point *p)
+{
+	struct route_graph_segment *tmp;
+	struct route_turn_restriction *restrictions;
+	int count;
+	restrictions=route_graph_point_turn_restrictions(p, &count);
+	tmp=p->start;
+	dbg(lvl_debug,"node 0x%x,0x%x\n",p->c.x,p->c.y);
+	while (tmp) {
+		if (tmp->data.item.type != type_street_turn_restriction_no &&
+			tmp->data.item.type != type_street_turn_restriction_only)
+			route_graph_process_restriction_segment(this, p, tmp, 1, restrictions, count);
+		tmp=tmp->start_next;
+	}
+	tmp=p->end;
+	while (tmp) {
+		if (tmp->data.item.type != type_street_turn_restriction_no &&
+			tmp->data.item.type != type_street_turn_restriction_only)
+			route_graph_process_restriction_segment(this, p, tmp, -1, restrictions, count);
+		tmp=tmp->end_next;
+	}
+	g_free(restrictions);
+	p->flags |= RP_TURN_RESTRICTION_RESOLVED;
+}
+
+static void
+route_graph_process_restrictions(struct route_graph *this)
+{
+	struct route_graph_point *curr;
+	int i;
+	dbg(lvl_debug,"enter\n");
+	for (i = 0 ; i < this->point_count ; i++) {
+		curr=ROUTE_GRAPH_POINT(this, i);
+		if (curr->flags & RP_TURN_RESTRICTION) 
+			route_graph_process_restriction_point(this, curr);
+	}
+}
+
+/**
+ * @brief Adds an item read from a map to the route graph
+ *
+ * @param rg The route graph
+ * @param item The item
+ * @param profile The vehicle profile
+ */
+static void
+route_graph_process_item(struct route_graph *rg, struct item *item, struct vehicleprofile *profile)
+{
+	if (item->type == type_traffic_distortion)
+		route_process_traffic_distortion(rg, item);
+	else if (item->type == type_street_turn_restriction_no || item->type == type_street_turn_restriction_only)
+		route_process_turn_restriction(rg, item);
+	else
+		route_process_street_graph(rg, item, profile);
+}
+
+static void route_graph_build_idle(struct route_graph *rg, struct vehicleprofile *profile);
+
+#ifdef HAVE_PTHREAD
+/**
+ * @brief Copy of a map item read by a graph build worker
+ *
+ * Items of a map rect are only valid until the next item is fetched, so workers copy everything
+ * route_process_street_graph() and friends need. The copy implements the item methods, so these
+ * functions can process it later on the main loop just like the original item.
+ */
+struct route_graph_build_item {
+	struct item item;				/**< The item, {@code meth} and {@code priv_data} refer to the copy */
+	struct route_graph_build_item *next;		/**< The next item read by the same worker */
+	int split;					/**< Set if the item was read from a part of a map, see {@code struct route_graph_build_unit} */
+	int coord_count;				/**< Number of coordinates */
+	int coord_pos;					/**< Index of the next coordinate to return */
+	int attr_count;					/**< Number of attributes */
+	struct coord *c;				/**< Coordinates of the item */
+	unsigned char *node;				/**< Result of item_coord_is_node() before each coordinate */
+	struct attr *attrs;				/**< Attributes of the item, all of them numbers */
+};
+
+/**
+ * @brief Block of memory a graph build worker stores the items it read in
+ */
+struct route_graph_build_block {
+	struct route_graph_build_block *next;		/**< The block filled before this one */
+	int used;					/**< Number of bytes used */
+	int size;					/**< Number of bytes available */
+};
+
+/**
+ * @brief A map, or a part of it, to be read by a graph build worker
+ */
+struct route_graph_build_unit {
+	struct map *map;				/**< The map of the mapset, the items read are attributed to it */
+	struct map *dup;				/**< The map opened again for the worker, see map_dup(), or NULL to read
+							 *  {@code map} on the main loop */
+	struct map_selection *sel;			/**< The part of the selection to read */
+	int split;					/**< Set if other units read the other parts of the selection */
+	int part;					/**< First part of the selection whose items the unit estimates the size of */
+	int part_end;					/**< Part after the last one whose items the unit estimates the size of */
+	int parts;					/**< Number of parts the selection is split into */
+};
+
+/**
+ * @brief A thread reading some of the maps of a mapset for the route graph
+ *
+ * All buffers belong to the worker, so the threads do not compete for memory while reading.
+ */
+struct route_graph_build_worker {
+	pthread_t thread;				/**< The thread */
+	struct route_graph_build_workers *workers;	/**< All workers building the same graph */
+	GList *units;					/**< {@code struct route_graph_build_unit} to read */
+	struct route_graph_build_block *block;		/**< The block items are currently stored in */
+	struct route_graph_build_item *first;		/**< The first item read */
+	struct route_graph_build_item *last;		/**< The last item read */
+	long estimate;					/**< Estimated bytes of the graph for the items read since the last check */
+	int size;					/**< Number of entries in {@code c} and {@code node} */
+	struct coord *c;				/**< Buffer for the coordinates of the item being copied */
+	unsigned char *node;				/**< Buffer for the node flags of the item being copied */
+};
+
+/**
+ * @brief Threads reading the maps of a mapset for a route graph
+ */
+struct route_graph_build_workers {
+	pthread_mutex_t mutex;				/**< Protects {@code running}, {@code cancel}, {@code estimate} and
+							 *  {@code over_budget} */
+	pthread_cond_t cond;				/**< Signalled when a worker is finished */
+	int running;					/**< Number of workers still reading */
+	int cancel;					/**< Set to make the workers stop reading */
+	long budget;					/**< Bytes the graph may use, 0 for no limit */
+	long estimate;					/**< Estimated bytes of the graph for all items read so far */
+	int over_budget;				/**< Set if {@code estimate} exceeded {@code budget}, the workers stop then */
+	struct map_selection *sel;			/**< The whole selection, to assign items read by several units to one */
+	int count;					/**< Number of threads */
+	struct route_graph_build_worker *worker;	/**< The workers, one per thread followed by one for the main loop */
+	struct vehicleprofile *profile;			/**< Copy of the vehicle profile to select streets with */
+	int merge_worker;				/**< Index of the worker whose items are merged next */
+	struct route_graph_build_item *merge_item;	/**< The next item to merge */
+	struct item_hash *merged;			/**< Items read from parts of a map which are merged already, except streets */
+	struct callback *poll_cb;			/**< Callback to check if all workers are finished */
+	struct event_timeout *poll;			/**< Timeout to call {@code poll_cb} */
+};
+
+/**
+ * Interval in milliseconds at which the main loop checks if all workers are finished
+ */
+#define ROUTE_GRAPH_BUILD_POLL 20
+
+/**
+ * Number of items after which a worker checks if it has been cancelled or the graph exceeds its budget
+ */
+#define ROUTE_GRAPH_BUILD_CANCEL_CHECK 256
+
+/**
+ * Estimated bytes a street segment read by a worker takes in the route graph, see
+ * route_graph_build_workers_check()
+ */
+#define ROUTE_GRAPH_BUILD_SEGMENT_ESTIMATE (sizeof(struct route_graph_segment)-sizeof(struct route_segment_data)+\
+	route_segment_data_size(0)+sizeof(struct route_graph_point)/2+sizeof(void *))
+
+/**
+ * Minimum size of the blocks the workers store items in
+ */
+#define ROUTE_GRAPH_BUILD_BLOCK_SIZE 65536
+
+#define ROUTE_GRAPH_BUILD_ALIGN(size) (((size)+7) & ~7)
+
+/**
+ * Attributes which are copied from items read by the workers
+ */
+static enum attr_type route_graph_build_attrs[]={attr_flags, attr_maxspeed, attr_delay, attr_vehicle_dangerous_goods,
+	attr_vehicle_width, attr_vehicle_height, attr_vehicle_length, attr_vehicle_weight, attr_vehicle_axle_weight};
+
+/**
+ * Workers which were cancelled while reading, they are freed from the main loop once they stopped
+ */
+static GList *route_graph_build_workers_stopping;
+static struct callback *route_graph_build_workers_reap_cb;
+static struct event_timeout *route_graph_build_workers_reap_ev;
+
+static void
+route_graph_build_item_coord_rewind(void *priv_data)
+{
+	struct route_graph_build_item *bi=priv_data;
+	bi->coord_pos=0;
+}
+
+static int
+route_graph_build_item_coord_get(void *priv_data, struct coord *c, int count)
+{
+	struct route_graph_build_item *bi=priv_data;
+	if (count > bi->coord_count-bi->coord_pos)
+		count=bi->coord_count-bi->coord_pos;
+	memcpy(c, bi->c+bi->coord_pos, count*sizeof(*c));
+	bi->coord_pos+=count;
+	return count;
+}
+
+static void
+route_graph_build_item_attr_rewind(void *priv_data)
+{
+}
+
+static int
+route_graph_build_item_attr_get(void *priv_data, enum attr_type attr_type, struct attr *attr)
+{
+	struct route_graph_build_item *bi=priv_data;
+	int i;
+	for (i = 0 ; i < bi->attr_count ; i++) {
+		if (bi->attrs[i].type == attr_type) {
+			*attr=bi->attrs[i];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int
+route_graph_build_item_coord_is_node(void *priv_data)
+{
+	struct route_graph_build_item *bi=priv_data;
+	return bi->coord_pos < bi->coord_count && bi->node[bi->coord_pos];
+}
+
+static struct item_methods route_graph_build_item_meth = {
+	route_graph_build_item_coord_rewind,
+	route_graph_build_item_coord_get,
+	route_graph_build_item_attr_rewind,
+	route_graph_build_item_attr_get,
+	route_graph_build_item_coord_is_node,
+};
+
+/**
+ * @brief Allocates memory from the blocks of a worker
+ *
+ * @param w The worker
+ * @param size The number of bytes needed
+ * @return The memory, freed with the blocks of the worker
+ */
+static void *
+route_graph_build_alloc(struct route_graph_build_worker *w, int size)
+{
+	struct route_graph_build_block *b=w->block;
+	int header=ROUTE_GRAPH_BUILD_ALIGN(sizeof(*b));
+	void *ret;
+
+	size=ROUTE_GRAPH_BUILD_ALIGN(size);
+	if (!b || b->used+size > b->size) {
+		int block_size=MAX(size, ROUTE_GRAPH_BUILD_BLOCK_SIZE);
+		b=g_malloc(header+block_size);
+		b->next=w->block;
+		b->used=0;
+		b->size=block_size;
+		w->block=b;
+	}
+	ret=(char *)b+header+b->used;
+	b->used+=size;
+	return ret;
+}
+
+/**
+ * @brief Checks if the size of an item is estimated by a unit
+ *
+ * Items on the border of two parts of a selection, or even all items of a tile, are read by several
+ * units. Only the unit whose part contains the first coordinate of the item counts it.
+ *
+ * @param workers The workers
+ * @param u The unit which read the item
+ * @param c The first coordinate of the item
+ * @return True if the unit counts the item
+ */
+static int
+route_graph_build_unit_owns(struct route_graph_build_workers *workers, struct route_graph_build_unit *u, struct coord *c)
+{
+	struct map_selection *sel;
+	int part=0;
+
+	if (u->parts < 2)
+		return 1;
+	for (sel=workers->sel ; sel ; sel=sel->next) {
+		struct coord_rect *r=&sel->u.c_rect;
+		if (coord_rect_contains(r, c)) {
+			long long width=(long long)r->rl.x-r->lu.x;
+			if (width > 0)
+				part=MIN(((long long)c->x-r->lu.x)*u->parts/width, u->parts-1);
+			break;
+		}
+	}
+	return part >= u->part && part < u->part_end;
+}
+
+/**
+ * @brief Copies an item for processing on the main loop
+ *
+ * @param w The worker which read the item
+ * @param u The map the item was read from
+ * @param item The item as returned by the map
+ */
+static void
+route_graph_build_item_add(struct route_graph_build_worker *w, struct route_graph_build_unit *u, struct item *item)
+{
+	struct route_graph_build_item *ret;
+	struct attr attrs[sizeof(route_graph_build_attrs)/sizeof(*route_graph_build_attrs)];
+	int coord_count=0,attr_count=0,i;
+
+	for (;;) {
+		if (coord_count == w->size) {
+			w->size=w->size ? w->size*2 : 256;
+			w->c=g_renew(struct coord, w->c, w->size);
+			w->node=g_renew(unsigned char, w->node, w->size);
+		}
+		w->node[coord_count]=item_coord_is_node(item);
+		if (!item_coord_get(item, &w->c[coord_count], 1))
+			break;
+		coord_count++;
+	}
+	for (i = 0 ; i < sizeof(route_graph_build_attrs)/sizeof(*route_graph_build_attrs) ; i++) {
+		item_attr_rewind(item);
+		if (item_attr_get(item, route_graph_build_attrs[i], &attrs[attr_count]))
+			attr_count++;
+	}
+	ret=route_graph_build_alloc(w, sizeof(*ret)+coord_count*sizeof(struct coord)+attr_count*sizeof(struct attr)+coord_count);
+	ret->item=*item;
+	/* The graph refers to the map of the mapset, the map of the worker is closed afterwards */
+	ret->item.map=u->map;
+	ret->item.meth=&route_graph_build_item_meth;
+	ret->item.priv_data=ret;
+	ret->next=NULL;
+	ret->split=u->split;
+	ret->coord_count=coord_count;
+	ret->coord_pos=0;
+	ret->attr_count=attr_count;
+	ret->c=(struct coord *)(ret+1);
+	ret->attrs=(struct attr *)(ret->c+coord_count);
+	ret->node=(unsigned char *)(ret->attrs+attr_count);
+	memcpy(ret->c, w->c, coord_count*sizeof(struct coord));
+	memcpy(ret->attrs, attrs, attr_count*sizeof(struct attr));
+	memcpy(ret->node, w->node, coord_count);
+	if (item->type != type_traffic_distortion && item->type != type_street_turn_restriction_no &&
+		item->type != type_street_turn_restriction_only && coord_count && route_graph_build_unit_owns(w->workers, u, &w->c[0])) {
+		/* One segment, plus one more at each node of a segmented street */
+		int segments=1;
+		for (i = 1 ; i < coord_count-1 ; i++)
+			segments+=w->node[i] != 0;
+		w->estimate+=segments*ROUTE_GRAPH_BUILD_SEGMENT_ESTIMATE;
+	}
+	if (w->last)
+		w->last->next=ret;
+	else
+		w->first=ret;
+	w->last=ret;
+}
+
+/**
+ * @brief Returns a part of a selection, so several workers can read the same map
+ *
+ * Each rectangle of the selection is cut into stripes from west to east. Items on the border of two
+ * stripes are read by both workers.
+ *
+ * @param sel The selection
+ * @param part The part to return
+ * @param parts The number of parts
+ * @return The part of the selection, to be freed with map_selection_destroy()
+ */
+static struct map_selection *
+route_graph_build_split_selection(struct map_selection *sel, int part, int parts)
+{
+	struct map_selection *ret=map_selection_dup(sel),*curr;
+	for (curr=ret ; curr ; curr=curr->next) {
+		int lu=curr->u.c_rect.lu.x;
+		long long width=(long long)curr->u.c_rect.rl.x-lu;
+		curr->u.c_rect.lu.x=lu+width*part/parts;
+		curr->u.c_rect.rl.x=lu+width*(part+1)/parts;
+	}
+	return ret;
+}
+
+/**
+ * @brief Checks if the workers of a route graph have been cancelled or exceeded the memory budget
+ *
+ * The size of the graph is estimated from the items the workers read, so the budget is checked while
+ * reading rather than only once the items are merged. If the estimate exceeds the budget, all workers
+ * stop and route_graph_build_check_budget() starts reading again with a degraded selection.
+ *
+ * @param workers The workers
+ * @param w The worker checking, its estimate is added to the one of all workers
+ * @return True if the worker has to stop reading
+ */
+static int
+route_graph_build_workers_check(struct route_graph_build_workers *workers, struct route_graph_build_worker *w)
+{
+	int ret;
+	pthread_mutex_lock(&workers->mutex);
+	workers->estimate+=w->estimate;
+	w->estimate=0;
+	if (workers->budget && workers->estimate > workers->budget && !workers->over_budget) {
+		workers->over_budget=1;
+		workers->cancel=1;
+	}
+	ret=workers->cancel;
+	pthread_mutex_unlock(&workers->mutex);
+	return ret;
+}
+
+/**
+ * @brief Returns the number of workers of a route graph which are still reading
+ */
+static int
+route_graph_build_workers_running(struct route_graph_build_workers *workers)
+{
+	int ret;
+	pthread_mutex_lock(&workers->mutex);
+	ret=workers->running;
+	pthread_mutex_unlock(&workers->mutex);
+	return ret;
+}
+
+/**
+ * @brief Main function of a graph build worker
+ *
+ * Reads all items relevant for routing from the maps of the worker.
+ *
+ * @param data The {@code struct route_graph_build_worker}
+ */
+static void *
+route_graph_build_worker(void *data)
+{
+	struct route_graph_build_worker *w=data;
+	struct route_graph_build_workers *workers=w->workers;
+	struct route_graph_build_unit *u;
+	struct map_rect *mr;
+	struct item *item;
+	GList *l;
+	int count=0,cancel=0;
+
+	for (l=w->units ; l && !cancel ; l=g_list_next(l)) {
+		u=l->data;
+		mr=map_rect_new(u->dup ? u->dup : u->map, u->sel);
+		if (!mr)
+			continue;
+		while (!cancel && (item=map_rect_get_item(mr))) {
+			if (item->type == type_traffic_distortion || item->type == type_street_turn_restriction_no ||
+				item->type == type_street_turn_restriction_only || vehicleprofile_get_roadprofile(workers->profile, item->type))
+				route_graph_build_item_add(w, u, item);
+			if (!(++count % ROUTE_GRAPH_BUILD_CANCEL_CHECK))
+				cancel=route_graph_build_workers_check(workers, w);
+		}
+		map_rect_destroy(mr);
+		if (!cancel)
+			cancel=route_graph_build_workers_check(workers, w);
+	}
+	pthread_mutex_lock(&workers->mutex);
+	workers->running--;
+	pthread_cond_signal(&workers->cond);
+	pthread_mutex_unlock(&workers->mutex);
+	return NULL;
+}
+
+/**
+ * @brief Waits until all workers are finished
+ *
+ * @param workers The workers
+ */
+static void
+route_graph_build_workers_wait(struct route_graph_build_workers *workers)
+{
+	pthread_mutex_lock(&workers->mutex);
+	while (workers->running)
+		pthread_cond_wait(&workers->cond, &workers->mutex);
+	pthread_mutex_unlock(&workers->mutex);
+}
+
+/**
+ * @brief Frees workers which are finished, including the maps they opened and the items they read
+ *
+ * @param workers The workers
+ */
+static void
+route_graph_build_workers_free(struct route_graph_build_workers *workers)
+{
+	struct route_graph_build_block *b;
+	GList *l;
+	int i;
+
+	for (i = 0 ; i <= workers->count ; i++) {
+		struct route_graph_build_worker *w=&workers->worker[i];
+		if (w->thread)
+			pthread_join(w->thread, NULL);
+		while ((b=w->block)) {
+			w->block=b->next;
+			g_free(b);
+		}
+		for (l=w->units ; l ; l=g_list_next(l)) {
+			struct route_graph_build_unit *u=l->data;
+			if (u->dup)
+				navit_object_unref((struct navit_object *)u->dup);
+			map_selection_destroy(u->sel);
+			g_free(u);
+		}
+		g_list_free(w->units);
+		g_free(w->c);
+		g_free(w->node);
+	}
+	if (workers->merged)
+		item_hash_destroy(workers->merged);
+	map_selection_destroy(workers->sel);
+	vehicleprofile_destroy(workers->profile);
+	pthread_mutex_destroy(&workers->mutex);
+	pthread_cond_destroy(&workers->cond);
+	g_free(workers->worker);
+	g_free(workers);
+}
+
+/**
+ * @brief Frees cancelled workers which stopped reading
+ */
+static void
+route_graph_build_workers_reap(void)
+{
+	GList *l,*next;
+
+	for (l=route_graph_build_workers_stopping ; l ; l=next) {
+		next=g_list_next(l);
+		if (!route_graph_build_workers_running(l->data)) {
+			route_graph_build_workers_free(l->data);
+			route_graph_build_workers_stopping=g_list_delete_link(route_graph_build_workers_stopping, l);
+		}
+	}
+	if (!route_graph_build_workers_stopping) {
+		event_remove_timeout(route_graph_build_workers_reap_ev);
+		route_graph_build_workers_reap_ev=NULL;
+	}
+}
+
+/**
+ * @brief Stops the workers of a route graph and frees all items which were not merged
+ *
+ * When building asynchronously, this does not wait for the workers: They stop at the next check
+ * and are freed from the main loop then.
+ *
+ * @param rg The route graph
+ */
+static void
+route_graph_build_workers_destroy(struct route_graph *rg)
+{
+	struct route_graph_build_workers *workers=rg->workers;
+
+	pthread_mutex_lock(&workers->mutex);
+	workers->cancel=1;
+	pthread_mutex_unlock(&workers->mutex);
+	if (workers->poll)
+		event_remove_timeout(workers->poll);
+	callback_destroy(workers->poll_cb);
+	rg->workers=NULL;
+	if (rg->async && route_graph_build_workers_running(workers)) {
+		route_graph_build_workers_stopping=g_list_prepend(route_graph_build_workers_stopping, workers);
+		if (!route_graph_build_workers_reap_ev) {
+			if (!route_graph_build_workers_reap_cb)
+				route_graph_build_workers_reap_cb=callback_new_0(callback_cast(route_graph_build_workers_reap));
+			route_graph_build_workers_reap_ev=event_add_timeout(ROUTE_GRAPH_BUILD_POLL, 1, route_graph_build_workers_reap_cb);
+		}
+		return;
+	}
+	route_graph_build_workers_wait(workers);
+	route_graph_build_workers_free(workers);
+}
+
+/**
+ * @brief Checks from the main loop if all workers of a route graph are finished
+ *
+ * If so, merging the items they read into the graph is started on the main loop.
+ *
+ * @param rg The route graph
+ * @param profile The vehicle profile
+ */
+static void
+route_graph_build_workers_poll(struct route_graph *rg, struct vehicleprofile *profile)
+{
+	struct route_graph_build_workers *workers=rg->workers;
+
+	if (route_graph_build_workers_running(workers))
+		return;
+	event_remove_timeout(workers->poll);
+	workers->poll=NULL;
+	rg->idle_cb=callback_new_2(callback_cast(route_graph_build_idle), rg, profile);
+	rg->idle_ev=event_add_idle(50, rg->idle_cb);
+}
+
+/**
+ * @brief Adds a map, or a part of it, to the maps a worker reads
+ */
+static void
+route_graph_build_unit_add(struct route_graph_build_worker *w, struct map *map, struct map *dup, struct map_selection *sel, int split,
+		int part, int part_end, int parts)
+{
+	struct route_graph_build_unit *u=g_new0(struct route_graph_build_unit, 1);
+	u->map=map;
+	u->dup=dup;
+	u->sel=sel;
+	u->split=split;
+	u->part=part;
+	u->part_end=part_end;
+	u->parts=parts;
+	w->units=g_list_append(w->units, u);
+}
+
+/**
+ * @brief Starts threads which read the maps of a mapset for a route graph
+ *
+ * Each thread reads its maps through instances of its own, see map_dup(). If there are fewer maps
+ * than threads, the selection is split, so several threads read parts of the same map. Maps which
+ * cannot be opened again, like the route map, are read on the main loop right away. The items read
+ * are merged into the graph on the main loop once all workers are finished.
+ *
+ * @param rg The route graph, its selection must be set
+ * @param ms The mapset
+ * @param profile The vehicle profile
+ * @param threads The maximum number of threads to use
+ * @param async Whether the graph is built asynchronously
+ * @return True if the workers were started
+ */
+static int
+route_graph_build_workers_start(struct route_graph *rg, struct mapset *ms, struct vehicleprofile *profile, int threads, int async)
+{
+	struct route_graph_build_workers *workers;
+	struct route_graph_build_worker *w;
+	struct mapset_handle *h;
+	struct map *m,*dup;
+	struct attr cache_size={attr_tile_cache_size},prefetch={attr_tile_prefetch_threads},*dup_attrs[]={&cache_size,&prefetch,NULL};
+	GList *maps=NULL,*l;
+	int i,count,parts,next=0;
+
+	/* Workers read each tile once, so the maps opened for them need neither a tile cache of their
+	 * own nor threads prefetching tiles */
+	cache_size.u.num=0;
+	prefetch.u.num=0;
+
+	h=mapset_open(ms);
+	while ((m=mapset_next(h, 2)))
+		maps=g_list_append(maps, m);
+	mapset_close(h);
+	count=g_list_length(maps);
+	if (!count) {
+		g_list_free(maps);
+		return 0;
+	}
+	parts=MAX(threads/count, 1);
+	workers=g_new0(struct route_graph_build_workers, 1);
+	pthread_mutex_init(&workers->mutex, NULL);
+	pthread_cond_init(&workers->cond, NULL);
+	workers->count=MIN(count*parts, threads);
+	workers->worker=g_new0(struct route_graph_build_worker, workers->count+1);
+	workers->profile=vehicleprofile_dup(profile);
+	workers->budget=rg->memory_budget;
+	workers->sel=map_selection_dup(rg->sel);
+	for (l=maps ; l ; l=g_list_next(l)) {
+		for (i = 0 ; i < parts ; i++) {
+			dup=map_dup(l->data, dup_attrs);
+			if (!dup) {
+				route_graph_build_unit_add(&workers->worker[workers->count], l->data, NULL, map_selection_dup(rg->sel), i > 0,
+					i, parts, parts);
+				break;
+			}
+			route_graph_build_unit_add(&workers->worker[next++ % workers->count], l->data, dup,
+				route_graph_build_split_selection(rg->sel, i, parts), parts > 1, i, i+1, parts);
+		}
+	}
+	g_list_free(maps);
+	rg->workers=workers;
+	for (i = 0 ; i <= workers->count ; i++) {
+		w=&workers->worker[i];
+		w->workers=workers;
+		if (!w->units)
+			continue;
+		pthread_mutex_lock(&workers->mutex);
+		workers->running++;
+		pthread_mutex_unlock(&workers->mutex);
+		if (i == workers->count || pthread_create(&w->thread, NULL, route_graph_build_worker, w)) {
+			if (i < workers->count)
+				dbg(lvl_error,"failed to start graph build worker\n");
+			w->thread=0;
+			route_graph_build_worker(w);
+		}
+	}
+	dbg(lvl_debug,"started %d workers for %d maps in %d parts\n", workers->count, count, parts);
+	if (async) {
+		workers->poll_cb=callback_new_2(callback_cast(route_graph_build_workers_poll), rg, profile);
+		workers->poll=event_add_timeout(ROUTE_GRAPH_BUILD_POLL, 1, workers->poll_cb);
+	}
+	return 1;
+}
+
+static int route_graph_build_check_budget(struct route_graph *rg, struct vehicleprofile *profile);
+
+/**
+ * @brief Checks if an item read by the workers was merged into the route graph already
+ *
+ * Streets on the border of two parts of a selection are read twice, their segments are dropped
+ * by route_process_street_graph() just like those of streets contained in several maps. Other items
+ * read twice are dropped here.
+ *
+ * @param workers The workers
+ * @param bi The item
+ * @return True if the item must not be merged
+ */
+static int
+route_graph_build_item_is_duplicate(struct route_graph_build_workers *workers, struct route_graph_build_item *bi)
+{
+	if (!bi->split || (bi->item.type != type_traffic_distortion && bi->item.type != type_street_turn_restriction_no &&
+		bi->item.type != type_street_turn_restriction_only))
+		return 0;
+	if (!workers->merged)
+		workers->merged=item_hash_new();
+	if (item_hash_lookup(workers->merged, &bi->item))
+		return 1;
+	item_hash_insert(workers->merged, &bi->item, bi);
+	return 0;
+}
+
+/**
+ * @brief Merges items read by the workers into the route graph
+ *
+ * Waits for the workers first if they are still running, which only happens if the graph is built
+ * synchronously.
+ *
+ * @param rg The route graph
+ * @param profile The vehicle profile
+ */
+static void
+route_graph_build_merge(struct route_graph *rg, struct vehicleprofile *profile)
+{
+	struct route_graph_build_workers *workers=rg->workers;
+	struct route_graph_build_item *bi;
+	int count=1000;
+
+	route_graph_build_workers_wait(workers);
+	if (!workers->merge_worker && !workers->merge_item && route_graph_build_check_budget(rg, profile))
+		return;
+	while (count > 0) {
+		while (!workers->merge_item) {
+			if (workers->merge_worker > workers->count) {
+				route_graph_build_done(rg, 0);
+				return;
+			}
+			workers->merge_item=workers->worker[workers->merge_worker++].first;
+		}
+		bi=workers->merge_item;
+		workers->merge_item=bi->next;
+		if (!route_graph_build_item_is_duplicate(workers, bi))
+			route_graph_process_item(rg, &bi->item, profile);
+		if (route_graph_build_check_budget(rg, profile))
+			return;
+		count--;
+	}
+}
+#endif
+
+static void
+route_graph_build_done(struct route_graph *rg, int cancel)
+{
+	dbg(lvl_debug,"cancel=%d\n",cancel);
+#ifdef HAVE_PTHREAD
+	if (rg->workers)
+		route_graph_build_workers_destroy(rg);
+#endif
+	if (rg->idle_ev)
+		event_remove_idle(rg->idle_ev);
+	if (rg->idle_cb)
+		callback_destroy(rg->idle_cb);
+	map_rect_destroy(rg->mr);
+        mapset_close(rg->h);
+	route_free_selection(rg->sel);
+	rg->idle_ev=NULL;
+	rg->idle_cb=NULL;
+	rg->mr=NULL;
+	rg->h=NULL;
+	rg->sel=NULL;
+	if (! cancel) {
+		dbg(lvl_info,"%d points, index size %d, %d lookups with %d probes, longest probe sequence %d\n", rg->point_count,
+			rg->point_index_size, rg->point_lookups, rg->point_probes, rg->point_probe_max);
+		route_graph_process_restrictions(rg);
+		if (rg->cache_key)
+			route_graph_cache_save(rg);
+	}
+	rg->busy=0;
+	/* Called last, since the callback may hand the graph over to a route worker */
+	if (! cancel)
+		callback_call_0(rg->done_cb);
+}
+
+static void route_graph_build_start(struct route_graph *rg, struct vehicleprofile *profile);
+
+/**
+ * @brief Starts reading the maps again with a degraded selection if a route graph exceeds its memory budget
+ *
+ * Everything read so far is dropped. The graph is no longer stored in the graph cache, since it
+ * does not match the key of its original selection any more. Workers reading the maps stop on their
+ * own once the graph is estimated to exceed the budget, see route_graph_build_workers_check(). If the
+ * selection can not be degraded further, they read everything again without a budget.
+ *
+ * @param rg The route graph
+ * @param profile The vehicle profile
+ * @return True if reading was started again, the caller must not continue reading then
+ */
+static int
+route_graph_build_check_budget(struct route_graph *rg, struct vehicleprofile *profile)
+{
+	int stopped=0,degraded;
+#ifdef HAVE_PTHREAD
+	/* The workers stop reading once the estimated size exceeds the budget */
+	stopped=rg->workers && rg->workers->over_budget;
+#endif
+	if (!stopped && (!rg->memory_budget || rg->memory <= rg->memory_budget))
+		return 0;
+	degraded=route_selection_degrade(rg->sel);
+	if (!degraded) {
+		dbg(lvl_warning,"route graph exceeds its memory budget of %ld kB, but can not be degraded further\n",
+			rg->memory_budget/1024);
+		rg->memory_budget=0;
+		if (!stopped)
+			return 0;
+	} else if (stopped) {
+		dbg(lvl_warning,"route graph is estimated to exceed its memory budget of %ld kB, reading fewer streets\n",
+			rg->memory_budget/1024);
+	} else {
+		dbg(lvl_warning,"route graph exceeds its memory budget of %ld kB with %d points, reading fewer streets\n",
+			rg->memory_budget/1024, rg->point_count);
+	}
+#ifdef HAVE_PTHREAD
+	if (rg->workers)
+		route_graph_build_workers_destroy(rg);
+#endif
+	if (rg->idle_ev)
+		event_remove_idle(rg->idle_ev);
+	if (rg->idle_cb)
+		callback_destroy(rg->idle_cb);
+	map_rect_destroy(rg->mr);
+	mapset_close(rg->h);
+	rg->idle_ev=NULL;
+	rg->idle_cb=NULL;
+	rg->mr=NULL;
+	rg->h=NULL;
+	route_graph_free_points(rg);
+	route_graph_turn_labels_free(rg);
+	route_graph_free_segments(rg);
+	rg->max_maxspeed=-1;
+	if (degraded) {
+		g_free(rg->cache_key);
+		rg->cache_key=NULL;
+	}
+	route_graph_build_start(rg, profile);
+	return 1;
+}
+
+static void
+route_graph_build_idle(struct route_graph *rg, struct vehicleprofile *profile)
+{
+	int count=1000;
+	struct item *item;
+
+#ifdef HAVE_PTHREAD
+	if (rg->workers) {
+		route_graph_build_merge(rg, profile);
+		return;
+	}
+#endif
+	while (count > 0) {
+		for (;;) {	
+			item=map_rect_get_item(rg->mr);
+			if (item)
+				break;
+			if (!route_graph_build_next_map(rg)) {
+				route_graph_build_done(rg, 0);
+				return;
+			}
+		}
+		route_graph_process_item(rg, item, profile);
+		if (route_graph_build_check_budget(rg, profile))
+			return;
+		count--;
+	}
+}
+
+/**
+ * @brief Aligns the rectangles of a selection to the graph cache grid
+ *
+ * @param sel The selection to align, it is modified in place
+ */
+static void
+route_graph_cache_align_selection(struct map_selection *sel)
+{
+	int grid=ROUTE_GRAPH_CACHE_GRID;
+	while (sel) {
+		struct coord_rect *r=&sel->u.c_rect;
+		r->lu.x=(r->lu.x >= 0 ? r->lu.x : r->lu.x-grid+1)/grid*grid;
+		r->rl.y=(r->rl.y >= 0 ? r->rl.y : r->rl.y-grid+1)/grid*grid;
+		r->rl.x=(r->rl.x >= 0 ? r->rl.x+grid-1 : r->rl.x)/grid*grid;
+		r->lu.y=(r->lu.y >= 0 ? r->lu.y+grid-1 : r->lu.y)/grid*grid;
+		sel=sel->next;
+	}
+}
+
+static void
+route_graph_cache_key_append(char **key, char *str)
+{
+	char *old=*key;
+	*key=g_strconcat(old ? old : "", str, NULL);
+	g_free(old);
+	g_free(str);
+}
+
+static void
+route_graph_cache_key_roadprofile(gpointer key, gpointer value, gpointer user_data)
+{
+	GList **types=user_data;
+	*types=g_list_prepend(*types, key);
+}
+
+static gint
+route_graph_cache_key_compare(gconstpointer a, gconstpointer b)
+{
+	return GPOINTER_TO_INT(a)-GPOINTER_TO_INT(b);
+}
+
+/**
+ * @brief Checks if a map is kept in memory by navit, like the route or the isochrone map
+ *
+ * Such maps have an empty data attribute, see map_dup(). They change all the time, so their items
+ * are not stored in the graph cache but read again whenever a cached graph is loaded.
+ *
+ * @param m The map
+ * @return True if the map is kept in memory
+ */
+static int
+route_graph_cache_map_in_memory(struct map *m)
+{
+	struct attr data;
+	return map_get_attr(m, attr_data, &data, NULL) && data.u.str && !data.u.str[0];
+}
+
+/**
+ * @brief Builds the key identifying a route graph in the graph cache
+ *
+ * The key covers everything the graph is built from: the selection, the data files of all active
+ * maps together with their size and modification time, and the item types the vehicle profile has
+ * a road profile for. Maps kept in memory are left out, see route_graph_cache_map_in_memory().
+ *
+ * @param ms The mapset
+ * @param sel The selection the graph is built for
+ * @param profile The vehicle profile
+ * @return The key, or NULL if the graph can not be cached because a map has no data file
+ */
+static char *
+route_graph_cache_key(struct mapset *ms, struct map_selection *sel, struct vehicleprofile *profile)
+{
+	char *ret=NULL;
+	struct mapset_handle *h;
+	struct map *m;
+	struct attr data;
+	struct stat st;
+	GList *types=NULL,*l;
+
+	while (sel) {
+		route_graph_cache_key_append(&ret, g_strdup_printf("sel %d 0x%x,0x%x-0x%x,0x%x %d-%d\n", sel->order,
+			sel->u.c_rect.lu.x, sel->u.c_rect.lu.y, sel->u.c_rect.rl.x, sel->u.c_rect.rl.y,
+			sel->range.min, sel->range.max));
+		sel=sel->next;
+	}
+	h=mapset_open(ms);
+	while ((m=mapset_next(h, 2))) {
+		if (route_graph_cache_map_in_memory(m))
+			continue;
+		if (!map_get_attr(m, attr_data, &data, NULL) || stat(data.u.str, &st)) {
+			dbg(lvl_debug,"map without data file, not caching\n");
+			mapset_close(h);
+			g_free(ret);
+			return NULL;
+		}
+		route_graph_cache_key_append(&ret, g_strdup_printf("map %s "LONGLONG_FMT" %ld\n", data.u.str,
+			(long long)st.st_size, (long)st.st_mtime));
+	}
+	mapset_close(h);
+	g_hash_table_foreach(profile->roadprofile_hash, route_graph_cache_key_roadprofile, &types);
+	types=g_list_sort(types, route_graph_cache_key_compare);
+	for (l=types ; l ; l=g_list_next(l))
+		route_graph_cache_key_append(&ret, g_strdup_printf("road 0x%x\n", GPOINTER_TO_INT(l->data)));
+	g_list_free(types);
+	return ret;
+}
+
+/**
+ * @brief Returns the name of the graph cache file
+ *
+ * @return The file name, to be freed with {@code g_free()}
+ */
+static char *
+route_graph_cache_file(void)
+{
+	return g_strjoin(NULL, navit_get_user_data_directory(TRUE), "/route_graph.cache", NULL);
+}
+
+/**
+ * @brief Header of the graph cache file
+ *
+ * The header is followed by
+ * <ul>
+ * <li>the key, padded to a multiple of 4 bytes,</li>
+ * <li>{@code point_count+1} {@code struct route_graph_cache_point}, the last one only marking the end
+ * of the segments of the last point,</li>
+ * <li>{@code segment_count} {@code struct route_graph_cache_segment}, grouped by their start point,</li>
+ * <li>{@code data_size} bytes of packed segment data, each a {@code struct route_graph_cache_data}
+ * followed by the optional fields of {@code struct route_segment_data}.</li>
+ * </ul>
+ * The file is only read on the machine which wrote it, so all values are in native byte order.
+ */
+struct route_graph_cache_header {
+	char magic[4];
+	int version;
+	int key_size;
+	int point_count;
+	int segment_count;
+	int data_size;
+};
+
+struct route_graph_cache_point {
+	struct coord c;
+	int flags;
+	int first_segment;	/**< Index of the first segment starting at this point */
+};
+
+struct route_graph_cache_segment {
+	int end;		/**< Index of the end point */
+	int data;		/**< Offset of the segment data */
+};
+
+struct route_graph_cache_data {
+	int type;
+	int id_hi;
+	int id_lo;
+	int map;		/**< Index of the map within the active maps of the mapset */
+	int flags;
+	int len;
+	unsigned char start_dir;
+	unsigned char end_dir;
+	unsigned short pad;
+};
+
+/* Segments without a map (e.g. the street added for a position) cannot be reloaded and those of maps kept in memory
+ * are read again on loading, so neither are saved */
+#define ROUTE_GRAPH_CACHE_SAVED(maps,seg) ((seg)->data.item.map && g_hash_table_lookup((maps), (seg)->data.item.map))
+
+/**
+ * @brief Writes a route graph to the graph cache file
+ *
+ * The file is written under a temporary name and renamed, so a concurrent reader never sees a
+ * partially written graph.
+ *
+ * @param this The graph, which must have a {@code cache_key}
+ */
+static void
+route_graph_cache_save(struct route_graph *this)
+{
+	struct route_graph_cache_header header;
+	struct route_graph_cache_point cp;
+	struct route_graph_cache_segment cs;
+	struct route_graph_cache_data cd;
+	struct route_graph_point *p;
+	struct route_graph_segment *seg;
+	struct mapset_handle *h;
+	struct map *m;
+	GHashTable *points=g_hash_table_new(NULL, NULL);
+	GHashTable *maps=g_hash_table_new(NULL, NULL);
+	char *name=route_graph_cache_file(), *tmp=g_strconcat(name, ".tmp", NULL);
+	char pad[4]={0,0,0,0};
+	FILE *f;
+	int i,ok;
+
+	h=mapset_open(this->ms);
+	i=0;
+	while ((m=mapset_next(h, 2))) {
+		if (!route_graph_cache_map_in_memory(m))
+			g_hash_table_insert(maps, m, GINT_TO_POINTER(++i));
+	}
+	mapset_close(h);
+	memset(&header, 0, sizeof(header));
+	header.point_count=this->point_count;
+	for (i = 0 ; i < this->point_count ; i++) {
+		p=ROUTE_GRAPH_POINT(this, i);
+		g_hash_table_insert(points, p, GINT_TO_POINTER(i));
+		for (seg=p->start ; seg ; seg=seg->start_next) {
+			if (!ROUTE_GRAPH_CACHE_SAVED(maps, seg))
+				continue;
+			header.segment_count++;
+			header.data_size+=sizeof(cd)+route_segment_data_size(seg->data.flags)-sizeof(struct route_segment_data);
+		}
+	}
+	f=fopen(tmp, "wb");
+	if (!f) {
+		dbg(lvl_error,"failed to create %s\n", tmp);
+		goto out;
+	}
+	memcpy(header.magic, ROUTE_GRAPH_CACHE_MAGIC, 4);
+	header.version=ROUTE_GRAPH_CACHE_VERSION;
+	header.key_size=strlen(this->cache_key);
+	ok=fwrite(&header, sizeof(header), 1, f) == 1;
+	ok=ok && fwrite(this->cache_key, header.key_size, 1, f) == 1;
+	ok=ok && fwrite(pad, (4-header.key_size%4)%4, 1, f) <= 1;
+	cp.first_segment=0;
+	for (i = 0 ; ok && i < this->point_count ; i++) {
+		p=ROUTE_GRAPH_POINT(this, i);
+		cp.c=p->c;
+		cp.flags=p->flags;
+		ok=fwrite(&cp, sizeof(cp), 1, f) == 1;
+		for (seg=p->start ; seg ; seg=seg->start_next)
+			if (ROUTE_GRAPH_CACHE_SAVED(maps, seg))
+				cp.first_segment++;
+	}
+	memset(&cp.c, 0, sizeof(cp.c));
+	cp.flags=0;
+	ok=ok && fwrite(&cp, sizeof(cp), 1, f) == 1;
+	cs.data=0;
+	for (i = 0 ; ok && i < this->point_count ; i++) {
+		p=ROUTE_GRAPH_POINT(this, i);
+		for (seg=p->start ; ok && seg ; seg=seg->start_next) {
+			if (!ROUTE_GRAPH_CACHE_SAVED(maps, seg))
+				continue;
+			cs.end=GPOINTER_TO_INT(g_hash_table_lookup(points, seg->end));
+			ok=fwrite(&cs, sizeof(cs), 1, f) == 1;
+			cs.data+=sizeof(cd)+route_segment_data_size(seg->data.flags)-sizeof(struct route_segment_data);
+		}
+	}
+	for (i = 0 ; ok && i < this->point_count ; i++) {
+		p=ROUTE_GRAPH_POINT(this, i);
+		for (seg=p->start ; ok && seg ; seg=seg->start_next) {
+			int extra=route_segment_data_size(seg->data.flags)-sizeof(struct route_segment_data);
+			if (!ROUTE_GRAPH_CACHE_SAVED(maps, seg))
+				continue;
+			cd.type=seg->data.item.type;
+			cd.id_hi=seg->data.item.id_hi;
+			cd.id_lo=seg->data.item.id_lo;
+			cd.map=GPOINTER_TO_INT(g_hash_table_lookup(maps, seg->data.item.map))-1;
+			cd.flags=seg->data.flags;
+			cd.len=seg->data.len;
+			cd.start_dir=seg->start_dir;
+			cd.end_dir=seg->end_dir;
+			cd.pad=0;
+			ok=fwrite(&cd, sizeof(cd), 1, f) == 1;
+			if (ok && extra)
+				ok=fwrite((char *)&seg->data+sizeof(struct route_segment_data), extra, 1, f) == 1;
+		}
+	}
+	if (fclose(f) || !ok) {
+		dbg(lvl_error,"failed to write %s\n", tmp);
+		remove(tmp);
+		goto out;
+	}
+	remove(name);
+	if (rename(tmp, name)) {
+		dbg(lvl_error,"failed to rename %s to %s\n", tmp, name);
+		remove(tmp);
+		goto out;
+	}
+	dbg(lvl_debug,"stored %d points and %d segments in %s\n", header.point_count, header.segment_count, name);
+out:
+	g_hash_table_destroy(points);
+	g_hash_table_destroy(maps);
+	g_free(tmp);
+	g_free(name);
+}
+/**
+ * @brief Reads a route graph from the graph cache file
+ *
+ * The file is mapped into memory and the points and segments are created directly from the arrays
+ * in the file, without reading any map items.
+ *
+ * @param ms The mapset the graph is for
+ * @param key The key of the graph, see {@code route_graph_cache_key()}
+ * @return The graph, or NULL if the cache file does not contain a graph with this key
+ */
+static struct route_graph *
+route_graph_cache_load(struct mapset *ms, char *key)
+{
+	char *name=route_graph_cache_file();
+	struct file *file=file_create(name, NULL);
+	struct route_graph *ret=NULL;
+	struct route_graph_cache_header *header;
+	struct route_graph_cache_point *cp;
+	struct route_graph_cache_segment *cs;
+	struct route_graph_point **points=NULL;
+	struct mapset_handle *h;
+	struct map *m,**maps=NULL;
+	unsigned char *data;
+	int i,j,key_size,map_count=0;
+
+	g_free(name);
+	if (!file)
+		return NULL;
+	if (file_size(file) < sizeof(*header) || !file_mmap(file))
+		goto out;
+	header=(struct route_graph_cache_header *)file->begin;
+	key_size=(header->key_size+3)&~3;
+	if (memcmp(header->magic, ROUTE_GRAPH_CACHE_MAGIC, 4) || header->version != ROUTE_GRAPH_CACHE_VERSION ||
+		header->key_size != strlen(key) || header->point_count < 0 || header->segment_count < 0 || header->data_size < 0 ||
+		file_size(file) != sizeof(*header)+key_size+(header->point_count+1LL)*sizeof(*cp)+
+			(long long)header->segment_count*sizeof(*cs)+header->data_size) {
+		dbg(lvl_debug,"invalid cache file\n");
+		goto out;
+	}
+	if (memcmp(file->begin+sizeof(*header), key, header->key_size)) {
+		dbg(lvl_debug,"cache file contains a different graph\n");
+		goto out;
+	}
+	cp=(struct route_graph_cache_point *)(file->begin+sizeof(*header)+key_size);
+	cs=(struct route_graph_cache_segment *)(cp+header->point_count+1);
+	data=(unsigned char *)(cs+header->segment_count);
+	h=mapset_open(ms);
+	while ((m=mapset_next(h, 2))) {
+		if (route_graph_cache_map_in_memory(m))
+			continue;
+		maps=g_renew(struct map *, maps, map_count+1);
+		maps[map_count++]=m;
+	}
+	mapset_close(h);
+	ret=g_new0(struct route_graph, 1);
+	ret->max_maxspeed=-1;
+	ret->ms=ms;
+	points=g_new(struct route_graph_point *, header->point_count);
+	for (i = 0 ; i < header->point_count ; i++) {
+		points[i]=route_graph_point_new(ret, &cp[i].c);
+		points[i]->flags=cp[i].flags;
+	}
+	/* segments are prepended to the lists of their points, so create them backwards to keep the order */
+	for (i = header->point_count-1 ; i >= 0 ; i--) {
+		if (cp[i].first_segment < 0 || cp[i].first_segment > cp[i+1].first_segment ||
+			cp[i+1].first_segment > header->segment_count)
+			goto fail;
+		for (j = cp[i+1].first_segment-1 ; j >= cp[i].first_segment ; j--) {
+			struct route_graph_cache_data *cd;
+			struct route_graph_segment_data sd;
+			struct item item;
+			unsigned char *extra;
+			if (cs[j].end < 0 || cs[j].end >= header->point_count || cs[j].data < 0 ||
+				cs[j].data+sizeof(*cd) > header->data_size)
+				goto fail;
+			cd=(struct route_graph_cache_data *)(data+cs[j].data);
+			if (cd->map < 0 || cd->map >= map_count || cs[j].data+sizeof(*cd)+
+				route_segment_data_size(cd->flags)-sizeof(struct route_segment_data) > header->data_size)
+				goto fail;
+			memset(&item, 0, sizeof(item));
+			item.type=cd->type;
+			item.id_hi=cd->id_hi;
+			item.id_lo=cd->id_lo;
+			item.map=maps[cd->map];
+			sd.item=&item;
+			sd.flags=cd->flags;
+			sd.len=cd->len;
+			sd.offset=1;
+			sd.maxspeed=-1;
+			sd.dangerous_goods=0;
+			sd.start_dir=cd->start_dir;
+			sd.end_dir=cd->end_dir;
+			extra=(unsigned char *)(cd+1);
+			if (cd->flags & AF_SPEED_LIMIT) {
+				memcpy(&sd.maxspeed, extra, sizeof(int));
+				extra+=sizeof(int);
+			}
+			if (cd->flags & AF_SEGMENTED) {
+				memcpy(&sd.offset, extra, sizeof(int));
+				extra+=sizeof(int);
+			}
+			if (cd->flags & AF_SIZE_OR_WEIGHT_LIMIT) {
+				memcpy(&sd.size_weight, extra, sizeof(struct size_weight_limit));
+				extra+=sizeof(struct size_weight_limit);
+			}
+			if (cd->flags & AF_DANGEROUS_GOODS)
+				memcpy(&sd.dangerous_goods, extra, sizeof(int));
+			route_graph_add_segment(ret, points[i], points[cs[j].end], &sd);
+		}
+	}
+	dbg(lvl_debug,"loaded %d points and %d segments\n", header->point_count, header->segment_count);
+	goto out;
+fail:
+	dbg(lvl_error,"corrupt cache file\n");
+	route_graph_destroy(ret);
+	ret=NULL;
+out:
+	g_free(points);
+	g_free(maps);
+	file_destroy(file);
+	return ret;
+}
+
+/**
+ * @brief Adds the items of the maps kept in memory to a route graph loaded from the graph cache
+ *
+ * @param this The route graph
+ * @param sel The selection the graph was built for
+ * @param profile The vehicle profile
+ */
+static void
+route_graph_cache_read_memory_maps(struct route_graph *this, struct map_selection *sel, struct vehicleprofile *profile)
+{
+	struct mapset_handle *h;
+	struct map_rect *mr;
+	struct map *m;
+	struct item *item;
+	int i;
+
+	h=mapset_open(this->ms);
+	while ((m=mapset_next(h, 2))) {
+		if (!route_graph_cache_map_in_memory(m))
+			continue;
+		mr=map_rect_new(m, sel);
+		while (mr && (item=map_rect_get_item(mr)))
+			route_graph_process_item(this, item, profile);
+		map_rect_destroy(mr);
+	}
+	mapset_close(h);
+	for (i = 0 ; i < this->point_count ; i++) {
+		struct route_graph_point *p=ROUTE_GRAPH_POINT(this, i);
+		if ((p->flags & (RP_TURN_RESTRICTION|RP_TURN_RESTRICTION_RESOLVED)) == RP_TURN_RESTRICTION)
+			route_graph_process_restriction_point(this, p);
+	}
+}
+
+/**
+ * @brief Starts building a route graph from the items within a map selection
+ *
+ * @param ms The mapset to read the items from
+ * @param sel The selection, which is owned by the graph afterwards
+ * @param done_cb The callback to call when the graph is complete
+ * @param async If true, the graph is built from an idle event. Otherwise the caller has to call
+ * route_graph_build_idle() while the graph is busy.
+ * @param profile The vehicle profile to use
+ * @param cache If true, the graph is taken from or stored in the graph cache
+ * @param threads Number of threads to read the maps with
+ * @param budget Bytes the points and segments of the graph may use, 0 for no limit. If the graph grows
+ * beyond, the selection is degraded, see route_selection_degrade().
+ * @return The new route graph
+ */
+static struct route_graph *
+route_graph_build_selection(struct mapset *ms, struct map_selection *sel, struct callback *done_cb, int async, struct vehicleprofile *profile, int cache, int threads,
+		long budget)
+{
+	struct route_graph *ret=g_new0(struct route_graph, 1);
+
+	dbg(lvl_debug,"enter\n");
+
+	ret->max_maxspeed=-1;
+	ret->ms=ms;
+	ret->sel=sel;
+	if (cache) {
+		route_graph_cache_align_selection(ret->sel);
+		ret->cache_key=route_graph_cache_key(ms, ret->sel, profile);
+	}
+	route_selection_rect(ret->sel, &ret->rect);
+	ret->done_cb=done_cb;
+	ret->busy=1;
+	ret->async=async;
+	ret->threads=threads;
+	ret->memory_budget=budget;
+	route_graph_build_start(ret, profile);
+	return ret;
+}
+
+/**
+ * @brief Starts reading the maps for a route graph, on worker threads or from the main loop
+ *
+ * @param rg The route graph, its selection must be set
+ * @param profile The vehicle profile
+ */
+static void
+route_graph_build_start(struct route_graph *rg, struct vehicleprofile *profile)
+{
+#ifdef HAVE_PTHREAD
+	if (rg->threads > 1 && route_graph_build_workers_start(rg, rg->ms, profile, rg->threads, rg->async))
+		return;
+#endif
+	rg->h=mapset_open(rg->ms);
+	if (route_graph_build_next_map(rg)) {
+		if (rg->async) {
+			rg->idle_cb=callback_new_2(callback_cast(route_graph_build_idle), rg, profile);
+			rg->idle_ev=event_add_idle(50, rg->idle_cb);
+		}
+	} else
+		route_graph_build_done(rg, 0);
+}
+
+/**
+ * @brief Builds a new route graph from a mapset
+ *
+ * This function builds a new route graph from a map. Please note that this function does not
+ * add any routing information to the route graph - this has to be done via the route_graph_flood()
+ * function.
+ *
+ * The function does not create a graph covering the whole map, but only covering the rectangle
+ * between c1 and c2.
+ *
+ * @param ms The mapset to build the route graph from
+ * @param c The coordinates of the destination or next waypoint
+ * @param c1 Corner 1 of the rectangle to use from the map
+ * @param c2 Corner 2 of the rectangle to use from the map
+ * @param done_cb The callback which will be called when graph is complete
+ * @return The new route graph.
+ */
+// FIXME documentation does not match argument list
+static struct route_graph *
+route_graph_build(struct mapset *ms, struct coord *c, int count, struct callback *done_cb, int async, struct vehicleprofile *profile, int cache, int threads,
+		long budget)
+{
+	return route_graph_build_selection(ms, route_calc_selection(c, count, profile), done_cb, async, profile, cache, threads, budget);
+}
+
+static struct route_info *
+route_info_dup(struct route_info *ri)
+{
+	struct route_info *ret=g_memdup(ri, sizeof(*ri));
+	if (ri->street)
+		ret->street=street_data_dup(ri->street);
+	return ret;
+}
+
+#ifdef HAVE_PTHREAD
+/**
+ * @brief Reports the progress of a worker and checks if it was cancelled
+ *
+ * Called from the worker thread only.
+ *
+ * @param w The worker
+ * @param progress Progress within the current phase in percent
+ * @return True if the worker was cancelled
+ */
+static int
+route_worker_check(struct route_worker *w, int progress)
+{
+	int ret;
+	pthread_mutex_lock(&w->mutex);
+	w->progress=w->phase_base+w->phase_span*MIN(progress,100)/100;
+	ret=w->cancel;
+	pthread_mutex_unlock(&w->mutex);
+	return ret;
+}
+
+/**
+ * @brief Computes the route path on the worker thread
+ *
+ * The progress is split evenly between the legs. Legs are computed from the last destination
+ * backwards, just like route_path_update_done() does on the main loop.
+ *
+ * @param data The worker
+ * @return Always NULL
+ */
+static void *
+route_worker_main(void *data)
+{
+	struct route_worker *w=data;
+	struct route_info *dst,*prev;
+	struct route_path *path;
+	GList *l;
+	int legs,leg=0;
+
+	for (l=w->traffic ; l ; l=g_list_next(l)) {
+		struct route_graph_point *ends[2];
+		route_graph_apply_traffic(w->graph, l->data, 0, ends);
+	}
+	route_graph_set_speed_profiles(w->graph, w->speed_profiles, w->departure_time);
+	w->graph->worker=w;
+	legs=g_list_length(w->destinations);
+	w->phase_span=100/legs;
+	for (l=g_list_last(w->destinations) ; l ; l=g_list_previous(l)) {
+		if (route_worker_check(w, 0))
+			break;
+		w->phase_base=w->phase_span*leg++;
+		dst=l->data;
+		prev=g_list_previous(l) ? g_list_previous(l)->data : w->pos;
+		if (l->next)
+			route_graph_reset(w->graph);
+		route_graph_flood(w->graph, dst, prev, w->profile, NULL);
+		if (route_worker_check(w, 100))
+			break;
+		path=route_path_new(w->graph, NULL, prev, dst, w->profile);
+		if (!path) {
+			route_path_destroy(w->path, 1);
+			w->path=NULL;
+			break;
+		}
+		route_path_set_totals(path, w->profile, w->graph->speed_profiles, w->graph->departure);
+		path->next=w->path;
+		w->path=path;
+		w->current_dst=g_list_position(w->destinations, l);
+	}
+	w->graph->worker=NULL;
+	pthread_mutex_lock(&w->mutex);
+	w->progress=100;
+	w->finished=1;
+	pthread_mutex_unlock(&w->mutex);
+	return NULL;
+}
+
+/**
+ * @brief Frees a worker which is no longer running
+ *
+ * @param this The route the worker belongs to
+ */
+static void
+route_worker_destroy(struct route *this)
+{
+	struct route_worker *w=this->worker;
+	if (w->poll)
+		event_remove_timeout(w->poll);
+	callback_destroy(w->poll_cb);
+	pthread_mutex_destroy(&w->mutex);
+	route_path_destroy(w->path, 1);
+	route_graph_destroy(w->graph);
+	route_info_free(w->pos);
+	g_list_foreach(w->destinations, (GFunc)route_info_free, NULL);
+	g_list_free(w->destinations);
+	g_list_foreach(w->traffic, (GFunc)g_free, NULL);
+	g_list_free(w->traffic);
+	if (w->maps)
+		g_hash_table_destroy(w->maps);
+	vehicleprofile_destroy(w->profile);
+	g_free(w);
+	this->worker=NULL;
+}
+
+/**
+ * @brief Stops the worker of a route and drops everything it computed
+ *
+ * @param this The route
+ */
+static void
+route_worker_cancel(struct route *this)
+{
+	struct route_worker *w=this->worker;
+	if (!w)
+		return;
+	dbg(lvl_debug,"cancelling route worker\n");
+	pthread_mutex_lock(&w->mutex);
+	w->cancel=1;
+	pthread_mutex_unlock(&w->mutex);
+	pthread_join(w->thread, NULL);
+	route_worker_destroy(this);
+}
+
+/**
+ * @brief Checks the worker of a route from the main loop
+ *
+ * Reports the progress as {@code route_progress} attribute. Once the worker is finished, its graph
+ * and path are installed into the route, unless traffic distortions changed meanwhile, in which
+ * case the worker is started again.
+ *
+ * @param this The route
+ */
+static void
+route_worker_poll(struct route *this)
+{
+	struct route_worker *w=this->worker;
+	struct attr attr;
+	int progress,finished;
+
+	pthread_mutex_lock(&w->mutex);
+	progress=w->progress;
+	finished=w->finished;
+	pthread_mutex_unlock(&w->mutex);
+	attr.type=attr_route_progress;
+	attr.u.num=progress;
+	route_set_attr(this, &attr);
+	if (!finished || (this->path2 && this->path2->in_use > 1))
+		return;
+	pthread_join(w->thread, NULL);
+	if (w->traffic_changed) {
+		dbg(lvl_debug,"traffic changed while computing route, restarting worker\n");
+		route_worker_destroy(this);
+		route_graph_update(this, this->route_graph_flood_done_cb, 1);
+		return;
+	}
+	route_graph_destroy(this->graph);
+	this->graph=w->graph;
+	w->graph=NULL;
+	route_path_destroy(this->path2, 1);
+	this->path2=w->path;
+	w->path=NULL;
+	this->current_dst=g_list_nth_data(this->destinations, w->current_dst);
+	this->link_path=0;
+	route_worker_destroy(this);
+	attr.type=attr_route_status;
+	if (this->path2) {
+		attr.u.num=route_status_path_done_new;
+		route_alternatives_schedule(this);
+	} else
+		attr.u.num=route_status_not_found;
+	route_set_attr(this, &attr);
+}
+
+/**
+ * @brief Opens the maps a route graph refers to once more, for reading them on a worker thread
+ *
+ * Map instances are not safe to read from several threads at once, so the worker builds the route
+ * path from instances of its own, see map_dup().
+ *
+ * @param graph The route graph, which must not be busy
+ * @return The maps of the worker by the maps of the graph, or NULL if a map can not be opened again
+ */
+static GHashTable *
+route_worker_maps(struct route_graph *graph)
+{
+	struct attr cache_size={attr_tile_cache_size},prefetch={attr_tile_prefetch_threads},*dup_attrs[]={&cache_size,&prefetch,NULL};
+	GHashTable *ret=g_hash_table_new_full(NULL, NULL, NULL, (GDestroyNotify)navit_object_unref);
+	struct route_graph_segment *s;
+	struct map *last=NULL,*dup;
+
+	/* The path only reads the few items it follows, a tile cache would just take memory */
+	cache_size.u.num=0;
+	prefetch.u.num=0;
+	for (s=graph->route_segments ; s ; s=s->next) {
+		if (!s->data.item.map || s->data.item.map == last)
+			continue;
+		last=s->data.item.map;
+		if (g_hash_table_lookup(ret, last))
+			continue;
+		dup=map_dup(last, dup_attrs);
+		if (!dup) {
+			dbg(lvl_debug,"map %p can not be opened again, routing on the main loop\n", last);
+			g_hash_table_destroy(ret);
+			return NULL;
+		}
+		g_hash_table_insert(ret, last, dup);
+	}
+	return ret;
+}
+
+/**
+ * @brief Starts computing the route path of a route on a worker thread
+ *
+ * The route graph is built on the main loop beforehand, from where the maps are read. The worker
+ * floods it and builds the path, reading the items of the path through map instances of its own.
+ * The route has no graph while the worker runs, it gets it back once the worker is finished.
+ *
+ * @param this The route
+ * @param graph The route graph to use
+ * @return True if the worker was started and owns the graph, false if the route has to be computed
+ * on the main loop
+ */
+static int
+route_worker_start(struct route *this, struct route_graph *graph)
+{
+	struct route_worker *w;
+	GHashTable *maps=route_worker_maps(graph);
+	GList *l;
+
+	if (!maps)
+		return 0;
+	w=g_new0(struct route_worker, 1);
+	pthread_mutex_init(&w->mutex, NULL);
+	w->maps=maps;
+	w->profile=vehicleprofile_dup(this->vehicleprofile);
+	w->pos=route_info_dup(this->pos);
+	for (l=this->destinations ; l ; l=g_list_next(l))
+		w->destinations=g_list_append(w->destinations, route_info_dup(l->data));
+	for (l=this->traffic ; l ; l=g_list_next(l))
+		w->traffic=g_list_append(w->traffic, g_memdup(l->data, sizeof(struct route_traffic)));
+	w->speed_profiles=this->speed_profiles;
+	w->departure_time=this->departure_time;
+	w->graph=graph;
+	this->worker=w;
+	if (pthread_create(&w->thread, NULL, route_worker_main, w)) {
+		dbg(lvl_error,"failed to start route worker\n");
+		w->graph=NULL;
+		route_worker_destroy(this);
+		return 0;
+	}
+	w->poll_cb=callback_new_1(callback_cast(route_worker_poll), this);
+	w->poll=event_add_timeout(ROUTE_WORKER_POLL, 1, w->poll_cb);
+	return 1;
+}
+#endif
+
+static void
+route_graph_update_done(struct route *this, struct callback *cb)
+{
+#ifdef HAVE_PTHREAD
+	if (this->route_worker && this->graph->async && route_worker_start(this, this->graph)) {
+		this->graph=NULL;
+		return;
+	}
+#endif
+	route_traffic_apply_all(this);
+	route_graph_set_speed_profiles(this->graph, this->speed_profiles, this->departure_time);
+	route_graph_flood(this->graph, this->current_dst, route_previous_destination(this), this->vehicleprofile, cb);
+}
+
+/**
+ * @brief Updates the route graph
+ *
+ * This updates the route graph after settings in the route have changed. It also
+ * adds routing information afterwards by calling route_graph_flood().
+ * 
+ * @param this The route to update the graph for
+ * @param cb The callback function to call when the route graph update is complete (used only in asynchronous mode)
+ * @param async Set to nonzero in order to update the route graph asynchronously
+ */
+static void
+route_graph_update(struct route *this, struct callback *cb, int async)
+{
+	struct attr route_status;
+	struct coord *c=g_alloca(sizeof(struct coord)*(1+g_list_length(this->destinations)));
+	int i=0;
+	GList *tmp;
+
+	route_status.type=attr_route_status;
+	route_alternatives_stop(this);
+	route_graph_destroy(this->graph);
+	this->graph=NULL;
+	callback_destroy(this->route_graph_done_cb);
+	this->route_graph_done_cb=callback_new_2(callback_cast(route_graph_update_done), this, cb);
+	route_status.u.num=route_status_building_graph;
+	route_set_attr(this, &route_status);
+	c[i++]=this->pos->c;
+	tmp=this->destinations;
+	while (tmp) {
+		struct route_info *dst=tmp->data;
+		c[i++]=dst->c;
+		tmp=g_list_next(tmp);
+	}
+	if (this->graph_cache) {
+		struct map_selection *sel=route_calc_selection(c, i, this->vehicleprofile);
+		char *key;
+		route_graph_cache_align_selection(sel);
+		key=route_graph_cache_key(this->ms, sel, this->vehicleprofile);
+		if (key)
+			this->graph=route_graph_cache_load(this->ms, key);
+		g_free(key);
+		if (this->graph) {
+			route_selection_rect(sel, &this->graph->rect);
+			route_graph_cache_read_memory_maps(this->graph, sel, this->vehicleprofile);
+		}
+		route_free_selection(sel);
+		if (this->graph) {
+			dbg(lvl_debug,"using cached route graph\n");
+#ifdef HAVE_PTHREAD
+			if (async && this->route_worker && route_worker_start(this, this->graph)) {
+				this->graph=NULL;
+				return;
+			}
+#endif
+			callback_call_0(this->route_graph_done_cb);
+			return;
+		}
+	}
+	this->graph=route_graph_build(this->ms, c, i, this->route_graph_done_cb, async, this->vehicleprofile, this->graph_cache,
+		this->graph_build_threads, (long)this->graph_memory_budget*1024);
+	if (! async) {
+		while (this->graph->busy) 
+			route_graph_build_idle(this->graph, this->vehicleprofile);
+	}
+}
+
+/**
+ * @brief Gets street data for an item
+ *
+ * @param item The item to get the data for
+ * @return Street data for the item
+ */
+struct street_data *
+street_get_data (struct item *item)
+{
+	int count=0,*flags;
+	struct street_data *ret = NULL, *ret1;
+	struct attr flags_attr, maxspeed_attr;
+	const int step = 128;
+	int c;
+
+	do {
+		ret1=g_realloc(ret, sizeof(struct street_data)+(count+step)*sizeof(struct coord));
+		if (!ret1) {
+			if (ret)
+				g_free(ret);
+			return NULL;
+		}
+		ret = ret1;
+		c = item_coord_get(item, &ret->c[count], step);
+		count += c;
+	} while (c && c == step);
+
+	ret1=g_realloc(ret, sizeof(struct street_data)+count*sizeof(struct coord));
+	if (ret1)
+		ret = ret1;
+	ret->item=*item;
+	ret->count=count;
+	if (item_attr_get(item, attr_flags, &flags_attr)) 
+		ret->flags=flags_attr.u.num;
+	else {
+		flags=item_get_default_flags(item->type);
+		if (flags)
+			ret->flags=*flags;
+		else
+			ret->flags=0;
+	}
+
+	ret->maxspeed = -1;
+	if (ret->flags & AF_SPEED_LIMIT) {
+		if (item_attr_get(item, attr_maxspeed, &maxspeed_attr)) {
+			ret->maxspeed = maxspeed_attr.u.num;
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Copies street data
+ * 
+ * @param orig The street data to copy
+ * @return The copied street data
+ */ 
+struct street_data *
+street_data_dup(struct street_data *orig)
+{
+	struct street_data *ret;
+	int size=sizeof(struct street_data)+orig->count*sizeof(struct coord);
+
+	ret=g_malloc(size);
+	memcpy(ret, orig, size);
+
+	return ret;
+}
+
+/**
+ * @brief Frees street data
+ *
+ * @param sd Street data to be freed
+ */
+void
+street_data_free(struct street_data *sd)
+{
+	g_free(sd);
+}
+
+/**
+ * @brief Checks if a street can be driven on in at least one direction with a vehicle profile
+ */
+static int
+route_street_usable(struct street_data *sd, struct vehicleprofile *vehicleprofile)
+{
+	return (sd->flags & vehicleprofile->flags_forward_mask) == vehicleprofile->flags ||
+		(sd->flags & vehicleprofile->flags_reverse_mask) == vehicleprofile->flags;
+}
+
+/**
+ * @brief Finds the nearest street to a given coordinate
+ *
+ * The street is looked up in the street index of the mapset, see street_index_nearest().
+ *
+ * @param vehicleprofile The vehicle profile, only streets usable with it are considered
+ * @param ms The mapset to search in for the street
+ * @param pc The coordinate to find a street nearby
+ * @return The nearest street
+ */
+static struct route_info *
+route_find_nearest_street(struct vehicleprofile *vehicleprofile, struct mapset *ms, struct pcoord *pc)
+{
+	struct route_info *ret;
+	int max_dist=1000;
+	int dist;
+
+	if(!vehicleprofile)
+		return NULL;
+
+	ret=g_new0(struct route_info, 1);
+	ret->street=street_index_nearest(ms, pc, max_dist, (street_index_filter)route_street_usable, vehicleprofile,
+			&ret->c, &ret->lp, &ret->pos, &dist);
+	if (!ret->street) {
+		dbg(lvl_debug,"no street within %d\n", max_dist);
+		g_free(ret);
+		ret = NULL;
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Destroys a route_info
+ *
+ * @param info The route info to be destroyed
+ */
+void
+route_info_free(struct route_info *inf)
+{
+	if (!inf)
+		return;
+	if (inf->street)
+		street_data_free(inf->street);
+	g_free(inf);
+}
+
+
+#include "point.h"
+
+/**
+ * @brief Returns street data for a route info 
+ *
+ * @param rinf The route info to return the street data for
+ * @return Street data for the route info
+ */
+struct street_data *
+route_info_street(struct route_info *rinf)
+{
+	return rinf->street;
+}
+
+#if 0
+struct route_crossings *
+route_crossings_get(struct route *this, struct coord *c)
+{
+      struct route_point *pnt;
+      struct route_segment *seg;
+      int crossings=0;
+      struct route_crossings *ret;
+
+       pnt=route_graph_get_point(this, c);
+       seg=pnt->start;
+       while (seg) {
+		printf("start: 0x%x 0x%x\n", seg->item.id_hi, seg->item.id_lo);
+               crossings++;
+               seg=seg->start_next;
+       }
+       seg=pnt->end;
+       while (seg) {
+		printf("end: 0x%x 0x%x\n", seg->item.id_hi, seg->item.id_lo);
+               crossings++;
+               seg=seg->end_next;
+       }
+       ret=g_malloc(sizeof(struct route_crossings)+crossings*sizeof(struct route_crossing));
+       ret->count=crossings;
+       return ret;
+}
+#endif
+
+
+struct map_rect_priv {
+	struct route_info_handle *ri;
+	enum attr_type attr_next;
+	int pos;
+	struct map_priv *mpriv;
+	struct item item;
+	unsigned int last_coord;
+	struct route_path *path;
+	struct route_path_segment *seg,*seg_next;
+	struct route_graph_point *point;
+	struct route_graph_segment *rseg;
+	char *str;
+	int point_idx;
+	struct coord *coord_sel;	/**< Set this to a coordinate if you want to filter for just a single route graph point */
+	struct route_graph_point_iterator it;
+	/* Pointer to current waypoint element of route->destinations */
+	GList *dest;
+	GList *alternatives;		/**< Alternative route paths, referenced while the map rect exists */
+	GList *alt;			/**< Current element of {@code alternatives} */
+	GList *isochrones;		/**< Isochrones, referenced while the map rect exists */
+	GList *isochrone;		/**< Current element of {@code isochrones} */
+	int geometry_order;		/**< Order of the simplified geometry to return plus one, 0 for the full geometry */
+	int geometry_pos;		/**< Position of the next chunk within the simplified geometry of the current path */
+	struct coord *chunk;		/**< Coordinates of the current item if it is a chunk of simplified geometry */
+	int chunk_count;		/**< Number of coordinates in {@code chunk} */
+};
+
+static void
+rm_coord_rewind(void *priv_data)
+{
+	struct map_rect_priv *mr = priv_data;
+	mr->last_coord = 0;
+}
+
+static void
+rm_attr_rewind(void *priv_data)
+{
+	struct map_rect_priv *mr = priv_data;
+	mr->attr_next = attr_street_item;
+}
+
+static int
+rm_attr_get(void *priv_data, enum attr_type attr_type, struct attr *attr)
+{
+	struct map_rect_priv *mr = priv_data;
+	struct route_path_segment *seg=mr->seg;
+	struct route *route=mr->mpriv->route;
+	if (mr->item.type != type_street_route && mr->item.type != type_street_route_alternative &&
+		mr->item.type != type_waypoint && mr->item.type != type_route_end)
+		return 0;
+	attr->type=attr_type;
+	switch (attr_type) {
+		case attr_any:
+			while (mr->attr_next != attr_none) {
+				if (rm_attr_get(priv_data, mr->attr_next, attr))
+					return 1;
+			}
+			return 0;
+		case attr_maxspeed:
+			mr->attr_next = attr_street_item;
+			if (seg && seg->data->flags & AF_SPEED_LIMIT) {
+				attr->u.num=RSD_MAXSPEED(seg->data);
+
+			} else {
+				return 0;
+			}
+			return 1;
+		case attr_street_item:
+			mr->attr_next=attr_direction;
+			if (seg && seg->data->item.map)
+				attr->u.item=&seg->data->item;
+			else
+				return 0;
+			return 1;
+		case attr_direction:
+			mr->attr_next=attr_route;
+			if (seg) 
+				attr->u.num=seg->direction;
+			else
+				return 0;
+			return 1;
+		case attr_route:
+			mr->attr_next=attr_length;
+			attr->u.route = mr->mpriv->route;
+			return 1;
+		case attr_length:
+			mr->attr_next=attr_time;
+			if (seg)
+				attr->u.num=seg->data->len;
+			else
+				return 0;
+			return 1;
+		case attr_time:
+			mr->attr_next=attr_speed;
+			if (seg)
+				attr->u.num=route_time_seg(route->vehicleprofile, seg->data, NULL);
+			else
+				return 0;
+			return 1;
+		case attr_speed:
+			mr->attr_next=attr_label;
+			if (seg)
+				attr->u.num=route_seg_speed(route->vehicleprofile, seg->data, NULL);
+			else
+				return 0;
+			return 1;
+		case attr_label:
+			mr->attr_next=attr_none;
+			if(mr->item.type==type_waypoint || mr->item.type == type_route_end) {
+				if(mr->str)
+					g_free(mr->str);
+				mr->str=g_strdup_printf("%d",route->reached_destinations_count+g_list_position(route->destinations,mr->dest)+1);
+				attr->u.str=mr->str;
+				return 1;
+			}
+			return 0;
+		default:
+			mr->attr_next=attr_none;
+			attr->type=attr_none;
+			return 0;
+	}
+	return 0;
+}
+
+static int
+rm_coord_get(void *priv_data, struct coord *c, int count)
+{
+	struct map_rect_priv *mr = priv_data;
+	struct route_path_segment *seg = mr->seg;
+	int i,rc=0;
+	struct route *r = mr->mpriv->route;
+	enum projection pro = route_projection(r);
+
+	if (pro == projection_none)
+		return 0;
+	if (mr->item.type == type_route_start || mr->item.type == type_route_start_reverse || mr->item.type == type_route_end || mr->item.type == type_waypoint ) {
+		if (! count || mr->last_coord)
+			return 0;
+		mr->last_coord=1;
+		if (mr->item.type == type_route_start || mr->item.type == type_route_start_reverse)
+			c[0]=r->pos->c;
+		else if (mr->item.type == type_waypoint) {
+			c[0]=((struct route_info *)mr->dest->data)->c;
+		} else { /*type_route_end*/
+			c[0]=route_get_dst(r)->c;
+		}
+		return 1;
+	}
+	if (mr->chunk) {
+		for (i=0; i < count && mr->last_coord < mr->chunk_count; i++) {
+			if (pro != projection_mg)
+				transform_from_to(&mr->chunk[mr->last_coord++], pro, &c[i], projection_mg);
+			else
+				c[i] = mr->chunk[mr->last_coord++];
+			rc++;
+		}
+		return rc;
+	}
+	if (! seg)
+		return 0;
+	for (i=0; i < count; i++) {
+		if (mr->last_coord >= seg->ncoords)
+			break;
+		if (i >= seg->ncoords)
+			break;
+		if (pro != projection_mg)
+			transform_from_to(&seg->c[mr->last_coord++], pro,
+				&c[i],projection_mg);
+		else
+			c[i] = seg->c[mr->last_coord++];
+		rc++;
+	}
+	dbg(lvl_debug,"return %d\n",rc);
+	return rc;
+}
+
+static struct item_methods methods_route_item = {
+	rm_coord_rewind,
+	rm_coord_get,
+	rm_attr_rewind,
+	rm_attr_get,
+};
+
+static void
+rp_attr_rewind(void *priv_data)
+{
+	struct map_rect_priv *mr = priv_data;
+	mr->attr_next = attr_label;
+}
+
+static int
+rp_attr_get(void *priv_data, enum attr_type attr_type, struct attr *attr)
+{
+	struct map_rect_priv *mr = priv_data;
+	struct route_graph_point *p = mr->point;
+	struct route_graph_segment *seg = mr->rseg;
+	struct route *route=mr->mpriv->route;
+
+	attr->type=attr_type;
+	switch (attr_type) {
+	case attr_any: // works only with rg_points for now
+		while (mr->attr_next != attr_none) {
+			dbg(lvl_debug,"querying %s\n", attr_to_name(mr->attr_next));
+			if (rp_attr_get(priv_data, mr->attr_next, attr))
+				return 1;
+		}
+		return 0;
+	case attr_maxspeed:
+		mr->attr_next = attr_label;
+		if (mr->item.type != type_rg_segment) 
+			return 0;
+		if (seg && (seg->data.flags & AF_SPEED_LIMIT)) {
+			attr->type = attr_maxspeed;
+			attr->u.num=RSD_MAXSPEED(&seg->data);
+			return 1;
+		} else {
+			return 0;
+		}
+	case attr_label:
+		mr->attr_next=attr_street_item;
+		attr->type = attr_label;
+		if (mr->str)
+			g_free(mr->str);
+		if (mr->item.type == type_rg_point) {
+			if (p->value != INT_MAX)
+				mr->str=g_strdup_printf("%d", p->value);
+			else
+				mr->str=g_strdup("-");
+		} else {
+			int len=seg->data.len;
+			int speed=route_seg_speed(route->vehicleprofile, &seg->data, NULL);
+			int time=route_time_seg(route->vehicleprofile, &seg->data, NULL);
+			if (speed)
+				mr->str=g_strdup_printf("%dm %dkm/h %d.%ds",len,speed,time/10,time%10);
+			else if (len)
+				mr->str=g_strdup_printf("%dm",len);
+			else {
+				mr->str=NULL;
+				return 0;
+			}
+		}
+		attr->u.str = mr->str;
+		return 1;
+	case attr_street_item:
+		mr->attr_next=attr_flags;
+		if (mr->item.type != type_rg_segment) 
+			return 0;
+		if (seg && seg->data.item.map)
+			attr->u.item=&seg->data.item;
+		else
+			return 0;
+		return 1;
+	case attr_flags:
+		mr->attr_next = attr_direction;
+		if (mr->item.type != type_rg_segment)
+			return 0;
+		if (seg) {
+			attr->u.num = seg->data.flags;
+		} else {
+			return 0;
+		}
+		return 1;
+	case attr_direction:
+		mr->attr_next = attr_debug;
+		// This only works if the map has been opened at a single point, and in that case indicates if the
+		// segment returned last is connected to this point via its start (1) or its end (-1)
+		if (!mr->coord_sel || (mr->item.type != type_rg_segment))
+			return 0;
+		if (seg->start == mr->point) {
+			attr->u.num=1;
+		} else if (seg->end == mr->point) {
+			attr->u.num=-1;
+		} else {
+			return 0;
+		}
+		return 1;
+	case attr_debug:
+		mr->attr_next=attr_none;
+		if (mr->str)
+			g_free(mr->str);
+		mr->str=NULL;
+		switch (mr->item.type) {
+		case type_rg_point:
+		{
+			struct route_graph_segment *tmp;
+			int start=0;
+			int end=0;
+			tmp=p->start;
+			while (tmp) {
+				start++;
+				tmp=tmp->start_next;
+			}
+			tmp=p->end;
+			while (tmp) {
+				end++;
+				tmp=tmp->end_next;
+			}
+			mr->str=g_strdup_printf("%d %d %p (0x%x,0x%x)", start, end, p, p->c.x, p->c.y);
+			attr->u.str = mr->str;
+		}
+			return 1;
+		case type_rg_segment:
+			if (! seg)
+				return 0;
+			mr->str=g_strdup_printf("len %d time %d start %p end %p",seg->data.len, route_time_seg(route->vehicleprofile, &seg->data, NULL), seg->start, seg->end);
+			attr->u.str = mr->str;
+			return 1;
+		default:
+			return 0;
+		}
+	default:
+		mr->attr_next=attr_none;
+		attr->type=attr_none;
+		return 0;
+	}
+}
+
+/**
+ * @brief Returns the coordinates of a route graph item
+ *
+ * @param priv_data The route graph item's private data
+ * @param c Pointer where to store the coordinates
+ * @param count How many coordinates to get at a max?
+ * @return The number of coordinates retrieved
+ */
+static int
+rp_coord_get(void *priv_data, struct coord *c, int count)
+{
+	struct map_rect_priv *mr = priv_data;
+	struct route_graph_point *p = mr->point;
+	struct route_graph_segment *seg = mr->rseg;
+	int rc = 0,i,dir;
+	struct route *r = mr->mpriv->route;
+	enum projection pro = route_projection(r);
+
+	if (pro == projection_none)
+		return 0;
+	for (i=0; i < count; i++) {
+		if (mr->item.type == type_rg_point) {
+			if (mr->last_coord >= 1)
+				break;
+			if (pro != projection_mg)
+				transform_from_to(&p->c, pro,
+					&c[i],projection_mg);
+			else
+				c[i] = p->c;
+		} else {
+			if (mr->last_coord >= 2)
+				break;
+			dir=0;
+			if (seg->end->seg == seg)
+				dir=1;
+			if (mr->last_coord)
+				dir=1-dir;
+			if (dir) {
+				if (pro != projection_mg)
+					transform_from_to(&seg->end->c, pro,
+						&c[i],projection_mg);
+				else
+					c[i] = seg->end->c;
+			} else {
+				if (pro != projection_mg)
+					transform_from_to(&seg->start->c, pro,
+						&c[i],projection_mg);
+				else
+					c[i] = seg->start->c;
+			}
+		}
+		mr->last_coord++;
+		rc++;
+	}
+	return rc;
+}
+
+static struct item_methods methods_point_item = {
+	rm_coord_rewind,
+	rp_coord_get,
+	rp_attr_rewind,
+	rp_attr_get,
+};
+
+/**
+ * @brief Returns the outline of an isochrone
+ */
+static int
+ri_coord_get(void *priv_data, struct coord *c, int count)
+{
+	struct map_rect_priv *mr = priv_data;
+	struct route_isochrone *iso = mr->isochrone->data;
+	int rc = 0;
+
+	while (rc < count && mr->last_coord < iso->count)
+		c[rc++]=iso->c[mr->last_coord++];
+	return rc;
+}
+
+static void
+ri_attr_rewind(void *priv_data)
+{
+	struct map_rect_priv *mr = priv_data;
+	mr->attr_next = attr_label;
+}
+
+static int
+ri_attr_get(void *priv_data, enum attr_type attr_type, struct attr *attr)
+{
+	struct map_rect_priv *mr = priv_data;
+	struct route_isochrone *iso = mr->isochrone->data;
+
+	attr->type=attr_type;
+	switch (attr_type) {
+	case attr_any:
+		while (mr->attr_next != attr_none) {
+			if (ri_attr_get(priv_data, mr->attr_next, attr))
+				return 1;
+		}
+		return 0;
+	case attr_label:
+		mr->attr_next=attr_none;
+		g_free(mr->str);
+		mr->str=g_strdup_printf("%d min", (iso->budget+300)/600);
+		attr->u.str=mr->str;
+		return 1;
+	default:
+		mr->attr_next=attr_none;
+		attr->type=attr_none;
+		return 0;
+	}
+}
+
+static struct item_methods methods_isochrone_item = {
+	rm_coord_rewind,
+	ri_coord_get,
+	ri_attr_rewind,
+	ri_attr_get,
+};
+
+static void
+rp_destroy(struct map_priv *priv)
+{
+	g_free(priv);
+}
+
+static void
+rm_destroy(struct map_priv *priv)
+{
+	g_free(priv);
+}
+
+static struct map_rect_priv * 
+rm_rect_new(struct map_priv *priv, struct map_selection *sel)
+{
+	struct map_rect_priv * mr;
+	dbg(lvl_debug,"enter\n");
+#if 0
+	if (! route_get_pos(priv->route))
+		return NULL;
+	if (! route_get_dst(priv->route))
+		return NULL;
+#endif
+#if 0
+	if (! priv->route->path2)
+		return NULL;
+#endif
+	mr=g_new0(struct map_rect_priv, 1);
+	mr->mpriv = priv;
+	mr->item.priv_data = mr;
+	mr->item.type = type_none;
+	mr->item.meth = &methods_route_item;
+	if (priv->route->path2) {
+		mr->path=priv->route->path2;
+		mr->seg_next=mr->path->path;
+		mr->path->in_use++;
+	} else
+		mr->seg_next=NULL;
+	/* Navigation reads the map without a selection and always gets the full geometry */
+	if (sel && sel->order >= 0 && sel->order < ROUTE_GEOMETRY_LEVELS)
+		mr->geometry_order=sel->order+1;
+	return mr;
+}
+
+static struct map_rect_priv *
+ra_rect_new(struct map_priv *priv, struct map_selection *sel)
+{
+	struct map_rect_priv *mr;
+	GList *l;
+
+	if (! priv->route->alternatives)
+		return NULL;
+	mr=g_new0(struct map_rect_priv, 1);
+	mr->mpriv = priv;
+	mr->item.priv_data = mr;
+	/* rm_get_item() continues with the alternatives after the end of the route */
+	mr->item.type = type_route_end;
+	mr->item.meth = &methods_route_item;
+	mr->alternatives=g_list_copy(priv->route->alternatives);
+	for (l=mr->alternatives ; l ; l=g_list_next(l))
+		((struct route_path *)l->data)->in_use++;
+	if (sel && sel->order >= 0 && sel->order < ROUTE_GEOMETRY_LEVELS)
+		mr->geometry_order=sel->order+1;
+	return mr;
+}
+
+/**
+ * @brief Opens a new map rectangle on the route graph's map
+ *
+ * This function opens a new map rectangle on the route graph's map.
+ * The "sel" parameter enables you to only search for a single route graph
+ * point on this map (or exactly: open a map rectangle that only contains
+ * this one point). To do this, pass here a single map selection, whose 
+ * c_rect has both coordinates set to the same point. Otherwise this parameter
+ * has no effect.
+ *
+ * @param priv The route graph map's private data
+ * @param sel Here it's possible to specify a point for which to search. Please read the function's description.
+ * @return A new map rect's private data
+ */
+static struct map_rect_priv * 
+rp_rect_new(struct map_priv *priv, struct map_selection *sel)
+{
+	struct map_rect_priv * mr;
+
+	dbg(lvl_debug,"enter\n");
+	if (! priv->route->graph)
+		return NULL;
+	mr=g_new0(struct map_rect_priv, 1);
+	mr->mpriv = priv;
+	mr->item.priv_data = mr;
+	mr->item.type = type_rg_point;
+	mr->item.meth = &methods_point_item;
+	if (sel) {
+		if ((sel->u.c_rect.lu.x == sel->u.c_rect.rl.x) && (sel->u.c_rect.lu.y == sel->u.c_rect.rl.y)) {
+			mr->coord_sel = g_malloc(sizeof(struct coord));
+			*(mr->coord_sel) = sel->u.c_rect.lu;
+		}
+	}
+	return mr;
+}
+
+/**
+ * @brief Opens a new map rectangle on the isochrone map
+ *
+ * The isochrones present when the map rect is opened are returned, later calls to route_set_isochrone()
+ * do not affect it.
+ *
+ * @param priv The isochrone map's private data
+ * @param sel Unused, all isochrones are returned
+ * @return A new map rect's private data
+ */
+static struct map_rect_priv *
+ri_rect_new(struct map_priv *priv, struct map_selection *sel)
+{
+	struct map_rect_priv * mr;
+	GList *l;
+
+	if (! priv->route->isochrones)
+		return NULL;
+	mr=g_new0(struct map_rect_priv, 1);
+	mr->mpriv = priv;
+	mr->item.priv_data = mr;
+	mr->item.type = type_poly_isochrone;
+	mr->item.meth = &methods_isochrone_item;
+	mr->isochrones=g_list_copy(priv->route->isochrones);
+	for (l=mr->isochrones ; l ; l=g_list_next(l))
+		((struct route_isochrone *)l->data)->in_use++;
+	return mr;
+}
+
+static void
+rm_rect_destroy(struct map_rect_priv *mr)
+{
+	GList *l;
+	if (mr->str)
+		g_free(mr->str);
+	if (mr->coord_sel) {
+		g_free(mr->coord_sel);
+	}
+	if (mr->path) {
+		mr->path->in_use--;
+		if (mr->path->update_required && (mr->path->in_use==1) && (mr->mpriv->route->route_status & ~route_status_destination_set))
+			route_path_update_done(mr->mpriv->route, mr->path->update_required-1);
+		else if (!mr->path->in_use)
+			g_free(mr->path);
+	}
+	for (l=mr->alternatives ; l ; l=g_list_next(l)) {
+		struct route_path *path=l->data;
+		path->in_use--;
+		if (!path->in_use)
+			g_free(path);
+	}
+	g_list_free(mr->alternatives);
+	g_list_foreach(mr->isochrones, (GFunc)route_isochrone_unref, NULL);
+	g_list_free(mr->isochrones);
+
+	g_free(mr);
+}
+
+static struct item *
+rp_get_item(struct map_rect_priv *mr)
+{
+	struct route *r = mr->mpriv->route;
+	struct route_graph_point *p = mr->point;
+	struct route_graph_segment *seg = mr->rseg;
+
+	if (mr->item.type == type_rg_point) {
+		if (mr->coord_sel) {
+			// We are supposed to return only the point at one specified coordinate...
+			if (!p) {
+				p = route_graph_get_point_last(r->graph, mr->coord_sel);
+				if (!p) {
+					mr->point = NULL; // This indicates that no point has been found
+				} else {
+					mr->it = rp_iterator_new(p);
+				}
+			} else {
+				p = NULL;
+			}
+		} else {
+			if (!p)
+				mr->point_idx=0;
+			else
+				mr->point_idx++;
+			if (mr->point_idx < r->graph->point_count)
+				p=ROUTE_GRAPH_POINT(r->graph, mr->point_idx);
+			else
+				p=NULL;
+		}
+		if (p) {
+			mr->point = p;
+			mr->item.id_lo++;
+			rm_coord_rewind(mr);
+			rp_attr_rewind(mr);
+			return &mr->item;
+		} else 
+			mr->item.type = type_rg_segment;
+	}
+
+
+	if (mr->coord_sel) {
+		if (!mr->point) { /* This means that no point has been found */
+			return NULL;
+		}
+		seg = rp_iterator_next(&(mr->it));
+	} else {
+		if (!seg)
+			seg=r->graph->route_segments;
+		else
+			seg=seg->next;
+	}
+	
+	if (seg) {
+		mr->rseg = seg;
+		mr->item.id_lo++;
+		rm_coord_rewind(mr);
+		rp_attr_rewind(mr);
+		return &mr->item;
+	}
+	return NULL;
+	
+}
+
+static struct item *
+ri_get_item(struct map_rect_priv *mr)
+{
+	if (!mr->isochrone)
+		mr->isochrone=mr->isochrones;
+	else
+		mr->isochrone=g_list_next(mr->isochrone);
+	if (!mr->isochrone)
+		return NULL;
+	mr->item.id_lo++;
+	rm_coord_rewind(mr);
+	ri_attr_rewind(mr);
+	return &mr->item;
+}
+
+static struct item *
+rp_get_item_byid(struct map_rect_priv *mr, int id_hi, int id_lo)
+{
+	struct item *ret=NULL;
+	while (id_lo-- > 0) 
+		ret=rp_get_item(mr);
+	return ret;
+}
+
+
+/**
+ * @brief Selects the next chunk of the simplified geometry of a route path as the current item
+ *
+ * @param mr The map rect
+ * @param path The route path, may be NULL
+ * @return An identifier for the item, or NULL if the geometry of the path is exhausted
+ */
+static void *
+rm_get_geometry_chunk(struct map_rect_priv *mr, struct route_path *path)
+{
+	struct route_path_geometry *geometry;
+	int level=mr->geometry_order-1;
+
+	if (!path)
+		return NULL;
+	geometry=route_path_get_geometry(path);
+	/* chunks overlap by one coordinate to keep the line connected */
+	if (mr->geometry_pos+1 >= geometry->count[level])
+		return NULL;
+	mr->seg=NULL;
+	mr->chunk=geometry->c[level]+mr->geometry_pos;
+	mr->chunk_count=MIN(ROUTE_GEOMETRY_CHUNK, geometry->count[level]-mr->geometry_pos);
+	mr->geometry_pos+=mr->chunk_count-1;
+	return mr->chunk;
+}
+
+static struct item *
+rm_get_item(struct map_rect_priv *mr)
+{
+	struct route *route=mr->mpriv->route;
+	void *id=0;
+
+	mr->chunk=NULL;
+	switch (mr->item.type) {
+	case type_none:
+		if (route->pos && route->pos->street_direction && route->pos->street_direction != route->pos->dir)
+			mr->item.type=type_route_start_reverse;
+		else
+			mr->item.type=type_route_start;
+		if (route->pos) {
+			id=route->pos;
+			break;
+		}
+
+	case type_route_start:
+	case type_route_start_reverse:
+		mr->seg=NULL;
+		mr->dest=mr->mpriv->route->destinations;
+	default:
+		if (mr->item.type == type_waypoint)
+			mr->dest=g_list_next(mr->dest);
+		mr->item.type=type_street_route;
+		if (mr->geometry_order) {
+			if ((id=rm_get_geometry_chunk(mr, mr->path)))
+				break;
+			mr->seg_next=NULL;
+		}
+		mr->seg=mr->seg_next;
+		if (!mr->seg && mr->path && mr->path->next) {
+			struct route_path *p=NULL;
+			mr->path->in_use--;
+			if (!mr->path->in_use)
+				p=mr->path;
+			mr->path=mr->path->next;
+			mr->path->in_use++;
+			mr->seg=mr->path->path;
+			mr->geometry_pos=0;
+			if (p)
+				g_free(p);
+			if (mr->dest) {
+				id=mr->dest;
+				mr->item.type=type_waypoint;
+				mr->seg_next=mr->seg;
+				break;
+			}
+			if (mr->geometry_order && (id=rm_get_geometry_chunk(mr, mr->path)))
+				break;
+		}
+		if (mr->seg && !mr->geometry_order) {
+			mr->seg_next=mr->seg->next;
+			id=mr->seg;
+			break;
+		}
+		if (mr->dest && g_list_next(mr->dest)) {
+			id=mr->dest;
+			mr->item.type=type_waypoint;
+			break;
+		}
+		mr->item.type=type_route_end;
+		id=&(mr->mpriv->route->destinations);
+		if (mr->mpriv->route->destinations)
+			break;
+	case type_route_end:
+		mr->item.type=type_street_route_alternative;
+		mr->alt=mr->alternatives;
+		mr->seg_next=mr->alt ? ((struct route_path *)mr->alt->data)->path : NULL;
+		mr->geometry_pos=0;
+	case type_street_route_alternative:
+		if (mr->geometry_order) {
+			while (mr->alt && !(id=rm_get_geometry_chunk(mr, mr->alt->data))) {
+				mr->alt=g_list_next(mr->alt);
+				mr->geometry_pos=0;
+			}
+			if (!mr->alt)
+				return NULL;
+			mr->seg=NULL;
+			break;
+		}
+		while (mr->alt && !mr->seg_next) {
+			mr->alt=g_list_next(mr->alt);
+			if (mr->alt)
+				mr->seg_next=((struct route_path *)mr->alt->data)->path;
+		}
+		if (!mr->alt)
+			return NULL;
+		mr->seg=mr->seg_next;
+		mr->seg_next=mr->seg->next;
+		id=mr->seg;
+		break;
+	}
+	mr->last_coord = 0;
+	item_id_from_ptr(&mr->item,id);
+	rm_attr_rewind(mr);
+	return &mr->item;
+}
+
+static struct item *
+rm_get_item_byid(struct map_rect_priv *mr, int id_hi, int id_lo)
+{
+	struct item *ret=NULL;
+	do {
+		ret=rm_get_item(mr);
+	} while (ret && (ret->id_lo!=id_lo || ret->id_hi!=id_hi));
+	return ret;
+}
+
+static struct map_methods route_meth = {
+	projection_mg,
+	"utf-8",
+	rm_destroy,
+	rm_rect_new,
+	rm_rect_destroy,
+	rm_get_item,
+	rm_get_item_byid,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static struct map_methods route_graph_meth = {
+	projection_mg,
+	"utf-8",
+	rp_destroy,
+	rp_rect_new,
+	rm_rect_destroy,
+	rp_get_item,
+	rp_get_item_byid,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static struct map_methods route_alternatives_meth = {
+	projection_mg,
+	"utf-8",
+	rm_destroy,
+	ra_rect_new,
+	rm_rect_destroy,
+	rm_get_item,
+	rm_get_item_byid,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static struct map_methods route_isochrone_meth = {
+	projection_mg,
+	"utf-8",
+	rp_destroy,
+	ri_rect_new,
+	rm_rect_destroy,
+	ri_get_item,
+	rp_get_item_byid,
+	NULL,
+	NULL,
+	NULL,
+};
+
+static struct map_priv *
+route_map_new_helper(struct map_methods *meth, struct attr **attrs, struct map_methods *methods)
+{
+	struct map_priv *ret;
+	struct attr *route_attr;
+
+	route_attr=attr_search(attrs, NULL, attr_route);
+	if (! route_attr)
+		return NULL;
+	ret=g_new0(struct map_priv, 1);
+	*meth=*methods;
+	ret->route=route_attr->u.route;
+
+	return ret;
+}
+
+static struct map_priv *
+route_map_new(struct map_methods *meth, struct attr **attrs, struct callback_list *cbl)
+{
+	return route_map_new_helper(meth, attrs, &route_meth);
+}
+
+static struct map_priv *
+route_graph_map_new(struct map_methods *meth, struct attr **attrs, struct callback_list *cbl)
+{
+	return route_map_new_helper(meth, attrs, &route_graph_meth);
+}
+
+static struct map_priv *
+route_alternatives_map_new(struct map_methods *meth, struct attr **attrs, struct callback_list *cbl)
+{
+	return route_map_new_helper(meth, attrs, &route_alternatives_meth);
+}
+
+static struct map_priv *
+route_isochrone_map_new(struct map_methods *meth, struct attr **attrs, struct callback_list *cbl)
+{
+	return route_map_new_helper(meth, attrs, &route_isochrone_meth);
+}
+
+static struct map *
+route_get_map_helper(struct route *this_, struct map **map, char *type, char *description)
+{
+	struct attr *attrs[5];
+	struct attr a_type,navigation,data,a_description;
+	a_type.type=attr_type;
+	a_type.u.str=type;
+	navigation.type=attr_route;
+	navigation.u.route=this_;
+	data.type=attr_data;
+	data.u.str="";
+	a_description.type=attr_description;
+	a_description.u.str=description;
+
+	attrs[0]=&a_type;
+	attrs[1]=&navigation;
+	attrs[2]=&data;
+	attrs[3]=&a_description;
+	attrs[4]=NULL;
+
+	if (! *map) { 
+		*map=map_new(NULL, attrs);
+		navit_object_ref((struct navit_object *)*map);
+	}
+ 
+	return *map;
+}
+
+/**
+ * @brief Returns a new map containing the route path
+ *
+ * This function returns a new map containing the route path.
+ *
+ * @important Do not map_destroy() this!
+ *
+ * @param this_ The route to get the map of
+ * @return A new map containing the route path
+ */
+struct map *
+route_get_map(struct route *this_)
+{
+	return route_get_map_helper(this_, &this_->map, "route","Route");
+}
+
+
+/**
+ * @brief Returns a new map containing the route graph
+ *
+ * This function returns a new map containing the route graph.
+ *
+ * @important Do not map_destroy()  this!
+ *
+ * @param this_ The route to get the map of
+ * @return A new map containing the route graph
+ */
+struct map *
+route_get_graph_map(struct route *this_)
+{
+	return route_get_map_helper(this_, &this_->graph_map, "route_graph","Route Graph");
+}
+
+
+/**
+ * @brief Returns a new map containing the alternative routes
+ *
+ * The map contains the {@code street_route_alternative} items of the alternatives found for the route.
+ * They are kept apart from the route map, which navigation reads.
+ *
+ * @important Do not map_destroy() this!
+ *
+ * @param this_ The route to get the map of
+ * @return A new map containing the alternative routes
+ */
+struct map *
+route_get_alternatives_map(struct route *this_)
+{
+	return route_get_map_helper(this_, &this_->alternatives_map, "route_alternatives","Alternative Routes");
+}
+
+
+/**
+ * @brief Returns a new map containing the isochrones of the route
+ *
+ * The map contains a {@code poly_isochrone} item for each area computed by route_set_isochrone().
+ *
+ * @important Do not map_destroy() this!
+ *
+ * @param this_ The route to get the map of
+ * @return A new map containing the isochrones
+ */
+struct map *
+route_get_isochrone_map(struct route *this_)
+{
+	return route_get_map_helper(this_, &this_->isochrone_map, "route_isochrone","Isochrones");
+}
+
+
+/**
+ * @brief Returns the flags for the route.
+ */
+enum route_path_flags route_get_flags(struct route *this_) {
+	return this_->flags;
+}
+
+/**
+ * @brief Whether the route has a valid graph.
+ *
+ * @return True if the route has a graph, false if not.
+ */
+int
+route_has_graph(struct route *this_) {
+	return (this_->graph != NULL);
+}
+
+void
+route_set_projection(struct route *this_, enum projection pro)
+{
+}
+
+int
+route_set_attr(struct route *this_, struct attr *attr)
+{
+	int attr_updated=0;
+	switch (attr->type) {
+	case attr_route_status:
+		attr_updated = (this_->route_status != attr->u.num);
+		this_->route_status = attr->u.num;
+		break;
+	case attr_destination:
+		route_set_destination(this_, attr->u.pcoord, 1);
+		return 1;
+	case attr_position:
+		route_set_position_flags(this_, attr->u.pcoord, route_path_flag_async);
+		return 1;
+	case attr_position_test:
+		return route_set_position_flags(this_, attr->u.pcoord, route_path_flag_no_rebuild);
+	case attr_optimize_waypoints:
+		attr_updated = (this_->optimize_waypoints != attr->u.num);
+		this_->optimize_waypoints = attr->u.num;
+		break;
+	case attr_departure_time:
+		attr_updated = (this_->departure_time != attr->u.num);
+		this_->departure_time = attr->u.num;
+		break;
+	case attr_route_progress:
+		attr_updated = (this_->progress != attr->u.num);
+		this_->progress = attr->u.num;
+		break;
+	case attr_vehicle:
+		attr_updated = (this_->v != attr->u.vehicle);
+		this_->v=attr->u.vehicle;
+		if (attr_updated) {
+			struct attr g;
+			struct pcoord pc;
+			struct coord c;
+			if (vehicle_get_attr(this_->v, attr_position_coord_geo, &g, NULL)) {
+				pc.pro=projection_mg;
+				transform_from_geo(projection_mg, g.u.coord_geo, &c);
+				pc.x=c.x;
+				pc.y=c.y;
+				route_set_position(this_, &pc);
+			}
 		}
+		break;
 	default:
-		mr->attr_next=attr_none;
-		attr->type=attr_none;
+		dbg(lvl_error,"unsupported attribute: %s\n",attr_to_name(attr->type));
 		return 0;
 	}
+	if (attr_updated)
+		callback_list_call_attr_2(this_->cbl2, attr->type, this_, attr);
+	return 1;
 }
 
-/**
- * @brief Returns the coordinates of a route graph item
- *
- * @param priv_data The route graph item's private data
- * @param c Pointer where to store the coordinates
- * @param count How many coordinates to get at a max?
- * @return The number of coordinates retrieved
- */
-static int
-rp_coord_get(void *priv_data, struct coord *c, int count)
+int
+route_add_attr(struct route *this_, struct attr *attr)
 {
-	struct map_rect_priv *mr = priv_data;
-	struct route_graph_point *p = mr->point;
-	struct route_graph_segment *seg = mr->rseg;
-	int rc = 0,i,dir;
-	struct route *r = mr->mpriv->route;
-	enum projection pro = route_projection(r);
-
-	if (pro == projection_none)
+	switch (attr->type) {
+	case attr_callback:
+		callback_list_add(this_->cbl2, attr->u.callback);
+		return 1;
+	default:
 		return 0;
-	for (i=0; i < count; i++) {
-		if (mr->item.type == type_rg_point) {
-			if (mr->last_coord >= 1)
-				break;
-			if (pro != projection_mg)
-				transform_from_to(&p->c, pro,
-					&c[i],projection_mg);
-			else
-				c[i] = p->c;
-		} else {
-			if (mr->last_coord >= 2)
-				break;
-			dir=0;
-			if (seg->end->seg == seg)
-				dir=1;
-			if (mr->last_coord)
-				dir=1-dir;
-			if (dir) {
-				if (pro != projection_mg)
-					transform_from_to(&seg->end->c, pro,
-						&c[i],projection_mg);
-				else
-					c[i] = seg->end->c;
-			} else {
-				if (pro != projection_mg)
-					transform_from_to(&seg->start->c, pro,
-						&c[i],projection_mg);
-				else
-					c[i] = seg->start->c;
-			}
-		}
-		mr->last_coord++;
-		rc++;
 	}
-	return rc;
 }
 
-static struct item_methods methods_point_item = {
-	rm_coord_rewind,
-	rp_coord_get,
-	rp_attr_rewind,
-	rp_attr_get,
-};
-
-static void
-rp_destroy(struct map_priv *priv)
+int
+route_remove_attr(struct route *this_, struct attr *attr)
 {
-	g_free(priv);
+	dbg(lvl_debug,"enter\n");
+	switch (attr->type) {
+	case attr_callback:
+		callback_list_remove(this_->cbl2, attr->u.callback);
+		return 1;
+	case attr_vehicle:
+		this_->v=NULL;
+		return 1;
+	default:
+		return 0;
+	}
 }
 
-static void
-rm_destroy(struct map_priv *priv)
+int
+route_get_attr(struct route *this_, enum attr_type type, struct attr *attr, struct attr_iter *iter)
 {
-	g_free(priv);
+	int ret=1;
+	switch (type) {
+	case attr_map:
+		attr->u.map=route_get_map(this_);
+		ret=(attr->u.map != NULL);
+		break;
+	case attr_destination:
+		if (this_->destinations) {
+			struct route_info *dst;
+			if (iter) {
+				if (iter->u.list) {
+					iter->u.list=g_list_next(iter->u.list);
+				} else {
+					iter->u.list=this_->destinations;
+				}
+				if (!iter->u.list) {
+					return 0;
+				}
+				dst = (struct route_info*)iter->u.list->data;				
+			} else { //No iter handling
+				dst=route_get_dst(this_);
+			}
+			attr->u.pcoord=&this_->pc;
+			this_->pc.pro=projection_mg; /* fixme */
+			this_->pc.x=dst->c.x;
+			this_->pc.y=dst->c.y;
+		} else
+			ret=0;
+		break;
+	case attr_vehicle:
+		attr->u.vehicle=this_->v;
+		ret=(this_->v != NULL);
+		dbg(lvl_debug,"get vehicle %p\n",this_->v);
+		break;
+	case attr_vehicleprofile:
+		attr->u.vehicleprofile=this_->vehicleprofile;
+		ret=(this_->vehicleprofile != NULL);
+		break;
+	case attr_route_status:
+		attr->u.num=this_->route_status;
+		break;
+	case attr_alternatives:
+		attr->u.num=g_list_length(this_->alternatives);
+		break;
+	case attr_optimize_waypoints:
+		attr->u.num=this_->optimize_waypoints;
+		break;
+	case attr_departure_time:
+		attr->u.num=this_->departure_time;
+		break;
+	case attr_route_progress:
+		attr->u.num=this_->progress;
+		break;
+	case attr_graph_memory_budget:
+		attr->u.num=this_->graph_memory_budget;
+		break;
+	case attr_graph_memory:
+		if (!this_->graph)
+			return 0;
+		attr->u.num=(this_->graph->memory+this_->graph->heap_memory)/1024;
+		break;
+	case attr_destination_time:
+		if (this_->path2 && (this_->route_status == route_status_path_done_new || this_->route_status == route_status_path_done_incremental)) {
+			struct route_path *path=this_->path2;
+			attr->u.num=0;
+			while (path) {
+				attr->u.num+=path->path_time;
+				path=path->next;
+			}
+			dbg(lvl_debug,"path_time %ld\n",attr->u.num);
+		} else
+			ret=0;
+		break;
+	case attr_destination_length:
+		if (this_->path2 && (this_->route_status == route_status_path_done_new || this_->route_status == route_status_path_done_incremental)) {
+			struct route_path *path=this_->path2;
+			attr->u.num=0;
+			while (path) {
+				attr->u.num+=path->path_len;
+				path=path->next;
+			}
+		} else
+			ret=0;
+		break;
+	default:
+		return 0;
+	}
+	attr->type=type;
+	return ret;
 }
 
-static struct map_rect_priv * 
-rm_rect_new(struct map_priv *priv, struct map_selection *sel)
+struct attr_iter *
+route_attr_iter_new(void)
 {
-	struct map_rect_priv * mr;
-	dbg(lvl_debug,"enter\n");
-#if 0
-	if (! route_get_pos(priv->route))
-		return NULL;
-	if (! route_get_dst(priv->route))
-		return NULL;
-#endif
-#if 0
-	if (! priv->route->path2)
-		return NULL;
-#endif
-	mr=g_new0(struct map_rect_priv, 1);
-	mr->mpriv = priv;
-	mr->item.priv_data = mr;
-	mr->item.type = type_none;
-	mr->item.meth = &methods_route_item;
-	if (priv->route->path2) {
-		mr->path=priv->route->path2;
-		mr->seg_next=mr->path->path;
-		mr->path->in_use++;
-	} else
-		mr->seg_next=NULL;
-	return mr;
+	return g_new0(struct attr_iter, 1);
 }
 
-/**
- * @brief Opens a new map rectangle on the route graph's map
- *
- * This function opens a new map rectangle on the route graph's map.
- * The "sel" parameter enables you to only search for a single route graph
- * point on this map (or exactly: open a map rectangle that only contains
- * this one point). To do this, pass here a single map selection, whose 
- * c_rect has both coordinates set to the same point. Otherwise this parameter
- * has no effect.
- *
- * @param priv The route graph map's private data
- * @param sel Here it's possible to specify a point for which to search. Please read the function's description.
- * @return A new map rect's private data
- */
-static struct map_rect_priv * 
-rp_rect_new(struct map_priv *priv, struct map_selection *sel)
+void
+route_attr_iter_destroy(struct attr_iter *iter)
 {
-	struct map_rect_priv * mr;
-
-	dbg(lvl_debug,"enter\n");
-	if (! priv->route->graph)
-		return NULL;
-	mr=g_new0(struct map_rect_priv, 1);
-	mr->mpriv = priv;
-	mr->item.priv_data = mr;
-	mr->item.type = type_rg_point;
-	mr->item.meth = &methods_point_item;
-	if (sel) {
-		if ((sel->u.c_rect.lu.x == sel->u.c_rect.rl.x) && (sel->u.c_rect.lu.y == sel->u.c_rect.rl.y)) {
-			mr->coord_sel = g_malloc(sizeof(struct coord));
-			*(mr->coord_sel) = sel->u.c_rect.lu;
-		}
-	}
-	return mr;
+	g_free(iter);
 }
 
-static void
-rm_rect_destroy(struct map_rect_priv *mr)
+/**
+ * @brief Starts building a route graph covering several points, for route_info_matrix()
+ *
+ * @param this The route whose mapset and vehicle profile are used
+ * @param info The points, entries may be {@code NULL}
+ * @param count Number of points
+ * @param done_cb The callback to call when the graph is built
+ * @param async If set, the graph is built from idle events or on worker threads
+ * @return The graph, or {@code NULL} if none of the points has a street
+ */
+static struct route_graph *
+route_info_matrix_graph(struct route *this, struct route_info **info, int count, struct callback *done_cb, int async)
 {
-	if (mr->str)
-		g_free(mr->str);
-	if (mr->coord_sel) {
-		g_free(mr->coord_sel);
-	}
-	if (mr->path) {
-		mr->path->in_use--;
-		if (mr->path->update_required && (mr->path->in_use==1) && (mr->mpriv->route->route_status & ~route_status_destination_set))
-			route_path_update_done(mr->mpriv->route, mr->path->update_required-1);
-		else if (!mr->path->in_use)
-			g_free(mr->path);
-	}
+	struct route_graph *ret=NULL;
+	struct coord *c=g_new(struct coord, count);
+	int i,n=0;
 
-	g_free(mr);
+	for (i = 0 ; i < count ; i++) {
+		if (info[i])
+			c[n++]=info[i]->c;
+	}
+	if (n)
+		ret=route_graph_build(this->ms, c, n, done_cb, async, this->vehicleprofile, 0, this->graph_build_threads,
+			(long)this->graph_memory_budget*1024);
+	g_free(c);
+	return ret;
 }
 
-static struct item *
-rp_get_item(struct map_rect_priv *mr)
+/**
+ * @brief Applies the traffic distortions and speed profiles of the route to a graph built by route_info_matrix_graph()
+ */
+static void
+route_info_matrix_prepare(struct route *this, struct route_graph *graph)
 {
-	struct route *r = mr->mpriv->route;
-	struct route_graph_point *p = mr->point;
-	struct route_graph_segment *seg = mr->rseg;
+	struct route_graph_point *ends[2];
+	GList *l;
 
-	if (mr->item.type == type_rg_point) {
-		if (mr->coord_sel) {
-			// We are supposed to return only the point at one specified coordinate...
-			if (!p) {
-				p = route_graph_get_point_last(r->graph, mr->coord_sel);
-				if (!p) {
-					mr->point = NULL; // This indicates that no point has been found
-				} else {
-					mr->it = rp_iterator_new(p);
-				}
-			} else {
-				p = NULL;
-			}
-		} else {
-			if (!p) {
-				mr->hash_bucket=0;
-				p = r->graph->hash[0];
-			} else 
-				p=p->hash_next;
-			while (!p) {
-				mr->hash_bucket++;
-				if (mr->hash_bucket >= HASH_SIZE)
-					break;
-				p = r->graph->hash[mr->hash_bucket];
-			}
-		}
-		if (p) {
-			mr->point = p;
-			mr->item.id_lo++;
-			rm_coord_rewind(mr);
-			rp_attr_rewind(mr);
-			return &mr->item;
-		} else 
-			mr->item.type = type_rg_segment;
-	}
+	for (l=this->traffic ; l ; l=g_list_next(l))
+		route_graph_apply_traffic(graph, l->data, 0, ends);
+	route_graph_set_speed_profiles(graph, this->speed_profiles, this->departure_time);
+}
 
+/**
+ * @brief Calculates the travel times and distances from all sources to one destination
+ *
+ * The graph is flooded once from the destination, then the paths from all sources are extracted.
+ *
+ * @param j Index of the destination
+ * @return Number of sources for which a route was found
+ */
+static int
+route_info_matrix_column(struct route *this, struct route_graph *graph, struct route_info **info, int src_count, int dst_count, int j,
+		int *times, int *distances)
+{
+	struct route_path *path;
+	int i,ret=0;
 
-	if (mr->coord_sel) {
-		if (!mr->point) { /* This means that no point has been found */
-			return NULL;
-		}
-		seg = rp_iterator_next(&(mr->it));
-	} else {
-		if (!seg)
-			seg=r->graph->route_segments;
-		else
-			seg=seg->next;
-	}
-	
-	if (seg) {
-		mr->rseg = seg;
-		mr->item.id_lo++;
-		rm_coord_rewind(mr);
-		rp_attr_rewind(mr);
-		return &mr->item;
+	if (!info[src_count+j])
+		return 0;
+	route_graph_reset(graph);
+	route_graph_flood(graph, info[src_count+j], NULL, this->vehicleprofile, NULL);
+	for (i = 0 ; i < src_count ; i++) {
+		if (!info[i])
+			continue;
+		path=route_path_new(graph, NULL, info[i], info[src_count+j], this->vehicleprofile);
+		if (!path)
+			continue;
+		route_path_set_totals(path, this->vehicleprofile, graph->speed_profiles, graph->departure);
+		times[i*dst_count+j]=path->path_time;
+		distances[i*dst_count+j]=path->path_len;
+		route_path_destroy(path, 1);
+		ret++;
 	}
-	return NULL;
-	
+	return ret;
 }
 
-static struct item *
-rp_get_item_byid(struct map_rect_priv *mr, int id_hi, int id_lo)
+/**
+ * @brief Calculates travel times and distances between several sources and destinations
+ *
+ * One route graph covering all points is built synchronously and flooded once per destination.
+ * Each flood yields the costs from every point of the graph, so the paths from all sources to
+ * that destination are then extracted without further searching. Times and distances are those
+ * of the extracted paths, as computed by route_time_seg(). Traffic distortions set on the route
+ * are taken into account.
+ *
+ * @param this The route whose mapset, vehicle profile and traffic distortions are used
+ * @param info The sources followed by the destinations, entries may be {@code NULL} if no street
+ * was found for a point
+ * @param src_count Number of sources
+ * @param dst_count Number of destinations
+ * @param times Receives {@code src_count*dst_count} travel times in tenths of seconds, see route_get_matrix()
+ * @param distances Receives the lengths of the routes in meters, see route_get_matrix()
+ * @return Number of pairs for which a route was found
+ */
+static int
+route_info_matrix(struct route *this, struct route_info **info, int src_count, int dst_count, int *times, int *distances)
 {
-	struct item *ret=NULL;
-	while (id_lo-- > 0) 
-		ret=rp_get_item(mr);
+	struct route_graph *graph;
+	int i,j,ret=0;
+
+	for (i = 0 ; i < src_count*dst_count ; i++) {
+		times[i]=-1;
+		distances[i]=-1;
+	}
+	graph=route_info_matrix_graph(this, info, src_count+dst_count, NULL, 0);
+	if (graph) {
+		while (graph->busy)
+			route_graph_build_idle(graph, this->vehicleprofile);
+		route_info_matrix_prepare(this, graph);
+		for (j = 0 ; j < dst_count ; j++)
+			ret+=route_info_matrix_column(this, graph, info, src_count, dst_count, j, times, distances);
+		route_graph_destroy(graph);
+	}
 	return ret;
 }
 
-
-static struct item *
-rm_get_item(struct map_rect_priv *mr)
+/**
+ * @brief Calculates travel times and distances between several sources and destinations
+ *
+ * See route_info_matrix() for how this is done.
+ *
+ * @param this The route whose mapset, vehicle profile and traffic distortions are used
+ * @param src The sources
+ * @param src_count Number of sources
+ * @param dst The destinations
+ * @param dst_count Number of destinations
+ * @param times Receives {@code src_count*dst_count} travel times in tenths of seconds, the times from the
+ * first source to all destinations come first. -1 if no route exists.
+ * @param distances Receives the lengths of the routes in meters in the same order, -1 if no route exists.
+ * @return Number of pairs for which a route was found
+ */
+int
+route_get_matrix(struct route *this, struct pcoord *src, int src_count, struct pcoord *dst, int dst_count,
+		int *times, int *distances)
 {
-	struct route *route=mr->mpriv->route;
-	void *id=0;
-
-	switch (mr->item.type) {
-	case type_none:
-		if (route->pos && route->pos->street_direction && route->pos->street_direction != route->pos->dir)
-			mr->item.type=type_route_start_reverse;
-		else
-			mr->item.type=type_route_start;
-		if (route->pos) {
-			id=route->pos;
-			break;
-		}
+	struct route_info **info;
+	int i,ret;
 
-	case type_route_start:
-	case type_route_start_reverse:
-		mr->seg=NULL;
-		mr->dest=mr->mpriv->route->destinations;
-	default:
-		if (mr->item.type == type_waypoint)
-			mr->dest=g_list_next(mr->dest);
-		mr->item.type=type_street_route;
-		mr->seg=mr->seg_next;
-		if (!mr->seg && mr->path && mr->path->next) {
-			struct route_path *p=NULL;
-			mr->path->in_use--;
-			if (!mr->path->in_use)
-				p=mr->path;
-			mr->path=mr->path->next;
-			mr->path->in_use++;
-			mr->seg=mr->path->path;
-			if (p)
-				g_free(p);
-			if (mr->dest) {
-				id=mr->dest;
-				mr->item.type=type_waypoint;
-				mr->seg_next=mr->seg;
-				break;
-			}
-		}
-		if (mr->seg) {
-			mr->seg_next=mr->seg->next;
-			id=mr->seg;
-			break;
+	if (!this->ms || !this->vehicleprofile || !src_count || !dst_count) {
+		for (i = 0 ; i < src_count*dst_count ; i++) {
+			times[i]=-1;
+			distances[i]=-1;
 		}
-		if (mr->dest && g_list_next(mr->dest)) {
-			id=mr->dest;
-			mr->item.type=type_waypoint;
-			break;
+		return 0;
+	}
+	info=g_new0(struct route_info *, src_count+dst_count);
+	for (i = 0 ; i < src_count+dst_count ; i++) {
+		struct pcoord *pc=i < src_count ? &src[i] : &dst[i-src_count];
+		info[i]=route_find_nearest_street(this->vehicleprofile, this->ms, pc);
+		if (info[i]) {
+			route_info_distances(info[i], pc->pro);
+			info[i]->street_direction=0;
 		}
-		mr->item.type=type_route_end;
-		id=&(mr->mpriv->route->destinations);
-		if (mr->mpriv->route->destinations)
-			break;
-	case type_route_end:
-		return NULL;
 	}
-	mr->last_coord = 0;
-	item_id_from_ptr(&mr->item,id);
-	rm_attr_rewind(mr);
-	return &mr->item;
+	ret=route_info_matrix(this, info, src_count, dst_count, times, distances);
+	for (i = 0 ; i < src_count+dst_count ; i++)
+		route_info_free(info[i]);
+	g_free(info);
+	return ret;
 }
 
-static struct item *
-rm_get_item_byid(struct map_rect_priv *mr, int id_hi, int id_lo)
+static void
+route_destinations_optimize_free(struct route_destinations_optimization *opt)
 {
-	struct item *ret=NULL;
-	do {
-		ret=rm_get_item(mr);
-	} while (ret && (ret->id_lo!=id_lo || ret->id_hi!=id_hi));
-	return ret;
-}
+	int i;
 
-static struct map_methods route_meth = {
-	projection_mg,
-	"utf-8",
-	rm_destroy,
-	rm_rect_new,
-	rm_rect_destroy,
-	rm_get_item,
-	rm_get_item_byid,
-	NULL,
-	NULL,
-	NULL,
-};
+	if (opt->idle)
+		event_remove_idle(opt->idle);
+	callback_destroy(opt->idle_cb);
+	route_graph_destroy(opt->graph);
+	callback_destroy(opt->done_cb);
+	for (i = 0 ; i < opt->count*2 ; i++)
+		route_info_free(opt->info[i]);
+	g_free(opt->info);
+	g_free(opt->times);
+	g_free(opt->distances);
+	g_free(opt);
+}
 
-static struct map_methods route_graph_meth = {
-	projection_mg,
-	"utf-8",
-	rp_destroy,
-	rp_rect_new,
-	rm_rect_destroy,
-	rp_get_item,
-	rp_get_item_byid,
-	NULL,
-	NULL,
-	NULL,
-};
+/**
+ * @brief Stops a running reordering of the waypoints, the waypoints keep their order
+ */
+static void
+route_destinations_optimize_cancel(struct route *this)
+{
+	if (!this->optimization)
+		return;
+	route_destinations_optimize_free(this->optimization);
+	this->optimization=NULL;
+}
 
-static struct map_priv *
-route_map_new_helper(struct map_methods *meth, struct attr **attrs, int graph)
+/**
+ * @brief Reorders the waypoints of the route by the travel times computed between them
+ */
+static void
+route_destinations_optimize_apply(struct route_destinations_optimization *opt)
 {
-	struct map_priv *ret;
-	struct attr *route_attr;
+	struct route *this=opt->route;
+	int *costs,*order;
+	int i,j,count=opt->count;
+	GList *destinations=NULL;
+
+	/* Stop 0 is the position, stop i is the i-th waypoint */
+	costs=g_new(int, (count+1)*(count+1));
+	for (i = 0 ; i < (count+1)*(count+1) ; i++)
+		costs[i]=-1;
+	for (i = 0 ; i < count ; i++) {
+		for (j = 0 ; j < count ; j++)
+			costs[i*(count+1)+j+1]=opt->times[i*count+j];
+	}
+	order=g_new(int, count+1);
+	route_order_optimize(costs, count+1, order, this->optimize_waypoints);
+	for (i = 1 ; i <= count ; i++)
+		destinations=g_list_append(destinations, g_list_nth_data(this->destinations, order[i]-1));
+	g_list_free(this->destinations);
+	this->destinations=destinations;
+	g_free(order);
+	g_free(costs);
+}
 
-	route_attr=attr_search(attrs, NULL, attr_route);
-	if (! route_attr)
-		return NULL;
-	ret=g_new0(struct map_priv, 1);
-	if (graph)
-		*meth=route_graph_meth;
-	else
-		*meth=route_meth;
-	ret->route=route_attr->u.route;
+/**
+ * @brief Floods the graph from the next waypoint, and reorders the waypoints after the last one
+ *
+ * Called from an idle event, one flood per call. The route is updated once the waypoints are
+ * reordered.
+ */
+static void
+route_destinations_optimize_idle(struct route_destinations_optimization *opt)
+{
+	struct route *this=opt->route;
 
-	return ret;
+	route_info_matrix_column(this, opt->graph, opt->info, opt->count, opt->count, opt->next++, opt->times, opt->distances);
+	if (opt->next < opt->count)
+		return;
+	route_destinations_optimize_apply(opt);
+	route_destinations_optimize_cancel(this);
+	callback_list_call_attr_1(this->cbl2, attr_destination, this);
+	route_graph_destroy(this->graph);
+	this->graph=NULL;
+	this->current_dst=route_get_dst(this);
+	route_path_update(this, 1, 1);
 }
 
-static struct map_priv *
-route_map_new(struct map_methods *meth, struct attr **attrs, struct callback_list *cbl)
+/**
+ * @brief Starts flooding the graph for the reordering once it is built
+ */
+static void
+route_destinations_optimize_built(struct route_destinations_optimization *opt)
 {
-	return route_map_new_helper(meth, attrs, 0);
+	if (!opt->graph) {
+		/* Built before route_graph_build() returned, route_destinations_optimize() continues */
+		opt->built=1;
+		return;
+	}
+	route_info_matrix_prepare(opt->route, opt->graph);
+	opt->idle_cb=callback_new_1(callback_cast(route_destinations_optimize_idle), opt);
+	opt->idle=event_add_idle(50, opt->idle_cb);
 }
 
-static struct map_priv *
-route_graph_map_new(struct map_methods *meth, struct attr **attrs, struct callback_list *cbl)
+/**
+ * @brief Reorders the intermediate waypoints of the route so they are visited in less time
+ *
+ * The travel times between the position and all destinations are computed with one shared route
+ * graph, flooded once per waypoint, see route_info_matrix(). route_order_optimize() then searches for
+ * a better order, within the time set by {@code attr_optimize_waypoints}. The final destination stays
+ * the last one.
+ *
+ * If {@code async} is set, the graph is built and flooded from idle events, one waypoint at a time.
+ * Until the waypoints are reordered, route_path_update() computes no route, and the route is updated
+ * and {@code attr_destination} is announced again afterwards. Changing the waypoints in the meantime
+ * stops the reordering.
+ *
+ * @param this The route
+ * @param async If set, reorder in the background
+ */
+static void
+route_destinations_optimize(struct route *this, int async)
 {
-	return route_map_new_helper(meth, attrs, 1);
+	struct route_destinations_optimization *opt;
+	GList *l;
+	int i,count=g_list_length(this->destinations);
+
+	route_destinations_optimize_cancel(this);
+	if (this->optimize_waypoints <= 0 || !this->pos || count < 3)
+		return;
+	opt=g_new0(struct route_destinations_optimization, 1);
+	opt->route=this;
+	opt->count=count;
+	/* Sources are the position and the intermediate waypoints, destinations are all waypoints */
+	opt->info=g_new0(struct route_info *, count*2);
+	opt->info[0]=route_info_dup(this->pos);
+	for (i = 0, l=this->destinations ; l ; i++, l=g_list_next(l)) {
+		if (i < count-1)
+			opt->info[i+1]=route_info_dup(l->data);
+		opt->info[count+i]=route_info_dup(l->data);
+	}
+	opt->times=g_new(int, count*count);
+	opt->distances=g_new(int, count*count);
+	if (!async) {
+		route_info_matrix(this, opt->info, count, count, opt->times, opt->distances);
+		route_destinations_optimize_apply(opt);
+		route_destinations_optimize_free(opt);
+		return;
+	}
+	for (i = 0 ; i < count*count ; i++) {
+		opt->times[i]=-1;
+		opt->distances[i]=-1;
+	}
+	this->optimization=opt;
+	opt->done_cb=callback_new_1(callback_cast(route_destinations_optimize_built), opt);
+	opt->graph=route_info_matrix_graph(this, opt->info, count*2, opt->done_cb, 1);
+	if (!opt->graph)
+		route_destinations_optimize_cancel(this);
+	else if (opt->built)
+		route_destinations_optimize_built(opt);
 }
 
-static struct map *
-route_get_map_helper(struct route *this_, struct map **map, char *type, char *description)
+/**
+ * @brief Releases a reference to an isochrone, and frees it when the last one is gone
+ */
+static void
+route_isochrone_unref(struct route_isochrone *iso)
 {
-	struct attr *attrs[5];
-	struct attr a_type,navigation,data,a_description;
-	a_type.type=attr_type;
-	a_type.u.str=type;
-	navigation.type=attr_route;
-	navigation.u.route=this_;
-	data.type=attr_data;
-	data.u.str="";
-	a_description.type=attr_description;
-	a_description.u.str=description;
+	if (!--iso->in_use)
+		g_free(iso);
+}
 
-	attrs[0]=&a_type;
-	attrs[1]=&navigation;
-	attrs[2]=&data;
-	attrs[3]=&a_description;
-	attrs[4]=NULL;
+static void
+route_isochrones_clear(struct route *this)
+{
+	g_list_foreach(this->isochrones, (GFunc)route_isochrone_unref, NULL);
+	g_list_free(this->isochrones);
+	this->isochrones=NULL;
+}
 
-	if (! *map) { 
-		*map=map_new(NULL, attrs);
-		navit_object_ref((struct navit_object *)*map);
-	}
- 
-	return *map;
+static gint
+route_isochrone_compare(gconstpointer a, gconstpointer b)
+{
+	return ((struct route_isochrone *)b)->budget-((struct route_isochrone *)a)->budget;
 }
 
 /**
- * @brief Returns a new map containing the route path
- *
- * This function returns a new map containing the route path.
- *
- * @important Do not map_destroy() this!
+ * @brief Records a reachable location if it is the farthest one from the center in its sector
  *
- * @param this_ The route to get the map of
- * @return A new map containing the route path
+ * @param center The center of the isochrone
+ * @param c The reachable location
+ * @param outline The farthest location of each sector
+ * @param dist The squared distance of the farthest location of each sector from the center, or -1
  */
-struct map *
-route_get_map(struct route *this_)
+static void
+route_isochrone_add(struct coord *center, struct coord *c, struct coord *outline, double *dist)
 {
-	return route_get_map_helper(this_, &this_->map, "route","Route");
-}
+	double dx=c->x-center->x,dy=c->y-center->y,d=dx*dx+dy*dy;
+	int sector;
 
+	if (!d)
+		return;
+	sector=(atan2(dy, dx)+M_PI)*ROUTE_ISOCHRONE_SECTORS/(2*M_PI);
+	if (sector >= ROUTE_ISOCHRONE_SECTORS)
+		sector=ROUTE_ISOCHRONE_SECTORS-1;
+	if (d > dist[sector]) {
+		dist[sector]=d;
+		outline[sector]=*c;
+	}
+}
 
 /**
- * @brief Returns a new map containing the route graph
- *
- * This function returns a new map containing the route graph.
+ * @brief Records how far a segment can be followed from a point within a time budget
  *
- * @important Do not map_destroy()  this!
- *
- * @param this_ The route to get the map of
- * @return A new map containing the route graph
+ * If {@code from} is reached within the budget but the other end of {@code s} is not, the
+ * location on {@code s} at which the budget runs out is recorded, assuming the segment is straight.
  */
-struct map *
-route_get_graph_map(struct route *this_)
+static void
+route_isochrone_add_segment(struct route_graph *graph, int budget, struct coord *center, struct route_graph_segment *s,
+		struct route_graph_point *from, struct vehicleprofile *profile, struct coord *outline, double *dist)
 {
-	return route_get_map_helper(this_, &this_->graph_map, "route_graph","Route Graph");
-}
+	struct route_graph_point *to=(from == s->start) ? s->end : s->start;
+	struct coord c;
+	int val;
+	double f;
 
+	if (from->value > budget || to->value <= budget)
+		return;
+	val=route_value_seg(profile, NULL, s, (from == s->start) ? 1 : -1, route_graph_speeds(graph, from->value));
+	if (val == INT_MAX || from->value+val <= budget)
+		return;
+	f=(double)(budget-from->value)/val;
+	c.x=from->c.x+(to->c.x-from->c.x)*f;
+	c.y=from->c.y+(to->c.y-from->c.y)*f;
+	route_isochrone_add(center, &c, outline, dist);
+}
 
 /**
- * @brief Returns the flags for the route.
+ * @brief Creates the outline of the area reachable within a time budget from a forward flooded graph
+ *
+ * @param graph The route graph, flooded by route_graph_flood_forward() with a limit of at least {@code budget}
+ * @param center The location the graph was flooded from
+ * @param pro The projection of the graph
+ * @param profile The vehicle profile the graph was flooded with
+ * @param budget The time budget in tenths of seconds
+ * @return The isochrone, or {@code NULL} if too little is reachable to form an area
  */
-enum route_path_flags route_get_flags(struct route *this_) {
-	return this_->flags;
+static struct route_isochrone *
+route_isochrone_new(struct route_graph *graph, struct coord *center, enum projection pro, struct vehicleprofile *profile, int budget)
+{
+	struct route_isochrone *ret;
+	struct route_graph_point *p;
+	struct route_graph_segment *s;
+	struct coord outline[ROUTE_ISOCHRONE_SECTORS];
+	double dist[ROUTE_ISOCHRONE_SECTORS];
+	int i;
+
+	for (i = 0 ; i < ROUTE_ISOCHRONE_SECTORS ; i++)
+		dist[i]=-1;
+	for (i = 0 ; i < graph->point_count ; i++) {
+		p=ROUTE_GRAPH_POINT(graph, i);
+		if (p->value <= budget)
+			route_isochrone_add(center, &p->c, outline, dist);
+	}
+	for (s = graph->route_segments ; s ; s = s->next) {
+		route_isochrone_add_segment(graph, budget, center, s, s->start, profile, outline, dist);
+		route_isochrone_add_segment(graph, budget, center, s, s->end, profile, outline, dist);
+	}
+	ret=g_malloc(sizeof(struct route_isochrone)+ROUTE_ISOCHRONE_SECTORS*sizeof(struct coord));
+	ret->in_use=1;
+	ret->budget=budget;
+	ret->count=0;
+	for (i = 0 ; i < ROUTE_ISOCHRONE_SECTORS ; i++) {
+		if (dist[i] < 0)
+			continue;
+		if (pro != projection_mg)
+			transform_from_to(&outline[i], pro, &ret->c[ret->count], projection_mg);
+		else
+			ret->c[ret->count]=outline[i];
+		ret->count++;
+	}
+	if (ret->count < 3) {
+		g_free(ret);
+		return NULL;
+	}
+	return ret;
 }
 
 /**
- * @brief Whether the route has a valid graph.
- *
- * @return True if the route has a graph, false if not.
+ * @brief Stops a running computation of isochrones
  */
-int
-route_has_graph(struct route *this_) {
-	return (this_->graph != NULL);
+static void
+route_isochrone_build_cancel(struct route *this)
+{
+	struct route_isochrone_build *build=this->isochrone_build;
+
+	if (!build)
+		return;
+	route_graph_destroy(build->graph);
+	callback_destroy(build->done_cb);
+	route_info_free(build->pos);
+	g_free(build->budgets);
+	g_free(build);
+	this->isochrone_build=NULL;
 }
 
-void
-route_set_projection(struct route *this_, enum projection pro)
+/**
+ * @brief Floods the graph built for isochrones and adds the areas to the route
+ *
+ * Called when the graph is built. Announces the number of areas found with {@code attr_isochrones}
+ * on the callback list of the route.
+ */
+static void
+route_isochrone_build_done(struct route_isochrone_build *build)
 {
+	struct route *this=build->route;
+	struct route_graph *graph=build->graph;
+	struct route_graph_point *ends[2];
+	struct route_isochrone *iso;
+	struct attr attr;
+	GList *l;
+	int i,ret=0;
+
+	if (!graph) {
+		/* Built before route_graph_build_selection() returned, route_set_isochrone() continues */
+		build->done=1;
+		return;
+	}
+	for (l=this->traffic ; l ; l=g_list_next(l))
+		route_graph_apply_traffic(graph, l->data, 0, ends);
+	route_graph_set_speed_profiles(graph, this->speed_profiles, this->departure_time);
+	route_graph_flood_forward(graph, build->pos, this->vehicleprofile, build->limit);
+	for (i = 0 ; i < build->count ; i++) {
+		iso=route_isochrone_new(graph, &build->pos->lp, build->pro, this->vehicleprofile, build->budgets[i]);
+		if (iso) {
+			this->isochrones=g_list_insert_sorted(this->isochrones, iso, route_isochrone_compare);
+			ret++;
+		}
+	}
+	dbg(lvl_debug,"%d isochrones from %d points\n", ret, graph->point_count);
+	route_isochrone_build_cancel(this);
+	attr.type=attr_isochrones;
+	attr.u.num=ret;
+	callback_list_call_attr_2(this->cbl2, attr_isochrones, this, &attr);
 }
 
+/**
+ * @brief Starts calculating the areas reachable from a location within several time budgets
+ *
+ * A route graph is built around {@code center}, large enough to cover everything reachable at the
+ * highest speed of the vehicle profile, see route_isochrone_selection(), and flooded forward from
+ * the street nearest to {@code center} until the largest budget is used up. The outline of each area
+ * runs through the farthest location reachable within each of {@code ROUTE_ISOCHRONE_SECTORS} sectors
+ * around the center, including locations part way along a street.
+ *
+ * The graph is built from idle events, or on worker threads if {@code graph_build_threads} is set.
+ * Once the areas are found, they replace those of a previous call, are shown on the map returned by
+ * route_get_isochrone_map() and their number is announced with {@code attr_isochrones} on the callback
+ * list of the route. A computation still running from a previous call is stopped. Traffic distortions
+ * set on the route are taken into account.
+ *
+ * @param this The route whose mapset, vehicle profile and traffic distortions are used
+ * @param center The location to start at
+ * @param budgets The time budgets in tenths of seconds
+ * @param count Number of time budgets, 0 to remove the areas of a previous call
+ * @return True if the computation was started
+ */
 int
-route_set_attr(struct route *this_, struct attr *attr)
+route_set_isochrone(struct route *this, struct pcoord *center, int *budgets, int count)
 {
-	int attr_updated=0;
-	switch (attr->type) {
-	case attr_route_status:
-		attr_updated = (this_->route_status != attr->u.num);
-		this_->route_status = attr->u.num;
-		break;
-	case attr_destination:
-		route_set_destination(this_, attr->u.pcoord, 1);
-		return 1;
-	case attr_position:
-		route_set_position_flags(this_, attr->u.pcoord, route_path_flag_async);
-		return 1;
-	case attr_position_test:
-		return route_set_position_flags(this_, attr->u.pcoord, route_path_flag_no_rebuild);
-	case attr_vehicle:
-		attr_updated = (this_->v != attr->u.vehicle);
-		this_->v=attr->u.vehicle;
-		if (attr_updated) {
-			struct attr g;
-			struct pcoord pc;
-			struct coord c;
-			if (vehicle_get_attr(this_->v, attr_position_coord_geo, &g, NULL)) {
-				pc.pro=projection_mg;
-				transform_from_geo(projection_mg, g.u.coord_geo, &c);
-				pc.x=c.x;
-				pc.y=c.y;
-				route_set_position(this_, &pc);
-			}
-		}
-		break;
-	default:
-		dbg(lvl_error,"unsupported attribute: %s\n",attr_to_name(attr->type));
+	struct route_isochrone_build *build;
+	struct route_info *pos;
+	struct route_graph *graph;
+	long long radius;
+	int i,limit=0,speed=0;
+
+	route_isochrone_build_cancel(this);
+	route_isochrones_clear(this);
+	if (!this->ms || !this->vehicleprofile || !count)
 		return 0;
+	for (i = 0 ; i < count ; i++) {
+		if (budgets[i] > limit)
+			limit=budgets[i];
 	}
-	if (attr_updated)
-		callback_list_call_attr_2(this_->cbl2, attr->type, this_, attr);
+	g_hash_table_foreach(this->vehicleprofile->roadprofile_hash, route_graph_max_route_weight, &speed);
+	if (!limit || !speed)
+		return 0;
+	pos=route_find_nearest_street(this->vehicleprofile, this->ms, center);
+	if (!pos) {
+		dbg(lvl_error,"no street found near center\n");
+		return 0;
+	}
+	route_info_distances(pos, center->pro);
+	build=g_new0(struct route_isochrone_build, 1);
+	build->route=this;
+	build->pos=pos;
+	build->pro=map_projection(pos->street->item.map);
+	build->budgets=g_memdup(budgets, count*sizeof(int));
+	build->count=count;
+	build->limit=limit;
+	build->done_cb=callback_new_1(callback_cast(route_isochrone_build_done), build);
+	this->isochrone_build=build;
+	radius=(long long)limit*speed/36;
+	if (build->pro == projection_mg)
+		radius*=transform_scale(pos->lp.y);
+	if (radius > INT_MAX/2)
+		radius=INT_MAX/2;
+	dbg(lvl_debug,"building graph within %lld of center for %d tenths of seconds\n", radius, limit);
+	graph=route_graph_build_selection(this->ms, route_isochrone_selection(&pos->lp, radius, this->vehicleprofile),
+			build->done_cb, 1, this->vehicleprofile, 0, this->graph_build_threads, (long)this->graph_memory_budget*1024);
+	build->graph=graph;
+	if (build->done)
+		route_isochrone_build_done(build);
 	return 1;
 }
 
-int
-route_add_attr(struct route *this_, struct attr *attr)
+/**
+ * @brief Returns the time in milliseconds elapsed since {@code start}
+ */
+static double
+route_benchmark_elapsed(struct timeval *start)
 {
-	switch (attr->type) {
-	case attr_callback:
-		callback_list_add(this_->cbl2, attr->u.callback);
-		return 1;
-	default:
-		return 0;
-	}
+	struct timeval curr;
+	gettimeofday(&curr, NULL);
+	return (curr.tv_sec-start->tv_sec)*1000.0+(curr.tv_usec-start->tv_usec)/1000.0;
 }
 
-int
-route_remove_attr(struct route *this_, struct attr *attr)
+/**
+ * @brief Calculates a route path synchronously and measures its phases
+ *
+ * If the vehicle profile allows it, see route_ch_usable(), the contraction hierarchy of the maps is
+ * queried first and no route graph is built if it finds a path. Otherwise the route graph is built
+ * for this path only and destroyed before returning, so this may run on several threads at once as
+ * long as each thread uses a mapset with instances of its own of the maps, see map_dup().
+ *
+ * @return The path, or NULL if no route was found
+ */
+static struct route_path *
+route_benchmark_path(struct mapset *ms, struct vehicleprofile *profile, struct pcoord *pos, struct pcoord *dst, int threads,
+		struct route_benchmark *result)
 {
-	dbg(lvl_debug,"enter\n");
-	switch (attr->type) {
-	case attr_callback:
-		callback_list_remove(this_->cbl2, attr->u.callback);
-		return 1;
-	case attr_vehicle:
-		this_->v=NULL;
-		return 1;
-	default:
-		return 0;
+	struct route_info *posi,*dsti;
+	struct route_graph *graph;
+	struct route_graph_segment *s;
+	struct route_path *path;
+	struct timeval start;
+	struct coord c[2];
+	int i;
+
+	memset(result, 0, sizeof(*result));
+	posi=route_find_nearest_street(profile, ms, pos);
+	dsti=route_find_nearest_street(profile, ms, dst);
+	if (!posi || !dsti) {
+		dbg(lvl_error,"no street found near %s\n", posi ? "destination" : "position");
+		route_info_free(posi);
+		route_info_free(dsti);
+		return NULL;
+	}
+	route_info_distances(posi, pos->pro);
+	route_info_distances(dsti, dst->pro);
+	posi->street_direction=0;
+	c[0]=posi->c;
+	c[1]=dsti->c;
+
+	if (route_ch_usable(profile)) {
+		gettimeofday(&start, NULL);
+		path=route_path_new_ch(ms, posi, dsti, profile);
+		if (path) {
+			result->path_ms=route_benchmark_elapsed(&start);
+			route_path_set_totals(path, profile, NULL, 0);
+			result->path_time=path->path_time;
+			result->path_len=path->path_len;
+			route_info_free(posi);
+			route_info_free(dsti);
+			return path;
+		}
+		dbg(lvl_debug,"no contraction hierarchy path, flooding the route graph\n");
+	}
+
+	gettimeofday(&start, NULL);
+	graph=route_graph_build(ms, c, 2, NULL, 0, profile, 0, threads, 0);
+	while (graph->busy)
+		route_graph_build_idle(graph, profile);
+	result->build_ms=route_benchmark_elapsed(&start);
+	result->points=graph->point_count;
+	for (s = graph->route_segments ; s ; s = s->next)
+		result->segments++;
+
+	gettimeofday(&start, NULL);
+	route_graph_flood(graph, dsti, posi, profile, NULL);
+	result->flood_ms=route_benchmark_elapsed(&start);
+	for (i = 0 ; i < graph->point_count ; i++) {
+		if (ROUTE_GRAPH_POINT(graph, i)->value != INT_MAX)
+			result->settled++;
 	}
+
+	gettimeofday(&start, NULL);
+	path=route_path_new(graph, NULL, posi, dsti, profile);
+	result->path_ms=route_benchmark_elapsed(&start);
+	if (path) {
+		route_path_set_totals(path, profile, graph->speed_profiles, graph->departure);
+		result->path_time=path->path_time;
+		result->path_len=path->path_len;
+	}
+	route_graph_destroy(graph);
+	route_info_free(posi);
+	route_info_free(dsti);
+	return path;
 }
 
+/**
+ * @brief Calculates a route synchronously and reports timings and sizes of its phases
+ *
+ * This runs the same steps as a route in use (building the route graph, flooding it and
+ * extracting the path), but without a {@code struct route} and without the event loop. It is
+ * meant for benchmarking routing outside of the GUI.
+ *
+ * @param ms The mapset to route on
+ * @param profile The vehicle profile to use
+ * @param pos The start of the route
+ * @param dst The destination of the route
+ * @param threads Number of threads to read the maps with, see {@code attr_graph_build_threads}
+ * @param result Receives the timings and sizes
+ * @return True if a route was found
+ */
 int
-route_get_attr(struct route *this_, enum attr_type type, struct attr *attr, struct attr_iter *iter)
+route_benchmark(struct mapset *ms, struct vehicleprofile *profile, struct pcoord *pos, struct pcoord *dst, int threads,
+		struct route_benchmark *result)
 {
-	int ret=1;
-	switch (type) {
-	case attr_map:
-		attr->u.map=route_get_map(this_);
-		ret=(attr->u.map != NULL);
-		break;
-	case attr_destination:
-		if (this_->destinations) {
-			struct route_info *dst;
-			if (iter) {
-				if (iter->u.list) {
-					iter->u.list=g_list_next(iter->u.list);
-				} else {
-					iter->u.list=this_->destinations;
-				}
-				if (!iter->u.list) {
-					return 0;
-				}
-				dst = (struct route_info*)iter->u.list->data;				
-			} else { //No iter handling
-				dst=route_get_dst(this_);
-			}
-			attr->u.pcoord=&this_->pc;
-			this_->pc.pro=projection_mg; /* fixme */
-			this_->pc.x=dst->c.x;
-			this_->pc.y=dst->c.y;
-		} else
-			ret=0;
-		break;
-	case attr_vehicle:
-		attr->u.vehicle=this_->v;
-		ret=(this_->v != NULL);
-		dbg(lvl_debug,"get vehicle %p\n",this_->v);
-		break;
-	case attr_vehicleprofile:
-		attr->u.vehicleprofile=this_->vehicleprofile;
-		ret=(this_->vehicleprofile != NULL);
-		break;
-	case attr_route_status:
-		attr->u.num=this_->route_status;
-		break;
-	case attr_destination_time:
-		if (this_->path2 && (this_->route_status == route_status_path_done_new || this_->route_status == route_status_path_done_incremental)) {
-			struct route_path *path=this_->path2;
-			attr->u.num=0;
-			while (path) {
-				attr->u.num+=path->path_time;
-				path=path->next;
-			}
-			dbg(lvl_debug,"path_time %ld\n",attr->u.num);
-		} else
-			ret=0;
-		break;
-	case attr_destination_length:
-		if (this_->path2 && (this_->route_status == route_status_path_done_new || this_->route_status == route_status_path_done_incremental)) {
-			struct route_path *path=this_->path2;
-			attr->u.num=0;
-			while (path) {
-				attr->u.num+=path->path_len;
-				path=path->next;
-			}
-		} else
-			ret=0;
-		break;
-	default:
+	struct route_path *path=route_benchmark_path(ms, profile, pos, dst, threads, result);
+	if (!path)
 		return 0;
-	}
-	attr->type=type;
-	return ret;
+	route_path_destroy(path, 1);
+	return 1;
 }
 
-struct attr_iter *
-route_attr_iter_new(void)
+/**
+ * @brief Calculates a route synchronously and returns its geometry
+ *
+ * Like route_benchmark(), this needs neither a {@code struct route} nor the event loop. Each call
+ * builds a route graph of its own, so routes can be calculated on several threads at once, as
+ * long as each thread passes a mapset with instances of its own of the maps, see map_dup(). The vehicle
+ * profile may be shared.
+ *
+ * @param ms The mapset to route on
+ * @param profile The vehicle profile to use
+ * @param pos The start of the route
+ * @param dst The destination of the route
+ * @param result Receives the time, length and coordinates of the path
+ * @return True if a route was found
+ */
+int
+route_calculate(struct mapset *ms, struct vehicleprofile *profile, struct pcoord *pos, struct pcoord *dst, struct route_result *result)
 {
-	return g_new0(struct attr_iter, 1);
-}
+	struct route_benchmark benchmark;
+	struct route_path *path=route_benchmark_path(ms, profile, pos, dst, 1, &benchmark);
+	struct route_path_segment *seg;
+	int count=0;
 
-void
-route_attr_iter_destroy(struct attr_iter *iter)
-{
-	g_free(iter);
+	memset(result, 0, sizeof(*result));
+	if (!path)
+		return 0;
+	for (seg=path->path ; seg ; seg=seg->next)
+		count+=seg->ncoords;
+	result->c=g_new(struct coord, count);
+	for (seg=path->path ; seg ; seg=seg->next) {
+		int i=0;
+		/* consecutive segments share their end points */
+		if (result->count && seg->ncoords && seg->c[0].x == result->c[result->count-1].x &&
+			seg->c[0].y == result->c[result->count-1].y)
+			i=1;
+		for ( ; i < seg->ncoords ; i++)
+			result->c[result->count++]=seg->c[i];
+	}
+	result->path_time=path->path_time;
+	result->path_len=path->path_len;
+	route_path_destroy(path, 1);
+	return 1;
 }
 
 void
@@ -4204,18 +9643,37 @@ route_init(void)
 {
 	plugin_register_category_map("route", route_map_new);
 	plugin_register_category_map("route_graph", route_graph_map_new);
+	plugin_register_category_map("route_alternatives", route_alternatives_map_new);
+	plugin_register_category_map("route_isochrone", route_isochrone_map_new);
 }
 
 void
 route_destroy(struct route *this_)
 {
 	this_->refcount++; /* avoid recursion */
+#ifdef HAVE_PTHREAD
+	route_worker_cancel(this_);
+#endif
+	route_alternatives_clear(this_);
+	callback_destroy(this_->alternatives_cb);
+	if (this_->traffic_timeout)
+		event_remove_timeout(this_->traffic_timeout);
+	callback_destroy(this_->traffic_cb);
+	g_list_foreach(this_->traffic, (GFunc)g_free, NULL);
+	g_list_free(this_->traffic);
+	g_free(this_->traffic_file);
+	if (this_->speed_profiles)
+		speed_profiles_destroy(this_->speed_profiles);
 	route_path_destroy(this_->path2,1);
 	route_graph_destroy(this_->graph);
 	route_clear_destinations(this_);
 	route_info_free(this_->pos);
 	map_destroy(this_->map);
 	map_destroy(this_->graph_map);
+	map_destroy(this_->alternatives_map);
+	map_destroy(this_->isochrone_map);
+	route_isochrone_build_cancel(this_);
+	route_isochrones_clear(this_);
 	g_free(this_);
 }
 
@@ -72,6 +72,30 @@ struct street_data {
 						 *   DO NOT INSERT FIELDS AFTER THIS. */
 };
 
+/**
+ * @brief Timings and sizes of a route calculated by route_benchmark()
+ */
+struct route_benchmark {
+	double build_ms;	/**< Time to build the route graph */
+	double flood_ms;	/**< Time to flood the route graph */
+	double path_ms;		/**< Time to extract the path */
+	int points;		/**< Number of points in the route graph */
+	int segments;		/**< Number of segments in the route graph */
+	int settled;		/**< Number of points which have costs after flooding */
+	int path_time;		/**< Time to drive the path in tenths of seconds */
+	int path_len;		/**< Length of the path in meters */
+};
+
+/**
+ * @brief A route calculated by route_calculate()
+ */
+struct route_result {
+	int path_time;		/**< Time to drive the path in tenths of seconds */
+	int path_len;		/**< Length of the path in meters */
+	int count;		/**< Number of coordinates of the path */
+	struct coord *c;	/**< Coordinates of the path in the projection of the map, to be freed with g_free() */
+};
+
 /* prototypes */
 enum attr_type;
 enum projection;
@@ -118,6 +142,8 @@ void route_info_free(struct route_info *inf);
 struct street_data *route_info_street(struct route_info *rinf);
 struct map *route_get_map(struct route *this_);
 struct map *route_get_graph_map(struct route *this_);
+struct map *route_get_alternatives_map(struct route *this_);
+struct map *route_get_isochrone_map(struct route *this_);
 enum route_path_flags route_get_flags(struct route *this_);
 int route_has_graph(struct route *this_);
 void route_set_projection(struct route *this_, enum projection pro);
@@ -128,6 +154,12 @@ int route_remove_attr(struct route *this_, struct attr *attr);
 struct attr_iter * route_attr_iter_new(void);
 void route_attr_iter_destroy(struct attr_iter *iter);
 int route_get_attr(struct route *this_, enum attr_type type, struct attr *attr, struct attr_iter *iter);
+void route_set_traffic_distortion(struct route *this_, int id, struct coord *start, struct coord *end, int delay, int maxspeed, int duration);
+void route_remove_traffic_distortion(struct route *this_, int id);
+int route_get_matrix(struct route *this_, struct pcoord *src, int src_count, struct pcoord *dst, int dst_count, int *times, int *distances);
+int route_set_isochrone(struct route *this_, struct pcoord *center, int *budgets, int count);
+int route_benchmark(struct mapset *ms, struct vehicleprofile *profile, struct pcoord *pos, struct pcoord *dst, int threads, struct route_benchmark *result);
+int route_calculate(struct mapset *ms, struct vehicleprofile *profile, struct pcoord *pos, struct pcoord *dst, struct route_result *result);
 void route_init(void);
 void route_destroy(struct route *this_);
 /* end of prototypes */
@@ -0,0 +1,985 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Headless routing benchmark and batch route server
+ *
+ * Loads maps and a vehicle profile, calculates the routes between the origin/destination pairs of
+ * a query file one after the other and reports the time spent in each phase of the calculation,
+ * the size of the route graph and the peak memory use. No GUI, graphics or event loop is needed.
+ *
+ * Each line of the query file holds two coordinates in any format understood by coord_parse(),
+ * e.g. {@code 11.5755 48.1372 11.5200 48.1500}. Empty lines and lines starting with # are skipped.
+ *
+ * In server mode ({@code --serve}), the maps and all vehicle profiles are loaded once and route
+ * requests are answered instead, e.g. to replay recorded trips against a new map. A request is a
+ * line like a query, optionally followed by the name of the vehicle profile to use. Requests are
+ * read from stdin or from the connections to a local socket ({@code --listen}) and calculated on
+ * several threads at once, each with a mapset and route graphs of its own. The answers are written
+ * in the order of the requests, one line each:
+ * {@code <request> <path_time> <path_len> <lng>,<lat> <lng>,<lat> ...} with the time in tenths of
+ * seconds, the length in meters and the path in WGS84, or {@code <request> error <reason>}.
+ *
+ * In decode mode ({@code --decode}), no routes are calculated. Every item of each map is read
+ * instead, with the tile cache of the map disabled, so every pass decompresses all tiles again.
+ * This compares the decode throughput and the size of maps built with different compression
+ * methods, e.g. deflate and Zstandard.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <glib.h>
+#ifdef _MSC_VER
+#include "getopt_long.h"
+#else
+#include <getopt.h>
+#endif
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <signal.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include "item.h"
+#include "attr.h"
+#include "coord.h"
+#include "projection.h"
+#include "main.h"
+#include "debug.h"
+#include "atom.h"
+#include "file.h"
+#include "plugin.h"
+#include "map.h"
+#include "mapset.h"
+#include "xmlconfig.h"
+#include "vehicleprofile.h"
+#include "route.h"
+#include "transform.h"
+#ifdef HAVE_GLIB
+#include "event_glib.h"
+#else
+extern void _g_slice_thread_init_nomessage(void);
+#endif
+
+#ifndef USE_PLUGINS
+extern void builtin_init(void);
+#endif
+
+/**
+ * @brief State while reading the vehicle profile from a configuration file
+ */
+struct routebench_xml {
+	GList *profile_names;		/**< Names of the vehicle profiles to read */
+	GHashTable *profiles;		/**< The vehicle profiles read so far, by name */
+	int read_mapset;		/**< Set to read the first enabled mapset as well */
+	struct mapset *mapset;		/**< The mapset, once it has been read */
+	GList *stack;			/**< Objects created for the enclosing elements, innermost first */
+	int skip;			/**< Depth within an element which is not read */
+};
+
+/**
+ * @brief A route request of the server mode
+ */
+struct routebench_request {
+	int number;			/**< Number of the request, counted from 1 */
+	struct pcoord pos;		/**< The start of the route */
+	struct pcoord dst;		/**< The destination of the route */
+	struct vehicleprofile *profile;	/**< The vehicle profile to use */
+	int done;			/**< Set once the route has been calculated */
+	int found;			/**< Set if a route was found */
+	const char *error;		/**< Why the request could not be calculated, or NULL */
+	struct route_result result;	/**< The route */
+};
+
+/**
+ * @brief State of the server mode, shared by the reader, the workers and the writer
+ */
+struct routebench_server {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t mutex;		/**< Protects everything below */
+	pthread_cond_t cond;		/**< Signalled whenever a request is queued or calculated */
+#endif
+	GList *queue;			/**< Requests waiting for a worker */
+	GList *pending;			/**< Requests not answered yet, in the order they were read */
+	int pending_count;		/**< Number of requests in {@code pending} */
+	int eof;			/**< Set when all requests of the current stream have been read */
+	int quit;			/**< Set to make the workers stop */
+	FILE *out;			/**< Where to write the answers of the current stream to */
+	struct mapset *ms;		/**< The mapset */
+	int jobs;			/**< Number of workers */
+	struct routebench_worker *worker;	/**< The workers */
+};
+
+/**
+ * @brief A thread calculating the routes of a server
+ */
+struct routebench_worker {
+#ifdef HAVE_PTHREAD
+	pthread_t thread;		/**< The thread */
+#endif
+	struct routebench_server *server;	/**< The server */
+	struct mapset *ms;		/**< The mapset of this worker, see routebench_worker_mapset() */
+};
+
+/** Marks elements whose children are read but which are not created themselves */
+static struct attr routebench_xml_container;
+
+static struct plugins *plugins;
+static int plugins_added;
+
+static void
+usage(FILE *f)
+{
+	fprintf(f,"routebench - headless routing benchmark and batch route server\n");
+	fprintf(f,"Usage:\n");
+	fprintf(f,"routebench [options] -c <config> -m <map> [<queries>]\n");
+	fprintf(f,"routebench [options] -S -c <config> [-m <map>] [<requests>]\n");
+	fprintf(f,"routebench [options] -D -c <config> -m <map>\n");
+	fprintf(f,"Options:\n");
+	fprintf(f,"-c (--config) <file>          : read the vehicle profile from this navit.xml\n");
+	fprintf(f,"-d (--debug-level) <n>        : set the global debug level\n");
+	fprintf(f,"-D (--decode)                 : read all items of the maps with their tile cache disabled instead of\n");
+	fprintf(f,"                                routing, to compare the decode throughput of maps\n");
+	fprintf(f,"-h (--help)                   : this screen\n");
+	fprintf(f,"-H (--heap) <n>               : priority queue to flood with (0=fibonacci, 1=4-ary, 2=radix)\n");
+	fprintf(f,"-j (--jobs) <n>               : number of requests to calculate at once in server mode, defaults to\n");
+	fprintf(f,"                                the number of processors\n");
+	fprintf(f,"-l (--listen) <path>          : in server mode, read requests from connections to this local socket\n");
+	fprintf(f,"-m (--map) <attributes>       : load a map, e.g. \"type=binfile data=map.bin\", may be repeated,\n");
+	fprintf(f,"                                defaults to the first enabled mapset of the config in server mode\n");
+	fprintf(f,"-p (--plugin) <path>          : load a plugin, may be repeated, defaults to all plugins on demand\n");
+	fprintf(f,"-r (--repeat) <n>             : calculate every route n times, or read the maps n times in decode mode\n");
+	fprintf(f,"-s (--search-mode) <n>        : how to flood the route graph (0=full, 1=A*, 2=contraction hierarchy,\n");
+	fprintf(f,"                                which falls back to A* if no map has a hierarchy for the query)\n");
+	fprintf(f,"-S (--serve)                  : answer route requests instead of benchmarking\n");
+	fprintf(f,"-t (--threads) <n>            : number of threads to read the maps with\n");
+	fprintf(f,"-v (--vehicleprofile) <name>  : vehicle profile to use, defaults to car. May be repeated in server\n");
+	fprintf(f,"                                mode, requests without a profile use the first one\n");
+	fprintf(f,"<queries> is a file with one origin/destination pair per line, stdin is read if omitted\n");
+	fprintf(f,"<requests> is a file with one origin/destination pair and an optional profile name per line\n");
+}
+
+static void
+add_plugin(char *path, int ondemand)
+{
+	struct attr pa_attr={attr_path};
+	struct attr od_attr={attr_ondemand};
+	struct attr pl_attr={attr_plugins};
+	struct attr *attrs[3]={&pa_attr,&od_attr,NULL};
+
+	if (! plugins)
+		plugins=plugins_new();
+	pa_attr.u.str=path;
+	od_attr.u.num=ondemand;
+	pl_attr.u.plugins=plugins;
+	plugin_new(&pl_attr,attrs);
+	plugins_added=1;
+}
+
+static struct map *
+add_map(struct mapset *ms, char *arg)
+{
+	char *arg_cp=g_strdup(arg),*attr_name=g_strdup(arg),*attr_value=g_strdup(arg);
+	struct attr *attrs[10],map;
+	int pos=0,i=0;
+
+	while (i < 9 && attr_from_line(arg_cp, NULL, &pos, attr_value, attr_name)) {
+		attrs[i]=attr_new_from_text(attr_name,attr_value);
+		if (attrs[i])
+			i++;
+		else
+			fprintf(stderr,"Failed to convert %s=%s to attribute\n",attr_name,attr_value);
+	}
+	attrs[i]=NULL;
+	map.type=attr_map;
+	map.u.map=map_new(NULL, attrs);
+	if (map.u.map)
+		mapset_add_attr(ms, &map);
+	while (i--)
+		attr_free(attrs[i]);
+	g_free(attr_name);
+	g_free(attr_value);
+	g_free(arg_cp);
+	return map.u.map;
+}
+
+static void
+routebench_xml_start(xml_context *context, const char *name, const char **attribute_names, const char **attribute_values,
+		void *data, GError **error)
+{
+	struct routebench_xml *xml=data;
+	struct attr *parent=xml->stack ? xml->stack->data : &routebench_xml_container;
+	struct attr **attrs,*attr;
+	struct object_func *func;
+	const char *profile_name=NULL;
+	int i,count=0,enabled=1;
+	void *obj;
+
+	if (xml->skip) {
+		xml->skip++;
+		return;
+	}
+	for (i = 0 ; attribute_names[i] ; i++) {
+		if (!strcmp(attribute_names[i],"enabled") && !strcmp(attribute_values[i],"no"))
+			enabled=0;
+	}
+	if (!enabled) {
+		xml->skip++;
+		return;
+	}
+	if (!strcmp(name,"config") || !strcmp(name,"navit")) {
+		if (parent == &routebench_xml_container) {
+			xml->stack=g_list_prepend(xml->stack, &routebench_xml_container);
+			return;
+		}
+	}
+	if (parent == &routebench_xml_container) {
+		/* Only the requested vehicle profiles, the plugins they may need and the mapset are read from the top level */
+		for (i = 0 ; attribute_names[i] ; i++) {
+			if (!strcmp(attribute_names[i],"name"))
+				profile_name=attribute_values[i];
+		}
+		if (!(!strcmp(name,"plugins") && !plugins) &&
+		    !(!strcmp(name,"vehicleprofile") && profile_name && !g_hash_table_lookup(xml->profiles, profile_name) &&
+		      g_list_find_custom(xml->profile_names, profile_name, (GCompareFunc)strcmp)) &&
+		    !(!strcmp(name,"mapset") && xml->read_mapset && !xml->mapset)) {
+			xml->skip++;
+			return;
+		}
+	}
+	func=object_func_lookup(attr_from_name(name));
+	if (!func || !func->create) {
+		xml->skip++;
+		return;
+	}
+	while (attribute_names[count])
+		count++;
+	attrs=g_new0(struct attr *, count+1);
+	for (i = 0, count = 0 ; attribute_names[i] ; i++) {
+		if (strcmp(attribute_names[i],"enabled") && (attrs[count]=attr_new_from_text(attribute_names[i], attribute_values[i])))
+			count++;
+	}
+	obj=func->create(parent == &routebench_xml_container ? NULL : parent, attrs);
+	attr_list_free(attrs);
+	if (!obj) {
+		xml->skip++;
+		return;
+	}
+	attr=g_new0(struct attr, 1);
+	attr->type=func->type;
+	attr->u.data=obj;
+	if (parent != &routebench_xml_container) {
+		func=object_func_lookup(parent->type);
+		if (func && func->add_attr)
+			func->add_attr(parent->u.data, attr);
+	}
+	xml->stack=g_list_prepend(xml->stack, attr);
+}
+
+static void
+routebench_xml_end(xml_context *context, const char *name, void *data, GError **error)
+{
+	struct routebench_xml *xml=data;
+	struct attr *attr;
+	struct object_func *func;
+
+	if (xml->skip) {
+		xml->skip--;
+		return;
+	}
+	attr=xml->stack->data;
+	xml->stack=g_list_delete_link(xml->stack, xml->stack);
+	if (attr == &routebench_xml_container)
+		return;
+	func=object_func_lookup(attr->type);
+	if (func && func->init)
+		func->init(attr->u.data);
+	if (attr->type == attr_plugins)
+		plugins=attr->u.plugins;
+	if (attr->type == attr_vehicleprofile) {
+		struct attr name;
+		if (vehicleprofile_get_attr(attr->u.vehicleprofile, attr_name, &name, NULL))
+			g_hash_table_insert(xml->profiles, g_strdup(name.u.str), attr->u.vehicleprofile);
+	}
+	if (attr->type == attr_mapset)
+		xml->mapset=attr->u.mapset;
+	g_free(attr);
+}
+
+static void
+routebench_xml_text(xml_context *context, const char *text, gsize len, void *data, GError **error)
+{
+}
+
+/**
+ * @brief Reads vehicle profiles and optionally a mapset from a configuration file
+ *
+ * The plugins of the file are loaded as well unless plugins have been given on the command line.
+ * Everything else is ignored, so a regular navit.xml can be used. Maps which are included from
+ * other files are not read.
+ *
+ * @param file The configuration file
+ * @param names Names of the vehicle profiles to read
+ * @param ms If not NULL, receives the first enabled mapset, or NULL if there is none
+ * @return The vehicle profiles which were found, by name, or NULL if the file could not be read
+ */
+static GHashTable *
+routebench_read_config(char *file, GList *names, struct mapset **ms)
+{
+	struct routebench_xml xml;
+	struct file *f;
+	unsigned char *data;
+	char *contents;
+
+	if (!(f=file_create(file, NULL)) || !(data=file_data_read_all(f))) {
+		fprintf(stderr,"Failed to read %s\n",file);
+		if (f)
+			file_destroy(f);
+		return NULL;
+	}
+	contents=g_strndup((char *)data, file_size(f));
+	file_data_free(f, data);
+	file_destroy(f);
+	memset(&xml, 0, sizeof(xml));
+	xml.profile_names=names;
+	xml.profiles=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	xml.read_mapset=ms != NULL;
+	xml_parse_text(contents, &xml, routebench_xml_start, routebench_xml_end, routebench_xml_text);
+	g_list_free(xml.stack);
+	g_free(contents);
+	if (ms)
+		*ms=xml.mapset;
+	return xml.profiles;
+}
+
+static long
+routebench_peak_memory(void)
+{
+#ifndef _WIN32
+	struct rusage usage;
+	if (!getrusage(RUSAGE_SELF, &usage))
+		return usage.ru_maxrss;
+#endif
+	return 0;
+}
+
+/**
+ * @brief Reads every item of a map with its coordinates and attributes and reports the throughput
+ *
+ * @param m The map
+ * @param repeat How often to read the map
+ */
+static void
+routebench_decode(struct map *m, int repeat)
+{
+	struct attr attr,cache_size={attr_tile_cache_size};
+	struct map_selection sel;
+	struct map_rect *mr;
+	struct item *item;
+	struct coord c[128];
+	struct timeval start,end;
+	struct stat st;
+	long long items=0,coords=0,size=0;
+	double ms;
+	int i,count;
+
+	if (map_get_attr(m, attr_data, &attr, NULL) && !stat(attr.u.str, &st))
+		size=st.st_size;
+	map_set_attr(m, &cache_size);
+	memset(&sel, 0, sizeof(sel));
+	sel.u.c_rect.lu.x=-0x7fffffff;
+	sel.u.c_rect.lu.y=0x7fffffff;
+	sel.u.c_rect.rl.x=0x7fffffff;
+	sel.u.c_rect.rl.y=-0x7fffffff;
+	sel.order=18;
+	sel.range=item_range_all;
+	gettimeofday(&start, NULL);
+	for (i = 0 ; i < repeat ; i++) {
+		mr=map_rect_new(m, &sel);
+		while ((item=map_rect_get_item(mr))) {
+			items++;
+			while ((count=item_coord_get(item, c, sizeof(c)/sizeof(c[0]))) > 0)
+				coords+=count;
+			while (item_attr_get(item, attr_any, &attr));
+		}
+		map_rect_destroy(mr);
+	}
+	gettimeofday(&end, NULL);
+	ms=((end.tv_sec-start.tv_sec)*1000.0+(end.tv_usec-start.tv_usec)/1000.0)/repeat;
+	printf("%s %lld %lld %lld %.1f %.1f\n", map_get_attr(m, attr_data, &attr, NULL) ? attr.u.str : "-", size/1024,
+		items/repeat, coords/repeat, ms, ms > 0 ? items/repeat/ms : 0);
+}
+
+/** Number of requests per job which may be read ahead of the answers written */
+#define ROUTEBENCH_PENDING 4
+
+/**
+ * @brief Writes the answer to a request of the server mode
+ */
+static void
+routebench_answer(FILE *out, struct routebench_request *req)
+{
+	struct coord_geo g;
+	int i;
+
+	if (req->error || !req->found) {
+		fprintf(out,"%d error %s\n", req->number, req->error ? req->error : "no route");
+		return;
+	}
+	fprintf(out,"%d %d %d", req->number, req->result.path_time, req->result.path_len);
+	for (i = 0 ; i < req->result.count ; i++) {
+		transform_to_geo(req->pos.pro, &req->result.c[i], &g);
+		fprintf(out," %.6f,%.6f", g.lng, g.lat);
+	}
+	fprintf(out,"\n");
+}
+
+static void
+routebench_request_free(struct routebench_request *req)
+{
+	g_free(req->result.c);
+	g_free(req);
+}
+
+/**
+ * @brief Parses a request of the server mode
+ *
+ * @param line The line to parse
+ * @param number The number of the request
+ * @param profiles The vehicle profiles, by name
+ * @param profile The vehicle profile to use if the request does not name one
+ * @return The request, with {@code error} set if it could not be parsed
+ */
+static struct routebench_request *
+routebench_request_new(char *line, int number, GHashTable *profiles, struct vehicleprofile *profile)
+{
+	struct routebench_request *req=g_new0(struct routebench_request, 1);
+	char *p=line,*name;
+	int len;
+
+	req->number=number;
+	req->profile=profile;
+	if (!(len=pcoord_parse(p, projection_mg, &req->pos))) {
+		req->error="invalid origin";
+		return req;
+	}
+	p+=len;
+	p+=strspn(p, " \t");
+	if (!(len=pcoord_parse(p, projection_mg, &req->dst))) {
+		req->error="invalid destination";
+		return req;
+	}
+	p+=len;
+	name=p+strspn(p, " \t");
+	name[strcspn(name, " \t\r\n")]='\0';
+	if (*name && !(req->profile=g_hash_table_lookup(profiles, name)))
+		req->error="unknown vehicle profile";
+	return req;
+}
+
+#ifdef HAVE_PTHREAD
+/**
+ * @brief Calculates the routes of queued requests until the server quits
+ */
+static void *
+routebench_worker_main(void *data)
+{
+	struct routebench_worker *w=data;
+	struct routebench_server *server=w->server;
+	struct routebench_request *req;
+
+	for (;;) {
+		pthread_mutex_lock(&server->mutex);
+		while (!server->queue && !server->quit)
+			pthread_cond_wait(&server->cond, &server->mutex);
+		if (!server->queue) {
+			pthread_mutex_unlock(&server->mutex);
+			return NULL;
+		}
+		req=server->queue->data;
+		server->queue=g_list_delete_link(server->queue, server->queue);
+		pthread_mutex_unlock(&server->mutex);
+		req->found=route_calculate(w->ms, req->profile, &req->pos, &req->dst, &req->result);
+		pthread_mutex_lock(&server->mutex);
+		req->done=1;
+		pthread_cond_broadcast(&server->cond);
+		pthread_mutex_unlock(&server->mutex);
+	}
+}
+
+/**
+ * @brief Writes the answers in the order of the requests until all requests of a session are answered
+ */
+static void *
+routebench_writer_main(void *data)
+{
+	struct routebench_server *server=data;
+	struct routebench_request *req;
+
+	for (;;) {
+		pthread_mutex_lock(&server->mutex);
+		while (server->pending ? !((struct routebench_request *)server->pending->data)->done : !server->eof)
+			pthread_cond_wait(&server->cond, &server->mutex);
+		if (!server->pending) {
+			pthread_mutex_unlock(&server->mutex);
+			return NULL;
+		}
+		req=server->pending->data;
+		server->pending=g_list_delete_link(server->pending, server->pending);
+		server->pending_count--;
+		pthread_cond_broadcast(&server->cond);
+		pthread_mutex_unlock(&server->mutex);
+		routebench_answer(server->out, req);
+		fflush(server->out);
+		routebench_request_free(req);
+	}
+}
+
+/**
+ * @brief Opens the maps of a mapset once more for a worker
+ *
+ * Map instances must not be read from several threads at once, so unlike mapset_dup(), which shares
+ * the maps, each map is opened again, see map_dup(). The maps keep their tile caches, since a worker
+ * reads the same area for many requests.
+ *
+ * @param ms The mapset
+ * @return The new mapset
+ */
+static struct mapset *
+routebench_worker_mapset(struct mapset *ms)
+{
+	struct mapset *ret=mapset_new(NULL, NULL);
+	struct mapset_handle *h=mapset_open(ms);
+	struct attr map;
+	struct map *m;
+
+	map.type=attr_map;
+	while ((m=mapset_next(h, 0))) {
+		map.u.map=map_dup(m, NULL);
+		if (!map.u.map) {
+			fprintf(stderr,"Failed to open map again for a worker, only maps read from files are supported\n");
+			exit(1);
+		}
+		mapset_add_attr(ret, &map);
+		navit_object_unref((struct navit_object *)map.u.map);
+	}
+	mapset_close(h);
+	return ret;
+}
+#endif
+
+/**
+ * @brief Starts the workers of the server mode
+ *
+ * @param ms The mapset, each worker opens its maps once more, see routebench_worker_mapset()
+ * @param jobs Number of workers
+ * @return The server
+ */
+static struct routebench_server *
+routebench_server_new(struct mapset *ms, int jobs)
+{
+	struct routebench_server *server=g_new0(struct routebench_server, 1);
+
+	server->ms=ms;
+#ifdef HAVE_PTHREAD
+	int i;
+
+	pthread_mutex_init(&server->mutex, NULL);
+	pthread_cond_init(&server->cond, NULL);
+	server->jobs=jobs;
+	server->worker=g_new0(struct routebench_worker, jobs);
+	for (i = 0 ; i < jobs ; i++) {
+		server->worker[i].server=server;
+		server->worker[i].ms=routebench_worker_mapset(ms);
+		if (pthread_create(&server->worker[i].thread, NULL, routebench_worker_main, &server->worker[i])) {
+			fprintf(stderr,"Failed to start worker\n");
+			exit(1);
+		}
+	}
+#endif
+	return server;
+}
+
+/**
+ * @brief Stops the workers of the server mode
+ */
+static void
+routebench_server_destroy(struct routebench_server *server)
+{
+#ifdef HAVE_PTHREAD
+	int i;
+
+	pthread_mutex_lock(&server->mutex);
+	server->quit=1;
+	pthread_cond_broadcast(&server->cond);
+	pthread_mutex_unlock(&server->mutex);
+	for (i = 0 ; i < server->jobs ; i++) {
+		pthread_join(server->worker[i].thread, NULL);
+		mapset_destroy(server->worker[i].ms);
+	}
+	g_free(server->worker);
+	pthread_mutex_destroy(&server->mutex);
+	pthread_cond_destroy(&server->cond);
+#endif
+	g_free(server);
+}
+
+/**
+ * @brief Answers the route requests read from a stream
+ *
+ * Requests are read ahead of the answers by at most {@code ROUTEBENCH_PENDING} per job, so a
+ * client may wait for each answer before sending the next request.
+ *
+ * @param server The server
+ * @param in The stream to read the requests from
+ * @param out The stream to write the answers to
+ * @param profiles The vehicle profiles, by name
+ * @param profile The vehicle profile to use for requests which do not name one
+ * @return Number of requests which could not be parsed
+ */
+static int
+routebench_serve(struct routebench_server *server, FILE *in, FILE *out, GHashTable *profiles, struct vehicleprofile *profile)
+{
+	struct routebench_request *req;
+	char line[1024],*p;
+	int number=0,failed=0;
+#ifdef HAVE_PTHREAD
+	pthread_t writer;
+
+	server->out=out;
+	server->eof=0;
+	if (pthread_create(&writer, NULL, routebench_writer_main, server)) {
+		fprintf(stderr,"Failed to start writer\n");
+		exit(1);
+	}
+#endif
+	while (fgets(line, sizeof(line), in)) {
+		p=line+strspn(line, " \t");
+		if (*p == '#' || *p == '\n' || *p == '\r' || !*p)
+			continue;
+		req=routebench_request_new(p, ++number, profiles, profile);
+		if (req->error)
+			failed++;
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&server->mutex);
+		while (server->pending_count >= server->jobs*ROUTEBENCH_PENDING)
+			pthread_cond_wait(&server->cond, &server->mutex);
+		server->pending=g_list_append(server->pending, req);
+		server->pending_count++;
+		if (req->error)
+			req->done=1;
+		else
+			server->queue=g_list_append(server->queue, req);
+		pthread_cond_broadcast(&server->cond);
+		pthread_mutex_unlock(&server->mutex);
+#else
+		if (!req->error)
+			req->found=route_calculate(server->ms, req->profile, &req->pos, &req->dst, &req->result);
+		routebench_answer(out, req);
+		fflush(out);
+		routebench_request_free(req);
+#endif
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&server->mutex);
+	server->eof=1;
+	pthread_cond_broadcast(&server->cond);
+	pthread_mutex_unlock(&server->mutex);
+	pthread_join(writer, NULL);
+#endif
+	return failed;
+}
+
+#ifndef _WIN32
+/**
+ * @brief Answers the route requests of the connections to a local socket, one connection after the other
+ *
+ * @param server The server
+ * @param path The path of the socket
+ * @param profiles The vehicle profiles, by name
+ * @param profile The vehicle profile to use for requests which do not name one
+ * @return False if the socket could not be created
+ */
+static int
+routebench_listen(struct routebench_server *server, char *path, GHashTable *profiles, struct vehicleprofile *profile)
+{
+	struct sockaddr_un addr;
+	FILE *in,*out;
+	int fd,conn;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr,"Socket path %s too long\n",path);
+		return 0;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	strcpy(addr.sun_path, path);
+	unlink(path);
+	if ((fd=socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 8)) {
+		perror(path);
+		if (fd >= 0)
+			close(fd);
+		return 0;
+	}
+	/* a client closing its connection early must not end the server */
+	signal(SIGPIPE, SIG_IGN);
+	while ((conn=accept(fd, NULL, NULL)) >= 0) {
+		in=fdopen(conn, "r");
+		out=fdopen(dup(conn), "w");
+		if (in && out)
+			routebench_serve(server, in, out, profiles, profile);
+		if (in)
+			fclose(in);
+		if (out)
+			fclose(out);
+	}
+	close(fd);
+	return 1;
+}
+#endif
+
+int
+main(int argc, char **argv)
+{
+	char *config_file=NULL,*query_file=NULL,*listen_path=NULL;
+	int threads=1,repeat=1,heap=-1,search_mode=-1,serve=0,decode=0,jobs=0;
+	int c,i,len,option_index=0,queries=0,failed=0;
+	struct vehicleprofile *profile;
+	struct mapset *ms=NULL;
+	struct routebench_server *server;
+	GHashTable *profiles;
+	GList *profile_names=NULL;
+	struct pcoord pos,dst;
+	struct route_benchmark result,total;
+	struct attr attr;
+	GList *maps=NULL,*decode_maps=NULL,*l;
+	char line[1024],*p;
+	FILE *f=stdin;
+
+	static struct option long_options[] = {
+		{"config", 1, 0, 'c'},
+		{"debug-level", 1, 0, 'd'},
+		{"decode", 0, 0, 'D'},
+		{"help", 0, 0, 'h'},
+		{"heap", 1, 0, 'H'},
+		{"jobs", 1, 0, 'j'},
+		{"listen", 1, 0, 'l'},
+		{"map", 1, 0, 'm'},
+		{"plugin", 1, 0, 'p'},
+		{"repeat", 1, 0, 'r'},
+		{"search-mode", 1, 0, 's'},
+		{"serve", 0, 0, 'S'},
+		{"threads", 1, 0, 't'},
+		{"vehicleprofile", 1, 0, 'v'},
+		{0, 0, 0, 0}
+	};
+
+#ifdef HAVE_GLIB
+	event_glib_init();
+#else
+	_g_slice_thread_init_nomessage();
+#endif
+	atom_init();
+	main_init(argv[0]);
+	debug_init(argv[0]);
+	file_init();
+#ifndef USE_PLUGINS
+	builtin_init();
+#endif
+	route_init();
+
+	while ((c = getopt_long(argc, argv, "c:d:DhH:j:l:m:p:r:s:St:v:", long_options, &option_index)) != -1) {
+		switch (c) {
+		case 'c':
+			config_file=optarg;
+			break;
+		case 'd':
+			debug_set_global_level(atoi(optarg), 1);
+			break;
+		case 'D':
+			decode=1;
+			break;
+		case 'h':
+			usage(stdout);
+			exit(0);
+		case 'H':
+			heap=atoi(optarg);
+			break;
+		case 'j':
+			jobs=atoi(optarg);
+			break;
+		case 'l':
+			listen_path=optarg;
+			break;
+		case 'm':
+			maps=g_list_append(maps, optarg);
+			break;
+		case 'p':
+			add_plugin(optarg, 0);
+			break;
+		case 'r':
+			repeat=atoi(optarg);
+			break;
+		case 's':
+			search_mode=atoi(optarg);
+			break;
+		case 'S':
+			serve=1;
+			break;
+		case 't':
+			threads=atoi(optarg);
+			break;
+		case 'v':
+			profile_names=g_list_append(profile_names, optarg);
+			break;
+		default:
+			usage(stderr);
+			exit(1);
+		}
+	}
+	if (optind < argc)
+		query_file=argv[optind];
+	if (!config_file || (!maps && !serve)) {
+		usage(stderr);
+		exit(1);
+	}
+	if (!profile_names)
+		profile_names=g_list_append(profile_names, "car");
+	if (!(profiles=routebench_read_config(config_file, profile_names, maps ? NULL : &ms)))
+		exit(1);
+	for (l = profile_names ; l ; l = g_list_next(l)) {
+		if (!g_hash_table_lookup(profiles, l->data)) {
+			fprintf(stderr,"Vehicle profile %s not found in %s\n",(char *)l->data,config_file);
+			exit(1);
+		}
+	}
+	profile=g_hash_table_lookup(profiles, profile_names->data);
+	if (!maps && !ms) {
+		fprintf(stderr,"No enabled mapset found in %s\n",config_file);
+		exit(1);
+	}
+#ifdef USE_PLUGINS
+	if (!plugins)
+		add_plugin("$NAVIT_LIBDIR/*/${NAVIT_LIBPREFIX}lib*.so", 1);
+	/* Plugins read from the configuration file have been initialized already */
+	if (plugins_added)
+		plugins_init(plugins);
+#endif
+	for (l = profile_names ; l ; l = g_list_next(l)) {
+		struct vehicleprofile *p=g_hash_table_lookup(profiles, l->data);
+		if (heap != -1) {
+			attr.type=attr_route_heap;
+			attr.u.num=heap;
+			vehicleprofile_set_attr(p, &attr);
+		}
+		if (search_mode != -1) {
+			attr.type=attr_route_search_mode;
+			attr.u.num=search_mode;
+			vehicleprofile_set_attr(p, &attr);
+		}
+	}
+	if (maps)
+		ms=mapset_new(NULL, NULL);
+	for (l = maps ; l ; l = g_list_next(l)) {
+		struct map *m=add_map(ms, l->data);
+		if (!m) {
+			fprintf(stderr,"Failed to create map from %s\n",(char *)l->data);
+			exit(1);
+		}
+		decode_maps=g_list_append(decode_maps, m);
+	}
+	g_list_free(maps);
+
+	if (decode) {
+		printf("# map size_kB items coords ms_per_pass items_per_ms\n");
+		for (l = decode_maps ; l ; l = g_list_next(l))
+			routebench_decode(l->data, repeat);
+		g_list_free(decode_maps);
+		return 0;
+	}
+	g_list_free(decode_maps);
+	if (query_file && !(f=fopen(query_file, "r"))) {
+		fprintf(stderr,"Failed to open %s\n",query_file);
+		exit(1);
+	}
+
+	if (serve) {
+#ifndef _WIN32
+		if (jobs <= 0)
+			jobs=sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+		if (jobs <= 0)
+			jobs=1;
+		server=routebench_server_new(ms, jobs);
+		if (listen_path) {
+#ifndef _WIN32
+			if (!routebench_listen(server, listen_path, profiles, profile))
+				failed++;
+#else
+			fprintf(stderr,"Local sockets are not supported\n");
+			failed++;
+#endif
+		} else
+			failed=routebench_serve(server, f, stdout, profiles, profile);
+		routebench_server_destroy(server);
+		if (f != stdin)
+			fclose(f);
+		return failed ? 2 : 0;
+	}
+
+	memset(&total, 0, sizeof(total));
+	printf("# query build_ms flood_ms path_ms points segments settled path_time path_len\n");
+	while (fgets(line, sizeof(line), f)) {
+		p=line+strspn(line, " \t");
+		if (*p == '#' || *p == '\n' || *p == '\r' || !*p)
+			continue;
+		if (!(len=pcoord_parse(p, projection_mg, &pos)) || !pcoord_parse(p+len+strspn(p+len, " \t"), projection_mg, &dst)) {
+			fprintf(stderr,"Failed to parse query %s",p);
+			continue;
+		}
+		queries++;
+		for (i = 0 ; i < repeat ; i++) {
+			if (!route_benchmark(ms, profile, &pos, &dst, threads, &result))
+				failed++;
+			printf("%d %.1f %.1f %.1f %d %d %d %d %d\n", queries, result.build_ms, result.flood_ms, result.path_ms,
+				result.points, result.segments, result.settled, result.path_time, result.path_len);
+			total.build_ms+=result.build_ms;
+			total.flood_ms+=result.flood_ms;
+			total.path_ms+=result.path_ms;
+		}
+	}
+	if (f != stdin)
+		fclose(f);
+	printf("# %d queries, %d runs, %d without route\n", queries, queries*repeat, failed);
+	if (queries) {
+		printf("# average build %.1f ms, flood %.1f ms, path %.1f ms\n", total.build_ms/(queries*repeat),
+			total.flood_ms/(queries*repeat), total.path_ms/(queries*repeat));
+	}
+	printf("# peak memory %ld kB\n", routebench_peak_memory());
+	return failed ? 2 : 0;
+}
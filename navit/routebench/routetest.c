@@ -0,0 +1,246 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Self tests of the routing helpers which need neither maps nor a configuration
+ *
+ * Run by ctest. Each test prints what it checked and the program exits with a non-zero status
+ * if any of them failed.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "coord.h"
+#include "transform.h"
+#include "item.h"
+#include "attr.h"
+#include "map.h"
+#include "route.h"
+#include "routeorder.h"
+
+static int failed;
+
+static void
+check(int ok, char *what)
+{
+	printf("%s: %s\n", ok ? "ok" : "FAILED", what);
+	if (!ok)
+		failed++;
+}
+
+/**
+ * @brief Returns a pseudo random number, the same sequence on every platform
+ */
+static int
+routetest_rand(unsigned int *state)
+{
+	*state=*state*1103515245+12345;
+	return (*state >> 16) & 0x7fff;
+}
+
+/**
+ * @brief Checks that a simplified polyline keeps both ends and stays within the tolerance
+ *
+ * The x coordinates of {@code in} have to increase, so each point of {@code out} can be matched
+ * to the point of {@code in} it was taken from.
+ */
+static int
+routetest_simplified(struct coord *in, int count, struct coord *out, int out_count, navit_float dist_sq)
+{
+	int i,j=0;
+
+	if (out_count < 2 || out_count > count)
+		return 0;
+	if (out[0].x != in[0].x || out[0].y != in[0].y || out[out_count-1].x != in[count-1].x || out[out_count-1].y != in[count-1].y)
+		return 0;
+	for (i = 0 ; i < count ; i++) {
+		if (in[i].x == out[j].x && in[i].y == out[j].y) {
+			if (++j == out_count)
+				return i == count-1;
+			continue;
+		}
+		if (!j || transform_distance_line_sq_float(&out[j-1], &out[j], &in[i], NULL) > dist_sq)
+			return 0;
+	}
+	return 0;
+}
+
+static void
+routetest_douglas_peucker(void)
+{
+	int i,count=1000000,out_count;
+	struct coord *in=g_new(struct coord, count),*out=g_new(struct coord, count);
+	unsigned int state=1;
+
+	/* A straight line across the whole map, far beyond the range of the integer distances.
+	 * Each point used to recurse one level deeper. */
+	for (i = 0 ; i < count ; i++) {
+		in[i].x=-20000000+i*40;
+		in[i].y=-10000000+i*20;
+	}
+	out_count=transform_douglas_peucker_float(in, count, 4, out);
+	check(out_count == 2 && routetest_simplified(in, count, out, out_count, 4), "long straight line collapses to its ends");
+
+	/* A winding road of 2000 km */
+	count=200000;
+	in[0].x=0;
+	in[0].y=0;
+	for (i = 1 ; i < count ; i++) {
+		in[i].x=in[i-1].x+1+routetest_rand(&state)%20;
+		in[i].y=in[i-1].y+routetest_rand(&state)%2001-1000;
+	}
+	out_count=transform_douglas_peucker_float(in, count, 1024.0*1024, out);
+	check(out_count > 2 && out_count < count/4 && routetest_simplified(in, count, out, out_count, 1024.0*1024),
+		"long winding polyline stays within the tolerance");
+	out_count=transform_douglas_peucker_float(in, count, 0, out);
+	check(out_count > count/2 && routetest_simplified(in, count, out, out_count, 0), "zero tolerance only drops points on the line");
+
+	/* The integer variant on a short track, as the vehicle log uses it */
+	count=1000;
+	for (i = 0 ; i < count ; i++) {
+		in[i].x=i*10;
+		in[i].y=(i%2)*100;
+	}
+	out_count=transform_douglas_peucker(in, count, 200*200, out);
+	check(out_count == 2 && out[0].x == in[0].x && out[1].x == in[count-1].x, "integer variant drops a small zigzag");
+	out_count=transform_douglas_peucker(in, count, 10*10, out);
+	check(out_count == count, "integer variant keeps a large zigzag");
+	g_free(in);
+	g_free(out);
+}
+
+/**
+ * @brief Returns the cost of visiting the stops in the given order
+ */
+static long long
+routetest_order_cost(int *costs, int count, int *order)
+{
+	long long ret=0;
+	int i;
+	for (i = 0 ; i < count-1 ; i++)
+		ret+=costs[order[i]*count+order[i+1]];
+	return ret;
+}
+
+/**
+ * @brief Finds the lowest cost of all orders of the stops between the first and the last one
+ *
+ * @param order The stops, those from {@code pos} to the second last one are permuted in place
+ */
+static long long
+routetest_order_brute_force(int *costs, int count, int *order, int pos)
+{
+	long long cost,ret;
+	int i,t;
+
+	if (pos >= count-2)
+		return routetest_order_cost(costs, count, order);
+	ret=routetest_order_brute_force(costs, count, order, pos+1);
+	for (i = pos+1 ; i < count-1 ; i++) {
+		t=order[pos];
+		order[pos]=order[i];
+		order[i]=t;
+		cost=routetest_order_brute_force(costs, count, order, pos+1);
+		if (cost < ret)
+			ret=cost;
+		order[i]=order[pos];
+		order[pos]=t;
+	}
+	return ret;
+}
+
+static void
+routetest_route_order(void)
+{
+	int costs[8*8],order[8],best_order[8],seen[8];
+	int i,trial,count=8,valid=1;
+	long long total=0,best=0;
+	unsigned int state=1;
+
+	/* Random asymmetric costs, as one-way streets make them */
+	for (trial = 0 ; trial < 200 ; trial++) {
+		for (i = 0 ; i < count*count ; i++)
+			costs[i]=routetest_rand(&state)%1000;
+		route_order_optimize(costs, count, order, 100);
+		memset(seen, 0, sizeof(seen));
+		for (i = 0 ; i < count ; i++) {
+			if (order[i] >= 0 && order[i] < count)
+				seen[order[i]]++;
+			best_order[i]=i;
+		}
+		for (i = 0 ; i < count ; i++) {
+			if (seen[i] != 1)
+				valid=0;
+		}
+		if (order[0] != 0 || order[count-1] != count-1)
+			valid=0;
+		total+=routetest_order_cost(costs, count, order);
+		best+=routetest_order_brute_force(costs, count, best_order, 1);
+	}
+	printf("route order: total cost %lld, optimum %lld\n", total, best);
+	check(valid, "optimized orders keep the ends and visit each stop once");
+	check(total*100 <= best*103, "optimized orders are within 3% of the optimum in total");
+
+	/* A leg without a route is avoided if possible */
+	for (i = 0 ; i < count*count ; i++)
+		costs[i]=100;
+	costs[0*count+1]=-1;
+	costs[1*count+2]=-1;
+	route_order_optimize(costs, count, order, 100);
+	for (i = 0 ; i < count-1 ; i++) {
+		if (costs[order[i]*count+order[i+1]] < 0)
+			break;
+	}
+	check(i == count-1, "legs without a route are avoided");
+}
+
+static void
+routetest_tile_selection(void)
+{
+	struct coord c1={0,0},c2={10000,10000};
+	struct map_selection *sel=route_rect(18, &c1, &c2, 25, 0);
+	struct item_range restrictions={type_street_turn_restriction_no,type_street_turn_restriction_only};
+	struct item_range distortions={type_traffic_distortion,type_traffic_distortion};
+	struct item_range streets={type_street_1_city,type_street_1_city};
+	struct item_range polygons={type_poly_wood,type_poly_wood};
+
+	check(map_selection_contains_tile_item_range(sel, 0, &streets, 1), "a route selection reads a tile with streets");
+	check(map_selection_contains_tile_item_range(sel, 0, &restrictions, 1),
+		"a route selection reads a tile holding only turn restrictions");
+	check(map_selection_contains_tile_item_range(sel, 0, &distortions, 1),
+		"a route selection reads a tile holding only traffic distortions");
+	check(!map_selection_contains_tile_item_range(sel, 0, &polygons, 1), "a route selection skips a tile holding only polygons");
+	sel->range.min=sel->range.max=type_poly_wood;
+	check(!map_selection_contains_tile_item_range(sel, 0, &restrictions, 1),
+		"a polygon selection skips a tile holding only turn restrictions");
+	g_free(sel);
+}
+
+int
+main(int argc, char **argv)
+{
+	routetest_douglas_peucker();
+	routetest_route_order();
+	routetest_tile_selection();
+	if (failed)
+		fprintf(stderr,"%d tests failed\n", failed);
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,490 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Query engine for the contraction hierarchy written by maptool
+ *
+ * maptool can preprocess the street graph into a contraction hierarchy (see maptool/ch.c). Every node
+ * of the hierarchy is stored as an item of type {@code type_ch_node} with one coordinate and one
+ * {@code attr_ch_edge} attribute per edge. Edges are stored at the node with the lower rank and point
+ * upwards, so a query is a bidirectional Dijkstra search which only ever follows edges to higher
+ * ranked nodes. Shortcut edges are unpacked recursively into the streets they represent once the
+ * best meeting point of both searches has been found.
+ *
+ * Nodes are decoded lazily from the map, only the nodes actually touched by a query are read.
+ *
+ * The edge weights are fixed when the map is built: maptool uses the speeds of {@code routech_road_speed()}
+ * and the car access and one way flags described at {@code ROUTECH_FLAGS}. The road profiles, maxspeeds,
+ * traffic distortions, turn restrictions and turn costs of the vehicle profile are not part of the hierarchy, so it may
+ * only be queried for profiles which test the street flags the same way.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <limits.h>
+#include "item.h"
+#include "attr.h"
+#include "coord.h"
+#include "map.h"
+#include "debug.h"
+#include "endianess.h"
+#include "fib.h"
+#include "routech.h"
+
+#define CH_EDGE_FORWARD 1	/**< The edge may be used from the holding node to the target */
+#define CH_EDGE_BACKWARD 2	/**< The edge may be used from the target to the holding node */
+#define CH_EDGE_SHORTCUT 4	/**< {@code middle} is a node, not a street */
+#define CH_EDGE_REVERSE 8	/**< The street in {@code middle} runs from the target to the holding node */
+
+/**
+ * @brief An edge as stored in an {@code attr_ch_edge} attribute
+ */
+struct routech_edge {
+	int flags;			/**< Combination of the CH_EDGE_* flags */
+	int weight;			/**< Cost of the edge */
+	struct item_id target;		/**< Node the edge leads to */
+	struct item_id middle;		/**< Node the shortcut is contracted over, or street for ordinary edges */
+};
+
+/**
+ * @brief A decoded node of the hierarchy together with the search state of both directions
+ */
+struct routech_node {
+	struct item_id id;			/**< Id of the {@code type_ch_node} item */
+	struct coord c;				/**< Coordinates of the node */
+	int edge_count;				/**< Number of edges in {@code edges} */
+	struct routech_edge *edges;		/**< Edges to higher ranked nodes */
+	int value[2];				/**< Cost from the start (0) or to the destination (1) */
+	int seed[2];				/**< Index of the seed the search reached the node from, -1 for none */
+	struct routech_node *prev[2];		/**< Previous node in the search tree of each direction */
+	struct routech_edge *prev_edge[2];	/**< Edge used to get from {@code prev} to this node */
+	struct fibheap_el *el[2];		/**< Heap element while the node is queued */
+};
+
+/**
+ * @brief State of one query
+ */
+struct routech {
+	struct map *m;				/**< The map holding the hierarchy */
+	struct map_rect *mr;			/**< Map rect to read the nodes */
+	GHashTable *nodes;			/**< All decoded nodes, keyed by {@code struct item_id} */
+	struct fibheap *heap[2];		/**< Queues of the forward (0) and backward (1) search */
+};
+
+/**
+ * @brief Returns the speed the hierarchy assumes for a street type
+ *
+ * @param type The street type
+ * @return The speed in km/h, or 0 if streets of this type are not part of the hierarchy
+ */
+int
+routech_road_speed(enum item_type type)
+{
+	switch (type) {
+	case type_street_0:
+	case type_street_1_city:
+	case type_living_street:
+	case type_street_service:
+	case type_track_gravelled:
+	case type_track_unpaved:
+		return 10;
+	case type_street_2_city:
+	case type_track_paved:
+		return 30;
+	case type_street_3_city:
+		return 40;
+	case type_street_4_city:
+		return 50;
+	case type_highway_city:
+		return 80;
+	case type_street_1_land:
+		return 60;
+	case type_street_2_land:
+		return 65;
+	case type_street_3_land:
+		return 70;
+	case type_street_4_land:
+		return 80;
+	case type_street_n_lanes:
+		return 120;
+	case type_highway_land:
+		return 120;
+	case type_ramp:
+		return 40;
+	case type_roundabout:
+		return 10;
+	case type_ferry:
+		return 40;
+	default:
+		return 0;
+	}
+}
+
+/**
+ * @brief Returns the cost of a street as the edge weights of the hierarchy measure it
+ *
+ * @param type The street type
+ * @param len The length of the street in meters
+ * @return The time in tenths of seconds, the unit {@code route_time_seg()} uses, or INT_MAX if streets of this
+ * type are not part of the hierarchy
+ */
+int
+routech_street_time(enum item_type type, int len)
+{
+	int speed=routech_road_speed(type);
+	if (!speed)
+		return INT_MAX;
+	return len*36/speed;
+}
+
+static void
+routech_node_free(void *data)
+{
+	struct routech_node *node=data;
+	g_free(node->edges);
+	g_free(node);
+}
+
+/**
+ * @brief Returns a node of the hierarchy, reading it from the map if it has not been used yet
+ *
+ * @param ch The query state
+ * @param id Id of the node item
+ * @return The node, or NULL if there is no such node
+ */
+static struct routech_node *
+routech_node_get(struct routech *ch, struct item_id *id)
+{
+	struct routech_node *ret=g_hash_table_lookup(ch->nodes, id);
+	struct item *item;
+	struct attr attr;
+	GList *edges=NULL,*l;
+	int i;
+
+	if (ret)
+		return ret;
+	item=map_rect_get_item_byid(ch->mr, id->id_hi, id->id_lo);
+	if (!item || item->type != type_ch_node) {
+		dbg(lvl_warning,"node "ITEM_ID_FMT" not found\n",ITEM_ID_ARGS(*id));
+		return NULL;
+	}
+	ret=g_new0(struct routech_node, 1);
+	ret->id=*id;
+	if (!item_coord_get(item, &ret->c, 1)) {
+		g_free(ret);
+		return NULL;
+	}
+	while (item_attr_get(item, attr_ch_edge, &attr))
+		edges=g_list_prepend(edges, attr.u.data);
+	ret->edge_count=g_list_length(edges);
+	ret->edges=g_new(struct routech_edge, ret->edge_count);
+	for (l=edges, i=ret->edge_count-1 ; l ; l=g_list_next(l), i--) {
+		struct routech_edge *e=&ret->edges[i];
+		memcpy(e, l->data, sizeof(*e));
+		e->flags=le32_to_cpu(e->flags);
+		e->weight=le32_to_cpu(e->weight);
+		e->target.id_hi=le32_to_cpu(e->target.id_hi);
+		e->target.id_lo=le32_to_cpu(e->target.id_lo);
+		e->middle.id_hi=le32_to_cpu(e->middle.id_hi);
+		e->middle.id_lo=le32_to_cpu(e->middle.id_lo);
+	}
+	g_list_free(edges);
+	for (i = 0 ; i < 2 ; i++) {
+		ret->value[i]=INT_MAX;
+		ret->seed[i]=-1;
+	}
+	g_hash_table_insert(ch->nodes, &ret->id, ret);
+	return ret;
+}
+
+/**
+ * @brief Finds the node of the hierarchy at a coordinate
+ *
+ * @param ch The query state
+ * @param c The coordinate, which has to match the node exactly
+ * @return The node, or NULL if there is no node at {@code c}
+ */
+static struct routech_node *
+routech_node_at(struct routech *ch, struct coord *c)
+{
+	struct map_selection sel;
+	struct map_rect *mr;
+	struct item *item;
+	struct coord nc;
+	struct item_id id;
+	int found=0;
+
+	memset(&sel, 0, sizeof(sel));
+	sel.u.c_rect.lu.x=c->x-1;
+	sel.u.c_rect.lu.y=c->y+1;
+	sel.u.c_rect.rl.x=c->x+1;
+	sel.u.c_rect.rl.y=c->y-1;
+	sel.order=18;
+	sel.range.min=type_ch_node;
+	sel.range.max=type_ch_node;
+	mr=map_rect_new(ch->m, &sel);
+	if (!mr)
+		return NULL;
+	while (!found && (item=map_rect_get_item(mr))) {
+		if (item->type != type_ch_node)
+			continue;
+		if (item_coord_get(item, &nc, 1) && nc.x == c->x && nc.y == c->y) {
+			id.id_hi=item->id_hi;
+			id.id_lo=item->id_lo;
+			found=1;
+		}
+	}
+	map_rect_destroy(mr);
+	if (!found)
+		return NULL;
+	return routech_node_get(ch, &id);
+}
+
+/**
+ * @brief Lowers the cost of a node in one search direction, queueing it if necessary
+ */
+static void
+routech_relax(struct routech *ch, int dir, struct routech_node *node, int value, int seed, struct routech_node *prev, struct routech_edge *edge)
+{
+	if (value >= node->value[dir])
+		return;
+	node->value[dir]=value;
+	node->seed[dir]=seed;
+	node->prev[dir]=prev;
+	node->prev_edge[dir]=edge;
+	if (node->el[dir])
+		fh_replacekey(ch->heap[dir], node->el[dir], value);
+	else
+		node->el[dir]=fh_insertkey(ch->heap[dir], value, node);
+}
+
+/**
+ * @brief Finds the cheapest edge which allows to travel from one node directly to another
+ *
+ * @param ch The query state
+ * @param from The node to start at
+ * @param to The node to arrive at
+ * @param holder Returns the node which stores the edge
+ * @return The edge, or NULL if there is none
+ */
+static struct routech_edge *
+routech_find_edge(struct routech *ch, struct routech_node *from, struct routech_node *to, struct routech_node **holder)
+{
+	struct routech_edge *ret=NULL;
+	int i;
+	for (i = 0 ; i < from->edge_count ; i++) {
+		struct routech_edge *e=&from->edges[i];
+		if ((e->flags & CH_EDGE_FORWARD) && item_id_equal(&e->target, &to->id) && (!ret || e->weight < ret->weight)) {
+			ret=e;
+			*holder=from;
+		}
+	}
+	for (i = 0 ; i < to->edge_count ; i++) {
+		struct routech_edge *e=&to->edges[i];
+		if ((e->flags & CH_EDGE_BACKWARD) && item_id_equal(&e->target, &from->id) && (!ret || e->weight < ret->weight)) {
+			ret=e;
+			*holder=to;
+		}
+	}
+	return ret;
+}
+
+/**
+ * @brief Unpacks an edge into the streets it represents
+ *
+ * @param ch The query state
+ * @param from The node the edge is traveled from
+ * @param to The node the edge is traveled to
+ * @param holder The node which stores the edge, either {@code from} or {@code to}
+ * @param edge The edge
+ * @param streets List to prepend the streets to, the result is in reverse driving order
+ * @return True on success, false if the hierarchy is inconsistent
+ */
+static int
+routech_unpack(struct routech *ch, struct routech_node *from, struct routech_node *to, struct routech_node *holder, struct routech_edge *edge, GList **streets)
+{
+	if (edge->flags & CH_EDGE_SHORTCUT) {
+		struct routech_node *middle=routech_node_get(ch, &edge->middle);
+		struct routech_node *h1,*h2;
+		struct routech_edge *e1,*e2;
+		if (!middle)
+			return 0;
+		e1=routech_find_edge(ch, from, middle, &h1);
+		e2=routech_find_edge(ch, middle, to, &h2);
+		if (!e1 || !e2) {
+			dbg(lvl_error,"shortcut over "ITEM_ID_FMT" can not be unpacked\n",ITEM_ID_ARGS(edge->middle));
+			return 0;
+		}
+		return routech_unpack(ch, from, middle, h1, e1, streets) && routech_unpack(ch, middle, to, h2, e2, streets);
+	} else {
+		struct routech_street *street=g_new(struct routech_street, 1);
+		street->id=edge->middle;
+		street->dir=(holder == from) ? 1 : -1;
+		if (edge->flags & CH_EDGE_REVERSE)
+			street->dir=-street->dir;
+		*streets=g_list_prepend(*streets, street);
+		return 1;
+	}
+}
+
+/**
+ * @brief Builds the list of streets from the start seed over {@code meet} to the destination seed
+ *
+ * @param ch The query state
+ * @param meet The node where both searches met
+ * @param ok Set to false if the hierarchy is inconsistent
+ * @return The list of streets in driving order
+ */
+static GList *
+routech_unpack_path(struct routech *ch, struct routech_node *meet, int *ok)
+{
+	GList *hops=NULL,*streets=NULL,*l;
+	struct routech_node *node;
+
+	*ok=1;
+	for (node=meet ; node->prev[0] ; node=node->prev[0])
+		hops=g_list_prepend(hops, node);
+	for (l=hops ; l && *ok ; l=g_list_next(l)) {
+		node=l->data;
+		*ok=routech_unpack(ch, node->prev[0], node, node->prev[0], node->prev_edge[0], &streets);
+	}
+	g_list_free(hops);
+	for (node=meet ; *ok && node->prev[1] ; node=node->prev[1])
+		*ok=routech_unpack(ch, node, node->prev[1], node->prev[1], node->prev_edge[1], &streets);
+	return g_list_reverse(streets);
+}
+
+static void
+routech_free_streets(GList *streets)
+{
+	GList *l;
+	for (l=streets ; l ; l=g_list_next(l))
+		g_free(l->data);
+	g_list_free(streets);
+}
+
+/**
+ * @brief Computes the cheapest path between a set of start and a set of end nodes
+ *
+ * The nodes are given by their coordinates, which have to match the coordinates of nodes of the
+ * hierarchy. The costs of the seeds are added to the path cost, so the seeds can be used to model
+ * the partial streets between the actual position and the nodes.
+ *
+ * @param m The map containing the hierarchy
+ * @param src The start nodes
+ * @param src_count Number of start nodes
+ * @param dst The end nodes
+ * @param dst_count Number of end nodes
+ * @return The path, or NULL if the map has no hierarchy for the seeds or no path exists. Free with
+ * {@code routech_path_destroy()}.
+ */
+struct routech_path *
+routech_query(struct map *m, struct routech_seed *src, int src_count, struct routech_seed *dst, int dst_count)
+{
+	struct routech ch;
+	struct routech_path *ret=NULL;
+	struct routech_node *node,*meet=NULL;
+	struct routech_seed *seeds[2]={src,dst};
+	int counts[2]={src_count,dst_count};
+	int best=INT_MAX,found[2]={0,0};
+	int dir,i,ok,key[2];
+
+	ch.m=m;
+	ch.mr=map_rect_new(m, NULL);
+	if (!ch.mr)
+		return NULL;
+	ch.nodes=g_hash_table_new_full(item_id_hash, item_id_equal, NULL, routech_node_free);
+	ch.heap[0]=fh_makekeyheap();
+	ch.heap[1]=fh_makekeyheap();
+	for (dir = 0 ; dir < 2 ; dir++) {
+		for (i = 0 ; i < counts[dir] ; i++) {
+			node=routech_node_at(&ch, &seeds[dir][i].c);
+			if (node) {
+				routech_relax(&ch, dir, node, seeds[dir][i].cost, i, NULL, NULL);
+				found[dir]++;
+			}
+		}
+	}
+	if (!found[0] || !found[1]) {
+		dbg(lvl_debug,"no hierarchy nodes at the seeds (%d,%d)\n",found[0],found[1]);
+		goto out;
+	}
+	for (;;) {
+		for (dir = 0 ; dir < 2 ; dir++) {
+			key[dir]=fh_minkey(ch.heap[dir]);
+			if (key[dir] == INT_MIN || key[dir] >= best)
+				key[dir]=INT_MAX;
+		}
+		if (key[0] == INT_MAX && key[1] == INT_MAX)
+			break;
+		dir=key[0] <= key[1] ? 0 : 1;
+		node=fh_extractmin(ch.heap[dir]);
+		node->el[dir]=NULL;
+		if (node->value[!dir] != INT_MAX && node->value[0]+node->value[1] < best) {
+			best=node->value[0]+node->value[1];
+			meet=node;
+		}
+		for (i = 0 ; i < node->edge_count ; i++) {
+			struct routech_edge *e=&node->edges[i];
+			struct routech_node *target;
+			if (!(e->flags & (dir ? CH_EDGE_BACKWARD : CH_EDGE_FORWARD)))
+				continue;
+			target=routech_node_get(&ch, &e->target);
+			if (target)
+				routech_relax(&ch, dir, target, node->value[dir]+e->weight, node->seed[dir], node, e);
+		}
+	}
+	if (!meet) {
+		dbg(lvl_debug,"no path found\n");
+		goto out;
+	}
+	ret=g_new0(struct routech_path, 1);
+	ret->cost=best;
+	for (node=meet ; node->prev[0] ; node=node->prev[0]);
+	ret->src=node->seed[0];
+	for (node=meet ; node->prev[1] ; node=node->prev[1]);
+	ret->dst=node->seed[1];
+	ret->streets=routech_unpack_path(&ch, meet, &ok);
+	if (!ok) {
+		routech_free_streets(ret->streets);
+		g_free(ret);
+		ret=NULL;
+	}
+out:
+	fh_deleteheap(ch.heap[0]);
+	fh_deleteheap(ch.heap[1]);
+	g_hash_table_destroy(ch.nodes);
+	map_rect_destroy(ch.mr);
+	return ret;
+}
+
+/**
+ * @brief Frees a path returned by {@code routech_query()}
+ *
+ * @param path The path to free
+ */
+void
+routech_path_destroy(struct routech_path *path)
+{
+	if (!path)
+		return;
+	routech_free_streets(path->streets);
+	g_free(path);
+}
@@ -0,0 +1,82 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Contains exported code for routech.c, the contraction hierarchy query engine
+ */
+
+#ifndef NAVIT_ROUTECH_H
+#define NAVIT_ROUTECH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Flags a street needs to be part of the hierarchy, see {@code struct vehicleprofile}
+ *
+ * maptool builds the hierarchy for cars only. Streets are entered in a direction if their flags masked with
+ * {@code ROUTECH_FLAGS_FORWARD_MASK} or {@code ROUTECH_FLAGS_REVERSE_MASK} equal {@code ROUTECH_FLAGS}, which
+ * is how the vehicle profile of a car tests them.
+ */
+#define ROUTECH_FLAGS AF_CAR
+#define ROUTECH_FLAGS_FORWARD_MASK (AF_CAR|AF_HIGH_OCCUPANCY_CAR_ONLY|AF_ONEWAYREV)	/**< Mask for driving in the order of the coordinates */
+#define ROUTECH_FLAGS_REVERSE_MASK (AF_CAR|AF_HIGH_OCCUPANCY_CAR_ONLY|AF_ONEWAY)	/**< Mask for driving against the order of the coordinates */
+
+/**
+ * @brief A start or end node of a contraction hierarchy query
+ */
+struct routech_seed {
+	struct coord c;		/**< Coordinates of the node */
+	int cost;		/**< Cost to get from the start to the node, or from the node to the destination, in the units of
+				     {@code routech_street_time()} */
+};
+
+/**
+ * @brief A street of the path found by a contraction hierarchy query
+ */
+struct routech_street {
+	struct item_id id;	/**< Id of the street item within the map */
+	int dir;		/**< 1 if the street is driven in the order of its coordinates, -1 otherwise */
+};
+
+/**
+ * @brief Result of a contraction hierarchy query
+ */
+struct routech_path {
+	int src;		/**< Index of the start seed the path begins at */
+	int dst;		/**< Index of the end seed the path ends at */
+	int cost;		/**< Total cost including the costs of both seeds */
+	GList *streets;		/**< List of {@code struct routech_street} in driving order */
+};
+
+/* prototypes */
+struct coord;
+struct map;
+int routech_road_speed(enum item_type type);
+int routech_street_time(enum item_type type, int len);
+struct routech_path *routech_query(struct map *m, struct routech_seed *src, int src_count, struct routech_seed *dst, int dst_count);
+void routech_path_destroy(struct routech_path *path);
+/* end of prototypes */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
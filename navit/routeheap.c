@@ -0,0 +1,421 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Priority queues used for routing
+ *
+ * All implementations share one interface. The queued objects carry a {@code void *} handle at a
+ * fixed offset, which is passed to route_heap_new(). The handle is {@code NULL} while the object is
+ * not queued, the queue maintains it otherwise and callers must only test it for {@code NULL}.
+ * This allows callers to find out cheaply whether an object is queued, and allows the queue to
+ * find the entry of an object whose key is lowered without searching.
+ *
+ * <ul>
+ * <li>The Fibonacci heap is the one Navit has always used. It allocates one node per insert.</li>
+ * <li>The 4-ary heap keeps all entries in one array, the handle is the index of the entry. It has
+ * a shallower tree than a binary heap and all children of a node share a cache line.</li>
+ * <li>The radix heap sorts entries into buckets by the highest bit in which their key differs
+ * from the last extracted key, so each entry moves at most 32 times. It only works if keys are
+ * never lower than the last extracted key, which holds for Dijkstra's algorithm. Lowering a key
+ * adds a new entry, the old one is recognized as stale by its id and dropped when it is reached.</li>
+ * </ul>
+ */
+
+#include <glib.h>
+#include <limits.h>
+#include "debug.h"
+#include "fib.h"
+#include "routeheap.h"
+
+#define ROUTE_HEAP_DARY_D 4
+#define ROUTE_HEAP_RADIX_BUCKETS 33
+
+/** Size of a node of the Fibonacci heap, which fib-1.1 does not export */
+#define ROUTE_HEAP_FIB_NODE_SIZE (3*sizeof(int)+5*sizeof(void *))
+
+/** Returns the handle of a queued object */
+#define ROUTE_HEAP_EL(heap,data) (*(void **)((char *)(data)+(heap)->el_offset))
+
+struct route_heap_entry {
+	int key;
+	int id;				/**< Only used by the radix heap, matches the handle as long as the entry is not stale */
+	void *data;
+};
+
+struct route_heap_bucket {
+	struct route_heap_entry *entries;
+	int count;
+	int size;
+};
+
+struct route_heap {
+	enum route_heap_type type;
+	int el_offset;			/**< Offset of the handle within queued objects */
+	int count;			/**< Number of queued objects */
+	int count_max;			/**< Highest number of objects queued at once */
+	struct fibheap *fh;		/**< Fibonacci heap */
+	struct route_heap_bucket array;	/**< Entries of the 4-ary heap */
+	struct route_heap_bucket bucket[ROUTE_HEAP_RADIX_BUCKETS];	/**< Buckets of the radix heap */
+	int last;			/**< Last key extracted from the radix heap */
+	int next_id;			/**< Id of the next entry inserted into the radix heap */
+};
+
+/**
+ * @brief Creates a new priority queue
+ *
+ * @param type The implementation to use
+ * @param el_offset Offset of the {@code void *} handle within the objects which will be queued
+ * @return The new queue
+ */
+struct route_heap *
+route_heap_new(enum route_heap_type type, int el_offset)
+{
+	struct route_heap *ret=g_new0(struct route_heap, 1);
+	ret->type=type;
+	ret->el_offset=el_offset;
+	if (type == route_heap_fibonacci)
+		ret->fh=fh_makekeyheap();
+	return ret;
+}
+
+/**
+ * @brief Destroys a priority queue
+ *
+ * The handles of objects still queued are not touched.
+ *
+ * @param heap The queue
+ */
+void
+route_heap_destroy(struct route_heap *heap)
+{
+	int i;
+	if (heap->fh)
+		fh_deleteheap(heap->fh);
+	g_free(heap->array.entries);
+	for (i = 0 ; i < ROUTE_HEAP_RADIX_BUCKETS ; i++)
+		g_free(heap->bucket[i].entries);
+	g_free(heap);
+}
+
+static void
+route_heap_bucket_push(struct route_heap_bucket *b, struct route_heap_entry *e)
+{
+	if (b->count == b->size) {
+		b->size=b->size ? b->size*2 : 64;
+		b->entries=g_renew(struct route_heap_entry, b->entries, b->size);
+	}
+	b->entries[b->count++]=*e;
+}
+
+static void
+route_heap_dary_set(struct route_heap *heap, int i, struct route_heap_entry *e)
+{
+	heap->array.entries[i]=*e;
+	ROUTE_HEAP_EL(heap, e->data)=GINT_TO_POINTER(i+1);
+}
+
+static void
+route_heap_dary_up(struct route_heap *heap, int i, struct route_heap_entry e)
+{
+	int parent;
+	while (i > 0) {
+		parent=(i-1)/ROUTE_HEAP_DARY_D;
+		if (heap->array.entries[parent].key <= e.key)
+			break;
+		route_heap_dary_set(heap, i, &heap->array.entries[parent]);
+		i=parent;
+	}
+	route_heap_dary_set(heap, i, &e);
+}
+
+static void
+route_heap_dary_down(struct route_heap *heap, int i, struct route_heap_entry e)
+{
+	struct route_heap_entry *entries=heap->array.entries;
+	int child,best,end;
+	for (;;) {
+		child=i*ROUTE_HEAP_DARY_D+1;
+		if (child >= heap->array.count)
+			break;
+		end=child+ROUTE_HEAP_DARY_D;
+		if (end > heap->array.count)
+			end=heap->array.count;
+		best=child;
+		for (child++ ; child < end ; child++) {
+			if (entries[child].key < entries[best].key)
+				best=child;
+		}
+		if (entries[best].key >= e.key)
+			break;
+		route_heap_dary_set(heap, i, &entries[best]);
+		i=best;
+	}
+	route_heap_dary_set(heap, i, &e);
+}
+
+static int
+route_heap_radix_bucket(struct route_heap *heap, int key)
+{
+	unsigned int diff=(unsigned int)key ^ (unsigned int)heap->last;
+	int ret=0;
+	while (diff) {
+		ret++;
+		diff>>=1;
+	}
+	return ret;
+}
+
+static void
+route_heap_radix_push(struct route_heap *heap, void *data, int key)
+{
+	struct route_heap_entry e;
+	if (key < heap->last) {
+		dbg(lvl_error,"key %d lower than last extracted key %d, heap order is broken\n", key, heap->last);
+		key=heap->last;
+	}
+	if (++heap->next_id <= 0)
+		heap->next_id=1;
+	e.key=key;
+	e.id=heap->next_id;
+	e.data=data;
+	ROUTE_HEAP_EL(heap, data)=GINT_TO_POINTER(e.id);
+	route_heap_bucket_push(&heap->bucket[route_heap_radix_bucket(heap, key)], &e);
+}
+
+static int
+route_heap_radix_live(struct route_heap *heap, struct route_heap_entry *e)
+{
+	return ROUTE_HEAP_EL(heap, e->data) == GINT_TO_POINTER(e->id);
+}
+
+/**
+ * @brief Makes sure the last entry of the first bucket of a radix heap is a live entry with the minimum key
+ *
+ * @return False if the heap is empty
+ */
+static int
+route_heap_radix_normalize(struct route_heap *heap)
+{
+	struct route_heap_bucket *b=&heap->bucket[0];
+	struct route_heap_entry *e;
+	int i,j,count,min;
+
+	for (;;) {
+		while (b->count && !route_heap_radix_live(heap, &b->entries[b->count-1]))
+			b->count--;
+		if (b->count)
+			return 1;
+		for (i = 1 ; i < ROUTE_HEAP_RADIX_BUCKETS && !heap->bucket[i].count ; i++);
+		if (i == ROUTE_HEAP_RADIX_BUCKETS)
+			return 0;
+		e=heap->bucket[i].entries;
+		count=heap->bucket[i].count;
+		min=INT_MAX;
+		for (j = 0 ; j < count ; j++) {
+			if (e[j].key < min && route_heap_radix_live(heap, &e[j]))
+				min=e[j].key;
+		}
+		heap->bucket[i].count=0;
+		if (min == INT_MAX)
+			continue;
+		heap->last=min;
+		/* All live entries of bucket i move to lower buckets, so bucket i is not written to here */
+		for (j = 0 ; j < count ; j++) {
+			if (route_heap_radix_live(heap, &e[j]))
+				route_heap_bucket_push(&heap->bucket[route_heap_radix_bucket(heap, e[j].key)], &e[j]);
+		}
+	}
+}
+
+/**
+ * @brief Queues an object
+ *
+ * @param heap The queue
+ * @param data The object, its handle must be {@code NULL}
+ * @param key The key of the object
+ */
+void
+route_heap_insert(struct route_heap *heap, void *data, int key)
+{
+	struct route_heap_entry e;
+	if (++heap->count > heap->count_max)
+		heap->count_max=heap->count;
+	switch (heap->type) {
+	case route_heap_fibonacci:
+		ROUTE_HEAP_EL(heap, data)=fh_insertkey(heap->fh, key, data);
+		break;
+	case route_heap_dary:
+		e.key=key;
+		e.id=0;
+		e.data=data;
+		route_heap_bucket_push(&heap->array, &e);
+		route_heap_dary_up(heap, heap->array.count-1, e);
+		break;
+	case route_heap_radix:
+		route_heap_radix_push(heap, data, key);
+		break;
+	}
+}
+
+/**
+ * @brief Lowers the key of a queued object
+ *
+ * @param heap The queue
+ * @param data The object, it must be queued
+ * @param key The new key, which must not be higher than the current one
+ */
+void
+route_heap_decrease(struct route_heap *heap, void *data, int key)
+{
+	struct route_heap_entry e;
+	switch (heap->type) {
+	case route_heap_fibonacci:
+		fh_replacekey(heap->fh, ROUTE_HEAP_EL(heap, data), key);
+		break;
+	case route_heap_dary:
+		e=heap->array.entries[GPOINTER_TO_INT(ROUTE_HEAP_EL(heap, data))-1];
+		e.key=key;
+		route_heap_dary_up(heap, GPOINTER_TO_INT(ROUTE_HEAP_EL(heap, data))-1, e);
+		break;
+	case route_heap_radix:
+		route_heap_radix_push(heap, data, key);
+		break;
+	}
+}
+
+/**
+ * @brief Removes the object with the lowest key from the queue
+ *
+ * @param heap The queue
+ * @return The object, its handle is {@code NULL} again, or {@code NULL} if the queue is empty
+ */
+void *
+route_heap_extract_min(struct route_heap *heap)
+{
+	void *ret=NULL;
+	struct route_heap_bucket *b;
+
+	switch (heap->type) {
+	case route_heap_fibonacci:
+		ret=fh_extractmin(heap->fh);
+		break;
+	case route_heap_dary:
+		if (!heap->array.count)
+			break;
+		ret=heap->array.entries[0].data;
+		if (--heap->array.count)
+			route_heap_dary_down(heap, 0, heap->array.entries[heap->array.count]);
+		break;
+	case route_heap_radix:
+		if (!route_heap_radix_normalize(heap))
+			break;
+		b=&heap->bucket[0];
+		ret=b->entries[--b->count].data;
+		break;
+	}
+	if (ret) {
+		ROUTE_HEAP_EL(heap, ret)=NULL;
+		heap->count--;
+	}
+	return ret;
+}
+
+/**
+ * @brief Returns the lowest key in the queue
+ *
+ * @param heap The queue
+ * @return The lowest key, or {@code INT_MAX} if the queue is empty
+ */
+int
+route_heap_min_key(struct route_heap *heap)
+{
+	if (!heap->count)
+		return INT_MAX;
+	switch (heap->type) {
+	case route_heap_fibonacci:
+		return fh_minkey(heap->fh);
+	case route_heap_dary:
+		return heap->array.entries[0].key;
+	case route_heap_radix:
+		if (route_heap_radix_normalize(heap))
+			return heap->last;
+		break;
+	}
+	return INT_MAX;
+}
+
+/**
+ * @brief Checks if a queue is empty
+ *
+ * @param heap The queue
+ * @return True if no object is queued
+ */
+int
+route_heap_empty(struct route_heap *heap)
+{
+	return !heap->count;
+}
+
+/**
+ * @brief Returns the name of a queue implementation, for logging
+ */
+const char *
+route_heap_type_name(enum route_heap_type type)
+{
+	switch (type) {
+	case route_heap_fibonacci:
+		return "fibonacci";
+	case route_heap_dary:
+		return "4-ary";
+	case route_heap_radix:
+		return "radix";
+	}
+	return "unknown";
+}
+
+/**
+ * @brief Returns the memory used by a queue
+ *
+ * For the Fibonacci heap, which frees its nodes as they are extracted, this is the memory used
+ * while most objects were queued. The other implementations keep their arrays until they are
+ * destroyed.
+ *
+ * @param heap The queue
+ * @return The number of bytes allocated
+ */
+long
+route_heap_memory(struct route_heap *heap)
+{
+	long ret=sizeof(*heap);
+	int i;
+	switch (heap->type) {
+	case route_heap_fibonacci:
+		ret+=(long)heap->count_max*ROUTE_HEAP_FIB_NODE_SIZE;
+		break;
+	case route_heap_dary:
+		ret+=(long)heap->array.size*sizeof(struct route_heap_entry);
+		break;
+	case route_heap_radix:
+		for (i = 0 ; i < ROUTE_HEAP_RADIX_BUCKETS ; i++)
+			ret+=(long)heap->bucket[i].size*sizeof(struct route_heap_entry);
+		break;
+	}
+	return ret;
+}
@@ -0,0 +1,58 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Contains exported code for routeheap.c, the priority queues used for routing
+ */
+
+#ifndef NAVIT_ROUTEHEAP_H
+#define NAVIT_ROUTEHEAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Implementations of the priority queue
+ */
+enum route_heap_type {
+	route_heap_fibonacci = 0,	/*!< Fibonacci heap from fib-1.1, one allocation per insert */
+	route_heap_dary = 1,		/*!< 4-ary heap in a flat array */
+	route_heap_radix = 2,		/*!< Radix heap, requires that no key lower than the last extracted one is inserted,
+					     searches which can not promise that fall back to the 4-ary heap */
+};
+
+/* prototypes */
+struct route_heap;
+struct route_heap *route_heap_new(enum route_heap_type type, int el_offset);
+void route_heap_destroy(struct route_heap *heap);
+void route_heap_insert(struct route_heap *heap, void *data, int key);
+void route_heap_decrease(struct route_heap *heap, void *data, int key);
+void *route_heap_extract_min(struct route_heap *heap);
+int route_heap_min_key(struct route_heap *heap);
+int route_heap_empty(struct route_heap *heap);
+const char *route_heap_type_name(enum route_heap_type type);
+long route_heap_memory(struct route_heap *heap);
+/* end of prototypes */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,254 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Optimizes the order in which the waypoints of a route are visited
+ *
+ * This is the open traveling salesman problem with a fixed start and end: Given the costs between
+ * all pairs of stops, find an order of the stops in between which makes the total cost low. Costs
+ * need not be symmetric, since one-way streets make legs differ in both directions.
+ *
+ * A first order is built by nearest insertion: The stop closest to any stop already in the order is
+ * inserted where it adds the least cost. The order is then improved by 2-opt (reversing a run of
+ * stops) and Or-opt (moving a run of up to three stops elsewhere) until no move helps any more or
+ * the time budget is used up.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "debug.h"
+#include "routeorder.h"
+
+/** Cost of a leg without a route, high enough that such legs are avoided whenever possible */
+#define ROUTE_ORDER_UNREACHABLE 100000000
+
+/** Longest run of stops moved by Or-opt */
+#define ROUTE_ORDER_OR_OPT_MAX 3
+
+struct route_order {
+	int *costs;			/**< Costs between all pairs of stops, -1 if there is no route */
+	int count;			/**< Number of stops */
+	int *order;			/**< Current order of the stops */
+	struct timeval start;		/**< Time the optimization started at */
+	int budget;			/**< Time in milliseconds the optimization may take */
+};
+
+static long long
+route_order_cost(struct route_order *this, int from, int to)
+{
+	int cost=this->costs[from*this->count+to];
+	return cost < 0 ? ROUTE_ORDER_UNREACHABLE : cost;
+}
+
+static long long
+route_order_total(struct route_order *this)
+{
+	long long ret=0;
+	int i;
+	for (i = 0 ; i < this->count-1 ; i++)
+		ret+=route_order_cost(this, this->order[i], this->order[i+1]);
+	return ret;
+}
+
+static int
+route_order_expired(struct route_order *this)
+{
+	struct timeval curr;
+	gettimeofday(&curr, NULL);
+	return (curr.tv_sec-this->start.tv_sec)*1000+(curr.tv_usec-this->start.tv_usec)/1000 >= this->budget;
+}
+
+/**
+ * @brief Builds a first order of the stops by nearest insertion
+ */
+static void
+route_order_insert(struct route_order *this)
+{
+	int *order=this->order,count=this->count;
+	char *used=g_new0(char, count);
+	int len,i,j,k,next,pos;
+	long long dist,best,add;
+
+	order[0]=0;
+	order[1]=count-1;
+	used[0]=used[count-1]=1;
+	for (len = 2 ; len < count ; len++) {
+		next=-1;
+		best=0;
+		for (k = 1 ; k < count-1 ; k++) {
+			if (used[k])
+				continue;
+			for (i = 0 ; i < len ; i++) {
+				dist=MIN(route_order_cost(this, order[i], k), route_order_cost(this, k, order[i]));
+				if (next == -1 || dist < best) {
+					next=k;
+					best=dist;
+				}
+			}
+		}
+		pos=1;
+		best=0;
+		for (i = 1 ; i < len ; i++) {
+			add=route_order_cost(this, order[i-1], next)+route_order_cost(this, next, order[i])-
+				route_order_cost(this, order[i-1], order[i]);
+			if (i == 1 || add < best) {
+				pos=i;
+				best=add;
+			}
+		}
+		for (j = len ; j > pos ; j--)
+			order[j]=order[j-1];
+		order[pos]=next;
+		used[next]=1;
+	}
+	g_free(used);
+}
+
+/**
+ * @brief Reverses runs of stops as long as this lowers the cost
+ *
+ * Reversing a run changes the direction of every leg within it, so their costs are summed up again.
+ *
+ * @return True if the order was changed
+ */
+static int
+route_order_two_opt(struct route_order *this)
+{
+	int *order=this->order,count=this->count;
+	int i,j,t,tmp,ret=0;
+	long long old,new;
+
+	for (i = 1 ; i < count-2 ; i++) {
+		if (route_order_expired(this))
+			break;
+		for (j = i+1 ; j < count-1 ; j++) {
+			old=route_order_cost(this, order[i-1], order[i])+route_order_cost(this, order[j], order[j+1]);
+			new=route_order_cost(this, order[i-1], order[j])+route_order_cost(this, order[i], order[j+1]);
+			for (t = i ; t < j ; t++) {
+				old+=route_order_cost(this, order[t], order[t+1]);
+				new+=route_order_cost(this, order[t+1], order[t]);
+			}
+			if (new >= old)
+				continue;
+			for (t = 0 ; t < (j-i+1)/2 ; t++) {
+				tmp=order[i+t];
+				order[i+t]=order[j-t];
+				order[j-t]=tmp;
+			}
+			ret=1;
+		}
+	}
+	return ret;
+}
+
+/**
+ * @brief Moves runs of up to {@code ROUTE_ORDER_OR_OPT_MAX} stops elsewhere as long as this lowers the cost
+ *
+ * @return True if the order was changed
+ */
+static int
+route_order_or_opt(struct route_order *this)
+{
+	int *order=this->order,count=this->count;
+	int *tmp=g_new(int, count);
+	int len,i,p,n,ret=0;
+	long long removed,added;
+
+	for (len = 1 ; len <= ROUTE_ORDER_OR_OPT_MAX ; len++) {
+		for (i = 1 ; i+len < count ; i++) {
+			if (route_order_expired(this))
+				break;
+			/* The run order[i]..order[i+len-1] is moved between order[p-1] and order[p] */
+			removed=route_order_cost(this, order[i-1], order[i])+route_order_cost(this, order[i+len-1], order[i+len])-
+				route_order_cost(this, order[i-1], order[i+len]);
+			for (p = 1 ; p < count ; p++) {
+				if (p >= i && p <= i+len)
+					continue;
+				added=route_order_cost(this, order[p-1], order[i])+route_order_cost(this, order[i+len-1], order[p])-
+					route_order_cost(this, order[p-1], order[p]);
+				if (added < removed)
+					break;
+			}
+			if (p == count)
+				continue;
+			n=0;
+			if (p < i) {
+				memcpy(tmp, order, p*sizeof(int));
+				n=p;
+				memcpy(tmp+n, order+i, len*sizeof(int));
+				n+=len;
+				memcpy(tmp+n, order+p, (i-p)*sizeof(int));
+				n+=i-p;
+				memcpy(tmp+n, order+i+len, (count-i-len)*sizeof(int));
+			} else {
+				memcpy(tmp, order, i*sizeof(int));
+				n=i;
+				memcpy(tmp+n, order+i+len, (p-i-len)*sizeof(int));
+				n+=p-i-len;
+				memcpy(tmp+n, order+i, len*sizeof(int));
+				n+=len;
+				memcpy(tmp+n, order+p, (count-p)*sizeof(int));
+			}
+			memcpy(order, tmp, count*sizeof(int));
+			ret=1;
+		}
+	}
+	g_free(tmp);
+	return ret;
+}
+
+/**
+ * @brief Finds an order in which to visit stops at low total cost
+ *
+ * The first and the last stop stay in place, all others may be reordered.
+ *
+ * @param costs The costs between all pairs of stops, {@code costs[i*count+j]} is the cost from stop i
+ * to stop j. -1 if there is no route.
+ * @param count Number of stops
+ * @param order Receives the order in which to visit the stops, as indices into {@code costs}
+ * @param budget Time in milliseconds the improvement of the first order may take
+ */
+void
+route_order_optimize(int *costs, int count, int *order, int budget)
+{
+	struct route_order this;
+	long long first;
+	int i,passes=0;
+
+	for (i = 0 ; i < count ; i++)
+		order[i]=i;
+	if (count < 4)
+		return;
+	this.costs=costs;
+	this.count=count;
+	this.order=order;
+	this.budget=budget;
+	gettimeofday(&this.start, NULL);
+	dbg(lvl_debug,"cost in given order %lld\n", route_order_total(&this));
+	route_order_insert(&this);
+	first=route_order_total(&this);
+	while (!route_order_expired(&this)) {
+		passes++;
+		if (!route_order_two_opt(&this) && !route_order_or_opt(&this))
+			break;
+	}
+	dbg(lvl_debug,"cost %lld after insertion, %lld after %d improvement passes\n", first, route_order_total(&this), passes);
+}
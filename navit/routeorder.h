@@ -0,0 +1,39 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Contains exported code for routeorder.c, the waypoint order optimizer
+ */
+
+#ifndef NAVIT_ROUTEORDER_H
+#define NAVIT_ROUTEORDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* prototypes */
+void route_order_optimize(int *costs, int count, int *order, int budget);
+/* end of prototypes */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,233 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Historic speed profiles of streets
+ *
+ * A speed profile gives the typical speed on a street for each time slot ("bucket") of a week, in
+ * percent of the speed the vehicle profile assumes for the street. Many streets share the same
+ * profile, so a file holds a list of profiles and assigns one of them to each street by its map and
+ * item id. Item ids are only unique within a map, so the file names the data files of the maps it
+ * covers, without their directory, and each street refers to one of them.
+ *
+ * The file is mapped into memory and used as is. It starts with a {@code struct speed_profiles_header},
+ * followed by {@code map_count} {@code struct speed_profiles_map}, {@code entry_count}
+ * {@code struct speed_profiles_entry} sorted by map and item id and {@code bucket_count} rows of
+ * {@code profile_count} speeds, one byte each. The speeds of all
+ * profiles for one bucket are adjacent, so once the bucket for a point in time is known, the speed
+ * of a street is a single array lookup. A speed of 0 means that the street is closed at that time.
+ * Speeds should not exceed 100 percent, since goal-directed searches assume that no street is
+ * faster than its road profile.
+ *
+ * Buckets are of equal length and start on Monday, 00:00 local time. The file is read on the
+ * machine which wrote it, so all values are in native byte order.
+ */
+
+#include "config.h"
+#include <glib.h>
+#include <string.h>
+#include <time.h>
+#include "debug.h"
+#include "item.h"
+#include "attr.h"
+#include "map.h"
+#include "file.h"
+#include "speedprofile.h"
+
+#define SPEED_PROFILES_MAGIC "NSPF"
+#define SPEED_PROFILES_VERSION 2
+
+/** Length of a week in seconds */
+#define SPEED_PROFILES_WEEK (7*86400)
+
+struct speed_profiles_header {
+	char magic[4];
+	int version;
+	int bucket_count;		/**< Number of buckets per week */
+	int profile_count;		/**< Number of profiles */
+	int entry_count;		/**< Number of streets with a profile */
+	int map_count;			/**< Number of maps */
+};
+
+struct speed_profiles_map {
+	char name[64];			/**< Name of the data file of the map without its directory, zero terminated */
+};
+
+struct speed_profiles_entry {
+	int map;			/**< Index of the map of the street */
+	unsigned int id_hi;
+	unsigned int id_lo;
+	int profile;			/**< Index of the profile of the street */
+};
+
+struct speed_profiles {
+	struct file *file;
+	struct speed_profiles_header *header;
+	struct speed_profiles_map *maps;
+	struct speed_profiles_entry *entries;
+	unsigned char *speeds;
+};
+
+/**
+ * @brief Opens a speed profile file
+ *
+ * @param filename The name of the file
+ * @return The speed profiles, or {@code NULL} if the file cannot be read or is invalid
+ */
+struct speed_profiles *
+speed_profiles_new(char *filename)
+{
+	struct speed_profiles *ret;
+	struct speed_profiles_header *header;
+	struct file *file=file_create(filename, NULL);
+
+	if (!file) {
+		dbg(lvl_error,"failed to open %s\n", filename);
+		return NULL;
+	}
+	if (file_size(file) < sizeof(*header) || !file_mmap(file)) {
+		dbg(lvl_error,"failed to map %s\n", filename);
+		file_destroy(file);
+		return NULL;
+	}
+	header=(struct speed_profiles_header *)file->begin;
+	if (memcmp(header->magic, SPEED_PROFILES_MAGIC, 4) || header->version != SPEED_PROFILES_VERSION ||
+		header->bucket_count <= 0 || header->profile_count <= 0 || header->profile_count > 65535 || header->entry_count < 0 ||
+		header->map_count < 0 || file_size(file) != sizeof(*header)+(long long)header->map_count*sizeof(struct speed_profiles_map)+
+			(long long)header->entry_count*sizeof(struct speed_profiles_entry)+
+			(long long)header->bucket_count*header->profile_count) {
+		dbg(lvl_error,"invalid speed profile file %s\n", filename);
+		file_destroy(file);
+		return NULL;
+	}
+	ret=g_new0(struct speed_profiles, 1);
+	ret->file=file;
+	ret->header=header;
+	ret->maps=(struct speed_profiles_map *)(header+1);
+	ret->entries=(struct speed_profiles_entry *)(ret->maps+header->map_count);
+	ret->speeds=(unsigned char *)(ret->entries+header->entry_count);
+	dbg(lvl_debug,"%d profiles with %d buckets for %d streets in %d maps\n", header->profile_count, header->bucket_count,
+		header->entry_count, header->map_count);
+	return ret;
+}
+
+void
+speed_profiles_destroy(struct speed_profiles *this_)
+{
+	file_destroy(this_->file);
+	g_free(this_);
+}
+
+/**
+ * @brief Finds the index of a map within the speed profiles
+ *
+ * The map is found by the name of its data file. Callers looking up many streets should look up
+ * the index once per map.
+ *
+ * @param this_ The speed profiles
+ * @param map The map
+ * @return The index to pass to speed_profiles_lookup(), or -1 if the file has no profiles for the map
+ */
+int
+speed_profiles_map(struct speed_profiles *this_, struct map *map)
+{
+	struct attr data;
+	char *name;
+	int i;
+
+	if (!map || !map_get_attr(map, attr_data, &data, NULL) || !data.u.str)
+		return -1;
+	name=strrchr(data.u.str, '/');
+	name=name ? name+1 : data.u.str;
+	for (i = 0 ; i < this_->header->map_count ; i++) {
+		if (!strncmp(this_->maps[i].name, name, sizeof(this_->maps[i].name)) && strlen(name) < sizeof(this_->maps[i].name))
+			return i;
+	}
+	return -1;
+}
+
+/**
+ * @brief Finds the profile of a street
+ *
+ * @param this_ The speed profiles
+ * @param map The index of the map of the street, see speed_profiles_map()
+ * @param item The street
+ * @return The index of the profile plus one, or 0 if the street has no profile
+ */
+int
+speed_profiles_lookup(struct speed_profiles *this_, int map, struct item *item)
+{
+	int lo=0,hi=this_->header->entry_count-1,mid;
+	struct speed_profiles_entry *e;
+
+	if (map < 0)
+		return 0;
+	while (lo <= hi) {
+		mid=(lo+hi)/2;
+		e=&this_->entries[mid];
+		if (e->map < map || (e->map == map && (e->id_hi < item->id_hi || (e->id_hi == item->id_hi && e->id_lo < item->id_lo))))
+			lo=mid+1;
+		else if (e->map > map || e->id_hi > item->id_hi || e->id_lo > item->id_lo)
+			hi=mid-1;
+		else
+			return (e->profile >= 0 && e->profile < this_->header->profile_count) ? e->profile+1 : 0;
+	}
+	return 0;
+}
+
+/**
+ * @brief Returns the time within the week of a point in time
+ *
+ * @param t The point in time
+ * @return The number of seconds since Monday, 00:00 local time
+ */
+int
+speed_profiles_week_time(time_t t)
+{
+	struct tm tm;
+
+	/* Route workers call this as well, so the reentrant variant is needed */
+#ifdef HAVE_PTHREAD
+	if (!localtime_r(&t, &tm))
+		return 0;
+#else
+	struct tm *tmp=localtime(&t);
+	if (!tmp)
+		return 0;
+	tm=*tmp;
+#endif
+	/* tm_wday counts from Sunday */
+	return ((tm.tm_wday+6)%7)*86400+tm.tm_hour*3600+tm.tm_min*60+tm.tm_sec;
+}
+
+/**
+ * @brief Returns the speeds of all profiles at a time within the week
+ *
+ * @param this_ The speed profiles
+ * @param secs The time in seconds since Monday, 00:00, see speed_profiles_week_time(). Times
+ * beyond the end of the week continue with the next week.
+ * @return The speeds in percent, indexed by profile
+ */
+unsigned char *
+speed_profiles_get_speeds(struct speed_profiles *this_, int secs)
+{
+	int bucket=(long long)(secs%SPEED_PROFILES_WEEK)*this_->header->bucket_count/SPEED_PROFILES_WEEK;
+	return this_->speeds+(long long)bucket*this_->header->profile_count;
+}
@@ -0,0 +1,49 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Contains exported code for speedprofile.c, the historic speed profiles of streets
+ */
+
+#ifndef NAVIT_SPEEDPROFILE_H
+#define NAVIT_SPEEDPROFILE_H
+
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* prototypes */
+struct item;
+struct map;
+struct speed_profiles;
+struct speed_profiles *speed_profiles_new(char *filename);
+void speed_profiles_destroy(struct speed_profiles *this_);
+int speed_profiles_map(struct speed_profiles *this_, struct map *map);
+int speed_profiles_lookup(struct speed_profiles *this_, int map, struct item *item);
+int speed_profiles_week_time(time_t t);
+unsigned char *speed_profiles_get_speeds(struct speed_profiles *this_, int secs);
+/* end of prototypes */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,412 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Spatial index of the streets of a mapset
+ *
+ * Finding the street nearest to a position used to mean reading every street within a kilometer
+ * from the maps, decoding it and measuring the distance to all of its segments. This happens whenever
+ * a destination is set and whenever tracking moves on, mostly in the same area as before.
+ *
+ * The index divides the plane into square cells of {@code STREET_INDEX_CELL_SIZE} map units. A cell
+ * is read from a map the first time a query touches it, and it keeps the decoded streets along with
+ * the bounding rectangle of each of their segments. A query only measures the distance to segments
+ * whose rectangle is closer than the best match so far. The least recently used cells are dropped
+ * once more than {@code STREET_INDEX_MAX_CELLS} are kept.
+ *
+ * Each mapset has its own index, see mapset_get_street_index(). It is flushed whenever maps are
+ * added to or removed from the mapset.
+ */
+
+#include <glib.h>
+#include <limits.h>
+#include "debug.h"
+#include "coord.h"
+#include "projection.h"
+#include "item.h"
+#include "map.h"
+#include "mapset.h"
+#include "transform.h"
+#include "route.h"
+#include "streetindex.h"
+
+/** Edge length of a cell in map units */
+#define STREET_INDEX_CELL_SIZE 2048
+
+/** Number of cells kept before the least recently used ones are dropped */
+#define STREET_INDEX_MAX_CELLS 64
+
+struct street_index_key {
+	struct map *map;
+	int x,y;			/**< Position of the cell in units of {@code STREET_INDEX_CELL_SIZE} */
+};
+
+struct street_index_segment {
+	struct coord_rect r;		/**< Bounding rectangle of the segment */
+	struct street_data *sd;		/**< The street the segment belongs to */
+	int pos;			/**< Index of the first coordinate of the segment within the street */
+};
+
+struct street_index_cell {
+	struct street_index_key key;
+	GList *streets;			/**< Streets with at least one segment overlapping the cell */
+	struct street_index_segment *segments;	/**< Segments of {@code streets} overlapping the cell */
+	int count;			/**< Number of segments */
+	int last_used;			/**< Value of the index clock when the cell was last queried */
+};
+
+struct street_index {
+	GHashTable *cells;
+	int clock;			/**< Incremented by every query */
+};
+
+static guint
+street_index_key_hash(gconstpointer key)
+{
+	const struct street_index_key *k=key;
+	return GPOINTER_TO_UINT(k->map) ^ (k->x*31) ^ (k->y*65599);
+}
+
+static gboolean
+street_index_key_equal(gconstpointer a, gconstpointer b)
+{
+	const struct street_index_key *ka=a,*kb=b;
+	return ka->map == kb->map && ka->x == kb->x && ka->y == kb->y;
+}
+
+static void
+street_index_cell_destroy(struct street_index_cell *cell)
+{
+	g_list_foreach(cell->streets, (GFunc)street_data_free, NULL);
+	g_list_free(cell->streets);
+	g_free(cell->segments);
+	g_free(cell);
+}
+
+/**
+ * @brief Creates a new, empty street index
+ */
+struct street_index *
+street_index_new(void)
+{
+	struct street_index *ret=g_new0(struct street_index, 1);
+	ret->cells=g_hash_table_new_full(street_index_key_hash, street_index_key_equal, NULL, (GDestroyNotify)street_index_cell_destroy);
+	return ret;
+}
+
+/**
+ * @brief Drops all cells of a street index, so they are read from the maps again
+ */
+void
+street_index_flush(struct street_index *this_)
+{
+	g_hash_table_remove_all(this_->cells);
+}
+
+void
+street_index_destroy(struct street_index *this_)
+{
+	g_hash_table_destroy(this_->cells);
+	g_free(this_);
+}
+
+/**
+ * @brief Returns the position of the cell containing a coordinate, along one axis
+ */
+static int
+street_index_cell_pos(int c)
+{
+	if (c >= 0)
+		return c/STREET_INDEX_CELL_SIZE;
+	return -((-(c+1))/STREET_INDEX_CELL_SIZE)-1;
+}
+
+/**
+ * @brief Reads the streets of a cell from its map
+ */
+static struct street_index_cell *
+street_index_cell_new(struct street_index_key *key)
+{
+	struct street_index_cell *ret=g_new0(struct street_index_cell, 1);
+	struct map_selection sel;
+	struct coord_rect *cr=&sel.u.c_rect,r;
+	struct street_index_segment *seg;
+	struct map_rect *mr;
+	struct street_data *sd;
+	struct item *item;
+	int i,size=0,added;
+
+	ret->key=*key;
+	sel.next=NULL;
+	sel.order=18;
+	sel.range.min=route_item_first;
+	sel.range.max=route_item_last;
+	cr->lu.x=key->x*STREET_INDEX_CELL_SIZE;
+	cr->rl.x=cr->lu.x+STREET_INDEX_CELL_SIZE-1;
+	cr->rl.y=key->y*STREET_INDEX_CELL_SIZE;
+	cr->lu.y=cr->rl.y+STREET_INDEX_CELL_SIZE-1;
+	mr=map_rect_new(key->map, &sel);
+	if (!mr)
+		return ret;
+	while ((item=map_rect_get_item(mr))) {
+		if (!item_get_default_flags(item->type))
+			continue;
+		sd=street_get_data(item);
+		if (!sd)
+			continue;
+		added=0;
+		for (i = 0 ; i+1 < sd->count ; i++) {
+			r.lu=sd->c[i];
+			r.rl=sd->c[i];
+			coord_rect_extend(&r, &sd->c[i+1]);
+			if (r.lu.x > cr->rl.x || r.rl.x < cr->lu.x || r.lu.y < cr->rl.y || r.rl.y > cr->lu.y)
+				continue;
+			if (ret->count == size) {
+				size=size ? size*2 : 256;
+				ret->segments=g_renew(struct street_index_segment, ret->segments, size);
+			}
+			seg=&ret->segments[ret->count++];
+			seg->r=r;
+			seg->sd=sd;
+			seg->pos=i;
+			added=1;
+		}
+		if (added)
+			ret->streets=g_list_prepend(ret->streets, sd);
+		else
+			street_data_free(sd);
+	}
+	map_rect_destroy(mr);
+	dbg(lvl_debug,"cell %d,%d of map %p has %d segments\n", key->x, key->y, key->map, ret->count);
+	return ret;
+}
+
+static void
+street_index_find_oldest(gpointer key, gpointer value, gpointer user_data)
+{
+	struct street_index_cell *cell=value,**oldest=user_data;
+	if (!*oldest || cell->last_used < (*oldest)->last_used)
+		*oldest=cell;
+}
+
+/**
+ * @brief Drops the least recently used cells until at most {@code STREET_INDEX_MAX_CELLS} are left
+ *
+ * This must not be called while a query still refers to the streets of a cell.
+ */
+static void
+street_index_evict(struct street_index *this_)
+{
+	struct street_index_cell *oldest;
+	while (g_hash_table_size(this_->cells) > STREET_INDEX_MAX_CELLS) {
+		oldest=NULL;
+		g_hash_table_foreach(this_->cells, street_index_find_oldest, &oldest);
+		g_hash_table_remove(this_->cells, &oldest->key);
+	}
+}
+
+/**
+ * @brief Returns the cells of a map which overlap a square, reading them if needed
+ *
+ * @param this_ The street index
+ * @param map The map
+ * @param c The center of the square in the projection of the map
+ * @param max_dist Half the edge length of the square
+ * @return The cells, the list has to be freed by the caller
+ */
+static GList *
+street_index_get_cells(struct street_index *this_, struct map *map, struct coord *c, int max_dist)
+{
+	struct street_index_cell *cell;
+	struct street_index_key key;
+	int x1=street_index_cell_pos(c->x-max_dist),x2=street_index_cell_pos(c->x+max_dist);
+	int y1=street_index_cell_pos(c->y-max_dist),y2=street_index_cell_pos(c->y+max_dist);
+	GList *ret=NULL;
+
+	key.map=map;
+	for (key.x = x1 ; key.x <= x2 ; key.x++) {
+		for (key.y = y1 ; key.y <= y2 ; key.y++) {
+			cell=g_hash_table_lookup(this_->cells, &key);
+			if (!cell) {
+				cell=street_index_cell_new(&key);
+				g_hash_table_insert(this_->cells, &cell->key, cell);
+			}
+			cell->last_used=this_->clock;
+			ret=g_list_prepend(ret, cell);
+		}
+	}
+	return ret;
+}
+
+/**
+ * @brief Returns the squared distance from a coordinate to the nearest point of a rectangle
+ */
+static long long
+street_index_rect_dist_sq(struct coord_rect *r, struct coord *c)
+{
+	long long dx=0,dy=0;
+	if (c->x < r->lu.x)
+		dx=r->lu.x-c->x;
+	else if (c->x > r->rl.x)
+		dx=c->x-r->rl.x;
+	if (c->y > r->lu.y)
+		dy=c->y-r->lu.y;
+	else if (c->y < r->rl.y)
+		dy=r->rl.y-c->y;
+	return dx*dx+dy*dy;
+}
+
+/**
+ * @brief Converts a coordinate to the projection of a map
+ */
+static void
+street_index_map_coord(struct map *m, struct pcoord *pc, struct coord *c)
+{
+	struct coord_geo g;
+	c->x=pc->x;
+	c->y=pc->y;
+	if (map_projection(m) != pc->pro) {
+		transform_to_geo(pc->pro, c, &g);
+		transform_from_geo(map_projection(m), &g, c);
+	}
+}
+
+/**
+ * @brief Finds the street nearest to a coordinate
+ *
+ * All maps of the mapset which are active for routing are searched.
+ *
+ * @param ms The mapset
+ * @param pc The coordinate
+ * @param max_dist The maximum distance of the street in map units
+ * @param filter Function deciding which streets may be returned, or {@code NULL} to allow all
+ * @param data Passed to {@code filter}
+ * @param c Receives {@code pc} in the projection of the map the street was found on
+ * @param lp Receives the point of the street nearest to {@code pc}
+ * @param pos Receives the index of the first coordinate of the segment {@code lp} lies on
+ * @param dist Receives the squared distance of {@code lp} from {@code pc}
+ * @return A copy of the street, to be freed with street_data_free(), or {@code NULL} if no street
+ * was found within {@code max_dist}
+ */
+struct street_data *
+street_index_nearest(struct mapset *ms, struct pcoord *pc, int max_dist, street_index_filter filter, void *data,
+		struct coord *c, struct coord *lp, int *pos, int *dist)
+{
+	struct street_index *this_;
+	struct street_index_segment *seg,*best=NULL;
+	struct street_index_cell *cell;
+	struct mapset_handle *h;
+	struct map *m;
+	struct coord cc,lpc;
+	struct street_data *ret=NULL;
+	GList *cells,*l;
+	int i,d,mindist=INT_MAX;
+
+	if (!ms)
+		return NULL;
+	this_=mapset_get_street_index(ms);
+	this_->clock++;
+	h=mapset_open(ms);
+	while ((m=mapset_next(h,2))) {
+		street_index_map_coord(m, pc, &cc);
+		cells=street_index_get_cells(this_, m, &cc, max_dist);
+		for (l = cells ; l ; l = g_list_next(l)) {
+			cell=l->data;
+			for (i = 0 ; i < cell->count ; i++) {
+				seg=&cell->segments[i];
+				if (street_index_rect_dist_sq(&seg->r, &cc) >= mindist)
+					continue;
+				if (filter && !filter(seg->sd, data))
+					continue;
+				d=transform_distance_line_sq(&seg->sd->c[seg->pos], &seg->sd->c[seg->pos+1], &cc, &lpc);
+				if (d < mindist) {
+					mindist=d;
+					best=seg;
+					*c=cc;
+					*lp=lpc;
+				}
+			}
+		}
+		g_list_free(cells);
+	}
+	mapset_close(h);
+	if (best && mindist <= max_dist*max_dist) {
+		ret=street_data_dup(best->sd);
+		*pos=best->pos;
+		*dist=mindist;
+		dbg(lvl_debug,"dist=%d id 0x%x 0x%x pos=%d\n", mindist, ret->item.id_hi, ret->item.id_lo, *pos);
+	}
+	street_index_evict(this_);
+	return ret;
+}
+
+/**
+ * @brief Returns all streets near a coordinate
+ *
+ * All maps of the mapset which are active for routing are searched.
+ *
+ * @param ms The mapset
+ * @param pc The coordinate
+ * @param max_dist Half the edge length of the square around {@code pc} in map units which the
+ * streets have to overlap
+ * @return A list of copies of the streets, each to be freed with street_data_free()
+ */
+GList *
+street_index_get_streets(struct mapset *ms, struct pcoord *pc, int max_dist)
+{
+	struct street_index *this_;
+	struct street_index_segment *seg;
+	struct street_index_cell *cell;
+	struct item_hash *seen;
+	struct mapset_handle *h;
+	struct map *m;
+	struct coord cc;
+	GList *cells,*l,*ret=NULL;
+	int i;
+
+	if (!ms)
+		return NULL;
+	this_=mapset_get_street_index(ms);
+	seen=item_hash_new();
+	this_->clock++;
+	h=mapset_open(ms);
+	while ((m=mapset_next(h,2))) {
+		street_index_map_coord(m, pc, &cc);
+		cells=street_index_get_cells(this_, m, &cc, max_dist);
+		for (l = cells ; l ; l = g_list_next(l)) {
+			cell=l->data;
+			for (i = 0 ; i < cell->count ; i++) {
+				seg=&cell->segments[i];
+				if (seg->r.lu.x > cc.x+max_dist || seg->r.rl.x < cc.x-max_dist ||
+				    seg->r.lu.y < cc.y-max_dist || seg->r.rl.y > cc.y+max_dist)
+					continue;
+				if (item_hash_lookup(seen, &seg->sd->item))
+					continue;
+				item_hash_insert(seen, &seg->sd->item, seg->sd);
+				ret=g_list_prepend(ret, street_data_dup(seg->sd));
+			}
+		}
+		g_list_free(cells);
+	}
+	mapset_close(h);
+	item_hash_destroy(seen);
+	street_index_evict(this_);
+	return ret;
+}
@@ -0,0 +1,58 @@
+/**
+ * Navit, a modular navigation system.
+ * Copyright (C) 2005-2011 Navit Team
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public License
+ * version 2 as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301, USA.
+ */
+
+/** @file
+ *
+ * @brief Contains exported code for streetindex.c, the spatial index of the streets of a mapset
+ */
+
+#ifndef NAVIT_STREETINDEX_H
+#define NAVIT_STREETINDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct street_data;
+
+/**
+ * @brief Decides whether a street may be returned by street_index_nearest()
+ *
+ * @param sd The street
+ * @param data The data passed to street_index_nearest()
+ * @return True if the street may be returned
+ */
+typedef int (*street_index_filter)(struct street_data *sd, void *data);
+
+/* prototypes */
+struct coord;
+struct mapset;
+struct pcoord;
+struct street_index;
+struct street_index *street_index_new(void);
+void street_index_flush(struct street_index *this_);
+void street_index_destroy(struct street_index *this_);
+struct street_data *street_index_nearest(struct mapset *ms, struct pcoord *pc, int max_dist, street_index_filter filter, void *data, struct coord *c, struct coord *lp, int *pos, int *dist);
+GList *street_index_get_streets(struct mapset *ms, struct pcoord *pc, int max_dist);
+/* end of prototypes */
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -32,6 +32,7 @@
 #include "projection.h"
 #include "map.h"
 #include "mapset.h"
+#include "streetindex.h"
 #include "plugin.h"
 #include "vehicleprofile.h"
 #include "vehicle.h"
@@ -424,87 +425,32 @@ tracking_get_angles(struct tracking_line *tl)
 		tl->angle[i]=transform_get_angle_delta(&sd->c[i], &sd->c[i+1], 0);
 }
 
-static int
-street_data_within_selection(struct street_data *sd, struct map_selection *sel)
-{
-	struct coord_rect r;
-	struct map_selection *curr;
-	int i;
-
-	if (!sel)
-		return 1;
-	r.lu=sd->c[0];
-	r.rl=sd->c[0];
-	for (i = 1 ; i < sd->count ; i++) {
-		if (r.lu.x > sd->c[i].x)
-			r.lu.x=sd->c[i].x;
-		if (r.rl.x < sd->c[i].x)
-			r.rl.x=sd->c[i].x;
-		if (r.rl.y > sd->c[i].y)
-			r.rl.y=sd->c[i].y;
-		if (r.lu.y < sd->c[i].y)
-			r.lu.y=sd->c[i].y;
-	}
-        curr=sel;
-	while (curr) {
-		struct coord_rect *sr=&curr->u.c_rect;
-		if (r.lu.x <= sr->rl.x && r.rl.x >= sr->lu.x &&
-		    r.lu.y >= sr->rl.y && r.rl.y <= sr->lu.y)
-			return 1;
-		curr=curr->next;
-	}
-        return 0;
-}
-
-
 static void
 tracking_doupdate_lines(struct tracking *tr, struct coord *pc, enum projection pro)
 {
 	int max_dist=1000;
-	struct map_selection *sel;
-	struct mapset_handle *h;
-	struct map *m;
-	struct map_rect *mr;
-	struct item *item;
 	struct street_data *street;
 	struct tracking_line *tl;
-	struct coord_geo g;
-	struct coord cc;
+	struct pcoord c;
+	GList *streets,*l;
 
 	dbg(lvl_debug,"enter\n");
-	h=mapset_open(tr->ms);
-	while ((m=mapset_next(h,2))) {
-		cc.x = pc->x;
-		cc.y = pc->y;
-		if (map_projection(m) != pro) {
-			transform_to_geo(pro, &cc, &g);
-			transform_from_geo(map_projection(m), &g, &cc);
-		}
-		sel = route_rect(18, &cc, &cc, 0, max_dist);
-		mr=map_rect_new(m, sel);
-		if (!mr)
-			continue;
-		while ((item=map_rect_get_item(mr))) {
-			if (item_get_default_flags(item->type)) {
-				street=street_get_data(item);
-				if (street_data_within_selection(street, sel)) {
-					tl=g_malloc(sizeof(struct tracking_line)+(street->count-1)*sizeof(int));
-					tl->street=street;
-					tracking_get_angles(tl);
-					tl->next=tr->lines;
-					tr->lines=tl;
-				} else
-					street_data_free(street);
-			}
-		}
-		map_selection_destroy(sel);
-		map_rect_destroy(mr);
+	c.pro=pro;
+	c.x=pc->x;
+	c.y=pc->y;
+	streets=street_index_get_streets(tr->ms, &c, max_dist);
+	for (l = streets ; l ; l = g_list_next(l)) {
+		street=l->data;
+		tl=g_malloc(sizeof(struct tracking_line)+(street->count-1)*sizeof(int));
+		tl->street=street;
+		tracking_get_angles(tl);
+		tl->next=tr->lines;
+		tr->lines=tl;
 	}
-	mapset_close(h);
+	g_list_free(streets);
 	dbg(lvl_debug, "exit\n");
 }
 
-
 void
 tracking_flush(struct tracking *tr)
 {
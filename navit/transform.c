@@ -1227,8 +1227,9 @@ transform_distance_line_sq(struct coord *l0, struct coord *l1, struct coord *ref
 		c1/=256;
 		c2/=256;
 	}
-	l.x=l0->x+vx*c1/c2;
-	l.y=l0->y+vy*c1/c2;
+	/* vx*c1 exceeds the int range once the line is longer than about 2000 units */
+	l.x=l0->x+(long long)vx*c1/c2;
+	l.y=l0->y+(long long)vy*c1/c2;
 	if (lpnt)
 		*lpnt=l;
 	return transform_distance_sq(&l, ref);
@@ -1288,56 +1289,114 @@ transform_distance_polyline_sq(struct coord *c, int count, struct coord *ref, st
 	return dist;
 }
 
+/*
+ * Douglas-Peucker simplification. The ranges still to be simplified are kept on a stack of their
+ * own instead of recursing, so long polylines can not overflow the stack. in and out must not overlap.
+ * The distances of this variant saturate at INT_MAX for spans beyond 32767 units, use
+ * transform_douglas_peucker_float() for polylines which may be longer.
+ */
 int
 transform_douglas_peucker(struct coord *in, int count, int dist_sq, struct coord *out)
 {
-	int ret=0;
-	int i,d,dmax=0, idx=0;
-	for (i = 1; i < count-2 ; i++) {
-		d=transform_distance_line_sq(&in[0], &in[count-1], &in[i], NULL);
-		if (d > dmax) {
-			idx=i;
-			dmax=d;
+	int *stack,sp=0,first,last,i,idx,ret=0;
+	int d,dmax;
+	char *keep;
+
+	if (count <= 2) {
+		for (i = 0 ; i < count ; i++)
+			out[i]=in[i];
+		return count;
+	}
+	/* The ranges on the stack never overlap, so there are less than count of them */
+	stack=g_new(int, 2*count);
+	keep=g_new0(char, count);
+	keep[0]=keep[count-1]=1;
+	stack[sp++]=0;
+	stack[sp++]=count-1;
+	while (sp) {
+		last=stack[--sp];
+		first=stack[--sp];
+		dmax=0;
+		idx=0;
+		for (i = first+1 ; i < last ; i++) {
+			d=transform_distance_line_sq(&in[first], &in[last], &in[i], NULL);
+			if (d > dmax) {
+				idx=i;
+				dmax=d;
+			}
+		}
+		if (dmax > dist_sq) {
+			keep[idx]=1;
+			if (idx-first > 1) {
+				stack[sp++]=first;
+				stack[sp++]=idx;
+			}
+			if (last-idx > 1) {
+				stack[sp++]=idx;
+				stack[sp++]=last;
+			}
 		}
 	}
-	if (dmax > dist_sq) {
-		ret=transform_douglas_peucker(in, idx, dist_sq, out)-1;
-		ret+=transform_douglas_peucker(in+idx, count-idx, dist_sq, out+ret);
-	} else {
-		if (count > 0)
-			out[ret++]=in[0];
-		if (count > 1)
-			out[ret++]=in[count-1];
+	for (i = 0 ; i < count ; i++) {
+		if (keep[i])
+			out[ret++]=in[i];
 	}
+	g_free(stack);
+	g_free(keep);
 	return ret;
 }
 
 int
 transform_douglas_peucker_float(struct coord *in, int count, navit_float dist_sq, struct coord *out)
 {
-	int ret=0;
-	int i,idx=0;
-	navit_float d,dmax=0;
-	for (i = 1; i < count-2 ; i++) {
-		d=transform_distance_line_sq_float(&in[0], &in[count-1], &in[i], NULL);
-		if (d > dmax) {
-			idx=i;
-			dmax=d;
+	int *stack,sp=0,first,last,i,idx,ret=0;
+	navit_float d,dmax;
+	char *keep;
+
+	if (count <= 2) {
+		for (i = 0 ; i < count ; i++)
+			out[i]=in[i];
+		return count;
+	}
+	/* The ranges on the stack never overlap, so there are less than count of them */
+	stack=g_new(int, 2*count);
+	keep=g_new0(char, count);
+	keep[0]=keep[count-1]=1;
+	stack[sp++]=0;
+	stack[sp++]=count-1;
+	while (sp) {
+		last=stack[--sp];
+		first=stack[--sp];
+		dmax=0;
+		idx=0;
+		for (i = first+1 ; i < last ; i++) {
+			d=transform_distance_line_sq_float(&in[first], &in[last], &in[i], NULL);
+			if (d > dmax) {
+				idx=i;
+				dmax=d;
+			}
+		}
+		if (dmax > dist_sq) {
+			keep[idx]=1;
+			if (idx-first > 1) {
+				stack[sp++]=first;
+				stack[sp++]=idx;
+			}
+			if (last-idx > 1) {
+				stack[sp++]=idx;
+				stack[sp++]=last;
+			}
 		}
 	}
-	if (dmax > dist_sq) {
-		ret=transform_douglas_peucker_float(in, idx, dist_sq, out)-1;
-		ret+=transform_douglas_peucker_float(in+idx, count-idx, dist_sq, out+ret);
-	} else {
-		if (count > 0)
-			out[ret++]=in[0];
-		if (count > 1)
-			out[ret++]=in[count-1];
+	for (i = 0 ; i < count ; i++) {
+		if (keep[i])
+			out[ret++]=in[i];
 	}
+	g_free(stack);
+	g_free(keep);
 	return ret;
 }
 
-
 void
 transform_print_deg(double deg)
 {
@@ -25,6 +25,7 @@
 #include "xmlconfig.h"
 #include "roadprofile.h"
 #include "vehicleprofile.h"
+#include "routeheap.h"
 #include "callback.h"
 
 static void
@@ -91,6 +92,21 @@ vehicleprofile_set_attr_do(struct vehicleprofile *this_, struct attr *attr)
 	case attr_turn_around_penalty2:
 		this_->turn_around_penalty2=attr->u.num;
 		break;
+	case attr_turn_penalty_left:
+		this_->turn_penalty_left=attr->u.num;
+		break;
+	case attr_turn_penalty_right:
+		this_->turn_penalty_right=attr->u.num;
+		break;
+	case attr_turn_penalty_yield:
+		this_->turn_penalty_yield=attr->u.num;
+		break;
+	case attr_route_search_mode:
+		this_->route_search_mode=attr->u.num;
+		break;
+	case attr_route_heap:
+		this_->route_heap=attr->u.num;
+		break;
 	default:
 		break;
 	}
@@ -133,6 +149,8 @@ vehicleprofile_clear(struct vehicleprofile *this_)
 	this_->weight=-1;
 	this_->axle_weight=-1;
 	this_->through_traffic_penalty=9000;
+	this_->route_search_mode=route_search_full;
+	this_->route_heap=route_heap_dary;
 	vehicleprofile_free_hash(this_);
 	this_->roadprofile_hash=g_hash_table_new(NULL, NULL);
 }
@@ -301,6 +319,54 @@ vehicleprofile_get_name(struct vehicleprofile *this_)
 	return this_->name;
 }
 
+static void
+vehicleprofile_dup_roadprofile(gpointer key, gpointer value, gpointer user_data)
+{
+	struct navit_object *rp=value;
+	g_hash_table_insert(user_data, key, rp->func->dup(rp));
+}
+
+/**
+ * @brief Copies a vehicle profile
+ *
+ * The copy has its own road profiles, so changes to the original or its road profiles do not
+ * affect it. It is not notified of changes to the profile options, so it keeps the values the
+ * original had when it was copied. This allows threads to route with a profile while the main
+ * loop is free to change the original.
+ *
+ * @param this_ The vehicle profile
+ * @return The copy, to be freed with vehicleprofile_destroy()
+ */
+struct vehicleprofile *
+vehicleprofile_dup(struct vehicleprofile *this_)
+{
+	struct vehicleprofile *ret=g_new(struct vehicleprofile, 1);
+	*ret=*this_;
+	ret->refcount=1;
+	ret->attrs=attr_list_dup(this_->attrs);
+	ret->name=g_strdup(this_->name);
+	ret->route_depth=g_strdup(this_->route_depth);
+	ret->active_callback.u.callback=NULL;
+	ret->roadprofile_hash=g_hash_table_new(NULL, NULL);
+	g_hash_table_foreach(this_->roadprofile_hash, vehicleprofile_dup_roadprofile, ret->roadprofile_hash);
+	return ret;
+}
+
+/**
+ * @brief Frees a copy of a vehicle profile made with vehicleprofile_dup()
+ *
+ * @param this_ The copy
+ */
+void
+vehicleprofile_destroy(struct vehicleprofile *this_)
+{
+	vehicleprofile_free_hash(this_);
+	attr_list_free(this_->attrs);
+	g_free(this_->name);
+	g_free(this_->route_depth);
+	g_free(this_);
+}
+
 static void
 vehicleprofile_init(struct vehicleprofile *this_)
 {
@@ -318,7 +384,7 @@ struct object_func vehicleprofile_func = {
 	(object_func_remove_attr)vehicleprofile_remove_attr,
 	(object_func_init)vehicleprofile_init,
 	(object_func_destroy)NULL,
-	(object_func_dup)NULL,
+	(object_func_dup)vehicleprofile_dup,
 	(object_func_ref)navit_object_ref,
 	(object_func_unref)navit_object_unref,
 };
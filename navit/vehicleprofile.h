@@ -29,6 +29,12 @@ enum maxspeed_handling {
 	maxspeed_ignore = 2,		/*!< Ignore maxspeed of segment, always use {@code route_weight} of road profile */
 };
 
+enum route_search_mode {
+	route_search_full = 0,		/*!< Flood the whole route graph, costs to the destination are known for every point */
+	route_search_astar = 1,		/*!< Goal-directed (A*) flood, stops as soon as the position is settled */
+	route_search_ch = 2,		/*!< Contraction hierarchy query if the map contains one and it was built for the flags of this car profile, A* flood otherwise */
+};
+
 
 struct vehicleprofile {
 	NAVIT_OBJECT
@@ -52,6 +58,11 @@ struct vehicleprofile {
 	struct attr active_callback;
 	int turn_around_penalty;		/**< Penalty when turning around */
 	int turn_around_penalty2;		/**< Penalty when turning around, for planned turn arounds */
+	int turn_penalty_left;			/**< Penalty for a right-angle turn to the left, in tenths of seconds */
+	int turn_penalty_right;			/**< Penalty for a right-angle turn to the right, in tenths of seconds */
+	int turn_penalty_yield;			/**< Penalty for turning from a road onto a faster one, in tenths of seconds */
+	int route_search_mode;			/**< How to flood the route graph, see {@code enum route_search_mode} */
+	int route_heap;				/**< Priority queue to flood the route graph with, see {@code enum route_heap_type} */
 };
 
 struct vehicleprofile * vehicleprofile_new(struct attr *parent, struct attr **attrs);
@@ -62,6 +73,8 @@ int vehicleprofile_set_attr(struct vehicleprofile *this_, struct attr *attr);
 int vehicleprofile_add_attr(struct vehicleprofile *this_, struct attr *attr);
 int vehicleprofile_remove_attr(struct vehicleprofile *this_, struct attr *attr);
 struct roadprofile * vehicleprofile_get_roadprofile(struct vehicleprofile *this_, enum item_type type);
+struct vehicleprofile *vehicleprofile_dup(struct vehicleprofile *this_);
+void vehicleprofile_destroy(struct vehicleprofile *this_);
 
 //! Returns the vehicle profile's name.
 char * vehicleprofile_get_name(struct vehicleprofile *this_);
@@ -113,6 +113,25 @@ struct zip_cd_ext {
 	unsigned long long zipofst;  //!< offset to start of local file header (only valid if the struct is for a ZIP64 extra field)
 } ATTRIBUTE_PACKED;
 
+//! Header ID of the alignment extra field, the same zipalign uses
+#define zip_alignment_tag 0xd935
+
+//! Extra field padding a local file header, so the data of a stored member starts aligned.
+
+//! The padding bytes follow the header.
+struct zip_alignment {
+	unsigned short tag;          //!< extra field header ID, zip_alignment_tag
+	unsigned short size;         //!< number of padding bytes following
+} ATTRIBUTE_PACKED;
+
+//! Compression method of members compressed with Zstandard, as assigned by the ZIP specification
+#define zip_zstd_method 93
+
+//! Name of the member holding the dictionary Zstandard members are compressed with.
+
+//! The member is stored uncompressed directly before the index. Its name is padded like the tile names.
+#define zip_zstd_dictionary "zstd_dict"
+
 struct zip_enc {
 	short efield_header;
 	short efield_size;